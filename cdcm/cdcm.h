@@ -25,6 +25,8 @@
 #include "cdcmDrvr.h"
 #include "cdcmLynxAPI.h"
 #include "cdcmLynxDefs.h"
+#include "cdcmThread.h" /* worker pool, ststart() with CPU placement */
+#include "cdcmMem.h"    /* mmap'able DMA buffers */
 
 #ifdef CONFIG_BUS_VME
 #include "vmebus.h" /* find_controller, etc */
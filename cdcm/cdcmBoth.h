@@ -20,6 +20,7 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/rcupdate.h>
 #include <linux/fs.h>
 
 #include <asm/byteorder.h>
@@ -83,6 +84,20 @@ struct cdcm_mutex {
 #define cdcm_mutex_lock_interruptible(cdcm) \
 		mutex_lock_interruptible(&(cdcm)->mutex)
 
+/*
+ * RCU: wrap Linux' RCU. Readers may run in interrupt context.
+ * @flags is only used in Lynx; it's there to keep the API common.
+ */
+#define cdcm_rcu_read_lock(flags)			\
+	do {						\
+		(flags) = 0;				\
+		rcu_read_lock();			\
+	} while (0)
+#define cdcm_rcu_read_unlock(flags)	rcu_read_unlock()
+#define cdcm_rcu_dereference(p)		rcu_dereference(p)
+#define cdcm_rcu_assign_pointer(p, v)	rcu_assign_pointer(p, v)
+#define cdcm_synchronize_rcu()		synchronize_rcu()
+
 
 
 #else /* LynxOS */
@@ -169,6 +184,21 @@ struct cdcm_mutex {
 #define cdcm_mutex_lock_interruptible(cdcm) \
 		swait(&(cdcm)->sem, SEM_SIGABORT)
 
+/*
+ * RCU: our Lynx boxes are uniprocessor. A reader runs with interrupts
+ * disabled, so once the writer has published the new pointer no reader can
+ * still be using the old one -- there's no grace period to wait for.
+ */
+#define cdcm_rcu_read_lock(flags)	disable(flags)
+#define cdcm_rcu_read_unlock(flags)	restore(flags)
+#define cdcm_rcu_dereference(p)		(p)
+#define cdcm_rcu_assign_pointer(p, v)	\
+	do {				\
+		cdcm_wmb();		\
+		(p) = (v);		\
+	} while (0)
+#define cdcm_synchronize_rcu()		do { } while (0)
+
 #endif /* !__linux__ */
 
 
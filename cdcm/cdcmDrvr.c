@@ -15,6 +15,7 @@
 #include "cdcmLynxAPI.h"
 #include "cdcmMem.h"
 #include "cdcmTime.h"
+#include "cdcmThread.h"
 
 #include "config_data.h"  /* for info tables data types */
 #include "general_both.h" /* for handy macroses */
@@ -53,6 +54,8 @@ cdcmStatics_t cdcmStatT = {
 	.cdcm_ipl           = (IPL_ERROR | IPL_INFO), /* info printout level */
 	.cdcm_thr_list_head = LIST_HEAD_INIT(cdcmStatT.cdcm_thr_list_head),
 	.cdcm_sem_list_head = LIST_HEAD_INIT(cdcmStatT.cdcm_sem_list_head),
+	.cdcm_dmabuf_list_head =
+		LIST_HEAD_INIT(cdcmStatT.cdcm_dmabuf_list_head),
 	.cdcm_flags         = 0,
 	.cdcm_isdg          = 0
 };
@@ -435,22 +438,23 @@ static long cdcm_fop_ioctl(struct file *file, unsigned int cmd,
 }
 
 /**
- * @brief Device I/O memory mapping to the user space
+ * @brief Device memory mapping to the user space
  *
  * @param file -- file struct pointer
- * @param vma  --
+ * @param vma  -- user's VMA
  *
- * @return
+ * For non-driverGen drivers the offset passed to mmap() selects one of the
+ * DMA buffers the driver allocated with @e cdcm_dmabuf_alloc().
+ *
+ * @return 0        - if success.
+ * @return negative - if fails.
  */
 static int cdcm_fop_mmap(struct file *file, struct vm_area_struct *vma)
 {
 	if (cdcmStatT.cdcm_isdg)
 		return dg_fop_mmap(file, vma);
 
-	//vma->vm_flags |= VM_IO | VM_RESERVED | VM_DONTCOPY | VM_DONTEXPAND;
-	//vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
-
-	return -ENOSYS;
+	return cdcm_dmabuf_mmap(vma);
 }
 
 /**
@@ -602,6 +606,10 @@ static void __exit cdcm_driver_cleanup(void)
 
 	cdcm_sema_cleanup_all(); /* cleanup semaphores */
 
+	cdcm_wp_cleanup(); /* stop the worker pool */
+
+	cdcm_dmabuf_free_all(); /* release DMA buffers the driver left */
+
 	device_destroy(cdcm_class, MKDEV(cdcmStatT.cdcm_major, 0));
 	class_destroy(cdcm_class);
 	cdcm_cleanup_dev();
@@ -645,8 +653,18 @@ static int __init cdcm_driver_init(void)
 
 	cdcmStatT.cdcm_isdg = drivergen;
 
+	/* start the worker pool before any ISR can queue work on it */
+	err = cdcm_wp_init();
+	if (err) {
+		PRNT_ABS_ERR("Can't start the worker pool");
+		goto out_device;
+	}
+
 	return 0;
 
+ out_device:
+	device_destroy(cdcm_class, MKDEV(cdcmStatT.cdcm_major, 0));
+	class_destroy(cdcm_class);
  out_chrdev:
 	unregister_chrdev(cdcmStatT.cdcm_major, cdcm_d_nm);
 	return err;
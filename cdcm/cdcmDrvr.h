@@ -175,6 +175,7 @@ typedef struct _cdcmStatics {
 	//struct list_head cdcm_proc_list_head;	/* process list */
 	cdcmt_t cdcm_timer[MAX_CDCM_TIMERS]; /* timers */
 	struct list_head cdcm_sem_list_head; /* semaphore list */
+	struct list_head cdcm_dmabuf_list_head; /* mmap'able DMA buffers */
 	cdcmflg_t cdcm_flags;	       /* bitset flags */
 	int cdcm_isdg;		       /* this is a driverGen driver */
 } cdcmStatics_t;
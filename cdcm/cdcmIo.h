@@ -167,6 +167,12 @@ static inline uint64_t __cdcm_swab64(uint64_t x)
 #define cdcm_iowrite16(V, A) iowrite16((V), (A))
 #define cdcm_iowrite32(V, A) iowrite32((V), (A))
 
+/* 64-bit accesses, where the architecture has them */
+#ifdef readq
+#define cdcm_ioread64(A)     readq((A))
+#define cdcm_iowrite64(V, A) writeq((V), (A))
+#endif
+
 #else /* LynxOS -- I/O functions */
 
 /*
@@ -18,6 +18,12 @@
 /* CDCM global variables (declared in the cdcmDrvr.c module)  */
 extern cdcmStatics_t cdcmStatT; /* CDCM statics table */
 
+/* protects cdcmStatT.cdcm_dmabuf_list_head and the offset allocator */
+static DEFINE_MUTEX(dmabuf_lock);
+
+/* next free mmap() offset. Offset 0 is never handed out */
+static unsigned long dmabuf_next_offset = PAGE_SIZE;
+
 /**
  * @brief Release previously allocated memory
  *
@@ -150,3 +156,306 @@ void free1page(void *addr)
 {
 	return free_page((unsigned long)addr);
 }
+
+/* give @db the next free mmap() offset and add it to the list */
+static void cdcm_mmapbuf_add(struct cdcm_mmapbuf *db)
+{
+	mutex_lock(&dmabuf_lock);
+	db->db_offset = dmabuf_next_offset;
+	dmabuf_next_offset += db->db_size;
+	list_add_tail(&db->db_list, &cdcmStatT.cdcm_dmabuf_list_head);
+	mutex_unlock(&dmabuf_lock);
+}
+
+/**
+ * @brief Allocate a DMA buffer that user space can mmap.
+ *
+ * @param size   - size in bytes (rounded up to a power of two of pages)
+ * @param offset - mmap() offset of the buffer is put here
+ *
+ * The buffer is zeroed out. Must be called from process context.
+ *
+ * @return kernel address of the buffer - if success.
+ * @return NULL                         - if fails.
+ */
+void *cdcm_dmabuf_alloc(unsigned long size, unsigned long *offset)
+{
+	return cdcm_dmabuf_alloc_flags(size, 0, offset);
+}
+
+/**
+ * @brief Allocate a DMA buffer that user space can mmap, with flags.
+ *
+ * @param size   - size in bytes (rounded up to a power of two of pages)
+ * @param flags  - CDCM_MMAP_RDONLY, or 0
+ * @param offset - mmap() offset of the buffer is put here
+ *
+ * See @e cdcm_dmabuf_alloc(). With CDCM_MMAP_RDONLY, user space can only
+ * map the buffer for reading, e.g. for counters that the driver updates.
+ *
+ * @return kernel address of the buffer - if success.
+ * @return NULL                         - if fails.
+ */
+void *cdcm_dmabuf_alloc_flags(unsigned long size, int flags,
+			      unsigned long *offset)
+{
+	struct cdcm_mmapbuf *db;
+	struct page *page, *end;
+	int order;
+
+	if (!size)
+		return NULL;
+
+	db = kzalloc(sizeof(*db), GFP_KERNEL);
+	if (db == NULL)
+		return NULL;
+
+	order = get_order(size);
+	db->db_kaddr = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, order);
+	if (db->db_kaddr == NULL) {
+		PRNT_ERR(cdcmStatT.cdcm_ipl,
+			 "Can't alloc 0x%lx bytes of DMA memory", size);
+		kfree(db);
+		return NULL;
+	}
+	db->db_order = order;
+	db->db_size = PAGE_SIZE << order;
+	db->db_flags = flags & CDCM_MMAP_RDONLY;
+	atomic_set(&db->db_mapped, 0);
+
+	/* remap_pfn_range() wants the pages to be reserved */
+	end = virt_to_page(db->db_kaddr + db->db_size - 1);
+	for (page = virt_to_page(db->db_kaddr); page <= end; page++)
+		SetPageReserved(page);
+
+	cdcm_mmapbuf_add(db);
+
+	if (offset)
+		*offset = db->db_offset;
+
+	return db->db_kaddr;
+}
+
+/**
+ * @brief Let user space mmap a range of device memory.
+ *
+ * @param phys   - physical address, page-aligned
+ * @param size   - size in bytes (rounded up to whole pages)
+ * @param flags  - CDCM_MMAP_RDONLY and/or CDCM_MMAP_WC
+ * @param offset - mmap() offset of the range is put here
+ *
+ * The range is mapped uncached, or write-combined with CDCM_MMAP_WC. The
+ * same range can be exported several times, e.g. once read-only and once
+ * write-combined for the clients that write to it.
+ *
+ * @return 0       - on success
+ * @return -EINVAL - if @a phys is not page-aligned
+ * @return -ENOMEM - if out of memory
+ */
+int cdcm_iomem_export(unsigned long phys, unsigned long size, int flags,
+		      unsigned long *offset)
+{
+	struct cdcm_mmapbuf *db;
+
+	if (!size || phys & ~PAGE_MASK)
+		return -EINVAL;
+
+	db = kzalloc(sizeof(*db), GFP_KERNEL);
+	if (db == NULL)
+		return -ENOMEM;
+
+	db->db_phys = phys;
+	db->db_size = PAGE_ALIGN(size);
+	db->db_flags = CDCM_MMAP_IOMEM |
+		(flags & (CDCM_MMAP_RDONLY | CDCM_MMAP_WC));
+	atomic_set(&db->db_mapped, 0);
+
+	cdcm_mmapbuf_add(db);
+
+	if (offset)
+		*offset = db->db_offset;
+
+	return 0;
+}
+
+/* Note: call with dmabuf_lock held */
+static void __cdcm_dmabuf_release(struct cdcm_mmapbuf *db)
+{
+	struct page *page, *end;
+
+	list_del(&db->db_list);
+	if (!(db->db_flags & CDCM_MMAP_IOMEM)) {
+		end = virt_to_page(db->db_kaddr + db->db_size - 1);
+		for (page = virt_to_page(db->db_kaddr); page <= end; page++)
+			ClearPageReserved(page);
+		free_pages((unsigned long)db->db_kaddr, db->db_order);
+	}
+	kfree(db);
+}
+
+/**
+ * @brief Release a DMA buffer allocated with @e cdcm_dmabuf_alloc().
+ *
+ * @param kaddr - kernel address of the buffer
+ *
+ * @return 0       - on success
+ * @return -EBUSY  - if user space still has it mapped
+ * @return -EINVAL - if @a kaddr is not a CDCM DMA buffer
+ */
+int cdcm_dmabuf_free(void *kaddr)
+{
+	struct cdcm_mmapbuf *db;
+	int rc = -EINVAL;
+
+	mutex_lock(&dmabuf_lock);
+	list_for_each_entry(db, &cdcmStatT.cdcm_dmabuf_list_head, db_list) {
+		if (db->db_kaddr != kaddr || db->db_flags & CDCM_MMAP_IOMEM)
+			continue;
+		if (atomic_read(&db->db_mapped)) {
+			rc = -EBUSY;
+			break;
+		}
+		__cdcm_dmabuf_release(db);
+		rc = 0;
+		break;
+	}
+	mutex_unlock(&dmabuf_lock);
+
+	return rc;
+}
+
+/**
+ * @brief Withdraw a range exported with @e cdcm_iomem_export().
+ *
+ * @param offset - mmap() offset of the range
+ *
+ * @return 0       - on success
+ * @return -EBUSY  - if user space still has it mapped
+ * @return -EINVAL - if there's no such range
+ */
+int cdcm_iomem_unexport(unsigned long offset)
+{
+	struct cdcm_mmapbuf *db;
+	int rc = -EINVAL;
+
+	mutex_lock(&dmabuf_lock);
+	list_for_each_entry(db, &cdcmStatT.cdcm_dmabuf_list_head, db_list) {
+		if (db->db_offset != offset ||
+		    !(db->db_flags & CDCM_MMAP_IOMEM))
+			continue;
+		if (atomic_read(&db->db_mapped)) {
+			rc = -EBUSY;
+			break;
+		}
+		__cdcm_dmabuf_release(db);
+		rc = 0;
+		break;
+	}
+	mutex_unlock(&dmabuf_lock);
+
+	return rc;
+}
+
+/**
+ * @brief Release all the DMA buffers and device memory ranges.
+ *        Called on module unload.
+ */
+void cdcm_dmabuf_free_all(void)
+{
+	struct cdcm_mmapbuf *db, *tmp;
+
+	mutex_lock(&dmabuf_lock);
+	list_for_each_entry_safe(db, tmp, &cdcmStatT.cdcm_dmabuf_list_head,
+				 db_list) {
+		if (atomic_read(&db->db_mapped))
+			PRNT_ABS_WARN("DMA buffer @ offset 0x%lx still mapped",
+				      db->db_offset);
+		__cdcm_dmabuf_release(db);
+	}
+	mutex_unlock(&dmabuf_lock);
+}
+
+static void cdcm_dmabuf_vm_open(struct vm_area_struct *vma)
+{
+	struct cdcm_mmapbuf *db = vma->vm_private_data;
+
+	atomic_inc(&db->db_mapped);
+}
+
+static void cdcm_dmabuf_vm_close(struct vm_area_struct *vma)
+{
+	struct cdcm_mmapbuf *db = vma->vm_private_data;
+
+	atomic_dec(&db->db_mapped);
+}
+
+static struct vm_operations_struct cdcm_dmabuf_vm_ops = {
+	.open  = cdcm_dmabuf_vm_open,
+	.close = cdcm_dmabuf_vm_close,
+};
+
+/**
+ * @brief Map (part of) a DMA buffer, or of a device memory range, into
+ *        user space.
+ *
+ * @param vma - user's VMA. Its offset selects the buffer.
+ *
+ * The mapping may start anywhere inside a buffer but must not cross its end.
+ *
+ * @return 0        - on success
+ * @return -EPERM   - if a read-only buffer is mapped for writing
+ * @return negative - on failure
+ */
+int cdcm_dmabuf_mmap(struct vm_area_struct *vma)
+{
+	unsigned long off = vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long len = vma->vm_end - vma->vm_start;
+	struct cdcm_mmapbuf *db;
+	unsigned long pfn;
+	int rc = -EINVAL;
+
+	mutex_lock(&dmabuf_lock);
+	list_for_each_entry(db, &cdcmStatT.cdcm_dmabuf_list_head, db_list) {
+		if (off < db->db_offset || off >= db->db_offset + db->db_size)
+			continue;
+		if (off + len > db->db_offset + db->db_size)
+			break;
+
+		if (db->db_flags & CDCM_MMAP_RDONLY) {
+			if (vma->vm_flags & VM_WRITE) {
+				rc = -EPERM;
+				break;
+			}
+			vma->vm_flags &= ~VM_MAYWRITE;
+		}
+		vma->vm_flags |= VM_RESERVED | VM_DONTEXPAND | VM_DONTCOPY;
+
+		if (db->db_flags & CDCM_MMAP_IOMEM) {
+			pfn = (db->db_phys + (off - db->db_offset)) >>
+				PAGE_SHIFT;
+			if (db->db_flags & CDCM_MMAP_WC)
+				vma->vm_page_prot =
+					pgprot_writecombine(vma->vm_page_prot);
+			else
+				vma->vm_page_prot =
+					pgprot_noncached(vma->vm_page_prot);
+			vma->vm_flags |= VM_IO;
+			rc = io_remap_pfn_range(vma, vma->vm_start, pfn, len,
+						vma->vm_page_prot);
+		} else {
+			pfn = virt_to_phys(db->db_kaddr + (off - db->db_offset))
+				>> PAGE_SHIFT;
+			rc = remap_pfn_range(vma, vma->vm_start, pfn, len,
+					     vma->vm_page_prot);
+		}
+		if (rc)
+			break;
+		vma->vm_ops = &cdcm_dmabuf_vm_ops;
+		vma->vm_private_data = db;
+		cdcm_dmabuf_vm_open(vma);
+		break;
+	}
+	mutex_unlock(&dmabuf_lock);
+
+	return rc;
+}
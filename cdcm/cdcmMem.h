@@ -23,4 +23,44 @@ struct cdcm_mem_header {
 void cdcm_mem_free(void *addr);
 void *cdcm_mem_alloc(ssize_t size, int flags);
 
+/*
+ * DMA buffers that can be mmap'ed by user space.
+ * They are physically contiguous lowmem pages, so they can be handed to
+ * vme_do_dma_kernel() and friends as they are.
+ * Each buffer gets a unique, page-aligned offset; this is what user space
+ * passes to mmap() to map that buffer.
+ * Device memory (e.g. a PCI BAR) can be exported in the same offset space,
+ * see cdcm_iomem_export().
+ */
+#define CDCM_MMAP_IOMEM  0x1 /* device memory, not a DMA buffer */
+#define CDCM_MMAP_RDONLY 0x2 /* user space can't map it for writing */
+#define CDCM_MMAP_WC     0x4 /* device memory mapped write-combined */
+
+struct cdcm_mmapbuf {
+	struct list_head db_list;   /* CDCM dma buffer list */
+	void            *db_kaddr;  /* kernel virtual address */
+	unsigned long    db_phys;   /* physical address (CDCM_MMAP_IOMEM) */
+	unsigned long    db_size;   /* size in bytes, page-aligned */
+	unsigned long    db_offset; /* mmap() offset, in bytes */
+	int              db_order;  /* allocation order */
+	int              db_flags;  /* CDCM_MMAP_* */
+	atomic_t         db_mapped; /* number of live user mappings */
+};
+
+void *cdcm_dmabuf_alloc(unsigned long size, unsigned long *offset);
+void *cdcm_dmabuf_alloc_flags(unsigned long size, int flags,
+			      unsigned long *offset);
+int   cdcm_dmabuf_free(void *kaddr);
+void  cdcm_dmabuf_free_all(void);
+int   cdcm_dmabuf_mmap(struct vm_area_struct *vma);
+
+int   cdcm_iomem_export(unsigned long phys, unsigned long size, int flags,
+			unsigned long *offset);
+int   cdcm_iomem_unexport(unsigned long offset);
+
+struct drm_node_s;
+int   cdcm_pci_export_bar(struct drm_node_s *node_h, int resource_id,
+			  int flags, unsigned long *offset,
+			  unsigned long *size);
+
 #endif /* _CDCM_MEM_H_INCLUDE_ */
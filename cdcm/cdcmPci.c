@@ -18,6 +18,7 @@
 #include "cdcmLynxDefs.h"
 #include "cdcmBoth.h"
 #include "cdcmPci.h"
+#include "cdcmMem.h"
 
 /* external crap */
 extern cdcmStatics_t cdcmStatT;	/* CDCM statics table */
@@ -569,3 +570,37 @@ int drm_unmap_resource(struct drm_node_s *node_h, int resource_id)
 	pci_release_region(cast->di_pci, bar);
 	return DRM_OK;
 }
+
+
+/**
+ * @brief Let user space mmap a PCI BAR. See @e cdcm_iomem_export().
+ *
+ * @param node_h      - device handle
+ * @param resource_id - PCI_RESID_BAR0 to PCI_RESID_BAR5
+ * @param flags       - CDCM_MMAP_RDONLY and/or CDCM_MMAP_WC
+ * @param offset      - mmap() offset of the BAR is put here
+ * @param size        - size of the BAR is put here, if not NULL
+ *
+ * @return 0        - on success
+ * @return -EINVAL  - if it's not a memory BAR
+ * @return negative - on failure
+ */
+int cdcm_pci_export_bar(struct drm_node_s *node_h, int resource_id,
+			int flags, unsigned long *offset, unsigned long *size)
+{
+	struct cdcm_dev_info *cast = (struct cdcm_dev_info*) node_h;
+	int bar = resource_id - PCI_RESID_BAR0;
+	unsigned long len;
+	int rc;
+
+	if (bar < 0 || bar > 5 ||
+	    !(pci_resource_flags(cast->di_pci, bar) & IORESOURCE_MEM))
+		return -EINVAL;
+
+	len = pci_resource_len(cast->di_pci, bar);
+	rc = cdcm_iomem_export(pci_resource_start(cast->di_pci, bar), len,
+			       flags, offset);
+	if (!rc && size)
+		*size = len;
+	return rc;
+}
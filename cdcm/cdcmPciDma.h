@@ -124,6 +124,33 @@ cdcm_dma_t cdcm_pci_map(void *handle, void *addr, size_t size, int write);
  */
 void cdcm_pci_unmap(void *handle, cdcm_dma_t dma_addr, int size, int write);
 
+/**
+ * @brief allocate memory that both the CPU and a PCI device can access
+ *
+ * @param handle - CDCM device
+ * @param size - size of the region
+ * @param dma - the address the device must use is put here
+ *
+ * The memory is physically contiguous, at least 16-byte aligned, and
+ * coherent: no mapping or unmapping is needed around DMA transfers. It's
+ * meant for small, long-lived structures such as DMA descriptor lists.
+ *
+ * @return virtual address of the region - on success
+ * @return NULL - on failure
+ */
+void *cdcm_pci_alloc_consistent(void *handle, size_t size, cdcm_dma_t *dma);
+
+/**
+ * @brief free memory allocated with @ref cdcm_pci_alloc_consistent
+ *
+ * @param handle - CDCM device
+ * @param size - size of the region, as passed on allocation
+ * @param addr - virtual address of the region
+ * @param dma - device address of the region
+ */
+void cdcm_pci_free_consistent(void *handle, size_t size, void *addr,
+			      cdcm_dma_t dma);
+
 /**
  * @brief map a user's buffer for DMA
  *
@@ -41,6 +41,21 @@ void cdcm_pci_unmap(void *handle, cdcm_dma_t dma_addr,
   return pci_unmap_single(cast->di_pci, dma_addr, size, direction);
 }
 
+void *cdcm_pci_alloc_consistent(void *handle, size_t size, cdcm_dma_t *dma)
+{
+  struct cdcm_dev_info *cast = (struct cdcm_dev_info*)handle;
+
+  return pci_alloc_consistent(cast->di_pci, size, dma);
+}
+
+void cdcm_pci_free_consistent(void *handle, size_t size, void *addr,
+			      cdcm_dma_t dma)
+{
+  struct cdcm_dev_info *cast = (struct cdcm_dev_info*)handle;
+
+  pci_free_consistent(cast->di_pci, size, addr, dma);
+}
+
 /**
  * @brief initialise a dma buffer
  *
@@ -28,6 +28,30 @@ void cdcm_pci_unmap(void *handle, cdcm_dma_t dma_addr, int size, int write)
   return;
 }
 
+/*
+ * As in cdcm_pci_map(), kernel memory is handed to the device as it is.
+ * sysbrk() doesn't guarantee the alignment, so the original address is
+ * kept right before the aligned one.
+ */
+void *cdcm_pci_alloc_consistent(void *handle, size_t size, cdcm_dma_t *dma)
+{
+  char *raw, *addr;
+
+  raw = sysbrk(size + 16 + sizeof(char *));
+  if (raw == NULL)
+    return NULL;
+  addr = (char *)(((unsigned long)raw + sizeof(char *) + 15) & ~15UL);
+  ((char **)addr)[-1] = raw;
+  *dma = cdcm_pci_map(handle, addr, size, 0);
+  return addr;
+}
+
+void cdcm_pci_free_consistent(void *handle, size_t size, void *addr,
+			      cdcm_dma_t dma)
+{
+  sysfree(((char **)addr)[-1], size + 16 + sizeof(char *));
+}
+
 int cdcm_pci_mmchain_lock(void *handle, struct cdcm_dmabuf *dma, int write,
 			  int pid, void *buf, unsigned long size,
 			  struct dmachain *out)
@@ -17,6 +17,28 @@
 /* global CDCM statics table */
 extern cdcmStatics_t cdcmStatT;
 
+/* worker pool parameters */
+static int wp_prio = 0;
+module_param(wp_prio, int, S_IRUGO);
+MODULE_PARM_DESC(wp_prio, "Worker pool SCHED_FIFO priority (0 -- SCHED_NORMAL)");
+
+/**
+ * @brief Per-CPU worker of the CDCM worker pool.
+ *
+ * @wk_lock  -- protects @wk_list. Taken from ISRs, so always irqsave
+ * @wk_list  -- pending work items, FIFO
+ * @wk_wq    -- worker sleeps here while @wk_list is empty
+ * @wk_task  -- worker thread (NULL if the CPU has no worker)
+ */
+struct cdcm_worker {
+	spinlock_t		wk_lock;
+	struct list_head	wk_list;
+	wait_queue_head_t	wk_wq;
+	struct task_struct	*wk_task;
+};
+
+static struct cdcm_worker cdcm_workers[NR_CPUS];
+
 
 /* if you know the better way to pass arbitrary number of parameters to
    the function - let me know pls... (IMHO __builtin_apply_args() and co.
@@ -118,23 +140,22 @@ cdcmthr_t* cdcm_get_thread_handle(int stid)
 
 
 /**
- * @brief Lynx stub.
+ * @brief Create and start a stream task, optionally bound to a CPU.
  *
+ * @param cpu       - CPU to bind the thread to (< 0 -- don't bind)
  * @param procaddr  - payload
- * @param stacksize - thread stack size
- * @param prio      - priority
  * @param name      - desired thread name
  * @param nargs     - number of arguments
- * @param ...       - args to pass to the stream task
+ * @param argptr    - args to pass to the stream task
  *
  * @return stid (stream task ID) - if success.
  * @return SYSERR (-1)           - if fails.
  */
-int ststart(tpp_t procaddr, int stacksize, int prio, char *name, int nargs, ...)
+static int __cdcm_ststart(int cpu, tpp_t procaddr, char *name, int nargs,
+			  va_list argptr)
 {
   int cntr;
   cdcmtpar_t tparp; /* multiple items are bundled as a single data structure */
-  va_list argptr;
   cdcmthr_t *cdcmthrp;
   struct task_struct *coco;
 
@@ -142,6 +163,12 @@ int ststart(tpp_t procaddr, int stacksize, int prio, char *name, int nargs, ...)
   if (nargs > CDCM_MAX_THR_ARGS)
     return(SYSERR);
 
+  if (cpu >= 0 && (cpu >= NR_CPUS || !cpu_online(cpu))) {
+	  PRNT_ABS_ERR("Can't bind '%s' to CPU %d. It is not online",
+		       name, cpu);
+	  return SYSERR;
+  }
+
   if (strlen(name) > CDCM_TNL)
 	  PRNT_ABS_WARN("Desired thread name is too long (%d char > %d char"
 			"MAX). Will be truncated!\n", strlen(name), CDCM_TNL);
@@ -161,9 +188,6 @@ int ststart(tpp_t procaddr, int stacksize, int prio, char *name, int nargs, ...)
   /* set stream task name */
   strncpy(cdcmthrp->thr_nm, name, CDCM_TNL - 1);
 
-  /* add it to the linked list */
-  list_add(&cdcmthrp->thr_list, &cdcmStatT.cdcm_thr_list_head);
-
   /* init some params (will be zero out by the compiler) */
   tparp = (cdcmtpar_t) {
     .tp_payload = procaddr,
@@ -172,28 +196,91 @@ int ststart(tpp_t procaddr, int stacksize, int prio, char *name, int nargs, ...)
   };
 
   /* get payload arguments and put them into the thread parameter struct */
-  va_start(argptr, nargs);
   for (cntr = 0; cntr < nargs; cntr++)
     tparp.tp_args[cntr] = va_arg(argptr, char *);
-  va_end(argptr);
 
-  /* Start up our control thread */
-  coco = kthread_run(cdcm_local_thread, &tparp, cdcmthrp->thr_nm);
+  /* Create our control thread. Bind it (if requested) before it runs */
+  coco = kthread_create(cdcm_local_thread, &tparp, cdcmthrp->thr_nm);
 
   if (IS_ERR(coco)) {
 	  PRNT_ABS_ERR("Unable to start '%s' control thread",
 		       cdcmthrp->thr_nm);
+	  kfree(cdcmthrp);
     return SYSERR;
   }
 
+  if (cpu >= 0)
+	  kthread_bind(coco, cpu);
+
+  /* add it to the linked list */
+  list_add(&cdcmthrp->thr_list, &cdcmStatT.cdcm_thr_list_head);
+
+  wake_up_process(coco);
+
   /* wait while crusial info will be set up (cdcmthrp->thr_pd pointer) */
   wait_for_completion(&cdcmthrp->thr_c);
 
-  printk("-----------> kthread %d started\n", cdcmthrp->thr_pd->pid);
+  PRNT_DBG(cdcmStatT.cdcm_ipl, "kthread %d started", cdcmthrp->thr_pd->pid);
 
   return(cdcmthrp->thr_pd->pid);
 }
 
+/**
+ * @brief Lynx stub.
+ *
+ * @param procaddr  - payload
+ * @param stacksize - thread stack size
+ * @param prio      - priority
+ * @param name      - desired thread name
+ * @param nargs     - number of arguments
+ * @param ...       - args to pass to the stream task
+ *
+ * Compatibility shim: the stream task gets its own kernel thread, free to
+ * run on any CPU. Use @e cdcm_ststart_on() to place it, or the worker pool
+ * (@e cdcm_queue_work()) for short bottom-half jobs.
+ *
+ * @return stid (stream task ID) - if success.
+ * @return SYSERR (-1)           - if fails.
+ */
+int ststart(tpp_t procaddr, int stacksize, int prio, char *name, int nargs, ...)
+{
+  va_list argptr;
+  int stid;
+
+  va_start(argptr, nargs);
+  stid = __cdcm_ststart(-1, procaddr, name, nargs, argptr);
+  va_end(argptr);
+
+  return stid;
+}
+
+/**
+ * @brief @e ststart() with CPU affinity.
+ *
+ * @param cpu       - CPU to bind the stream task to (< 0 -- any CPU)
+ * @param procaddr  - payload
+ * @param stacksize - thread stack size (ignored, as in @e ststart())
+ * @param prio      - priority (ignored, as in @e ststart())
+ * @param name      - desired thread name
+ * @param nargs     - number of arguments
+ * @param ...       - args to pass to the stream task
+ *
+ * @return stid (stream task ID) - if success.
+ * @return SYSERR (-1)           - if fails.
+ */
+int cdcm_ststart_on(int cpu, tpp_t procaddr, int stacksize, int prio,
+		    char *name, int nargs, ...)
+{
+  va_list argptr;
+  int stid;
+
+  va_start(argptr, nargs);
+  stid = __cdcm_ststart(cpu, procaddr, name, nargs, argptr);
+  va_end(argptr);
+
+  return stid;
+}
+
 /**
  * @brief Lynx stub. Remove user-defined kernel thread.
  *
@@ -258,3 +345,204 @@ void stremove(int stid)
 
 	local_irq_restore(iflags);
 }
+
+/**
+ * @brief Worker pool thread. Runs queued work items until told to stop.
+ *
+ * @param data - worker this thread serves
+ *
+ * @return 0 (passed to @e kthread_stop())
+ */
+static int cdcm_worker_thread(void *data)
+{
+	struct cdcm_worker *wk = data;
+	struct cdcm_work *work;
+	cdcm_work_func_t func;
+	unsigned long flags;
+	void *arg;
+
+	if (wp_prio > 0) {
+		struct sched_param param = { .sched_priority = wp_prio };
+
+		sched_setscheduler(current, SCHED_FIFO, &param);
+	}
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(wk->wk_wq,
+					 !list_empty(&wk->wk_list) ||
+					 kthread_should_stop());
+
+		spin_lock_irqsave(&wk->wk_lock, flags);
+		while (!list_empty(&wk->wk_list)) {
+			work = list_entry(wk->wk_list.next, struct cdcm_work,
+					  w_list);
+			list_del_init(&work->w_list);
+			func = work->w_func;
+			arg = work->w_arg;
+			/* from now on the item may be re-queued, even by func */
+			clear_bit(0, &work->w_pending);
+			spin_unlock_irqrestore(&wk->wk_lock, flags);
+
+			func(arg);
+
+			spin_lock_irqsave(&wk->wk_lock, flags);
+		}
+		spin_unlock_irqrestore(&wk->wk_lock, flags);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Start the worker pool: one bound worker per online CPU.
+ *
+ * @return 0        - on success
+ * @return negative - on failure (no worker is left running)
+ */
+int cdcm_wp_init(void)
+{
+	struct cdcm_worker *wk;
+	struct task_struct *task;
+	int cpu;
+
+	for_each_online_cpu(cpu) {
+		wk = &cdcm_workers[cpu];
+		spin_lock_init(&wk->wk_lock);
+		INIT_LIST_HEAD(&wk->wk_list);
+		init_waitqueue_head(&wk->wk_wq);
+
+		task = kthread_create(cdcm_worker_thread, wk, "cdcm_wp/%d",
+				      cpu);
+		if (IS_ERR(task)) {
+			PRNT_ABS_ERR("Can't create worker for CPU %d", cpu);
+			cdcm_wp_cleanup();
+			return PTR_ERR(task);
+		}
+		kthread_bind(task, cpu);
+		wk->wk_task = task;
+		wake_up_process(task);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Stop all the workers. Pending work items are dropped.
+ */
+void cdcm_wp_cleanup(void)
+{
+	struct cdcm_worker *wk;
+	struct cdcm_work *work, *tmp;
+	unsigned long flags;
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		wk = &cdcm_workers[cpu];
+		if (!wk->wk_task)
+			continue;
+		kthread_stop(wk->wk_task);
+		wk->wk_task = NULL;
+
+		spin_lock_irqsave(&wk->wk_lock, flags);
+		list_for_each_entry_safe(work, tmp, &wk->wk_list, w_list) {
+			PRNT_ABS_WARN("CPU %d: dropping pending work %p",
+				      cpu, work);
+			list_del_init(&work->w_list);
+			clear_bit(0, &work->w_pending);
+		}
+		spin_unlock_irqrestore(&wk->wk_lock, flags);
+	}
+}
+
+/**
+ * @brief Queue a work item on a given CPU's worker.
+ *
+ * @param cpu  - CPU whose worker will run the item
+ * @param work - work item
+ *
+ * Safe to call from interrupt context.
+ *
+ * @return 1       - if queued
+ * @return 0       - if it was already pending
+ * @return -EINVAL - if there is no worker on @a cpu
+ */
+int cdcm_queue_work_on(int cpu, struct cdcm_work *work)
+{
+	struct cdcm_worker *wk;
+	unsigned long flags;
+
+	if (cpu < 0 || cpu >= NR_CPUS || !cdcm_workers[cpu].wk_task)
+		return -EINVAL;
+	wk = &cdcm_workers[cpu];
+
+	if (test_and_set_bit(0, &work->w_pending))
+		return 0;
+
+	spin_lock_irqsave(&wk->wk_lock, flags);
+	list_add_tail(&work->w_list, &wk->wk_list);
+	spin_unlock_irqrestore(&wk->wk_lock, flags);
+
+	wake_up(&wk->wk_wq);
+	return 1;
+}
+
+/**
+ * @brief Queue a work item on the worker of the current CPU.
+ *
+ * @param work - work item
+ *
+ * Called from an ISR, the bottom-half thus runs on the CPU that took the
+ * interrupt, which keeps the data it touches cache-hot.
+ *
+ * @return see @e cdcm_queue_work_on()
+ */
+int cdcm_queue_work(struct cdcm_work *work)
+{
+	int cpu = get_cpu();
+	int ret;
+
+	ret = cdcm_queue_work_on(cpu, work);
+	put_cpu();
+
+	return ret;
+}
+
+/**
+ * @brief Remove a work item from its worker queue, if still pending.
+ *
+ * @param work - work item
+ *
+ * An item that is already running is not waited for.
+ *
+ * @return 1 - if the item was pending and has been removed
+ * @return 0 - otherwise
+ */
+int cdcm_cancel_work(struct cdcm_work *work)
+{
+	struct cdcm_worker *wk;
+	unsigned long flags;
+	int cpu;
+
+	for (cpu = 0; cpu < NR_CPUS; cpu++) {
+		wk = &cdcm_workers[cpu];
+		if (!wk->wk_task)
+			continue;
+		spin_lock_irqsave(&wk->wk_lock, flags);
+		if (test_bit(0, &work->w_pending) &&
+		    !list_empty(&work->w_list)) {
+			struct cdcm_work *entry;
+
+			list_for_each_entry(entry, &wk->wk_list, w_list) {
+				if (entry != work)
+					continue;
+				list_del_init(&work->w_list);
+				clear_bit(0, &work->w_pending);
+				spin_unlock_irqrestore(&wk->wk_lock, flags);
+				return 1;
+			}
+		}
+		spin_unlock_irqrestore(&wk->wk_lock, flags);
+	}
+
+	return 0;
+}
@@ -15,6 +15,7 @@
 #define _CDCM_THREAD_H_INCLUDE_
 
 #include <linux/completion.h>
+#include <linux/wait.h>
 
 /* user stream task termination check */
 #define CDCM_LOOP_AGAIN				\
@@ -56,4 +57,49 @@ typedef struct _cdcmThrParam {
   cdcmthr_t *tp_handle;		         /* thread handler */
 } cdcmtpar_t;
 
+/*
+ * Worker pool.
+ * One kernel thread per online CPU, bound to it. Work items can be queued
+ * from any context (including ISRs) and are run in process context on the
+ * worker of the CPU they were queued on (or on the requested one).
+ */
+typedef void (*cdcm_work_func_t)(void *);
+
+/* work item. Owned by the caller; must stay alive while it is pending */
+struct cdcm_work {
+  struct list_head  w_list;    /* worker queue */
+  cdcm_work_func_t  w_func;    /* user payload */
+  void             *w_arg;     /* payload argument */
+  unsigned long     w_pending; /* bit 0 set while queued */
+};
+
+#define CDCM_WORK_INITIALIZER(n, f, a) {		\
+  .w_list    = LIST_HEAD_INIT((n).w_list),		\
+  .w_func    = (f),					\
+  .w_arg     = (a),					\
+  .w_pending = 0					\
+}
+
+#define CDCM_DECLARE_WORK(n, f, a)			\
+  struct cdcm_work n = CDCM_WORK_INITIALIZER(n, f, a)
+
+static inline void cdcm_work_init(struct cdcm_work *work,
+				  cdcm_work_func_t func, void *arg)
+{
+  INIT_LIST_HEAD(&work->w_list);
+  work->w_func    = func;
+  work->w_arg     = arg;
+  work->w_pending = 0;
+}
+
+int  cdcm_wp_init(void);
+void cdcm_wp_cleanup(void);
+int  cdcm_queue_work(struct cdcm_work *work);
+int  cdcm_queue_work_on(int cpu, struct cdcm_work *work);
+int  cdcm_cancel_work(struct cdcm_work *work);
+
+/* ststart() with CPU placement. cpu < 0 means 'any CPU' (plain ststart) */
+int cdcm_ststart_on(int cpu, tpp_t procaddr, int stacksize, int prio,
+		    char *name, int nargs, ...);
+
 #endif /* _CDCM_THREAD_H_INCLUDE_ */
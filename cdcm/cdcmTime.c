@@ -244,6 +244,12 @@ static noinline int __cdcm_down_timeout(struct cdcm_sem *sem, long jiffies)
 	return __cdcm_down_common(sem, TASK_UNINTERRUPTIBLE, jiffies);
 }
 
+static noinline int
+__cdcm_down_timeout_interruptible(struct cdcm_sem *sem, long jiffies)
+{
+	return __cdcm_down_common(sem, TASK_INTERRUPTIBLE, jiffies);
+}
+
 static inline void cdcm_down(struct cdcm_sem *sem)
 {
 	unsigned long flags;
@@ -286,6 +292,22 @@ static inline int cdcm_down_timeout(struct cdcm_sem *sem, long jiffies)
 	return result;
 }
 
+static inline int
+cdcm_down_timeout_interruptible(struct cdcm_sem *sem, long jiffies)
+{
+	unsigned long flags;
+	int result = 0;
+
+	spin_lock_irqsave(&sem->lock, flags);
+	if (likely(sem->count > 0))
+		sem->count--;
+	else
+		result = __cdcm_down_timeout_interruptible(sem, jiffies);
+	spin_unlock_irqrestore(&sem->lock, flags);
+
+	return result;
+}
+
 /**
  * @brief try to acquire the semaphore, without waiting
  * @return 0 - if the semaphore has been acquired successfully
@@ -383,7 +405,11 @@ int tswait(int *user_sem, int sig, int interval)
 	else if (interval < 0)
 		return swait(user_sem, sig);
 
-	ret = cdcm_down_timeout(&sema->sem, expires); /* non-interruptible */
+	/* as in swait(), only SEM_SIGIGNORE waits through signals */
+	if (sig == SEM_SIGIGNORE)
+		ret = cdcm_down_timeout(&sema->sem, expires);
+	else
+		ret = cdcm_down_timeout_interruptible(&sema->sem, expires);
 	switch (ret) {
 	case 0:
 		return OK;
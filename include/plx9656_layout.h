@@ -294,6 +294,18 @@ typedef enum {
   PlxDmaDprDIR_LOC_PCI     = 0x08   //!< Set: Local to PCI. Clear: PCI to Local
 } PlxDmaDpr;
 
+/*! DMA descriptor, for scatter gather mode (PlxDmaModeSCAT_GATHER).
+ *
+ * The chip fetches the list from PCI memory when DPR has PlxDmaDprSPACE set.
+ * Descriptors must be 16-byte aligned and little endian.
+ */
+typedef struct {
+  uint32_t PADR; //!< PCI address
+  uint32_t LADR; //!< Local address
+  uint32_t SIZ;  //!< Transfer size in bytes
+  uint32_t DPR;  //!< Next descriptor address | PlxDmaDpr flags
+} __attribute__ ((packed)) PlxDmaDesc;
+
 #define PlxBIG_ENDIAN 0xFF
 
 typedef enum {
@@ -22,6 +22,8 @@
 
 #define SkelDrvrMAX_MAPS 10 /* max. entries in SkelDrvrMaps */
 
+#define SkelDrvrMAX_DMA_BUFS 8 /* max. DMA buffers per module */
+
 typedef enum {
    SkelDrvrDebugFlagASSERTION   = 0x01,  /* Assertion violations */
    SkelDrvrDebugFlagTRACE       = 0x02,  /* Trace all IOCTL calls */
@@ -107,6 +109,20 @@ typedef struct {
    struct mapping_info 	Maps[SkelDrvrMAX_MAPS];
 } SkelDrvrMaps;
 
+/* ============================================ */
+/* DMA buffers shared with user space. Map them */
+/* with mmap(fd, Size, ..., MAP_SHARED, Offset) */
+
+typedef struct {
+   uint32_t Size;    /* Buffer size in bytes */
+   uint32_t Offset;  /* Offset to pass to mmap() */
+ } SkelDrvrDmaBuf;
+
+typedef struct {
+   uint32_t       Buffers;                    /* Number of valid entries */
+   SkelDrvrDmaBuf Bufs[SkelDrvrMAX_DMA_BUFS]; /* In allocation order */
+ } SkelDrvrDmaBufs;
+
 /* ============================================================= */
 /* Standard status definitions: A value of ZERO is the BAD state */
 
@@ -210,9 +226,18 @@ typedef struct {
 #define SkelDrvrIoctlRAW_BLOCK_WRITE    SKEL_IOWR(27, SkelDrvrRawIoTransferBlock)
 //!< Raw write access to card for debug
 
-#define SkelDrvrIoctlLAST_STANDARD      SKEL_IO (28)
+#define SkelDrvrIoctlGET_DMA_BUFS       SKEL_IOR(28, SkelDrvrDmaBufs)
+//!< Get the module's mmap'able DMA buffers
+
+#define SkelDrvrIoctlLAST_STANDARD      SKEL_IO (29)
 
-#define SkelDrvrSPECIFIC_IOCTL_OFFSET (_IOC_NR(SkelDrvrIoctlLAST_STANDARD) + 1)
+/*
+ * Drivers number their specific IOCTLs from here. It is frozen at the value
+ * it had before GET_DMA_BUFS took number 28, so that adding a standard IOCTL
+ * doesn't renumber them. There is no room left below it for another
+ * standard IOCTL.
+ */
+#define SkelDrvrSPECIFIC_IOCTL_OFFSET 29
 
 /* compatibility with utils/fpga_loader/ports.c */
 #define JTAG_READ_BYTE	SkelDrvrIoctlJTAG_READ_BYTE
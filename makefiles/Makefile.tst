@@ -35,7 +35,8 @@ LDLIBS = \
 	$(LOCAL_LIBS) \
 	$(XTRALIBS)
 
-SRCFILES = $(wildcard *.c)
+# stand-alone programs (see TEST_PROGS below) are not part of the test program
+SRCFILES = $(filter-out $(TEST_PROGS), $(wildcard *.c))
 
 # the standard test program (utils/extest) will be compiled
 # unless USE_EXTEST is set to 'n'
@@ -79,12 +80,22 @@ endif
 
 $(EXEC_OBJS): $(OBJFILES)
 
-_build: $(EXEC_OBJS) $(OBJDIR) $(FINAL_DEST) move_objs
+# TEST_PROGS (set it in Makefile.specific) lists .c files in test/ that
+# have a main() of their own; each is built as <name>.$(CPU), against the
+# local libraries
+PROGS_OBJS = $(TEST_PROGS:.c=$(EXTOBJ))
+PROGS_EXEC = $(TEST_PROGS:.c=.$(CPU))
+
+$(PROGS_EXEC): %.$(CPU): %$(EXTOBJ)
+	$(CC) $(CFLAGS) -o $@ $^ -L../$(FINAL_DEST) $(LOCAL_LIBS) -lpthread \
+		$(filter -lrt, $(LOADLIBES))
+
+_build: $(EXEC_OBJS) $(PROGS_EXEC) $(OBJDIR) $(FINAL_DEST) move_objs
 
 # Move compiled files to proper place
 move_objs:
-	$(Q)mv $(OBJFILES) $(OBJDIR)
-	$(Q)mv $(EXEC_OBJS) ../$(FINAL_DEST)
+	$(Q)mv $(OBJFILES) $(PROGS_OBJS) $(OBJDIR)
+	$(Q)mv $(EXEC_OBJS) $(PROGS_EXEC) ../$(FINAL_DEST)
 
 # CERN delivery
 include ../$(ROOTDIR)/makefiles/deliver.mk
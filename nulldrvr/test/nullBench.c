@@ -0,0 +1,439 @@
+/**
+ * @file nullBench.c
+ *
+ * @brief Measure the overhead of CDCM and skel with the null driver
+ *
+ * nulldrvr's callbacks do nothing, so whatever time is spent in its
+ * entry points is the framework's. Measured:
+ *
+ * - open() and close()
+ * - a null ioctl (GET_TIMEOUT: copy-out of an int, no driver work)
+ * - GET_STATUS
+ * - event delivery: write() (SIMULATE) from one client wakes up another
+ *   blocked in read(); latency from before the write() to the return of
+ *   the read()
+ * - sustained event rate: events delivered per second while keeping the
+ *   reader's queue from overflowing
+ * - RAW_BLOCK_READ throughput versus transfer size
+ *
+ * Latencies are printed as percentiles, in nanoseconds.
+ *
+ * Built against the skel simulator (skel/sim, see the Makefile) the same
+ * program runs the driver in user space, installing it from an XML file.
+ *
+ * Copyright (c) 2010 CERN
+ * @author Emilio G. Cota <emilio.garcia.cota@cern.ch>
+ *
+ * @section license_sec License
+ * Released under the GPL v2. (and only v2, not any later version)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include <skeluser.h>
+#include <skeluser_ioctl.h>
+#include <skel.h>
+
+#ifdef SKELSIM_REDIRECT
+#include <skelsim.h>
+#endif
+
+#ifndef DRIVER_NAME
+#define DRIVER_NAME "NULL"
+#endif
+
+static char *node = "/dev/" DRIVER_NAME ".1";
+static int iterations = 10000;
+static int module = 1;
+static int space = 0x39;
+static int max_size = 0x10000;
+static char *tests = "open,ioctl,status,event,rate,raw";
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_i64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a;
+	int64_t y = *(const int64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int64_t pct(int64_t *v, int n, double p)
+{
+	int i = (int)(p / 100.0 * (n - 1) + 0.5);
+
+	return v[i];
+}
+
+static void report(const char *name, int64_t *v, int n)
+{
+	if (n <= 0) {
+		printf("%-22s no samples\n", name);
+		return;
+	}
+	qsort(v, n, sizeof(*v), cmp_i64);
+	printf("%-22s %8d %8lld %8lld %8lld %8lld %8lld %8lld\n", name, n,
+	       (long long)v[0], (long long)pct(v, n, 50),
+	       (long long)pct(v, n, 90), (long long)pct(v, n, 99),
+	       (long long)pct(v, n, 99.9), (long long)v[n - 1]);
+}
+
+static void header(void)
+{
+	printf("%-22s %8s %8s %8s %8s %8s %8s %8s\n", "[ns]", "n", "min",
+	       "p50", "p90", "p99", "p99.9", "max");
+}
+
+static int open_node(void)
+{
+	int fd = open(node, O_RDWR);
+
+	if (fd < 0)
+		fprintf(stderr, "open %s: %s\n", node, strerror(errno));
+	return fd;
+}
+
+static int bench_open(int64_t *v)
+{
+	int64_t *w = v + iterations;
+	int64_t t0;
+	int i, fd;
+
+	for (i = 0; i < iterations; i++) {
+		t0 = now_ns();
+		fd = open(node, O_RDWR);
+		v[i] = now_ns() - t0;
+		if (fd < 0) {
+			fprintf(stderr, "open %s: %s\n", node, strerror(errno));
+			return -1;
+		}
+		t0 = now_ns();
+		close(fd);
+		w[i] = now_ns() - t0;
+	}
+	report("open", v, iterations);
+	report("close", w, iterations);
+	return 0;
+}
+
+static int bench_ioctl(int64_t *v, int fd, unsigned long cmd, void *arg,
+		       const char *name)
+{
+	int64_t t0;
+	int i;
+
+	for (i = 0; i < iterations; i++) {
+		t0 = now_ns();
+		if (ioctl(fd, cmd, arg) < 0) {
+			fprintf(stderr, "%s: %s\n", name, strerror(errno));
+			return -1;
+		}
+		v[i] = now_ns() - t0;
+	}
+	report(name, v, iterations);
+	return 0;
+}
+
+/*
+ * Event delivery
+ *
+ * The reader runs on its own client; the writer SIMULATEs interrupts on
+ * another one. The writer takes a credit before each write() and the
+ * reader gives one back after each read(), which bounds the number of
+ * queued events without spinning (the writer may share the reader's CPU).
+ */
+struct events {
+	int		fd;
+	int		n;
+	int64_t		*lat;
+	volatile int64_t t0;
+	sem_t		credits;
+	int		received;
+	int		error;
+};
+
+static void *reader(void *arg)
+{
+	struct events *ev = arg;
+	SkelDrvrReadBuf rb;
+	int ret;
+
+	while (ev->received < ev->n) {
+		ret = read(ev->fd, &rb, sizeof(rb));
+		if (ret <= 0) {
+			__atomic_store_n(&ev->error, ret ? errno : ETIMEDOUT,
+					 __ATOMIC_RELEASE);
+			sem_post(&ev->credits);
+			break;
+		}
+		if (ev->lat)
+			ev->lat[ev->received] = now_ns() - ev->t0;
+		ev->received++;
+		sem_post(&ev->credits);
+	}
+	return NULL;
+}
+
+/* @window: how many events may be queued besides the one being read */
+static int run_events(struct events *ev, int window, int64_t *elapsed)
+{
+	SkelDrvrConnection conx;
+	pthread_t thread;
+	uint32_t tmo = 100; /* 1s */
+	int64_t t0;
+	int i, wfd, err = 0;
+
+	ev->fd = open_node();
+	if (ev->fd < 0)
+		return -1;
+	wfd = open_node();
+	if (wfd < 0) {
+		close(ev->fd);
+		return -1;
+	}
+
+	conx.Module = module;
+	conx.ConMask = 1;
+	if (ioctl(ev->fd, SkelDrvrIoctlSET_TIMEOUT, &tmo) < 0 ||
+	    ioctl(ev->fd, SkelDrvrIoctlCONNECT, &conx) < 0) {
+		fprintf(stderr, "connect: %s\n", strerror(errno));
+		err = -1;
+		goto out;
+	}
+
+	ev->received = ev->error = 0;
+	sem_init(&ev->credits, 0, window + 1);
+	if (pthread_create(&thread, NULL, reader, ev)) {
+		err = -1;
+		goto out;
+	}
+
+	t0 = now_ns();
+	for (i = 0; i < ev->n; i++) {
+		sem_wait(&ev->credits);
+		if (__atomic_load_n(&ev->error, __ATOMIC_ACQUIRE))
+			break;
+		ev->t0 = now_ns();
+		if (write(wfd, &conx, sizeof(conx)) < 0) {
+			fprintf(stderr, "write: %s\n", strerror(errno));
+			break;
+		}
+	}
+	pthread_join(thread, NULL);
+	*elapsed = now_ns() - t0;
+	sem_destroy(&ev->credits);
+
+	if (ev->error) {
+		fprintf(stderr, "events: %d/%d delivered: %s\n", ev->received,
+			ev->n, strerror(ev->error));
+		err = -1;
+	}
+ out:
+	close(wfd);
+	close(ev->fd);
+	return err;
+}
+
+static int bench_event(int64_t *v)
+{
+	struct events ev = { .n = iterations, .lat = v };
+	int64_t elapsed;
+
+	if (run_events(&ev, 0, &elapsed))
+		return -1;
+	report("write->read", v, iterations);
+	return 0;
+}
+
+static int bench_rate(void)
+{
+	struct events ev = { .n = iterations * 10 };
+	int64_t elapsed;
+	int window = SkelDrvrQUEUE_SIZE / 2;
+
+	if (run_events(&ev, window, &elapsed))
+		return -1;
+	printf("event rate: %d events in %lld us: %.0f events/s "
+	       "(at most %d queued)\n", ev.n, (long long)elapsed / 1000,
+	       ev.n * 1e9 / elapsed, window);
+	return 0;
+}
+
+static int bench_raw(int64_t *v, int fd)
+{
+	SkelDrvrRawIoTransferBlock iob;
+	char *buf;
+	int64_t t0;
+	int size, i, n;
+
+	buf = malloc(max_size);
+	if (buf == NULL)
+		return -1;
+
+	printf("%-22s %8s %8s %8s %10s\n", "RAW_BLOCK_READ [bytes]", "n",
+	       "p50[ns]", "p99[ns]", "MB/s(p50)");
+	for (size = 4; size <= max_size; size *= 4) {
+		memset(&iob, 0, sizeof(iob));
+		iob.SpaceNumber = space;
+		iob.DataWidth = 32;
+		iob.AddrIncr = 1;
+		iob.BytesTr = size;
+		iob.Data = buf;
+
+		/* about the same amount of data for each size */
+		n = iterations / (1 + size / 1024);
+		if (n < 10)
+			n = 10;
+		for (i = 0; i < n; i++) {
+			t0 = now_ns();
+			if (ioctl(fd, SkelDrvrIoctlRAW_BLOCK_READ, &iob) < 0) {
+				fprintf(stderr, "RAW_BLOCK_READ %d: %s\n",
+					size, strerror(errno));
+				free(buf);
+				return -1;
+			}
+			v[i] = now_ns() - t0;
+		}
+		qsort(v, n, sizeof(*v), cmp_i64);
+		printf("%-22d %8d %8lld %8lld %10.1f\n", size, n,
+		       (long long)pct(v, n, 50), (long long)pct(v, n, 99),
+		       size * 1e3 / pct(v, n, 50));
+	}
+	free(buf);
+	return 0;
+}
+
+static int selected(const char *name)
+{
+	const char *p = tests;
+	int len = strlen(name);
+
+	while ((p = strstr(p, name)) != NULL) {
+		if ((p == tests || p[-1] == ',') &&
+		    (p[len] == ',' || p[len] == '\0'))
+			return 1;
+		p += len;
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -d <node>    device node (%s)\n"
+		"  -n <n>       iterations (%d)\n"
+		"  -m <lun>     module (%d)\n"
+		"  -s <space>   address space for RAW_BLOCK_READ (0x%x)\n"
+		"  -S <bytes>   largest RAW_BLOCK_READ (0x%x)\n"
+		"  -t <tests>   comma-separated subset of %s\n"
+#ifdef SKELSIM_REDIRECT
+		"  -x <xml>     installation file (../xml/config.xml)\n"
+#endif
+		, prog, node, iterations, module, space, max_size, tests);
+}
+
+int main(int argc, char *argv[])
+{
+	SkelDrvrStatus status;
+	uint32_t tmo, lun;
+	int64_t *v;
+	int c, fd, err = 0;
+#ifdef SKELSIM_REDIRECT
+	char *xml = "../xml/config.xml";
+#endif
+
+	while ((c = getopt(argc, argv, "d:n:m:s:S:t:x:h")) != -1) {
+		switch (c) {
+		case 'd':
+			node = optarg;
+			break;
+		case 'n':
+			iterations = strtol(optarg, NULL, 0);
+			break;
+		case 'm':
+			module = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			space = strtol(optarg, NULL, 0);
+			break;
+		case 'S':
+			max_size = strtol(optarg, NULL, 0);
+			break;
+		case 't':
+			tests = optarg;
+			break;
+#ifdef SKELSIM_REDIRECT
+		case 'x':
+			xml = optarg;
+			break;
+#endif
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (iterations <= 0)
+		iterations = 1;
+
+#ifdef SKELSIM_REDIRECT
+	if (skelsim_install(xml, "null")) {
+		fprintf(stderr, "install %s: %s\n", xml, strerror(errno));
+		return 1;
+	}
+#endif
+
+	/* two samples per iteration for open/close, 10 at least for raw */
+	v = malloc((2 * iterations + 10) * sizeof(*v));
+	if (v == NULL)
+		return 1;
+
+	header();
+	if (selected("open"))
+		err |= bench_open(v);
+
+	fd = open_node();
+	if (fd < 0)
+		return 1;
+	lun = module;
+	if (ioctl(fd, SkelDrvrIoctlSET_MODULE, &lun) < 0) {
+		fprintf(stderr, "SET_MODULE %d: %s\n", module, strerror(errno));
+		return 1;
+	}
+
+	if (selected("ioctl"))
+		err |= bench_ioctl(v, fd, SkelDrvrIoctlGET_TIMEOUT, &tmo,
+				   "ioctl(GET_TIMEOUT)");
+	if (selected("status"))
+		err |= bench_ioctl(v, fd, SkelDrvrIoctlGET_STATUS, &status,
+				   "ioctl(GET_STATUS)");
+	if (selected("event"))
+		err |= bench_event(v);
+	if (selected("rate"))
+		err |= bench_rate();
+	if (selected("raw"))
+		err |= bench_raw(v, fd);
+
+	close(fd);
+	free(v);
+#ifdef SKELSIM_REDIRECT
+	skelsim_uninstall();
+#endif
+	return err ? 1 : 0;
+}
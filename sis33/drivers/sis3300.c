@@ -35,6 +35,7 @@
  * @req_events:	number of requested events
  * @completion:	signals when an acquisition has finished
  * @sampcache:	cache to store the interleaved data coming from each ADC group
+ * @ctlwin:	control window; NULL when the registers are accessed with DMA
  *
  * NOTE: when printing to the kernel log, we use card->dev (the device that
  * user-space sees) only when we're sure that is already there. Otherwise,
@@ -46,6 +47,7 @@ struct sis3300 {
 	int			req_events;
 	struct completion	completion;
 	u32			*sampcache[SIS3300_MAX_NR_SEGMENTS][SIS3300_NR_ADCGROUPS];
+	struct sis33_ctlwin	*ctlwin;
 };
 
 static long base[SIS33_MAX_DEVICES];
@@ -138,7 +140,7 @@ static inline unsigned int sis3300_readw(struct sis3300 *sis, ssize_t offset)
 {
 	unsigned int val;
 
-	val = sis33_dma_read(sis->pdev, sis->vme_base + offset);
+	val = sis33_ctl_read(sis->pdev, sis->ctlwin, sis->vme_base + offset);
 	dev_dbg(sis->pdev, "readw:\t0x%8x\tval: 0x%8x\n", (unsigned int)offset, val);
 
 	return val;
@@ -147,7 +149,7 @@ static inline unsigned int sis3300_readw(struct sis3300 *sis, ssize_t offset)
 static inline void sis3300_writew(struct sis3300 *sis, ssize_t offset, u32 val)
 {
 	dev_dbg(sis->pdev, "writew:\t\t0x%8x\tval: 0x%8x\n", (unsigned int)offset, (unsigned int)val);
-	sis33_dma_write(sis->pdev, sis->vme_base + offset, val);
+	sis33_ctl_write(sis->pdev, sis->ctlwin, sis->vme_base + offset, val);
 }
 
 static inline unsigned int sis3300_rev(const struct sis33_card *card)
@@ -315,11 +317,12 @@ static void sis3300_u32_swap(u32 *buf, int n)
 		buf[i] = be32_to_cpu(buf[i]);
 }
 
+/* @to_user is 0 when acq->data is a kernel address */
 static int
-sis3300_read_event(struct sis33_acq *acq, int channel, u32 *raw_data, u64 prevticks, struct sis33_event *event)
+sis3300_read_event(struct sis33_acq *acq, int channel, u32 *raw_data, u64 prevticks, struct sis33_event *event, int to_user)
 {
+	u16 *kdata = (u16 __force *)acq->data;
 	u16 data;
-	int ret;
 	int i;
 
 	acq->nr_samples = event->nr_samples;
@@ -333,9 +336,10 @@ sis3300_read_event(struct sis33_acq *acq, int channel, u32 *raw_data, u64 prevti
 			data = (raw_data[i] & ADC1_DATA_MASK) >> ADC1_DATA_SHIFT;
 		else
 			data = (raw_data[i] & ADC0_DATA_MASK) >> ADC0_DATA_SHIFT;
-		ret = put_user(data, &acq->data[i]);
-		if (ret)
-			return ret;
+		if (!to_user)
+			kdata[i] = data;
+		else if (put_user(data, &acq->data[i]))
+			return -EFAULT;
 	}
 	return 0;
 }
@@ -530,36 +534,68 @@ static u32 *sis3300_pt_cache_get(struct sis33_card *card, int segment_nr)
 	return ERR_PTR(err);
 }
 
+/*
+ * Read the bounce buffers of all the ADC groups involved first, so that the
+ * DMAs go back to back; both channels of a group are then copied out of the
+ * same buffer.
+ */
 static int
-sis3300_fetch(struct sis33_card *card, int segment_nr, int channel_nr, struct sis33_acq *acqs, int nr_events)
+__sis3300_fetch_channels(struct sis33_card *card, int segment_nr, u32 channel_mask,
+			 struct sis33_acq *acqs, int n_acqs, int nr_events, int to_user)
 {
 	struct sis33_segment *segment = &card->segments[segment_nr];
+	u32 *bouncebufs[SIS3300_NR_ADCGROUPS];
 	struct sis33_event *events;
-	u32 *bouncebuf;
 	u32 *pt_cache;
+	int channel;
 	int ret;
 	int i;
 
 	events = sis3300_evcache_get(card, segment_nr);
 	if (IS_ERR(events))
 		return PTR_ERR(events);
-	bouncebuf = sis3300_sampcache_get(card, segment_nr, channel_nr);
-	if (IS_ERR(bouncebuf))
-		return PTR_ERR(bouncebuf);
+	for (i = 0; i < SIS3300_NR_ADCGROUPS; i++) {
+		if (!(channel_mask & (3 << (2 * i))))
+			continue;
+		bouncebufs[i] = sis3300_sampcache_get(card, segment_nr, 2 * i);
+		if (IS_ERR(bouncebufs[i]))
+			return PTR_ERR(bouncebufs[i]);
+	}
 	pt_cache = sis3300_pt_cache_get(card, segment_nr);
 	if (IS_ERR(pt_cache))
 		return PTR_ERR(pt_cache);
 
-	for (i = 0; i < nr_events; i++) {
-		u32 *raw_event = &bouncebuf[i * segment->nr_samp_per_ev];
+	for (channel = 0; channel < SIS3300_NR_CHANNELS; channel++) {
+		if (!(channel_mask & (1 << channel)))
+			continue;
+		for (i = 0; i < nr_events; i++) {
+			u32 *raw_event = &bouncebufs[channel / 2][i * segment->nr_samp_per_ev];
 
-		ret = sis3300_read_event(&acqs[i], channel_nr, raw_event, pt_cache[i], &events[i]);
-		if (ret)
-			goto out;
+			ret = sis3300_read_event(&acqs[i], channel, raw_event, pt_cache[i], &events[i], to_user);
+			if (ret)
+				return ret;
+		}
+		acqs += n_acqs;
 	}
-	ret = i;
- out:
-	return ret;
+	return nr_events;
+}
+
+static int
+sis3300_fetch_channels(struct sis33_card *card, int segment_nr, u32 channel_mask, struct sis33_acq *acqs, int n_acqs, int nr_events)
+{
+	return __sis3300_fetch_channels(card, segment_nr, channel_mask, acqs, n_acqs, nr_events, 1);
+}
+
+static int
+sis3300_fetch_kernel(struct sis33_card *card, int segment_nr, u32 channel_mask, struct sis33_acq *acqs, int n_acqs, int nr_events)
+{
+	return __sis3300_fetch_channels(card, segment_nr, channel_mask, acqs, n_acqs, nr_events, 0);
+}
+
+static int
+sis3300_fetch(struct sis33_card *card, int segment_nr, int channel_nr, struct sis33_acq *acqs, int nr_events)
+{
+	return sis3300_fetch_channels(card, segment_nr, 1 << channel_nr, acqs, nr_events, nr_events);
 }
 
 static int sis3300_trigger(struct sis33_card *card, u32 trigger)
@@ -694,6 +730,8 @@ static struct sis33_card_ops sis3300_ops = {
 	.conf_acq		= sis3300_conf_acq,
 	.conf_ev		= sis3300_conf_ev,
 	.fetch			= sis3300_fetch,
+	.fetch_channels		= sis3300_fetch_channels,
+	.fetch_kernel		= sis3300_fetch_kernel,
 	.trigger		= sis3300_trigger,
 	.acq_start		= sis3300_acq_start,
 	.acq_wait		= sis3300_acq_wait,
@@ -797,6 +835,10 @@ static void sis3300_irq_work(struct work_struct *work)
 {
 	struct sis33_card *card = container_of(work, struct sis33_card, irq_work);
 	struct sis3300 *priv = card->private_data;
+	struct sis33_segment *segment;
+	int segment_nr;
+	int acquiring;
+	int done;
 	u32 status;
 
 	/*
@@ -804,6 +846,9 @@ static void sis3300_irq_work(struct work_struct *work)
 	 * throughout the handling of the interrupt
 	 */
 	mutex_lock(&card->lock);
+	segment_nr = card->curr_segment;
+	segment = &card->segments[segment_nr];
+	acquiring = atomic_read(&segment->acquiring);
 	/*
 	 * Overlapping interrupts aren't queued because we're clearing them in
 	 * ROAK mode--the interrupt source is disabled when acknowledged by
@@ -813,7 +858,11 @@ static void sis3300_irq_work(struct work_struct *work)
 	 */
 	while ((status = sis3300_readw(priv, SIS3300_INTCTL) & INTCTL_ST_MASK))
 		sis3300_do_irq(card, status);
+	/* the segment has just finished if it was acquiring */
+	done = acquiring && !atomic_read(&segment->acquiring);
 	mutex_unlock(&card->lock);
+	if (done)
+		sis33_cont_segment_done(card, segment_nr);
 }
 
 static int __devinit
@@ -854,6 +903,7 @@ static int __devinit sis3300_device_init(struct sis33_card *card, int ndev)
 	int err;
 
 	priv->vme_base = base[ndev];
+	priv->ctlwin = sis33_ctlwin_get(card->pdev, priv->vme_base);
 	reg = sis3300_readw(priv, SIS3300_FW);
 	card->id = (reg & FW_MODID) >> FW_MODID_SHIFT;
 	card->major_rev = (reg & FW_MAJOR) >> FW_MAJOR_SHIFT;
@@ -863,15 +913,20 @@ static int __devinit sis3300_device_init(struct sis33_card *card, int ndev)
 		dev_err(card->pdev, "device not present at base address 0x%08lx. "
 			"version read back 0x%04x expected 0x3300\n",
 			priv->vme_base, card->id);
-		return -ENODEV;
+		err = -ENODEV;
+		goto out_err;
 	}
 	sis3300_reset(priv);
 
 	init_completion(&priv->completion);
 	err = sis3300_request_irq(card, vector[ndev], level[ndev]);
 	if (err)
-		return err;
+		goto out_err;
 	return 0;
+
+ out_err:
+	sis33_ctlwin_put(priv->ctlwin);
+	return err;
 }
 
 static void sis3300_free_irq(struct sis33_card *card, int vector, int level)
@@ -892,8 +947,11 @@ static void sis3300_free_irq(struct sis33_card *card, int vector, int level)
 
 static void sis3300_device_exit(struct sis33_card *card, int ndev)
 {
+	struct sis3300 *priv = card->private_data;
+
 	sis3300_free_irq(card, vector[ndev], level[ndev]);
 	flush_workqueue(sis33_workqueue);
+	sis33_ctlwin_put(priv->ctlwin);
 }
 
 static int __devinit sis3300_probe(struct device *pdev, unsigned int ndev)
@@ -42,6 +42,7 @@
  * @completion:	completion to signal when an acquisition has finished
  * @pdev:	parent (physical) device
  * @curr_page:	caches the current ADC memory page.
+ * @ctlwin:	control window; NULL when the registers are accessed with DMA
  *
  * NOTE: when printing to the kernel log, we use card->dev (the device that
  * user-space sees) only when we're sure that is already there. Otherwise,
@@ -53,6 +54,7 @@ struct sis3320 {
 	struct completion	completion;
 	struct device		*pdev;
 	unsigned int		curr_page;
+	struct sis33_ctlwin	*ctlwin;
 };
 
 static long base[SIS33_MAX_DEVICES];
@@ -158,7 +160,7 @@ static inline unsigned int sis3320_readw(struct sis3320 *sis, ssize_t offset)
 {
 	unsigned int val;
 
-	val = sis33_dma_read(sis->pdev, sis->vme_base + offset);
+	val = sis33_ctl_read(sis->pdev, sis->ctlwin, sis->vme_base + offset);
 	dev_dbg(sis->pdev, "readw:\t0x%8x\tval: 0x%8x\n", (unsigned int)offset, val);
 
 	return val;
@@ -167,7 +169,13 @@ static inline unsigned int sis3320_readw(struct sis3320 *sis, ssize_t offset)
 static inline void sis3320_writew(struct sis3320 *sis, ssize_t offset, u32 val)
 {
 	dev_dbg(sis->pdev, "writew:\t\t0x%8x\tval: 0x%8x\n", (unsigned int)offset, (unsigned int)val);
-	sis33_dma_write(sis->pdev, sis->vme_base + offset, val);
+	sis33_ctl_write(sis->pdev, sis->ctlwin, sis->vme_base + offset, val);
+}
+
+/* consecutive registers, with a single DMA when there's no control window */
+static inline int sis3320_write_regs(struct sis3320 *sis, ssize_t offset, const u32 *buf, int n)
+{
+	return sis33_ctl_write_regs(sis->pdev, sis->ctlwin, sis->vme_base + offset, buf, n);
 }
 
 /* Note: Event descriptors of the same channel are contiguous */
@@ -235,9 +243,8 @@ sis3320_read_events_dir(struct sis33_card *card, int segment_nr, int channel,
 	return 0;
 }
 
-static void sis3320_read_segment(struct sis33_card *card, int segment_nr)
+static void sis3320_read_segment(struct sis33_card *card, int segment_nr, u32 ev_counter)
 {
-	struct sis3320 *priv = card->private_data;
 	struct sis33_segment *segment = &card->segments[segment_nr];
 	u32 *raw_events;
 	int i;
@@ -248,8 +255,7 @@ static void sis3320_read_segment(struct sis33_card *card, int segment_nr)
 		segment->nr_events = 0;
 	}
 
-	segment->nr_events = sis3320_readw(priv, SIS3320_EV_COUNTER);
-	segment->nr_events &= EV_COUNTER_MASK;
+	segment->nr_events = ev_counter & EV_COUNTER_MASK;
 	if (!segment->nr_events)
 		return;
 
@@ -395,6 +401,7 @@ static void sis3320_irq_work(struct work_struct *work)
 	struct sis3320 *priv = card->private_data;
 	struct sis33_segment *segment;
 	unsigned int status;
+	int segment_nr;
 
 	status = sis3320_readw(priv, SIS3320_INTCTL);
 
@@ -404,13 +411,15 @@ static void sis3320_irq_work(struct work_struct *work)
 	 */
 	if (status & INTCTL_ST_LEV) {
 		sis3320_writew(priv, SIS3320_INTCTL, INTCTL_DICL_LEV);
-		segment = &card->segments[card->curr_segment];
+		segment_nr = card->curr_segment;
+		segment = &card->segments[segment_nr];
 		/* BUG_ON(!atomic_read(&segment->acquiring)); */
 		do_gettimeofday(&segment->endtime);
-		sis3320_read_segment(card, card->curr_segment);
-		sis3320_read_prevticks(card, card->curr_segment);
+		sis3320_read_segment(card, segment_nr, sis3320_readw(priv, SIS3320_EV_COUNTER));
+		sis3320_read_prevticks(card, segment_nr);
 		sis3320_acq_complete(card);
 		sis3320_writew(priv, SIS3320_INTCTL, INTCTL_EN_LEV);
+		sis33_cont_segment_done(card, segment_nr);
 	}
 }
 
@@ -425,12 +434,13 @@ static int sis3320_irq(void *arg)
 static void __devinit
 sis3320_spi_sleep(const struct sis33_card *card, unsigned long vme_spi)
 {
+	struct sis3320 *priv = card->private_data;
 	u32 val;
 	int i;
 
 	for (i = 0; i < 3; i++) {
 		udelay(5);
-		val = sis33_dma_read(card->pdev, vme_spi);
+		val = sis33_ctl_read(card->pdev, priv->ctlwin, vme_spi);
 		if (!(val & SPI_REG_BUSY))
 			return;
 	}
@@ -453,13 +463,13 @@ sis3320_spi_write(const struct sis33_card *card, int group, int adc, int addr, i
 	reg |= data << SPI_REG_DATA_SHIFT;
 
 	reg &= ~SPI_REG_RD;
-	sis33_dma_write(card->pdev, vme_spi, reg);
+	sis33_ctl_write(card->pdev, priv->ctlwin, vme_spi, reg);
 	sis3320_spi_sleep(card, vme_spi);
 
 	reg = second_adc ? SPI_REG_SEL : 0;
 	reg |= AD9230_DEVICE_UPDATE << SPI_REG_ADDR_SHIFT;
 	reg |= 1 << SPI_REG_DATA_SHIFT;
-	sis33_dma_write(card->pdev, vme_spi, reg);
+	sis33_ctl_write(card->pdev, priv->ctlwin, vme_spi, reg);
 	sis3320_spi_sleep(card, vme_spi);
 }
 
@@ -542,6 +552,7 @@ static int __devinit sis3320_device_init(struct sis33_card *card, int ndev)
 	int err;
 
 	priv->vme_base = base[ndev];
+	priv->ctlwin = sis33_ctlwin_get(card->pdev, priv->vme_base);
 
 	/* identify the module version */
 	reg = sis3320_readw(priv, SIS3320_FW);
@@ -560,7 +571,8 @@ static int __devinit sis3320_device_init(struct sis33_card *card, int ndev)
 		dev_err(card->pdev, "device not present at base address 0x%08lx. "
 			"version read back 0x%04x expected 0x33{02,20}\n",
 			priv->vme_base, card->id);
-		return -ENODEV;
+		err = -ENODEV;
+		goto out_err;
 	}
 
 	sis3320_reset(priv);
@@ -583,14 +595,21 @@ static int __devinit sis3320_device_init(struct sis33_card *card, int ndev)
 
 	err = sis3320_request_irq(card, vector[ndev], level[ndev]);
 	if (err)
-		return err;
+		goto out_err;
 	return 0;
+
+ out_err:
+	sis33_ctlwin_put(priv->ctlwin);
+	return err;
 }
 
 static inline void sis3320_device_exit(struct sis33_card *card, int ndev)
 {
+	struct sis3320 *priv = card->private_data;
+
 	sis3320_free_irq(card, vector[ndev], level[ndev]);
 	flush_workqueue(sis33_workqueue);
+	sis33_ctlwin_put(priv->ctlwin);
 }
 
 static int __devinit sis3320_match(struct device *devp, unsigned int ndev)
@@ -684,6 +703,7 @@ static u32 sis3320_get_ev_length(struct sis33_card *card, u32 size)
 static int sis3320_conf_acq(struct sis33_card *card, struct sis33_cfg *cfg)
 {
 	struct sis3320 *priv = card->private_data;
+	u32 delays[2];
 	u32 val;
 
 	/* clear the clocksource bits before updating them */
@@ -708,10 +728,9 @@ static int sis3320_conf_acq(struct sis33_card *card, struct sis33_cfg *cfg)
 	/*
 	 * Start/Stop Delay
 	 */
-	sis3320_writew(priv, SIS3320_EXT_START_DELAY, cfg->start_delay);
-	sis3320_writew(priv, SIS3320_EXT_STOP_DELAY, cfg->stop_delay);
-
-	return 0;
+	delays[0] = cfg->start_delay;
+	delays[1] = cfg->stop_delay;
+	return sis3320_write_regs(priv, SIS3320_EXT_START_DELAY, delays, 2);
 }
 
 static void sis3320_dac_write(struct sis3320 *sis, u32 val)
@@ -836,29 +855,13 @@ static void sis3320_put_page(struct sis3320 *priv, unsigned int page_nr)
 	sis3320_writew(priv, SIS3320_ADC_MEM_PAGE, page_nr);
 }
 
-static unsigned int
-sis3320_get_offset(struct sis33_card *card, int segment_nr, int event_nr)
-{
-	struct sis33_segment *segment = &card->segments[segment_nr];
-	struct sis3320 *priv = card->private_data;
-	unsigned int event_size;
-	unsigned int membase;
-	unsigned int offset;
-
-	event_size = segment->nr_samp_per_ev * sizeof(u16);
-	membase = sis3320_get_segment_base(card, segment_nr) * sizeof(u16);
-	offset = membase + event_nr * event_size;
-	sis3320_put_page(priv, offset >> SIS3320_PAGESHIFT);
-	return offset & SIS3320_PAGEMASK;
-}
-
 /*
  * The length and start address of the event fetched by this function is assumed
  * to be a multiple of the ADC memory window size. This is one of the reasons
  * for not supporting segment sizes which aren't a power of two.
  */
 static int
-sis3320_get_data_bigpage(struct sis33_card *card, int segment_nr, struct sis33_acq *acq, int channel, int event_nr)
+sis3320_get_data_bigpage(struct sis33_card *card, int segment_nr, struct sis33_acq *acq, int channel, int event_nr, int to_user)
 {
 	struct sis33_segment *segment = &card->segments[segment_nr];
 	struct sis3320 *priv = card->private_data;
@@ -879,35 +882,73 @@ sis3320_get_data_bigpage(struct sis33_card *card, int segment_nr, struct sis33_a
 
 		sis3320_put_page(priv, page0 + i);
 		vme_addr = priv->vme_base + SIS3320_MEM_ADC(channel);
-		ret = sis33_dma_read_mblt_user(card->dev, vme_addr, addr, SIS3320_PAGESIZE);
+		if (to_user)
+			ret = sis33_dma_read_mblt_user(card->dev, vme_addr, addr, SIS3320_PAGESIZE);
+		else
+			ret = sis33_dma_read_mblt(card->dev, vme_addr, (void __force *)addr, SIS3320_PAGESIZE);
 		if (ret)
 			return ret;
 	}
 	return 0;
 }
 
+/*
+ * Events that fit in the ADC memory window are contiguous, and never cross
+ * a window boundary. The events in the same window are read with a single
+ * DMA, scattered straight into their buffers. An event ends the DMA if its
+ * buffer is shorter than the event, since the next one wouldn't follow.
+ * Kernel buffers (@to_user is 0) are read with a plain DMA, so there the
+ * events of a DMA must also follow each other in memory.
+ */
 static int
-sis3320_get_data_smallpage(struct sis33_card *card, int segment_nr, struct sis33_acq *acq, int channel, int event_nr)
+sis3320_get_data_smallpages(struct sis33_card *card, int segment_nr, struct sis33_acq *acqs, int channel, int nr_events, int to_user)
 {
+	struct sis33_segment *segment = &card->segments[segment_nr];
 	struct sis3320 *priv = card->private_data;
-	unsigned int vme_addr;
+	unsigned int event_size;
+	unsigned int membase;
 	unsigned int offset;
+	unsigned int page;
+	unsigned int vme_addr;
+	struct iovec *iov;
+	size_t len;
+	int first, i;
+	int ret = 0;
 
-	offset = sis3320_get_offset(card, segment_nr, event_nr);
-	vme_addr = priv->vme_base + SIS3320_MEM_ADC(channel) + offset;
-	return sis33_dma_read_mblt_user(card->dev, vme_addr, acq->data, acq->size);
-}
+	iov = kmalloc(nr_events * sizeof(*iov), GFP_KERNEL);
+	if (iov == NULL)
+		return -ENOMEM;
 
-static int
-sis3320_get_data(struct sis33_card *card, int segment_nr, struct sis33_acq *acq, int channel, int event_nr)
-{
-	struct sis33_segment *segment = &card->segments[segment_nr];
+	event_size = segment->nr_samp_per_ev * sizeof(u16);
+	membase = sis3320_get_segment_base(card, segment_nr) * sizeof(u16);
+	for (first = 0; first < nr_events; first = i) {
+		offset = membase + first * event_size;
+		page = offset >> SIS3320_PAGESHIFT;
+
+		len = 0;
+		for (i = first; i < nr_events; i++) {
+			if (i > first && (acqs[i - 1].size != event_size ||
+				(membase + i * event_size) >> SIS3320_PAGESHIFT != page))
+				break;
+			if (i > first && !to_user &&
+				(u8 __force *)acqs[i].data != (u8 __force *)acqs[i - 1].data + event_size)
+				break;
+			iov[i - first].iov_base = acqs[i].data;
+			iov[i - first].iov_len = acqs[i].size;
+			len += acqs[i].size;
+		}
 
-	acq->be = 1;
-	if (segment->nr_samp_per_ev <= SIS3320_PAGESIZE_SAMPLES)
-		return sis3320_get_data_smallpage(card, segment_nr, acq, channel, event_nr);
-	else
-		return sis3320_get_data_bigpage(card, segment_nr, acq, channel, event_nr);
+		sis3320_put_page(priv, page);
+		vme_addr = priv->vme_base + SIS3320_MEM_ADC(channel) + (offset & SIS3320_PAGEMASK);
+		if (to_user)
+			ret = sis33_dma_read_mblt_iov(card->dev, vme_addr, iov, i - first);
+		else
+			ret = sis33_dma_read_mblt(card->dev, vme_addr, (void __force *)acqs[first].data, len);
+		if (ret)
+			break;
+	}
+	kfree(iov);
+	return ret;
 }
 
 static int
@@ -932,12 +973,14 @@ sis3320_read_event(struct sis33_card *card, int segment_nr, struct sis33_acq *ac
 	event = sis3320_get_event(segment, channel, event_nr);
 	acq->nr_samples = event->nr_samples;
 	acq->first_samp = event->first_samp;
-	return sis3320_get_data(card, segment_nr, acq, channel, event_nr);
+	acq->be = 1;
+	return 0;
 }
 
 static int
-sis3320_fetch(struct sis33_card *card, int segment_nr, int channel_nr, struct sis33_acq *acqs, int nr_events)
+__sis3320_fetch(struct sis33_card *card, int segment_nr, int channel_nr, struct sis33_acq *acqs, int nr_events, int to_user)
 {
+	struct sis33_segment *segment = &card->segments[segment_nr];
 	int ret;
 	int i;
 
@@ -946,9 +989,43 @@ sis3320_fetch(struct sis33_card *card, int segment_nr, int channel_nr, struct si
 		if (ret)
 			return ret;
 	}
+
+	if (segment->nr_samp_per_ev <= SIS3320_PAGESIZE_SAMPLES) {
+		ret = sis3320_get_data_smallpages(card, segment_nr, acqs, channel_nr, nr_events, to_user);
+		return ret ? ret : nr_events;
+	}
+
+	for (i = 0; i < nr_events; i++) {
+		ret = sis3320_get_data_bigpage(card, segment_nr, &acqs[i], channel_nr, i, to_user);
+		if (ret)
+			return ret;
+	}
 	return i;
 }
 
+static int
+sis3320_fetch(struct sis33_card *card, int segment_nr, int channel_nr, struct sis33_acq *acqs, int nr_events)
+{
+	return __sis3320_fetch(card, segment_nr, channel_nr, acqs, nr_events, 1);
+}
+
+static int
+sis3320_fetch_kernel(struct sis33_card *card, int segment_nr, u32 channel_mask, struct sis33_acq *acqs, int n_acqs, int nr_events)
+{
+	int ret;
+	int i;
+
+	for (i = 0; i < card->n_channels; i++) {
+		if (!(channel_mask & (1 << i)))
+			continue;
+		ret = __sis3320_fetch(card, segment_nr, i, acqs, nr_events, 0);
+		if (ret < 0)
+			return ret;
+		acqs += n_acqs;
+	}
+	return nr_events;
+}
+
 static int sis3320_trigger(struct sis33_card *card, u32 trigger)
 {
 	struct sis3320 *priv = card->private_data;
@@ -972,6 +1049,7 @@ static int sis3320_conf_ev(struct sis33_card *card, struct sis33_acq_desc *desc)
 {
 	struct sis3320 *priv = card->private_data;
 	struct sis33_cfg *cfg = &card->cfg;
+	u32 gall[SAMP_STADDR / 4 + 1];
 	u32 val;
 
 	/* single or multi-event mode */
@@ -992,7 +1070,8 @@ static int sis3320_conf_ev(struct sis33_card *card, struct sis33_acq_desc *desc)
 	sis3320_writew(priv, SIS3320_NR_EVENTS, desc->nr_events);
 
 	/*
-	 * Event Configuration
+	 * Event Configuration, Sample Length and Start Address are consecutive,
+	 * and are written together.
 	 * Note: this applies to all channels
 	 */
 	val = card->cfg.stop_auto ? EV_EN_SAMPLEN_STOP : 0;
@@ -1001,7 +1080,10 @@ static int sis3320_conf_ev(struct sis33_card *card, struct sis33_acq_desc *desc)
 		val |= EV_EN_WRAP_MODE;
 		val |= sis3320_get_ev_length(card, desc->ev_length);
 	}
-	sis3320_writew(priv, SIS3320_GALL(EV_CONF), val);
+	gall[EV_CONF / 4] = val;
+
+	/* set initial sampling address, in samples */
+	gall[SAMP_STADDR / 4] = sis3320_get_segment_base(card, desc->segment);
 
 	/* Sample Length */
 	if (card->cfg.stop_auto) {
@@ -1010,12 +1092,12 @@ static int sis3320_conf_ev(struct sis33_card *card, struct sis33_acq_desc *desc)
 		 * two bits unused.  From the manual:
 		 * "Desired sample length 0x100 -> set the register to 0xfc."
 		 */
-		val = (desc->ev_length - 4) & 0x01fffffc;
-		sis3320_writew(priv, SIS3320_GALL(SAMP_LEN), val);
+		gall[SAMP_LEN / 4] = (desc->ev_length - 4) & 0x01fffffc;
+		return sis3320_write_regs(priv, SIS3320_GALL(EV_CONF), gall, ARRAY_SIZE(gall));
 	}
-
-	/* set initial sampling address, in samples */
-	sis3320_writew(priv, SIS3320_GALL(SAMP_STADDR), sis3320_get_segment_base(card, desc->segment));
+	/* leave the Sample Length untouched */
+	sis3320_writew(priv, SIS3320_GALL(EV_CONF), gall[EV_CONF / 4]);
+	sis3320_writew(priv, SIS3320_GALL(SAMP_STADDR), gall[SAMP_STADDR / 4]);
 
 	return 0;
 }
@@ -1097,6 +1179,7 @@ static struct sis33_card_ops sis3320_ops = {
 	.conf_ev		= sis3320_conf_ev,
 	.conf_channels		= sis3320_conf_channels,
 	.fetch			= sis3320_fetch,
+	.fetch_kernel		= sis3320_fetch_kernel,
 	.trigger		= sis3320_trigger,
 	.acq_start		= sis3320_acq_start,
 	.acq_wait		= sis3320_acq_wait,
@@ -6,6 +6,7 @@
  * Released under the GPL v2. (and only v2, not any later version)
  */
 #include <linux/compat.h>
+#include <linux/bitops.h>
 #include <linux/fs.h>
 
 #include <asm/uaccess.h>
@@ -44,13 +45,30 @@ struct sis33_compat_acq_list {
 	u32			unused[4];
 };
 
+struct sis33_compat_acq_mlist {
+	u32			segment;
+	u32			channel_mask;
+	compat_uptr_t		acqs;
+	u32			n_acqs;
+	u32			flags;
+	struct compat_timespec	timeout;
+	struct compat_timeval	endtime;
+	u32			unused[4];
+};
+
 struct sis33_combined_acq_list {
 	struct sis33_acq_list	list;
 	struct sis33_acq	acqs[1];
 };
 
+struct sis33_combined_acq_mlist {
+	struct sis33_acq_mlist	list;
+	struct sis33_acq	acqs[1];
+};
+
 #define SIS33_IOC32_FETCH	_IOW ('3', 0, struct sis33_compat_acq_list)
 #define SIS33_IOC32_ACQUIRE	_IOW ('3', 1, struct sis33_compat_acq_desc)
+#define SIS33_IOC32_FETCH_CHANNELS _IOWR('3', 2, struct sis33_compat_acq_mlist)
 
 static int sis33_translated_ioctl(struct file *file, unsigned int cm, unsigned long arg)
 {
@@ -265,6 +283,118 @@ static int sis33_compat_fetch_ioctl(struct file *file, unsigned long arg)
 	return sis33_put_compat_acq_list(compat_list, &combined->list);
 }
 
+static int sis33_get_compat_acq_mlist(struct sis33_acq_mlist __user *list,
+				struct sis33_compat_acq_mlist __user *compat_list,
+				struct sis33_acq __user *acqs, u32 n)
+{
+	struct sis33_compat_acq __user *compat_acqs;
+	struct timeval ktime;
+	struct timespec ts;
+	compat_uptr_t uptr;
+	u32 uint;
+	int err;
+	int i;
+
+	if (!access_ok(VERIFY_READ, compat_list, sizeof(*compat_list)) ||
+	    !access_ok(VERIFY_WRITE, list, sizeof(*list)))
+		return -EFAULT;
+	err = 0;
+	err |= __get_user(uint, &compat_list->n_acqs);
+	err |= __put_user(uint, &list->n_acqs);
+	err |= __get_user(uint, &compat_list->segment);
+	err |= __put_user(uint, &list->segment);
+	err |= __get_user(uint, &compat_list->channel_mask);
+	err |= __put_user(uint, &list->channel_mask);
+	err |= __get_user(uint, &compat_list->flags);
+	err |= __put_user(uint, &list->flags);
+	err |= __put_user(acqs, &list->acqs);
+	err |= get_compat_timespec(&ts, &compat_list->timeout);
+	err |= copy_to_user(&list->timeout, &ts, sizeof(ts));
+	err |= __get_user(ktime.tv_sec, &compat_list->endtime.tv_sec);
+	err |= __put_user(ktime.tv_sec, &list->endtime.tv_sec);
+	err |= __get_user(ktime.tv_usec, &compat_list->endtime.tv_usec);
+	err |= __put_user(ktime.tv_usec, &list->endtime.tv_usec);
+	err |= __get_user(uptr, &compat_list->acqs);
+	compat_acqs = compat_ptr(uptr);
+	if (err)
+		return -EFAULT;
+
+	for (i = 0; i < n; i++) {
+		err = sis33_get_compat_acq(&acqs[i], &compat_acqs[i]);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static int sis33_put_compat_acq_mlist(struct sis33_compat_acq_mlist __user *compat_list,
+				struct sis33_acq_mlist __user *list, u32 n)
+{
+	struct sis33_compat_acq __user *compat_acqs;
+	struct sis33_acq __user *acqs;
+	struct timeval ktime;
+	compat_uptr_t uptr;
+	int err;
+	int i;
+
+	if (!access_ok(VERIFY_READ, list, sizeof(*list)) ||
+	    !access_ok(VERIFY_WRITE, compat_list, sizeof(*compat_list)))
+		return -EFAULT;
+
+	/* only the end time and the acquisitions are updated by the fetch */
+	err = 0;
+	err |= __get_user(ktime.tv_sec, &list->endtime.tv_sec);
+	err |= __put_user(ktime.tv_sec, &compat_list->endtime.tv_sec);
+	err |= __get_user(ktime.tv_usec, &list->endtime.tv_usec);
+	err |= __put_user(ktime.tv_usec, &compat_list->endtime.tv_usec);
+	err |= __get_user(acqs, &list->acqs);
+	err |= __get_user(uptr, &compat_list->acqs);
+	compat_acqs = compat_ptr(uptr);
+	if (err)
+		return -EFAULT;
+
+	for (i = 0; i < n; i++) {
+		err = sis33_put_compat_acq(&compat_acqs[i], &acqs[i]);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static int sis33_compat_fetch_channels_ioctl(struct file *file, unsigned long arg)
+{
+	struct sis33_combined_acq_mlist __user *combined;
+	struct sis33_compat_acq_mlist __user *compat_list;
+	u32 channel_mask;
+	u32 n_acqs;
+	u32 n;
+	int ret;
+	int err;
+
+	compat_list = compat_ptr(arg);
+	if (!access_ok(VERIFY_READ, compat_list, sizeof(*compat_list)))
+		return -EFAULT;
+	if (__get_user(n_acqs, &compat_list->n_acqs) ||
+	    __get_user(channel_mask, &compat_list->channel_mask))
+		return -EFAULT;
+	/* the fetch itself checks these; here we only need a sane size */
+	if (n_acqs == 0 || channel_mask == 0 ||
+	    n_acqs > INT_MAX / 32 / sizeof(struct sis33_acq))
+		return -EINVAL;
+	n = n_acqs * hweight32(channel_mask);
+	combined = compat_alloc_user_space(offsetof(struct sis33_combined_acq_mlist, acqs[n]));
+	err = sis33_get_compat_acq_mlist(&combined->list, compat_list, &combined->acqs[0], n);
+	if (err)
+		return err;
+
+	ret = sis33_translated_ioctl(file, SIS33_IOC_FETCH_CHANNELS, (unsigned long)&combined->list);
+	if (ret < 0)
+		return ret;
+
+	err = sis33_put_compat_acq_mlist(compat_list, &combined->list, n);
+	return err ? err : ret;
+}
+
 long sis33_compat_ioctl(struct file *file, unsigned int cm, unsigned long arg)
 {
 	switch (cm) {
@@ -272,6 +402,12 @@ long sis33_compat_ioctl(struct file *file, unsigned int cm, unsigned long arg)
 		return sis33_compat_acquire_ioctl(file, arg);
 	case SIS33_IOC32_FETCH:
 		return sis33_compat_fetch_ioctl(file, arg);
+	case SIS33_IOC32_FETCH_CHANNELS:
+		return sis33_compat_fetch_channels_ioctl(file, arg);
+	/* struct sis33_cont_desc has the same layout in both ABIs */
+	case SIS33_IOC_CONT_START:
+	case SIS33_IOC_CONT_STOP:
+		return sis33_translated_ioctl(file, cm, (unsigned long)compat_ptr(arg));
 	default:
 		return -ENOTTY;
 	}
@@ -0,0 +1,449 @@
+/*
+ * sis33_cont.c
+ * Continuous acquisition: ping-pong segments and a ring mapped to user-space
+ *
+ * With SIS33_IOC_ACQUIRE and SIS33_IOC_FETCH an application starts an
+ * acquisition, waits for it, fetches the data and only then starts the next
+ * one; the card sits idle while the host fetches. Here the segments are used
+ * in turn instead: when a segment finishes, the interrupt work arms the next
+ * one straight away, and then reads the finished one into a slot of a
+ * vmalloc'ed ring that user-space maps and polls.
+ *
+ * A segment is never re-armed before it has been read, since all the
+ * interrupt work goes through sis33_workqueue: the interrupt that re-arms it
+ * is handled after the copy. When the reader falls behind and the ring is
+ * full, finished segments are dropped and counted.
+ *
+ * Copyright (c) 2010 Emilio G. Cota <cota@braap.org>
+ * Released under the GPL v2. (and only v2, not any later version)
+ */
+#include <linux/moduleparam.h>
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/bitops.h>
+#include <linux/kref.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+
+#include <asm/uaccess.h>
+
+#include "sis33core.h"
+#include "sis33core_internal.h"
+
+static unsigned int cont_ring_max = 256;
+module_param(cont_ring_max, uint, 0644);
+MODULE_PARM_DESC(cont_ring_max, "Maximum size of a continuous acquisition ring, in MB");
+
+/**
+ * struct sis33_cont - continuous acquisition
+ * @kref:		the card holds a reference until the acquisition is
+ *			stopped, and so does each mapping of the ring
+ * @file:		file that started the acquisition; closing it stops it
+ * @ring:		the ring: a header page followed by the slots
+ * @ring_size:		size of the ring, in bytes
+ * @slot_size:		size of each slot, in bytes
+ * @samples_offset:	offset of the samples within a slot
+ * @nr_slots:		number of slots
+ * @nr_events:		number of events per segment
+ * @ev_length:		number of samples per event
+ * @channel_mask:	channels copied to the ring
+ * @n_channels:		number of channels in @channel_mask
+ * @acqs:		@nr_events descriptors per channel, pointing to a slot
+ * @head:		number of slots filled. @ring->head is only a copy,
+ *			since user-space can write to it
+ * @stopping:		set when a segment couldn't be re-armed
+ */
+struct sis33_cont {
+	struct kref		kref;
+	struct file		*file;
+	struct sis33_ring	*ring;
+	unsigned long		ring_size;
+	unsigned long		slot_size;
+	unsigned long		samples_offset;
+	unsigned int		nr_slots;
+	unsigned int		nr_events;
+	unsigned int		ev_length;
+	u32			channel_mask;
+	int			n_channels;
+	struct sis33_acq	*acqs;
+	u32			head;
+	int			stopping;
+};
+
+static void sis33_cont_free(struct kref *kref)
+{
+	struct sis33_cont *cont = container_of(kref, struct sis33_cont, kref);
+
+	vfree(cont->ring);
+	kfree(cont->acqs);
+	kfree(cont);
+}
+
+static struct sis33_cont *
+sis33_cont_alloc(struct sis33_card *card, const struct sis33_cont_desc *desc)
+{
+	u64 max = (u64)cont_ring_max << 20;
+	struct sis33_ring *ring;
+	struct sis33_cont *cont;
+	int n_acqs;
+	u64 size;
+	int ret;
+
+	cont = kzalloc(sizeof(*cont), GFP_KERNEL);
+	if (cont == NULL)
+		return ERR_PTR(-ENOMEM);
+	kref_init(&cont->kref);
+	cont->nr_slots		= desc->nr_slots;
+	cont->nr_events		= desc->nr_events;
+	cont->ev_length		= desc->ev_length;
+	cont->channel_mask	= desc->channel_mask;
+	cont->n_channels	= hweight32(desc->channel_mask);
+	n_acqs = cont->n_channels * cont->nr_events;
+
+	size = sizeof(struct sis33_ring_slot) + (u64)n_acqs * sizeof(struct sis33_ring_event);
+	if (size > max)
+		goto too_big;
+	cont->samples_offset = PAGE_ALIGN((unsigned long)size);
+	size = cont->samples_offset + (u64)n_acqs * cont->ev_length * sizeof(u16);
+	if (size > max)
+		goto too_big;
+	cont->slot_size = PAGE_ALIGN((unsigned long)size);
+	size = PAGE_SIZE + (u64)cont->slot_size * cont->nr_slots;
+	if (size > max)
+		goto too_big;
+	cont->ring_size = size;
+
+	cont->acqs = kcalloc(n_acqs, sizeof(*cont->acqs), GFP_KERNEL);
+	if (cont->acqs == NULL) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+	/* zeroed, and suitable for remap_vmalloc_range() */
+	cont->ring = vmalloc_user(cont->ring_size);
+	if (cont->ring == NULL) {
+		dev_info(card->dev, "Couldn't allocate a ring of %lu bytes\n", cont->ring_size);
+		ret = -ENOMEM;
+		goto out_free;
+	}
+	ring = cont->ring;
+	ring->nr_slots		= cont->nr_slots;
+	ring->slot_size		= cont->slot_size;
+	ring->data_offset	= PAGE_SIZE;
+	ring->slot_events	= cont->nr_events;
+	return cont;
+
+ too_big:
+	dev_info(card->dev, "Ring of %llu bytes or more exceeds cont_ring_max (%u MB)\n",
+		(unsigned long long)size, cont_ring_max);
+	ret = -EINVAL;
+ out_free:
+	kref_put(&cont->kref, sis33_cont_free);
+	return ERR_PTR(ret);
+}
+
+/* the tail is written by user-space */
+static u32 sis33_cont_tail(struct sis33_cont *cont)
+{
+	return *(volatile u32 *)&cont->ring->tail;
+}
+
+/*
+ * Read the finished segment @segment_nr into the slot at the head of the
+ * ring, and publish it. Runs from the interrupt work, which is the only
+ * writer of the counters.
+ */
+static void sis33_cont_fill(struct sis33_card *card, struct sis33_cont *cont, int segment_nr)
+{
+	struct sis33_segment *segment = &card->segments[segment_nr];
+	struct sis33_ring *ring = cont->ring;
+	struct sis33_ring_event *events;
+	struct sis33_ring_slot *slot;
+	size_t ev_size = cont->ev_length * sizeof(u16);
+	u8 *samples;
+	int nr_events;
+	int n_acqs;
+	int ret;
+	int i;
+
+	ring->completed = ++card->cont_completed;
+	if (cont->head - sis33_cont_tail(cont) >= cont->nr_slots) {
+		ring->dropped = ++card->cont_dropped;
+		return;
+	}
+	/* the reader is done with the slot before we overwrite it */
+	smp_mb();
+
+	slot = (void *)ring + PAGE_SIZE + (cont->head % cont->nr_slots) * cont->slot_size;
+	samples = (u8 *)slot + cont->samples_offset;
+	n_acqs = cont->n_channels * cont->nr_events;
+	for (i = 0; i < n_acqs; i++) {
+		memset(&cont->acqs[i], 0, sizeof(cont->acqs[i]));
+		cont->acqs[i].data = (u16 __user __force *)(samples + i * ev_size);
+		cont->acqs[i].size = ev_size;
+	}
+
+	nr_events = min(segment->nr_events, cont->nr_events);
+	ret = 0;
+	if (nr_events)
+		ret = card->ops->fetch_kernel(card, segment_nr, cont->channel_mask, cont->acqs, cont->nr_events, nr_events);
+	if (ret < 0) {
+		dev_warn(card->dev, "Failed to read segment %d (err %d)\n", segment_nr, ret);
+		ring->errors = ++card->cont_errors;
+		return;
+	}
+
+	events = (struct sis33_ring_event *)(slot + 1);
+	for (i = 0; i < n_acqs; i++) {
+		events[i].nr_samples	= cont->acqs[i].nr_samples;
+		events[i].first_samp	= cont->acqs[i].first_samp;
+		events[i].prevticks	= cont->acqs[i].prevticks;
+	}
+	slot->seq		= card->cont_completed - 1;
+	slot->segment		= segment_nr;
+	slot->nr_events		= nr_events;
+	slot->ev_length		= cont->ev_length;
+	slot->channel_mask	= cont->channel_mask;
+	slot->be		= cont->acqs[0].be;
+	slot->samples_offset	= cont->samples_offset;
+	slot->endtime_sec	= segment->endtime.tv_sec;
+	slot->endtime_usec	= segment->endtime.tv_usec;
+
+	/* the slot is complete before the reader can see it */
+	smp_wmb();
+	ring->head = ++cont->head;
+}
+
+/**
+ * sis33_cont_segment_done - handle a finished segment
+ * @card:	card the segment belongs to
+ * @segment_nr:	segment that has just finished
+ *
+ * Drivers call this from their interrupt work, without the card's lock,
+ * after marking the segment as no longer acquiring. During a continuous
+ * acquisition the next segment is armed, and then @segment_nr is read into
+ * the ring; otherwise this does nothing.
+ */
+void sis33_cont_segment_done(struct sis33_card *card, int segment_nr)
+{
+	struct sis33_segment *segment = &card->segments[segment_nr];
+	struct sis33_acq_desc desc;
+	struct sis33_cont *cont;
+	int ret;
+
+	mutex_lock(&card->lock);
+	cont = card->cont;
+	if (cont == NULL || cont->stopping) {
+		mutex_unlock(&card->lock);
+		return;
+	}
+	memset(&desc, 0, sizeof(desc));
+	desc.segment	= (segment_nr + 1) % card->n_segments;
+	desc.nr_events	= cont->nr_events;
+	desc.ev_length	= cont->ev_length;
+	ret = sis33_arm(card, &desc);
+	if (ret) {
+		dev_err(card->dev, "Failed to arm segment %d (err %d). Continuous acquisition stopped\n",
+			desc.segment, ret);
+		cont->stopping = 1;
+		cont->ring->stopped = 1;
+	}
+	atomic_set(&segment->transferring, 1);
+	mutex_unlock(&card->lock);
+
+	if (!ret)
+		card->ops->acq_start(card);
+	sis33_cont_fill(card, cont, segment_nr);
+	atomic_set(&segment->transferring, 0);
+	wake_up_interruptible(&card->cont_wait);
+}
+EXPORT_SYMBOL_GPL(sis33_cont_segment_done);
+
+int sis33_cont_start_ioctl(struct sis33_card *card, struct file *file, void __user *arg)
+{
+	struct sis33_cont_desc desc;
+	struct sis33_acq_desc acq_desc;
+	struct sis33_cont *cont;
+	int ret;
+
+	if (copy_from_user(&desc, arg, sizeof(desc)))
+		return -EFAULT;
+	if (!card->ops->fetch_kernel || !card->ops->acq_start)
+		return -EINVAL;
+	if (desc.nr_slots < 2) {
+		dev_info(card->dev, "Invalid number of slots %u. Minimum: 2\n", desc.nr_slots);
+		return -EINVAL;
+	}
+	if (desc.channel_mask == 0 || desc.channel_mask >> card->n_channels) {
+		dev_info(card->dev, "Invalid channel mask 0x%x\n", desc.channel_mask);
+		return -EINVAL;
+	}
+
+	if (mutex_lock_interruptible(&card->lock))
+		return -EINTR;
+
+	if (card->n_segments < 2) {
+		dev_info(card->dev, "Continuous acquisition needs 2 segments or more\n");
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+	if (desc.nr_events == 0 || desc.nr_events > card->max_nr_events) {
+		dev_info(card->dev, "Invalid number of events %d. valid: 1-%d.\n",
+			desc.nr_events, card->max_nr_events);
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+	if (!sis33_value_is_in_array(card->ev_lengths, card->n_ev_lengths, desc.ev_length)) {
+		dev_info(card->dev, "Invalid event length %u\n", desc.ev_length);
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+	if (desc.nr_events * desc.ev_length > sis33_segment_max_nr_samples(card)) {
+		dev_info(card->dev, "Required number of samples per segment %d greater than the current maximum %d\n",
+			desc.nr_events * desc.ev_length, sis33_segment_max_nr_samples(card));
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+	if (sis33_is_acquiring(card) || sis33_is_transferring(card)) {
+		ret = -EBUSY;
+		goto out_unlock;
+	}
+
+	cont = sis33_cont_alloc(card, &desc);
+	if (IS_ERR(cont)) {
+		ret = PTR_ERR(cont);
+		goto out_unlock;
+	}
+	cont->file = file;
+
+	memset(&acq_desc, 0, sizeof(acq_desc));
+	acq_desc.segment	= 0;
+	acq_desc.nr_events	= desc.nr_events;
+	acq_desc.ev_length	= desc.ev_length;
+	ret = sis33_arm(card, &acq_desc);
+	if (ret) {
+		kref_put(&cont->kref, sis33_cont_free);
+		goto out_unlock;
+	}
+	card->cont_completed	= 0;
+	card->cont_dropped	= 0;
+	card->cont_errors	= 0;
+	card->cont		= cont;
+	desc.ring_size		= cont->ring_size;
+	mutex_unlock(&card->lock);
+
+	card->ops->acq_start(card);
+	/* the acquisition goes on regardless: it is stopped by the caller */
+	if (copy_to_user(arg, &desc, sizeof(desc)))
+		return -EFAULT;
+	return 0;
+
+ out_unlock:
+	mutex_unlock(&card->lock);
+	return ret;
+}
+
+/*
+ * Stop the continuous acquisition, if @file started it (or, with a NULL
+ * @file, whoever did). The owner is checked and card->cont cleared under
+ * a single hold of the lock, so that a new acquisition started meanwhile
+ * by another file isn't stopped in its place.
+ */
+static int __sis33_cont_stop(struct sis33_card *card, struct file *file)
+{
+	struct sis33_cont *cont;
+
+	/*
+	 * Once card->cont is cleared the interrupt work doesn't re-arm any
+	 * segment. Work already past that check may still start the next
+	 * segment, though: wait for it to finish, and only then cancel the
+	 * segment that is left armed.
+	 */
+	mutex_lock(&card->lock);
+	cont = card->cont;
+	if (cont && file && cont->file != file)
+		cont = NULL;
+	if (cont)
+		card->cont = NULL;
+	mutex_unlock(&card->lock);
+	if (cont == NULL)
+		return -EINVAL;
+
+	flush_workqueue(sis33_workqueue);
+	if (card->ops->acq_cancel)
+		card->ops->acq_cancel(card);
+	cont->ring->stopped = 1;
+	wake_up_interruptible(&card->cont_wait);
+	kref_put(&cont->kref, sis33_cont_free);
+	return 0;
+}
+
+int sis33_cont_stop(struct sis33_card *card)
+{
+	return __sis33_cont_stop(card, NULL);
+}
+
+void sis33_cont_release(struct sis33_card *card, struct file *file)
+{
+	__sis33_cont_stop(card, file);
+}
+
+static void sis33_cont_vm_open(struct vm_area_struct *vma)
+{
+	struct sis33_cont *cont = vma->vm_private_data;
+
+	kref_get(&cont->kref);
+}
+
+static void sis33_cont_vm_close(struct vm_area_struct *vma)
+{
+	struct sis33_cont *cont = vma->vm_private_data;
+
+	kref_put(&cont->kref, sis33_cont_free);
+}
+
+static struct vm_operations_struct sis33_cont_vm_ops = {
+	.open	= sis33_cont_vm_open,
+	.close	= sis33_cont_vm_close,
+};
+
+/* the ring outlives the acquisition while it's mapped */
+int sis33_cont_mmap(struct sis33_card *card, struct vm_area_struct *vma)
+{
+	struct sis33_cont *cont;
+	int ret;
+
+	if (mutex_lock_interruptible(&card->lock))
+		return -EINTR;
+	cont = card->cont;
+	if (cont == NULL) {
+		ret = -ENODEV;
+		goto out_unlock;
+	}
+	ret = remap_vmalloc_range(vma, cont->ring, vma->vm_pgoff);
+	if (ret)
+		goto out_unlock;
+	vma->vm_ops = &sis33_cont_vm_ops;
+	vma->vm_private_data = cont;
+	kref_get(&cont->kref);
+
+ out_unlock:
+	mutex_unlock(&card->lock);
+	return ret;
+}
+
+unsigned int sis33_cont_poll(struct sis33_card *card, struct file *file, poll_table *wait)
+{
+	struct sis33_cont *cont;
+	unsigned int mask = 0;
+
+	poll_wait(file, &card->cont_wait, wait);
+	mutex_lock(&card->lock);
+	cont = card->cont;
+	if (cont && cont->head != sis33_cont_tail(cont))
+		mask |= POLLIN | POLLRDNORM;
+	if (cont == NULL || cont->stopping)
+		mask |= POLLHUP;
+	mutex_unlock(&card->lock);
+	return mask;
+}
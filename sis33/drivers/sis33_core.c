@@ -11,6 +11,8 @@
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/log2.h>
+#include <linux/bitops.h>
+#include <linux/kernel.h>
 #include <linux/fs.h>
 
 #include <asm/uaccess.h>
@@ -40,6 +42,9 @@ int sis33_is_acquiring(struct sis33_card *card)
 {
 	int i;
 
+	/* a continuous acquisition keeps the card busy between segments */
+	if (card->cont)
+		return 1;
 	for (i = 0; i < card->n_segments; i++) {
 		if (atomic_read(&card->segments[i].acquiring))
 			return 1;
@@ -62,8 +67,7 @@ int sis33_is_transferring(struct sis33_card *card)
  * This function assumes that the first entry in card->ev_lengths is the
  * maximum length of a segment.
  */
-static int
-sis33_segment_max_nr_samples(struct sis33_card *card)
+int sis33_segment_max_nr_samples(struct sis33_card *card)
 {
 	return card->ev_lengths[0] / (card->n_segments / card->n_segments_min);
 }
@@ -95,69 +99,47 @@ static int sis33_check_acq_buffers(const struct sis33_card *card, int segment_nr
 	return 0;
 }
 
-static int sis33_fetch_ioctl(struct sis33_card *card, void __user *arg)
+/*
+ * Wait for the acquisition on @segment_nr to finish, as requested by @flags,
+ * and mark the segment as transferring so that no acquisition can start on
+ * it until sis33_segment_put(). Returns with the card's lock released.
+ */
+static int sis33_segment_get(struct sis33_card *card, unsigned int segment_nr,
+			     unsigned int flags, struct timespec *timeout)
 {
-	struct sis33_acq_list list;
-	struct sis33_acq *acqs;
 	struct sis33_segment *segment;
-	unsigned int flags;
-	ssize_t size;
-	int nr_events;
 	int ret;
 
-	if (copy_from_user(&list, arg, sizeof(list)))
-		return -EFAULT;
-
-	flags = list.flags & (SIS33_ACQF_DONTWAIT | SIS33_ACQF_TIMEOUT);
-	if (flags & SIS33_ACQF_DONTWAIT && flags & SIS33_ACQF_TIMEOUT) {
-		dev_info(card->dev, "Invalid flags: DONTWAIT and TIMEOUT can't coexist.\n");
-		return -EINVAL;
-	}
-
-	if (list.n_acqs == 0)
-		return -EINVAL;
-	size = list.n_acqs * sizeof(struct sis33_acq);
-	acqs = kzalloc(size, GFP_KERNEL);
-	if (acqs == NULL)
-		return -ENOMEM;
-
-	if (copy_from_user(acqs, list.acqs, size)) {
-		ret = -EFAULT;
-		goto out;
-	}
-
-	if (mutex_lock_interruptible(&card->lock)) {
-		ret = -EINTR;
-		goto out;
-	}
+	if (mutex_lock_interruptible(&card->lock))
+		return -EINTR;
 
-	if (list.segment >= card->n_segments ||
-	    list.channel >= card->n_channels) {
+	if (segment_nr >= card->n_segments) {
 		ret = -EINVAL;
 		goto out_unlock;
 	}
+	/* the segments are read by the continuous acquisition, if any */
+	if (card->cont) {
+		ret = -EBUSY;
+		goto out_unlock;
+	}
 
-	segment = &card->segments[list.segment];
+	segment = &card->segments[segment_nr];
 
 	if (atomic_read(&segment->acquiring)) {
 		mutex_unlock(&card->lock);
 		/* wait for the acquisition to finish */
-		if (!card->ops->acq_wait) {
-			ret = -EINVAL;
-			goto out;
-		}
+		if (!card->ops->acq_wait)
+			return -EINVAL;
 		if (flags & SIS33_ACQF_TIMEOUT)
-			ret = card->ops->acq_wait(card, &list.timeout);
+			ret = card->ops->acq_wait(card, timeout);
 		else if (flags & SIS33_ACQF_DONTWAIT)
 			ret = -EBUSY;
 		else
 			ret = card->ops->acq_wait(card, NULL);
 		if (ret)
-			goto out;
-		if (mutex_lock_interruptible(&card->lock)) {
-			ret = -EINTR;
-			goto out;
-		}
+			return ret;
+		if (mutex_lock_interruptible(&card->lock))
+			return -EINTR;
 	}
 	/*
 	 * We need to check segment->acquiring again because we had to
@@ -168,24 +150,78 @@ static int sis33_fetch_ioctl(struct sis33_card *card, void __user *arg)
 		ret = -EBUSY;
 		goto out_unlock;
 	}
-	/* fill in as many events as we can */
-	nr_events = min(segment->nr_events, list.n_acqs);
-	if (nr_events == 0) {
+	if (segment->nr_events == 0) {
 		ret = -ENODATA;
 		goto out_unlock;
 	}
+	atomic_set(&segment->transferring, 1);
+	ret = 0;
+
+ out_unlock:
+	mutex_unlock(&card->lock);
+	return ret;
+}
+
+static void sis33_segment_put(struct sis33_card *card, unsigned int segment_nr)
+{
+	atomic_set(&card->segments[segment_nr].transferring, 0);
+}
+
+static int sis33_check_flags(struct sis33_card *card, unsigned int flags)
+{
+	if (flags & SIS33_ACQF_DONTWAIT && flags & SIS33_ACQF_TIMEOUT) {
+		dev_info(card->dev, "Invalid flags: DONTWAIT and TIMEOUT can't coexist.\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int sis33_fetch_ioctl(struct sis33_card *card, void __user *arg)
+{
+	struct sis33_acq_list list;
+	struct sis33_acq *acqs;
+	struct sis33_segment *segment;
+	unsigned int flags;
+	ssize_t size;
+	int nr_events;
+	int ret;
+
+	if (copy_from_user(&list, arg, sizeof(list)))
+		return -EFAULT;
+
+	flags = list.flags & (SIS33_ACQF_DONTWAIT | SIS33_ACQF_TIMEOUT);
+	ret = sis33_check_flags(card, flags);
+	if (ret)
+		return ret;
+
+	if (list.n_acqs == 0 || list.channel >= card->n_channels)
+		return -EINVAL;
+	size = list.n_acqs * sizeof(struct sis33_acq);
+	acqs = kzalloc(size, GFP_KERNEL);
+	if (acqs == NULL)
+		return -ENOMEM;
+
+	if (copy_from_user(acqs, list.acqs, size)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	ret = sis33_segment_get(card, list.segment, flags, &list.timeout);
+	if (ret)
+		goto out;
+	segment = &card->segments[list.segment];
+	/* fill in as many events as we can */
+	nr_events = min(segment->nr_events, list.n_acqs);
 	ret = sis33_check_acq_buffers(card, list.segment, acqs, nr_events);
 	if (ret)
-		goto out_unlock;
+		goto out_put;
 	list.endtime = segment->endtime;
-	atomic_set(&segment->transferring, 1);
-	mutex_unlock(&card->lock);
 	/* .fetch always does blocking I/O */
 	if (card->ops->fetch)
 		ret = card->ops->fetch(card, list.segment, list.channel, acqs, nr_events);
 	else
 		ret = -EINVAL;
-	atomic_set(&segment->transferring, 0);
+	sis33_segment_put(card, list.segment);
 
 	if (ret < 0)
 		goto out;
@@ -198,13 +234,130 @@ static int sis33_fetch_ioctl(struct sis33_card *card, void __user *arg)
 		ret = -EFAULT;
 	goto out;
 
- out_unlock:
-	mutex_unlock(&card->lock);
+ out_put:
+	sis33_segment_put(card, list.segment);
+ out:
+	kfree(acqs);
+	return ret;
+}
+
+static int
+sis33_fetch_channels(struct sis33_card *card, int segment_nr, u32 channel_mask,
+		     struct sis33_acq *acqs, int n_acqs, int nr_events)
+{
+	int ret;
+	int i;
+
+	if (card->ops->fetch_channels)
+		return card->ops->fetch_channels(card, segment_nr, channel_mask, acqs, n_acqs, nr_events);
+	if (!card->ops->fetch)
+		return -EINVAL;
+	for (i = 0; i < card->n_channels; i++) {
+		if (!(channel_mask & (1 << i)))
+			continue;
+		ret = card->ops->fetch(card, segment_nr, i, acqs, nr_events);
+		if (ret < 0)
+			return ret;
+		acqs += n_acqs;
+	}
+	return nr_events;
+}
+
+/*
+ * Same as sis33_fetch_ioctl, but for all the channels in a mask: the waiting,
+ * locking and copying of the descriptors is done once for all of them, and
+ * the driver can read the channels' data back to back.
+ */
+static int sis33_fetch_channels_ioctl(struct sis33_card *card, void __user *arg)
+{
+	struct sis33_acq_mlist list;
+	struct sis33_acq *acqs;
+	struct sis33_segment *segment;
+	unsigned int flags;
+	int n_channels;
+	ssize_t size;
+	int nr_events;
+	int ret;
+	int i;
+
+	if (copy_from_user(&list, arg, sizeof(list)))
+		return -EFAULT;
+
+	flags = list.flags & (SIS33_ACQF_DONTWAIT | SIS33_ACQF_TIMEOUT);
+	ret = sis33_check_flags(card, flags);
+	if (ret)
+		return ret;
+
+	if (list.channel_mask == 0 || list.channel_mask >> card->n_channels)
+		return -EINVAL;
+	n_channels = hweight32(list.channel_mask);
+	if (list.n_acqs == 0 ||
+	    list.n_acqs > INT_MAX / n_channels / sizeof(struct sis33_acq))
+		return -EINVAL;
+	size = n_channels * list.n_acqs * sizeof(struct sis33_acq);
+	acqs = kzalloc(size, GFP_KERNEL);
+	if (acqs == NULL)
+		return -ENOMEM;
+
+	if (copy_from_user(acqs, list.acqs, size)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	ret = sis33_segment_get(card, list.segment, flags, &list.timeout);
+	if (ret)
+		goto out;
+	segment = &card->segments[list.segment];
+	nr_events = min(segment->nr_events, list.n_acqs);
+	for (i = 0; i < n_channels; i++) {
+		ret = sis33_check_acq_buffers(card, list.segment, &acqs[i * list.n_acqs], nr_events);
+		if (ret)
+			goto out_put;
+	}
+	list.endtime = segment->endtime;
+	ret = sis33_fetch_channels(card, list.segment, list.channel_mask, acqs, list.n_acqs, nr_events);
+	sis33_segment_put(card, list.segment);
+
+	if (ret < 0)
+		goto out;
+
+	if (copy_to_user(arg, &list, sizeof(list))) {
+		ret = -EFAULT;
+		goto out;
+	}
+	if (copy_to_user(list.acqs, acqs, size))
+		ret = -EFAULT;
+	goto out;
+
+ out_put:
+	sis33_segment_put(card, list.segment);
  out:
 	kfree(acqs);
 	return ret;
 }
 
+/*
+ * Configure the events of @desc->segment and mark it as the one to be
+ * acquired. Called with the card's lock held; ops->acq_start is then called
+ * to start the acquisition.
+ */
+int sis33_arm(struct sis33_card *card, struct sis33_acq_desc *desc)
+{
+	struct sis33_segment *segment = &card->segments[desc->segment];
+	int ret;
+
+	if (!card->ops->conf_ev)
+		return -EINVAL;
+	ret = card->ops->conf_ev(card, desc);
+	if (ret)
+		return ret;
+	atomic_set(&segment->acquiring, 1);
+	segment->nr_samp_per_ev = desc->ev_length;
+	/* segment->nr_events is set asynchronously by the acq. handler */
+	card->curr_segment = desc->segment;
+	return 0;
+}
+
 static int sis33_acq_start_ioctl(struct sis33_card *card, void __user *arg)
 {
 	struct sis33_acq_desc desc;
@@ -216,10 +369,9 @@ static int sis33_acq_start_ioctl(struct sis33_card *card, void __user *arg)
 		return -EFAULT;
 
 	flags = desc.flags & (SIS33_ACQF_DONTWAIT | SIS33_ACQF_TIMEOUT);
-	if (flags & SIS33_ACQF_DONTWAIT && flags & SIS33_ACQF_TIMEOUT) {
-		dev_info(card->dev, "Invalid flags: DONTWAIT and TIMEOUT can't coexist.\n");
-		return -EINVAL;
-	}
+	ret = sis33_check_flags(card, flags);
+	if (ret)
+		return ret;
 
 	if (mutex_lock_interruptible(&card->lock))
 		return -EINTR;
@@ -252,17 +404,9 @@ static int sis33_acq_start_ioctl(struct sis33_card *card, void __user *arg)
 		ret = -EBUSY;
 		goto out_unlock;
 	}
-	if (!card->ops->conf_ev) {
-		ret = -EINVAL;
-		goto out_unlock;
-	}
-	ret = card->ops->conf_ev(card, &desc);
+	ret = sis33_arm(card, &desc);
 	if (ret)
 		goto out_unlock;
-	atomic_set(&segment->acquiring, 1);
-	segment->nr_samp_per_ev = desc.ev_length;
-	/* segment->nr_events is set asynchronously by the acq. handler */
-	card->curr_segment = desc.segment;
 	mutex_unlock(&card->lock);
 	if (!card->ops->acq_start)
 		return -EINVAL;
@@ -295,6 +439,12 @@ static long sis33_do_ioctl(struct file *file, unsigned int cm, void __user *arg)
 		return sis33_fetch_ioctl(card, arg);
 	case SIS33_IOC_ACQUIRE:
 		return sis33_acq_start_ioctl(card, arg);
+	case SIS33_IOC_FETCH_CHANNELS:
+		return sis33_fetch_channels_ioctl(card, arg);
+	case SIS33_IOC_CONT_START:
+		return sis33_cont_start_ioctl(card, file, arg);
+	case SIS33_IOC_CONT_STOP:
+		return sis33_cont_stop(card);
 	default:
 		return -ENOTTY;
 	}
@@ -327,16 +477,33 @@ static int sis33_release(struct inode *inode, struct file *file)
 {
 	struct sis33_card *card = file->private_data;
 
+	sis33_cont_release(card, file);
 	module_put(card->module);
 	return 0;
 }
 
+static int sis33_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct sis33_card *card = file->private_data;
+
+	return sis33_cont_mmap(card, vma);
+}
+
+static unsigned int sis33_poll(struct file *file, poll_table *wait)
+{
+	struct sis33_card *card = file->private_data;
+
+	return sis33_cont_poll(card, file, wait);
+}
+
 static const struct file_operations sis33_fops = {
 	.owner		= THIS_MODULE,
 	.open		= sis33_open,
 	.release	= sis33_release,
 	.unlocked_ioctl	= sis33_ioctl,
 	.compat_ioctl	= sis33_compat_ioctl,
+	.mmap		= sis33_mmap,
+	.poll		= sis33_poll,
 };
 
 static int sis33_create_cdev(struct sis33_card *card, int ndev)
@@ -448,6 +615,7 @@ int sis33_card_create(int idx, struct module *module,
 	/* initialize the struct */
 	card->number = idx;
 	mutex_init(&card->lock);
+	init_waitqueue_head(&card->cont_wait);
 	*card_ret = card;
 	card->module = module;
 	dev_set_drvdata(pdev, card);
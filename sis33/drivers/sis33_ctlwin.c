@@ -0,0 +1,244 @@
+/*
+ * sis33_ctlwin.c
+ * Control windows: direct access to the control registers of sis33 modules
+ *
+ * A register access through sis33_dma_read()/sis33_dma_write() costs a whole
+ * DMA transfer: setup, pinning and a wait for completion. For the registers
+ * that are accessed often (interrupt control, acquisition, DAC...) we map
+ * instead a small window onto the A32 page that holds them, so that each
+ * access is a single VME cycle.
+ *
+ * The bridge has few windows, and sis33 modules take a lot of address space,
+ * so a window only covers an A32 page of 'ctlwin_size' bytes, and is shared
+ * (reference-counted) by all the cards whose base address is in that page.
+ * An existing bridge window that covers the page is reused; at most
+ * 'ctlwin_max' new windows are created. Cards without a control window keep
+ * accessing their registers with DMA, as do the accesses outside the window.
+ *
+ * Copyright (c) 2010 Emilio G. Cota <cota@braap.org>
+ * Released under the GPL v2. (and only v2, not any later version)
+ */
+#include <linux/moduleparam.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+
+#include <asm/io.h>
+
+#include <vmebus.h>
+#include "sis33core.h"
+
+static unsigned int ctlwin_size = 0x10000;
+module_param(ctlwin_size, uint, 0444);
+MODULE_PARM_DESC(ctlwin_size, "Size of the A32 page mapped for the control registers (power of 2). 0 disables control windows");
+static unsigned int ctlwin_max = 2;
+module_param(ctlwin_max, uint, 0444);
+MODULE_PARM_DESC(ctlwin_max, "Maximum number of bridge windows created for control windows");
+
+/**
+ * struct sis33_ctlwin - control window
+ * @list:	node in the list of control windows
+ * @map:	mapping of the A32 page
+ * @users:	number of cards using this window
+ * @created:	1 if the bridge window was created for us; 0 if it was reused
+ */
+struct sis33_ctlwin {
+	struct list_head	list;
+	struct vme_mapping	map;
+	int			users;
+	int			created;
+};
+
+static LIST_HEAD(sis33_ctlwins);
+static DEFINE_MUTEX(sis33_ctlwin_lock);
+static unsigned int sis33_ctlwins_created;
+
+/**
+ * sis33_ctlwin_get - get a control window for a card
+ * @dev:	device the window is for
+ * @vme_addr:	VME base address of the card
+ *
+ * returns the window on success, NULL if the card has to use DMA
+ */
+struct sis33_ctlwin *sis33_ctlwin_get(struct device *dev, unsigned int vme_addr)
+{
+	struct sis33_ctlwin *win;
+	unsigned int page;
+	int err;
+
+	if (!ctlwin_size)
+		return NULL;
+	if (!is_power_of_2(ctlwin_size)) {
+		dev_warn(dev, "Invalid ctlwin_size 0x%x: not a power of 2\n", ctlwin_size);
+		return NULL;
+	}
+	page = vme_addr & ~(ctlwin_size - 1);
+
+	mutex_lock(&sis33_ctlwin_lock);
+	list_for_each_entry(win, &sis33_ctlwins, list) {
+		if (win->map.vme_addrl == page) {
+			win->users++;
+			goto out;
+		}
+	}
+
+	win = kzalloc(sizeof(*win), GFP_KERNEL);
+	if (win == NULL)
+		goto out;
+	win->map.data_width	= VME_D32;
+	win->map.am		= VME_A32_USER_DATA_SCT;
+	win->map.sizel		= ctlwin_size;
+	win->map.vme_addrl	= page;
+
+	err = vme_find_mapping(&win->map, 0);
+	if (err && sis33_ctlwins_created < ctlwin_max) {
+		err = vme_find_mapping(&win->map, 1);
+		if (!err) {
+			win->created = 1;
+			sis33_ctlwins_created++;
+		}
+	}
+	if (err) {
+		dev_info(dev, "No control window for 0x%08x (err %d). Using DMA\n", page, err);
+		kfree(win);
+		win = NULL;
+		goto out;
+	}
+	win->users = 1;
+	list_add(&win->list, &sis33_ctlwins);
+	dev_info(dev, "Control window 0x%08x-0x%08x\n", page, page + ctlwin_size - 1);
+ out:
+	mutex_unlock(&sis33_ctlwin_lock);
+	return win;
+}
+EXPORT_SYMBOL_GPL(sis33_ctlwin_get);
+
+/**
+ * sis33_ctlwin_put - release a control window
+ * @win:	window returned by sis33_ctlwin_get(); may be NULL
+ */
+void sis33_ctlwin_put(struct sis33_ctlwin *win)
+{
+	int err;
+
+	if (win == NULL)
+		return;
+	mutex_lock(&sis33_ctlwin_lock);
+	if (--win->users)
+		goto out;
+	list_del(&win->list);
+	/* destroy the bridge window only if we created it */
+	err = vme_release_mapping(&win->map, win->created);
+	if (err)
+		printk(KERN_WARNING "sis33: failed to release control window 0x%08x, err %d\n",
+			win->map.vme_addrl, err);
+	if (win->created)
+		sis33_ctlwins_created--;
+	kfree(win);
+ out:
+	mutex_unlock(&sis33_ctlwin_lock);
+}
+EXPORT_SYMBOL_GPL(sis33_ctlwin_put);
+
+/* kernel address of @len bytes at @vme_addr, or NULL if @win doesn't cover them */
+static void __iomem *
+sis33_ctlwin_addr(struct sis33_ctlwin *win, unsigned int vme_addr, unsigned int len)
+{
+	unsigned int offset;
+
+	if (win == NULL || vme_addr < win->map.vme_addrl)
+		return NULL;
+	offset = vme_addr - win->map.vme_addrl;
+	if (offset >= win->map.sizel || len > win->map.sizel - offset)
+		return NULL;
+	return (void __iomem *)win->map.kernel_va + offset;
+}
+
+/**
+ * sis33_ctl_read - read a register
+ * @dev:	device to read from
+ * @win:	control window of the device; may be NULL
+ * @vme_addr:	VME address to read from
+ *
+ * returns the value read
+ */
+unsigned int sis33_ctl_read(struct device *dev, struct sis33_ctlwin *win, unsigned int vme_addr)
+{
+	void __iomem *addr = sis33_ctlwin_addr(win, vme_addr, sizeof(u32));
+
+	if (addr == NULL)
+		return sis33_dma_read(dev, vme_addr);
+	return ioread32be(addr);
+}
+EXPORT_SYMBOL_GPL(sis33_ctl_read);
+
+/**
+ * sis33_ctl_write - write a register
+ * @dev:	device to write to
+ * @win:	control window of the device; may be NULL
+ * @vme_addr:	VME address to write to
+ * @val:	value to be written
+ */
+void sis33_ctl_write(struct device *dev, struct sis33_ctlwin *win, unsigned int vme_addr, unsigned int val)
+{
+	void __iomem *addr = sis33_ctlwin_addr(win, vme_addr, sizeof(u32));
+
+	if (addr == NULL)
+		sis33_dma_write(dev, vme_addr, val);
+	else
+		iowrite32be(val, addr);
+}
+EXPORT_SYMBOL_GPL(sis33_ctl_write);
+
+/**
+ * sis33_ctl_read_regs - read consecutive registers
+ * @dev:	device to read from
+ * @win:	control window of the device; may be NULL
+ * @vme_addr:	VME address of the first register
+ * @buf:	where to store the values read
+ * @elems:	number of registers, up to 16
+ *
+ * Outside of the window, all the registers are read with a single DMA.
+ *
+ * returns 0 on success, negative error code on failure
+ */
+int sis33_ctl_read_regs(struct device *dev, struct sis33_ctlwin *win, unsigned int vme_addr, u32 *buf, unsigned int elems)
+{
+	void __iomem *addr = sis33_ctlwin_addr(win, vme_addr, elems * sizeof(u32));
+	int i;
+
+	if (addr == NULL)
+		return sis33_dma_read_regs(dev, vme_addr, buf, elems);
+	for (i = 0; i < elems; i++)
+		buf[i] = ioread32be(addr + i * sizeof(u32));
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sis33_ctl_read_regs);
+
+/**
+ * sis33_ctl_write_regs - write consecutive registers
+ * @dev:	device to write to
+ * @win:	control window of the device; may be NULL
+ * @vme_addr:	VME address of the first register
+ * @buf:	values to be written
+ * @elems:	number of registers, up to 16
+ *
+ * The registers are written in increasing address order. Outside of the
+ * window, they are written with a single DMA.
+ *
+ * returns 0 on success, negative error code on failure
+ */
+int sis33_ctl_write_regs(struct device *dev, struct sis33_ctlwin *win, unsigned int vme_addr, const u32 *buf, unsigned int elems)
+{
+	void __iomem *addr = sis33_ctlwin_addr(win, vme_addr, elems * sizeof(u32));
+	int i;
+
+	if (addr == NULL)
+		return sis33_dma_write_regs(dev, vme_addr, buf, elems);
+	for (i = 0; i < elems; i++)
+		iowrite32be(buf[i], addr + i * sizeof(u32));
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sis33_ctl_write_regs);
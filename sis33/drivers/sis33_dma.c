@@ -11,6 +11,9 @@
  * So what we do is to set up a DMA transfer for each register read or write.
  * Yes, it's ugly and unsafe, but with this hack we can fill up a VME crate
  * with ADCs and use them.
+ * When a control window is available (see sis33_ctlwin.c) the registers in it
+ * are accessed directly instead; consecutive registers outside of it can be
+ * accessed with a single DMA with sis33_dma_{read,write}_regs().
  *
  * Copyright (c) 2009 Emilio G. Cota <cota@braap.org>
  * Released under the GPL v2. (and only v2, not any later version)
@@ -18,27 +21,25 @@
 #include <vmebus.h>
 #include "sis33core.h"
 
-static int
-__sis33_dma(struct device *dev, unsigned int vme_addr, enum vme_address_modifier am,
-	    void *addr, ssize_t size, int to_user)
+static void
+__sis33_dma_desc(struct vme_dma *desc, unsigned int vme_addr,
+		 enum vme_address_modifier am, void *addr, ssize_t size)
 {
-	struct vme_dma desc;
 	struct vme_dma_attr *vme;
 	struct vme_dma_attr *pci;
-	int ret;
 
-	memset(&desc, 0, sizeof(desc));
+	memset(desc, 0, sizeof(*desc));
 
-	vme = &desc.src;
-	pci = &desc.dst;
+	vme = &desc->src;
+	pci = &desc->dst;
 
-	desc.dir = VME_DMA_FROM_DEVICE;
-	desc.length = size;
+	desc->dir = VME_DMA_FROM_DEVICE;
+	desc->length = size;
 
-	desc.ctrl.pci_block_size	= VME_DMA_BSIZE_2048;
-	desc.ctrl.pci_backoff_time	= VME_DMA_BACKOFF_0;
-	desc.ctrl.vme_block_size	= VME_DMA_BSIZE_2048;
-	desc.ctrl.vme_backoff_time	= VME_DMA_BACKOFF_0;
+	desc->ctrl.pci_block_size	= VME_DMA_BSIZE_2048;
+	desc->ctrl.pci_backoff_time	= VME_DMA_BACKOFF_0;
+	desc->ctrl.vme_block_size	= VME_DMA_BSIZE_2048;
+	desc->ctrl.vme_backoff_time	= VME_DMA_BACKOFF_0;
 
 	pci->addru = 0;
 	pci->addrl = (unsigned int)addr;
@@ -47,6 +48,16 @@ __sis33_dma(struct device *dev, unsigned int vme_addr, enum vme_address_modifier
 	vme->addrl = vme_addr;
 	vme->am = am;
 	vme->data_width = VME_D32;
+}
+
+static int
+__sis33_dma(struct device *dev, unsigned int vme_addr, enum vme_address_modifier am,
+	    void *addr, ssize_t size, int to_user)
+{
+	struct vme_dma desc;
+	int ret;
+
+	__sis33_dma_desc(&desc, vme_addr, am, addr, size);
 
 	dev_dbg(dev, "DMA 0x%8x size: 0x%x\n", vme_addr, desc.length);
 	if (to_user)
@@ -86,6 +97,28 @@ int sis33_dma_read_mblt_user(struct device *dev, unsigned int vme_addr, void __u
 }
 EXPORT_SYMBOL_GPL(sis33_dma_read_mblt_user);
 
+/**
+ * sis33_dma_read_mblt_iov - read a block of data to several user buffers using MBLT-DMA
+ * @dev:	device to read from
+ * @vme_addr:	VME address to start reading from
+ * @iov:	user buffers to write to, one after the other
+ * @nr_segs:	number of buffers
+ *
+ * The block is as long as all the buffers together. It is read with a
+ * single DMA transfer, and the buffers are pinned in a single pass.
+ *
+ * returns 0 on success, negative error code on failure
+ */
+int sis33_dma_read_mblt_iov(struct device *dev, unsigned int vme_addr, const struct iovec *iov, unsigned long nr_segs)
+{
+	struct vme_dma desc;
+
+	__sis33_dma_desc(&desc, vme_addr, VME_A32_USER_MBLT, NULL, 0);
+	dev_dbg(dev, "DMA 0x%8x %lu buffers\n", vme_addr, nr_segs);
+	return vme_do_dma_iov(&desc, iov, nr_segs);
+}
+EXPORT_SYMBOL_GPL(sis33_dma_read_mblt_iov);
+
 /**
  * sis33_dma_read32be_blt - read a block of 32-be data to kernel space from VME using BLT-DMA
  * @dev:	device to read from
@@ -109,27 +142,30 @@ int sis33_dma_read32be_blt(struct device *dev, unsigned int vme_addr, u32 __kern
 }
 EXPORT_SYMBOL_GPL(sis33_dma_read32be_blt);
 
-/**
- * sis33_dma_read - read a double word from VME using DMA
- * @dev:	device to read from
- * @vme_addr:	VME address to read from
- *
- * returns the value read
- */
-unsigned int sis33_dma_read(struct device *dev, unsigned int vme_addr)
+/* maximum number of registers in a single sis33_dma_{read,write}_regs() */
+#define SIS33_DMA_MAX_REGS	16
+
+/* SCT transfer of @elems consecutive registers, in the bus' endianness */
+static int
+__sis33_dma_regs(struct device *dev, unsigned int vme_addr, u32 *buf, unsigned int elems, int write)
 {
-	u32 val;
 	struct vme_dma desc;
 	struct vme_dma_attr *vme;
 	struct vme_dma_attr *pci;
+	int ret;
 
 	memset(&desc, 0, sizeof(desc));
 
-	vme = &desc.src;
-	pci = &desc.dst;
-
-	desc.dir = VME_DMA_FROM_DEVICE;
-	desc.length = sizeof(u32);
+	if (write) {
+		pci = &desc.src;
+		vme = &desc.dst;
+		desc.dir = VME_DMA_TO_DEVICE;
+	} else {
+		vme = &desc.src;
+		pci = &desc.dst;
+		desc.dir = VME_DMA_FROM_DEVICE;
+	}
+	desc.length = elems * sizeof(u32);
 
 	desc.ctrl.pci_block_size	= VME_DMA_BSIZE_64;
 	desc.ctrl.pci_backoff_time	= VME_DMA_BACKOFF_0;
@@ -137,16 +173,34 @@ unsigned int sis33_dma_read(struct device *dev, unsigned int vme_addr)
 	desc.ctrl.vme_backoff_time	= VME_DMA_BACKOFF_0;
 
 	pci->addru = 0;
-	pci->addrl = (unsigned int)&val;
+	pci->addrl = (unsigned int)buf;
 
 	vme->addru = 0;
 	vme->addrl = vme_addr;
 	vme->am = VME_A32_USER_DATA_SCT;
 	vme->data_width = VME_D32;
 
+	ret = vme_do_dma_kernel(&desc);
+	if (ret) {
+		dev_warn(dev, "vme_do_dma failed on address 0x%08x (%u registers). Status: 0x%8x\n",
+			vme_addr, elems, desc.status);
+	}
+	return ret;
+}
+
+/**
+ * sis33_dma_read - read a double word from VME using DMA
+ * @dev:	device to read from
+ * @vme_addr:	VME address to read from
+ *
+ * returns the value read
+ */
+unsigned int sis33_dma_read(struct device *dev, unsigned int vme_addr)
+{
+	u32 val;
+
 	/* @todo bail out gracefully here */
-	if (vme_do_dma_kernel(&desc))
-		dev_warn(dev, "vme_do_dma failed on address 0x%08x. Status: 0x%8x\n", vme_addr, desc.status);
+	__sis33_dma_regs(dev, vme_addr, &val, 1, 0);
 	val = be32_to_cpu(val);
 	dev_dbg(dev, "DMAr:\t0x%8x\tval: 0x%8x\n", vme_addr, val);
 
@@ -162,41 +216,61 @@ EXPORT_SYMBOL_GPL(sis33_dma_read);
  */
 void sis33_dma_write(struct device *dev, unsigned int vme_addr, unsigned int val)
 {
-	struct vme_dma desc;
-	struct vme_dma_attr *vme;
-	struct vme_dma_attr *pci;
 	u32 val_be;
 
 	val_be = cpu_to_be32(val);
+	dev_dbg(dev, "DMAw:\t\t0x%08x\tval: 0x%8x\n", vme_addr, val);
 
-	memset(&desc, 0, sizeof(desc));
-
-	pci = &desc.src;
-	vme = &desc.dst;
-
-	desc.dir = VME_DMA_TO_DEVICE;
-	desc.length = sizeof(u32);
-
-	desc.ctrl.pci_block_size	= VME_DMA_BSIZE_64;
-	desc.ctrl.pci_backoff_time	= VME_DMA_BACKOFF_0;
-	desc.ctrl.vme_block_size	= VME_DMA_BSIZE_64;
-	desc.ctrl.vme_backoff_time	= VME_DMA_BACKOFF_0;
+	/* @todo bail out gracefully here */
+	__sis33_dma_regs(dev, vme_addr, &val_be, 1, 1);
+}
+EXPORT_SYMBOL_GPL(sis33_dma_write);
 
-	pci->addru = 0;
-	pci->addrl = (unsigned int)&val_be;
+/**
+ * sis33_dma_read_regs - read consecutive registers with a single DMA
+ * @dev:	device to read from
+ * @vme_addr:	VME address of the first register
+ * @buf:	where to store the values read
+ * @elems:	number of registers, up to 16
+ *
+ * returns 0 on success, negative error code on failure
+ */
+int sis33_dma_read_regs(struct device *dev, unsigned int vme_addr, u32 *buf, unsigned int elems)
+{
+	int ret;
+	int i;
 
-	vme->addru = 0;
-	vme->addrl = vme_addr;
-	vme->am = VME_A32_USER_DATA_SCT;
-	vme->data_width = VME_D32;
+	if (WARN_ON(elems > SIS33_DMA_MAX_REGS))
+		return -EINVAL;
+	ret = __sis33_dma_regs(dev, vme_addr, buf, elems, 0);
+	if (ret)
+		return ret;
+	for (i = 0; i < elems; i++)
+		buf[i] = be32_to_cpu(buf[i]);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(sis33_dma_read_regs);
 
-	dev_dbg(dev, "DMAw:\t\t0x%08x\tval: 0x%8x\n", vme_addr, val);
+/**
+ * sis33_dma_write_regs - write consecutive registers with a single DMA
+ * @dev:	device to write to
+ * @vme_addr:	VME address of the first register
+ * @buf:	values to be written
+ * @elems:	number of registers, up to 16
+ *
+ * The registers are written in increasing address order.
+ *
+ * returns 0 on success, negative error code on failure
+ */
+int sis33_dma_write_regs(struct device *dev, unsigned int vme_addr, const u32 *buf, unsigned int elems)
+{
+	u32 be[SIS33_DMA_MAX_REGS];
+	int i;
 
-	/* @todo bail out gracefully here */
-	if (vme_do_dma_kernel(&desc)) {
-		dev_warn(dev, "vme_do_dma failed on address 0x%08x value 0x%08x. Status: 0x%8x\n",
-			vme_addr, val, desc.status);
-	}
-	return;
+	if (WARN_ON(elems > SIS33_DMA_MAX_REGS))
+		return -EINVAL;
+	for (i = 0; i < elems; i++)
+		be[i] = cpu_to_be32(buf[i]);
+	return __sis33_dma_regs(dev, vme_addr, be, elems, 1);
 }
-EXPORT_SYMBOL_GPL(sis33_dma_write);
+EXPORT_SYMBOL_GPL(sis33_dma_write_regs);
@@ -524,6 +524,31 @@ sis33_store_clk_freq(struct device *pdev, struct device_attribute *attr, const c
 	return ret;
 }
 
+/* counters of the continuous acquisition; they are reset when it starts */
+static ssize_t
+sis33_show_cont_completed(struct device *pdev, struct device_attribute *attr, char *buf)
+{
+	struct sis33_card *card = dev_get_drvdata(pdev);
+
+	return snprintf(buf, PAGE_SIZE, "%u\n", card->cont_completed);
+}
+
+static ssize_t
+sis33_show_cont_dropped(struct device *pdev, struct device_attribute *attr, char *buf)
+{
+	struct sis33_card *card = dev_get_drvdata(pdev);
+
+	return snprintf(buf, PAGE_SIZE, "%u\n", card->cont_dropped);
+}
+
+static ssize_t
+sis33_show_cont_errors(struct device *pdev, struct device_attribute *attr, char *buf)
+{
+	struct sis33_card *card = dev_get_drvdata(pdev);
+
+	return snprintf(buf, PAGE_SIZE, "%u\n", card->cont_errors);
+}
+
 static DEVICE_ATTR(start_auto, S_IWUSR | S_IRUGO, sis33_show_start_auto, sis33_store_start_auto);
 static DEVICE_ATTR(stop_auto, S_IWUSR | S_IRUGO, sis33_show_stop_auto, sis33_store_stop_auto);
 static DEVICE_ATTR(trigger_external_enable, S_IWUSR | S_IRUGO, sis33_show_trigger_ext, sis33_store_trigger_ext);
@@ -535,6 +560,9 @@ static DEVICE_ATTR(n_segments, S_IWUSR | S_IRUGO, sis33_show_n_segments, sis33_s
 static DEVICE_ATTR(acq_cancel, S_IWUSR, NULL, sis33_store_acq_cancel);
 static DEVICE_ATTR(clock_source, S_IWUSR | S_IRUGO, sis33_show_clk_src, sis33_store_clk_src);
 static DEVICE_ATTR(clock_frequency, S_IWUSR | S_IRUGO, sis33_show_clk_freq, sis33_store_clk_freq);
+static DEVICE_ATTR(cont_completed, S_IRUGO, sis33_show_cont_completed, NULL);
+static DEVICE_ATTR(cont_dropped, S_IRUGO, sis33_show_cont_dropped, NULL);
+static DEVICE_ATTR(cont_errors, S_IRUGO, sis33_show_cont_errors, NULL);
 
 static struct attribute *sis33_attrs[] = {
 	&dev_attr_description.attr,
@@ -558,6 +586,9 @@ static struct attribute *sis33_attrs[] = {
 	&dev_attr_acq_cancel.attr,
 	&dev_attr_clock_source.attr,
 	&dev_attr_clock_frequency.attr,
+	&dev_attr_cont_completed.attr,
+	&dev_attr_cont_dropped.attr,
+	&dev_attr_cont_errors.attr,
 	NULL,
 };
 
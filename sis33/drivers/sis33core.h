@@ -13,6 +13,8 @@
 #include <linux/mutex.h>
 #include <linux/cdev.h>
 #include <linux/time.h>
+#include <linux/wait.h>
+#include <linux/uio.h>
 
 #include <asm/atomic.h>
 
@@ -23,6 +25,8 @@
 extern struct workqueue_struct *sis33_workqueue;
 
 struct sis33_card_ops;
+struct sis33_ctlwin;
+struct sis33_cont;
 
 /**
  * struct sis33_channel - descriptor of an sis33's channel
@@ -124,6 +128,11 @@ struct sis33_segment {
  * @n_segments:		number of segments
  * @segments:		array of sis33 segments
  * @curr_segment:	current segment from the array of segments
+ * @cont:		continuous acquisition in progress, if any
+ * @cont_wait:		wait queue to poll for segments in the continuous acquisition ring
+ * @cont_completed:	segments acquired in the last continuous acquisition
+ * @cont_dropped:	segments dropped because the ring was full
+ * @cont_errors:	segments dropped because they couldn't be read
  *
  * NOTE:
  * The values in @ev_lengths and @freqs must be ordered from higher to lower.
@@ -168,6 +177,13 @@ struct sis33_card {
 	int			n_segments;
 	struct sis33_segment	*segments;
 	int			curr_segment;
+
+	/* continuous acquisition */
+	struct sis33_cont	*cont;
+	wait_queue_head_t	cont_wait;
+	unsigned int		cont_completed;
+	unsigned int		cont_dropped;
+	unsigned int		cont_errors;
 };
 
 /**
@@ -176,6 +192,14 @@ struct sis33_card {
  * @conf_ev:		configure events
  * @conf_channels:	configure channels
  * @fetch:		retrieve acquisition data
+ * @fetch_channels:	retrieve the data of several channels; @acqs holds
+ *			@n_acqs entries per channel in @channel_mask, of which
+ *			the first @nr_events are filled. Optional: the core
+ *			calls @fetch for each channel otherwise.
+ * @fetch_kernel:	same as @fetch_channels, but the data pointers of @acqs
+ *			are kernel addresses, possibly vmalloc'ed. Needed for
+ *			continuous acquisition, where segments are read from
+ *			the interrupt work.
  * @trigger:		send software trigger to the module
  * @acq_start:		start acquisition
  * @acq_wait:		wait for an acquisition to finish
@@ -187,6 +211,8 @@ struct sis33_card_ops {
 	int (*conf_ev)		(struct sis33_card *card, struct sis33_acq_desc *desc);
 	int (*conf_channels)	(struct sis33_card *card, struct sis33_channel *channels);
 	int (*fetch)		(struct sis33_card *card, int segment_nr, int channel_nr, struct sis33_acq *acqs, int nr_events);
+	int (*fetch_channels)	(struct sis33_card *card, int segment_nr, u32 channel_mask, struct sis33_acq *acqs, int n_acqs, int nr_events);
+	int (*fetch_kernel)	(struct sis33_card *card, int segment_nr, u32 channel_mask, struct sis33_acq *acqs, int n_acqs, int nr_events);
 	int (*trigger)		(struct sis33_card *card, u32 trigger);
 	void (*acq_start)	(struct sis33_card *card);
 	int (*acq_wait)		(struct sis33_card *card, struct timespec *timeout);
@@ -198,10 +224,21 @@ int sis33_card_create(int idx, struct module *module,
 		struct sis33_card **card_ret, struct device *pdev);
 int sis33_card_register(struct sis33_card *card, struct sis33_card_ops *ops);
 void sis33_card_free(struct sis33_card *card);
+void sis33_cont_segment_done(struct sis33_card *card, int segment_nr);
 int sis33_dma_read_mblt(struct device *dev, unsigned int vme_addr, void __kernel *addr, ssize_t size);
 int sis33_dma_read_mblt_user(struct device *dev, unsigned int vme_addr, void __user *addr, ssize_t size);
+int sis33_dma_read_mblt_iov(struct device *dev, unsigned int vme_addr, const struct iovec *iov, unsigned long nr_segs);
 int sis33_dma_read32be_blt(struct device *dev, unsigned int vme_addr, u32 __kernel *addr, unsigned int elems);
 unsigned int sis33_dma_read(struct device *dev, unsigned int vme_addr);
 void sis33_dma_write(struct device *dev, unsigned int vme_addr, unsigned int val);
+int sis33_dma_read_regs(struct device *dev, unsigned int vme_addr, u32 *buf, unsigned int elems);
+int sis33_dma_write_regs(struct device *dev, unsigned int vme_addr, const u32 *buf, unsigned int elems);
+
+struct sis33_ctlwin *sis33_ctlwin_get(struct device *dev, unsigned int vme_addr);
+void sis33_ctlwin_put(struct sis33_ctlwin *win);
+unsigned int sis33_ctl_read(struct device *dev, struct sis33_ctlwin *win, unsigned int vme_addr);
+void sis33_ctl_write(struct device *dev, struct sis33_ctlwin *win, unsigned int vme_addr, unsigned int val);
+int sis33_ctl_read_regs(struct device *dev, struct sis33_ctlwin *win, unsigned int vme_addr, u32 *buf, unsigned int elems);
+int sis33_ctl_write_regs(struct device *dev, struct sis33_ctlwin *win, unsigned int vme_addr, const u32 *buf, unsigned int elems);
 
 #endif /* _SIS33CORE_H_ */
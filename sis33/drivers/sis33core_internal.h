@@ -2,6 +2,8 @@
 #define _SIS33CORE_INTERNAL_H_
 
 #include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/mm.h>
 
 #include "sis33core.h"
 
@@ -10,6 +12,14 @@ void sis33_remove_sysfs_files(struct sis33_card *card);
 int sis33_is_acquiring(struct sis33_card *card);
 int sis33_is_transferring(struct sis33_card *card);
 int sis33_value_is_in_array(const unsigned int *array, int n, unsigned int value);
+int sis33_segment_max_nr_samples(struct sis33_card *card);
+int sis33_arm(struct sis33_card *card, struct sis33_acq_desc *desc);
+
+int sis33_cont_start_ioctl(struct sis33_card *card, struct file *file, void __user *arg);
+int sis33_cont_stop(struct sis33_card *card);
+void sis33_cont_release(struct sis33_card *card, struct file *file);
+int sis33_cont_mmap(struct sis33_card *card, struct vm_area_struct *vma);
+unsigned int sis33_cont_poll(struct sis33_card *card, struct file *file, poll_table *wait);
 
 #ifdef CONFIG_COMPAT
 long sis33_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
@@ -17,6 +17,8 @@ struct sis33lib {
 	unsigned int *ev_lengths;
 	int n_bits;
 	int ev_tstamp_supported;
+	struct sis33_ring *ring;
+	size_t ring_size;
 };
 /** @endcond */
 
@@ -28,6 +30,7 @@ sis33_t *sis33_open(int index);
 int sis33_close(sis33_t *device);
 
 int sis33_loglevel(int loglevel);
+int sis33_normalize_threads(int nr_threads);
 int sis33_errno(void);
 char *sis33_strerror(int errnum);
 void sis33_perror(const char *string);
@@ -47,6 +50,23 @@ int sis33_fetch_wait(sis33_t *device, unsigned int segment, unsigned int channel
 int sis33_fetch_timeout(sis33_t *device, unsigned int segment, unsigned int channel,
 			struct sis33_acq *acqs, unsigned int n_acqs,
 			struct timeval *endtime, struct timespec *timeout);
+int sis33_fetch_channels(sis33_t *device, unsigned int segment, uint32_t channel_mask,
+			 struct sis33_acq *acqs, unsigned int n_acqs, struct timeval *endtime);
+int sis33_fetch_channels_wait(sis33_t *device, unsigned int segment, uint32_t channel_mask,
+			      struct sis33_acq *acqs, unsigned int n_acqs, struct timeval *endtime);
+int sis33_fetch_channels_timeout(sis33_t *device, unsigned int segment, uint32_t channel_mask,
+				 struct sis33_acq *acqs, unsigned int n_acqs,
+				 struct timeval *endtime, struct timespec *timeout);
+
+int sis33_cont_start(sis33_t *device, unsigned int nr_events, unsigned int ev_length,
+		     uint32_t channel_mask, unsigned int nr_slots);
+int sis33_cont_stop(sis33_t *device);
+struct sis33_ring_slot *sis33_cont_get_slot(sis33_t *device, int timeout_ms);
+int sis33_cont_put_slot(sis33_t *device);
+int sis33_cont_read(sis33_t *device, const struct sis33_ring_slot *slot, unsigned int channel,
+		    struct sis33_acq *acqs, unsigned int n_acqs);
+int sis33_cont_get_counters(sis33_t *device, unsigned int *completed, unsigned int *dropped,
+			    unsigned int *errors);
 
 int sis33_set_clock_source(sis33_t *device, enum sis33_clksrc clksrc);
 int sis33_get_clock_source(sis33_t *device, enum sis33_clksrc *clksrc);
@@ -94,9 +94,103 @@ struct sis33_acq_list {
 };
 /** @endcond */
 
+/** @cond INTERNAL */
+/**
+ * @brief acquisition list struct for several channels
+ *
+ * @acqs holds @n_acqs acquisitions for each channel in @channel_mask, the
+ * lowest channel's first.
+ */
+struct sis33_acq_mlist {
+	uint32_t		segment;	/**< memory segment. 0 to n-1 */
+	uint32_t		channel_mask;	/**< channels to read from, bit n for channel n */
+	struct sis33_acq __user	*acqs;		/**< pointer to the array of acquisitions */
+	uint32_t		n_acqs;		/**< number of acquisitions per channel */
+	uint32_t		flags;		/**< acquisition flags ACQF_*  */
+	struct timespec		timeout;	/**< acquisition timeout */
+	struct timeval		endtime;	/**< local time when the acquisition finished */
+	uint32_t		unused[4];
+};
+/** @endcond */
+
+/** @cond INTERNAL */
+/**
+ * @brief continuous acquisition descriptor
+ *
+ * The segments are armed in turn; the data of each finished segment is copied
+ * to a ring of @nr_slots slots, which is then mmap'ed from offset 0 with
+ * the size returned in @ring_size.
+ */
+struct sis33_cont_desc {
+	uint32_t		nr_events;	/**< number of events per segment */
+	uint32_t		ev_length;	/**< event length, i.e. number of samples per event */
+	uint32_t		channel_mask;	/**< channels copied to the ring, bit n for channel n */
+	uint32_t		nr_slots;	/**< number of slots in the ring, at least 2 */
+	uint32_t		ring_size;	/**< size of the ring, filled in */
+	uint32_t		unused[4];
+};
+/** @endcond */
+
+/**
+ * @brief header of the continuous acquisition ring
+ *
+ * The header sits on the first page of the ring, and slot n starts at
+ * @data_offset + n * @slot_size. The driver fills the slot @head % @nr_slots
+ * and then increments @head; the reader consumes the slot @tail % @nr_slots
+ * and then increments @tail. When the ring is full the finished segments are
+ * dropped until the reader catches up.
+ */
+struct sis33_ring {
+	uint32_t		head;		/**< written by the driver */
+	uint32_t		tail;		/**< written by the reader */
+	uint32_t		nr_slots;	/**< number of slots */
+	uint32_t		slot_size;	/**< size of each slot, in bytes */
+	uint32_t		data_offset;	/**< offset of the first slot */
+	uint32_t		completed;	/**< segments acquired */
+	uint32_t		dropped;	/**< segments dropped because the ring was full */
+	uint32_t		errors;		/**< segments dropped because they couldn't be read */
+	uint32_t		stopped;	/**< 1 when the acquisition has been stopped */
+	uint32_t		slot_events;	/**< room for events per channel in each slot */
+	uint32_t		unused[6];
+};
+
+/**
+ * @brief event in a slot of the continuous acquisition ring
+ */
+struct sis33_ring_event {
+	uint32_t		nr_samples;	/**< number of samples acquired */
+	uint32_t		first_samp;	/**< index of the first valid sample */
+	uint64_t		prevticks;	/**< in multievent, number of clock ticks from the first stop trigger */
+};
+
+/**
+ * @brief slot of the continuous acquisition ring: a finished segment
+ *
+ * The slot header is followed by the events' descriptors: the ring's
+ * @slot_events for each channel in @channel_mask, the lowest channel's first,
+ * of which the first @nr_events are valid. The samples are at @samples_offset
+ * from the beginning of the slot, laid out the same way, each event taking
+ * @ev_length samples.
+ */
+struct sis33_ring_slot {
+	uint32_t		seq;		/**< sequence number of the segment, from 0 */
+	uint32_t		segment;	/**< memory segment the data comes from */
+	uint32_t		nr_events;	/**< number of events acquired */
+	uint32_t		ev_length;	/**< event length, i.e. number of samples per event */
+	uint32_t		channel_mask;	/**< channels in the slot */
+	uint32_t		be;		/**< 1 if the data is in big endian format; 0 otherwise */
+	uint32_t		samples_offset;	/**< offset of the samples from the beginning of the slot */
+	uint32_t		endtime_usec;	/**< local time when the acquisition finished: microseconds */
+	uint64_t		endtime_sec;	/**< local time when the acquisition finished: seconds */
+	uint32_t		unused[6];
+};
+
 /** @cond INTERNAL */
 #define SIS33_IOC_FETCH		_IOWR('3', 0, struct sis33_acq_list)
 #define SIS33_IOC_ACQUIRE	_IOW ('3', 1, struct sis33_acq_desc)
+#define SIS33_IOC_FETCH_CHANNELS _IOWR('3', 2, struct sis33_acq_mlist)
+#define SIS33_IOC_CONT_START	_IOWR('3', 3, struct sis33_cont_desc)
+#define SIS33_IOC_CONT_STOP	_IO  ('3', 4)
 /** @endcond */
 
 #endif /* _SIS33_H_ */
@@ -0,0 +1,155 @@
+/*
+ * cont_acq.c
+ *
+ * Continuous acquisition: the driver acquires on two segments in turn, and
+ * we read the finished segments from its ring.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include <libsis33.h>
+#include "my_stringify.h"
+
+/* default module number (LUN) */
+#define MODULE_NR	0
+#define NR_SEGMENTS	100
+#define NR_SLOTS	4
+
+#define PROGNAME	"cont_acq"
+
+static int		module_nr = MODULE_NR;
+static unsigned int	ev_length = 1024;
+static unsigned int	nr_events = 1;
+static unsigned int	nr_segments = NR_SEGMENTS;
+static unsigned int	nr_slots = NR_SLOTS;
+static int		channel;
+static int		slow_us;
+extern char *optarg;
+
+static const char usage_string[] =
+	"Continuous acquisition on an sis33 device\n"
+	" " PROGNAME " [-h] [-c<CHAN>] [-e<EVENTS>] [-l<LENGTH>] [-m<LUN>] [-n<SEGMENTS>] [-r<SLOTS>] [-s<US>]";
+
+static const char commands_string[] =
+	"options:\n"
+	" -c = channel (default: 0)\n"
+	" -e = number of events per segment (default: 1)\n"
+	" -h = show this help text\n"
+	" -l = event length (number of samples per event)\n"
+	" -m = Module number (default: " my_stringify(MODULE_NR) ")\n"
+	" -n = number of segments to read (default: " my_stringify(NR_SEGMENTS) ")\n"
+	" -r = number of slots in the ring (default: " my_stringify(NR_SLOTS) ")\n"
+	" -s = microseconds spent on each segment, to play a slow reader (default: 0)";
+
+static void usage_complete(void)
+{
+	printf("%s\n", usage_string);
+	printf("%s\n", commands_string);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	int c;
+
+	for (;;) {
+		c = getopt(argc, argv, "c:e:hl:m:n:r:s:");
+		if (c < 0)
+			break;
+		switch (c) {
+		case 'c':
+			channel = strtol(optarg, NULL, 0);
+			break;
+		case 'e':
+			nr_events = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage_complete();
+			exit(EXIT_SUCCESS);
+		case 'l':
+			ev_length = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			module_nr = strtol(optarg, NULL, 0);
+			break;
+		case 'n':
+			nr_segments = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			nr_slots = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			slow_us = strtol(optarg, NULL, 0);
+			break;
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct sis33_ring_slot *slot;
+	struct sis33_acq *acqs;
+	sis33_t *dev;
+	unsigned int completed, dropped, errors;
+	unsigned int i;
+	uint32_t last_seq = 0;
+	unsigned int gaps = 0;
+	struct timeval t0, t1;
+	double secs;
+	int n;
+
+	parse_args(argc, argv);
+
+	dev = sis33_open(module_nr);
+	if (dev == NULL)
+		exit(EXIT_FAILURE);
+
+	ev_length = sis33_round_event_length(dev, ev_length, SIS33_ROUND_NEAREST);
+	acqs = sis33_acqs_zalloc(nr_events, ev_length);
+	if (acqs == NULL)
+		exit(EXIT_FAILURE);
+
+	if (sis33_set_nr_segments(dev, 2) < 0)
+		exit(EXIT_FAILURE);
+	if (sis33_cont_start(dev, nr_events, ev_length, 1 << channel, nr_slots) < 0)
+		exit(EXIT_FAILURE);
+
+	gettimeofday(&t0, NULL);
+	for (i = 0; i < nr_segments; i++) {
+		slot = sis33_cont_get_slot(dev, 5000);
+		if (slot == NULL)
+			exit(EXIT_FAILURE);
+		/* a jump in the sequence means the segments in between were dropped */
+		if (i && slot->seq != last_seq + 1)
+			gaps++;
+		last_seq = slot->seq;
+		n = sis33_cont_read(dev, slot, channel, acqs, nr_events);
+		if (n < 0)
+			exit(EXIT_FAILURE);
+		if (sis33_cont_put_slot(dev) < 0)
+			exit(EXIT_FAILURE);
+		if (slow_us)
+			usleep(slow_us);
+	}
+	gettimeofday(&t1, NULL);
+
+	if (sis33_cont_get_counters(dev, &completed, &dropped, &errors) < 0)
+		exit(EXIT_FAILURE);
+	if (sis33_cont_stop(dev) < 0)
+		exit(EXIT_FAILURE);
+
+	secs = t1.tv_sec - t0.tv_sec + (t1.tv_usec - t0.tv_usec) / 1e6;
+	printf("%u segments of %u events of %u samples in %.3f s: %.1f segments/s\n",
+		nr_segments, nr_events, ev_length, secs, nr_segments / secs);
+	printf("completed %u dropped %u errors %u; %u gaps in the sequence\n",
+		completed, dropped, errors, gaps);
+
+	sis33_acqs_free(acqs, nr_events);
+	if (sis33_close(dev))
+		exit(EXIT_FAILURE);
+	return 0;
+}
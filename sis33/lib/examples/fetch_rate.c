@@ -0,0 +1,241 @@
+/*
+ * fetch_rate.c
+ *
+ * Measure the rate at which events are fetched from an sis33 device
+ *
+ * With -M, the channels in the mask are fetched both one by one and with
+ * a single sis33_fetch_channels(), and the two rates are compared.
+ */
+
+#include <sys/time.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include <libsis33.h>
+#include "my_stringify.h"
+
+#define MODULE_NR	0
+#define SEGMENT_NR	0
+#define CHANNEL_NR	0
+#define NR_EVENTS	256
+#define NR_FETCHES	20
+
+#define PROGNAME	"fetch_rate"
+
+static int		module_nr = MODULE_NR;
+static unsigned int	segment_nr = SEGMENT_NR;
+static unsigned int	channel_nr = CHANNEL_NR;
+static unsigned int	ev_length;
+static unsigned int	nr_events = NR_EVENTS;
+static unsigned int	nr_fetches = NR_FETCHES;
+static uint32_t		channel_mask;
+extern char *optarg;
+
+static const char usage_string[] =
+	"Measure the rate at which events are fetched\n"
+	" " PROGNAME " [-c<CHANNEL>] [-e<EVENTS>] [-h] [-l<LENGTH>] [-m<LUN>] [-M<MASK>] [-n<FETCHES>] [-s<SEGMENT>]";
+
+static const char commands_string[] =
+	"options:\n"
+	" -c = channel. Default: " my_stringify(CHANNEL_NR) "\n"
+	" -e = number of events. Default: " my_stringify(NR_EVENTS) "\n"
+	" -h = show this help text\n"
+	" -l = event length (number of samples per event).\n"
+	"      Default: all the available event lengths\n"
+	" -m = Module. Default: " my_stringify(MODULE_NR) "\n"
+	" -M = mask of channels to fetch at once, compared to fetching\n"
+	"      them one by one. Default: off\n"
+	" -n = number of fetches per event length. Default: " my_stringify(NR_FETCHES) "\n"
+	" -s = segment. Default: " my_stringify(SEGMENT_NR) "\n";
+
+static void usage_complete(void)
+{
+	printf("%s\n", usage_string);
+	printf("%s\n", commands_string);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	int c;
+
+	for (;;) {
+		c = getopt(argc, argv, "c:e:hl:m:M:n:s:");
+		if (c < 0)
+			break;
+		switch (c) {
+		case 'c':
+			channel_nr = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			nr_events = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage_complete();
+			exit(EXIT_SUCCESS);
+		case 'l':
+			ev_length = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			module_nr = strtol(optarg, NULL, 0);
+			break;
+		case 'M':
+			channel_mask = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			nr_fetches = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			segment_nr = strtoul(optarg, NULL, 0);
+			break;
+		}
+	}
+	if (!nr_events || !nr_fetches) {
+		usage_complete();
+		exit(EXIT_FAILURE);
+	}
+}
+
+static unsigned long long tv_subtract(struct timeval *t2, struct timeval *t1)
+{
+	return (t2->tv_sec - t1->tv_sec) * 1000000 + t2->tv_usec - t1->tv_usec;
+}
+
+/* acquire nr_events of @length samples, and time fetching them */
+static void measure(sis33_t *dev, unsigned int length)
+{
+	struct timeval t1, t2;
+	struct sis33_acq *acqs;
+	unsigned long long us;
+	double events;
+	int n = 0;
+	int i;
+
+	if (sis33_acq_wait(dev, segment_nr, nr_events, length) < 0) {
+		fprintf(stderr, "%10u: acquisition failed\n", length);
+		return;
+	}
+	acqs = sis33_acqs_zalloc(nr_events, length);
+	if (acqs == NULL)
+		exit(EXIT_FAILURE);
+
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < nr_fetches; i++) {
+		n = sis33_fetch(dev, segment_nr, channel_nr, acqs, nr_events, NULL);
+		if (n < 0)
+			exit(EXIT_FAILURE);
+	}
+	gettimeofday(&t2, NULL);
+	us = tv_subtract(&t2, &t1);
+
+	events = (double)n * nr_fetches;
+	printf("%10u %8d %12.0f %10.1f\n", length, n, events * 1e6 / us,
+	       events * length * 2 / us);
+	sis33_acqs_free(acqs, nr_events);
+}
+
+static int nr_channels_in(uint32_t mask)
+{
+	int n = 0;
+
+	for (; mask; mask &= mask - 1)
+		n++;
+	return n;
+}
+
+/*
+ * acquire nr_events of @length samples, and time fetching the channels in
+ * channel_mask one by one, and then all at once
+ */
+static void measure_channels(sis33_t *dev, unsigned int length)
+{
+	struct timeval t1, t2;
+	struct sis33_acq *acqs;
+	unsigned long long us[2];
+	int n_channels = nr_channels_in(channel_mask);
+	int n = 0;
+	int i, j;
+
+	if (sis33_acq_wait(dev, segment_nr, nr_events, length) < 0) {
+		fprintf(stderr, "%10u: acquisition failed\n", length);
+		return;
+	}
+	acqs = sis33_acqs_zalloc(n_channels * nr_events, length);
+	if (acqs == NULL)
+		exit(EXIT_FAILURE);
+
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < nr_fetches; i++) {
+		for (j = 0; j < 32; j++) {
+			if (!(channel_mask & (1 << j)))
+				continue;
+			n = sis33_fetch(dev, segment_nr, j, acqs, nr_events, NULL);
+			if (n < 0)
+				exit(EXIT_FAILURE);
+		}
+	}
+	gettimeofday(&t2, NULL);
+	us[0] = tv_subtract(&t2, &t1);
+
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < nr_fetches; i++) {
+		n = sis33_fetch_channels(dev, segment_nr, channel_mask, acqs, nr_events, NULL);
+		if (n < 0)
+			exit(EXIT_FAILURE);
+	}
+	gettimeofday(&t2, NULL);
+	us[1] = tv_subtract(&t2, &t1);
+
+	printf("%10u %8d %12.0f %12.0f\n", length, n,
+	       (double)n * n_channels * nr_fetches * 1e6 / us[0],
+	       (double)n * n_channels * nr_fetches * 1e6 / us[1]);
+	sis33_acqs_free(acqs, n_channels * nr_events);
+}
+
+int main(int argc, char *argv[])
+{
+	void (*do_measure)(sis33_t *, unsigned int);
+	unsigned int *lengths;
+	sis33_t *dev;
+	int n;
+	int i;
+
+	parse_args(argc, argv);
+
+	/* log errors */
+	sis33_loglevel(3);
+
+	dev = sis33_open(module_nr);
+	if (dev == NULL)
+		exit(EXIT_FAILURE);
+
+	if (channel_mask) {
+		do_measure = measure_channels;
+		printf("%10s %8s %12s %12s\n", "length", "events", "one by one", "at once");
+	} else {
+		do_measure = measure;
+		printf("%10s %8s %12s %10s\n", "length", "events", "events/s", "MB/s");
+	}
+	if (ev_length) {
+		do_measure(dev, sis33_round_event_length(dev, ev_length, SIS33_ROUND_NEAREST));
+		goto out;
+	}
+
+	n = sis33_get_nr_event_lengths(dev);
+	if (n <= 0)
+		exit(EXIT_FAILURE);
+	lengths = calloc(n, sizeof(*lengths));
+	if (lengths == NULL)
+		exit(EXIT_FAILURE);
+	if (sis33_get_available_event_lengths(dev, lengths, n) < 0)
+		exit(EXIT_FAILURE);
+	/* the lengths go from higher to lower */
+	for (i = n - 1; i >= 0; i--)
+		do_measure(dev, lengths[i]);
+	free(lengths);
+ out:
+	if (sis33_close(dev))
+		exit(EXIT_FAILURE);
+	return 0;
+}
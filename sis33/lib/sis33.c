@@ -12,6 +12,9 @@
 
 #include <sys/ioctl.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -32,6 +35,8 @@ const char *libsis33_version = LIBSIS33_VERSION;
 
 int __sis33_init;
 
+static int __sis33_normalize_threads = 1;
+
 static void __sis33_initialize(void)
 {
 	char *value;
@@ -42,6 +47,32 @@ static void __sis33_initialize(void)
 		__sis33_loglevel = strtol(value, NULL, 0);
 		LIBSIS33_DEBUG(3, "Setting loglevel to %d\n", __sis33_loglevel);
 	}
+	value = getenv("LIBSIS33_NORMALIZE_THREADS");
+	if (value) {
+		__sis33_normalize_threads = strtol(value, NULL, 0);
+		LIBSIS33_DEBUG(3, "Normalizing with up to %d threads\n", __sis33_normalize_threads);
+	}
+}
+
+/**
+ * @brief Set the number of threads used to normalize the samples fetched
+ * @param nr_threads	- maximum number of threads, the calling one included
+ *
+ * @return previous number of threads
+ *
+ * Fetched samples are put in the host's endianness and reordered so that the
+ * first acquired one comes first. With large fetches this can be split among
+ * several threads; small ones are always done by the calling thread.
+ * The default is 1, which can be overridden with the environment variable
+ * LIBSIS33_NORMALIZE_THREADS.
+ */
+int sis33_normalize_threads(int nr_threads)
+{
+	int old = __sis33_normalize_threads;
+
+	LIBSIS33_DEBUG(4, "old %d new %d\n", old, nr_threads);
+	__sis33_normalize_threads = nr_threads;
+	return old;
 }
 
 /**
@@ -137,6 +168,8 @@ int sis33_close(sis33_t *device)
 	int ret;
 
 	LIBSIS33_DEBUG(4, "handle %p\n", device);
+	if (device->ring)
+		munmap(device->ring, device->ring_size);
 	ret = close(device->fd);
 	if (ret < 0)
 		__sis33_libc_error(__func__);
@@ -957,7 +990,7 @@ static int __fetch(sis33_t *device, unsigned int segment, unsigned int channel,
 		__sis33_libc_error(__func__);
 		return -1;
 	}
-	if (sis33acq_list_normalize(&list, acq_events)) {
+	if (sis33acq_normalize_threads(acqs, acqs, acq_events, __sis33_normalize_threads)) {
 		__sis33_libc_error(__func__);
 		return -1;
 	}
@@ -1052,6 +1085,367 @@ int sis33_fetch_timeout(sis33_t *device, unsigned int segment, unsigned int chan
 	return __fetch(device, segment, channel, acqs, n_acqs, SIS33_ACQF_TIMEOUT, endtime, timeout);
 }
 
+static int __fetch_channels(sis33_t *device, unsigned int segment, uint32_t channel_mask,
+			struct sis33_acq *acqs, unsigned int n_acqs, int flags,
+			struct timeval *endtime, struct timespec *ts)
+{
+	struct sis33_acq_mlist list;
+	int acq_events;
+	int i;
+
+	if (acqs == NULL || n_acqs == 0 || channel_mask == 0) {
+		__sis33_param_error(LIBSIS33_EINVAL);
+		return -1;
+	}
+	memset(&list, 0, sizeof(list));
+	list.segment		= segment;
+	list.channel_mask	= channel_mask;
+	list.acqs		= acqs;
+	list.n_acqs		= n_acqs;
+	list.flags		= flags;
+	if (ts)
+		memcpy(&list.timeout, ts, sizeof(*ts));
+
+	acq_events = ioctl(device->fd, SIS33_IOC_FETCH_CHANNELS, &list);
+	if (acq_events < 0) {
+		__sis33_libc_error(__func__);
+		return -1;
+	}
+	for (i = 0; channel_mask; channel_mask &= channel_mask - 1, i++) {
+		if (sis33acq_normalize_threads(&acqs[i * n_acqs], &acqs[i * n_acqs], acq_events,
+					       __sis33_normalize_threads)) {
+			__sis33_libc_error(__func__);
+			return -1;
+		}
+	}
+	if (endtime)
+		memcpy(endtime, &list.endtime, sizeof(*endtime));
+	return acq_events;
+}
+
+/**
+ * @brief Fetch, normalize and store samples from several channels of an sis33 device
+ * @param device	- sis33 device
+ * @param segment	- segment to get the samples from
+ * @param channel_mask	- channels to get the samples from; bit n for channel n
+ * @param acqs		- array of acquisition buffers, n_acqs per channel
+ * @param n_acqs	- number of acquisition buffers per channel
+ * @param endtime	- Local time when the acquisition finished. Can be NULL
+ *
+ * @return Number of acquired events per channel on success, -1 on failure.
+ *
+ * This is the same as calling sis33_fetch() for each channel in the mask,
+ * from the lowest to the highest, each with the next n_acqs buffers in
+ * 'acqs'; but all the channels are fetched with a single call to the driver,
+ * which reads them back to back. Channels that share an ADC group on the
+ * device are read from the module only once.
+ * \see sis33_fetch
+ * \see sis33_fetch_channels_wait
+ * \see sis33_fetch_channels_timeout
+ */
+int sis33_fetch_channels(sis33_t *device, unsigned int segment, uint32_t channel_mask,
+			 struct sis33_acq *acqs, unsigned int n_acqs, struct timeval *endtime)
+{
+	LIBSIS33_DEBUG(4, "handle %p segment %u channel_mask 0x%x acqs %p n_acqs %u endtime %p\n",
+		device, segment, channel_mask, acqs, n_acqs, endtime);
+	return __fetch_channels(device, segment, channel_mask, acqs, n_acqs, SIS33_ACQF_DONTWAIT, endtime, NULL);
+}
+
+/**
+ * @brief Fetch samples from several channels of an sis33 device with sleeping wait
+ * @param device	- sis33 device
+ * @param segment	- segment to get the samples from
+ * @param channel_mask	- channels to get the samples from; bit n for channel n
+ * @param acqs		- array of acquisition buffers, n_acqs per channel
+ * @param n_acqs	- number of acquisition buffers per channel
+ * @param endtime	- Local time when the acquisition finished. Can be NULL
+ *
+ * @return Number of acquired events per channel on success, -1 on failure.
+ *
+ * \see sis33_fetch_channels
+ * \see sis33_fetch_wait
+ */
+int sis33_fetch_channels_wait(sis33_t *device, unsigned int segment, uint32_t channel_mask,
+			      struct sis33_acq *acqs, unsigned int n_acqs, struct timeval *endtime)
+{
+	LIBSIS33_DEBUG(4, "handle %p segment %u channel_mask 0x%x acqs %p n_acqs %u endtime %p\n",
+		device, segment, channel_mask, acqs, n_acqs, endtime);
+	return __fetch_channels(device, segment, channel_mask, acqs, n_acqs, 0, endtime, NULL);
+}
+
+/**
+ * @brief Fetch samples from several channels of an sis33 device with timeout
+ * @param device	- sis33 device
+ * @param segment	- segment to get the samples from
+ * @param channel_mask	- channels to get the samples from; bit n for channel n
+ * @param acqs		- array of acquisition buffers, n_acqs per channel
+ * @param n_acqs	- number of acquisition buffers per channel
+ * @param endtime	- Local time when the acquisition finished. Can be NULL
+ * @param timeout	- acquisition timeout
+ *
+ * @return Number of acquired events per channel on success, -1 on failure.
+ *
+ * \see sis33_fetch_channels
+ * \see sis33_fetch_timeout
+ */
+int sis33_fetch_channels_timeout(sis33_t *device, unsigned int segment, uint32_t channel_mask,
+				 struct sis33_acq *acqs, unsigned int n_acqs,
+				 struct timeval *endtime, struct timespec *timeout)
+{
+	LIBSIS33_DEBUG(4, "handle %p segment %u channel_mask 0x%x acqs %p n_acqs %u sec %lu nsec %lu endtime %p\n",
+		device, segment, channel_mask, acqs, n_acqs, timeout->tv_sec, timeout->tv_nsec, endtime);
+	return __fetch_channels(device, segment, channel_mask, acqs, n_acqs, SIS33_ACQF_TIMEOUT, endtime, timeout);
+}
+
+/**
+ * @brief Start a continuous acquisition
+ * @param device	- sis33 device
+ * @param nr_events	- number of events per segment
+ * @param ev_length	- number of samples per event
+ * @param channel_mask	- channels to get the samples from; bit n for channel n
+ * @param nr_slots	- number of segments the ring can hold, at least 2
+ *
+ * @return 0 on success, -1 on failure
+ *
+ * The device acquires on its segments in turn until sis33_cont_stop() is
+ * called: as soon as a segment finishes the driver arms the next one, and
+ * copies the finished one to a ring of 'nr_slots' slots, mapped into this
+ * process. The segments are read from the ring with sis33_cont_get_slot(),
+ * sis33_cont_read() and sis33_cont_put_slot(); those that finish while the
+ * ring is full are dropped, see sis33_cont_get_counters().
+ *
+ * The device needs at least 2 segments, see sis33_set_nr_segments(). While the
+ * continuous acquisition goes on, the device can't be configured, and
+ * sis33_acq() and sis33_fetch() fail. Closing the handle stops it.
+ */
+int sis33_cont_start(sis33_t *device, unsigned int nr_events, unsigned int ev_length,
+		     uint32_t channel_mask, unsigned int nr_slots)
+{
+	struct sis33_cont_desc desc;
+	void *ring;
+
+	LIBSIS33_DEBUG(4, "handle %p nr_events %u ev_length %u channel_mask 0x%x nr_slots %u\n",
+		device, nr_events, ev_length, channel_mask, nr_slots);
+	if (device->ring) {
+		__sis33_param_error(LIBSIS33_EINVAL);
+		return -1;
+	}
+	memset(&desc, 0, sizeof(desc));
+	desc.nr_events		= nr_events;
+	desc.ev_length		= ev_length;
+	desc.channel_mask	= channel_mask;
+	desc.nr_slots		= nr_slots;
+	if (ioctl(device->fd, SIS33_IOC_CONT_START, &desc) < 0) {
+		__sis33_libc_error(__func__);
+		return -1;
+	}
+	ring = mmap(NULL, desc.ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, device->fd, 0);
+	if (ring == MAP_FAILED) {
+		__sis33_libc_error(__func__);
+		ioctl(device->fd, SIS33_IOC_CONT_STOP);
+		return -1;
+	}
+	device->ring = ring;
+	device->ring_size = desc.ring_size;
+	return 0;
+}
+
+/**
+ * @brief Stop a continuous acquisition
+ * @param device	- sis33 device
+ *
+ * @return 0 on success, -1 on failure
+ *
+ * The slots that haven't been read are lost.
+ * \see sis33_cont_start
+ */
+int sis33_cont_stop(sis33_t *device)
+{
+	int ret = 0;
+
+	LIBSIS33_DEBUG(4, "handle %p\n", device);
+	if (ioctl(device->fd, SIS33_IOC_CONT_STOP) < 0) {
+		__sis33_libc_error(__func__);
+		ret = -1;
+	}
+	if (device->ring) {
+		munmap(device->ring, device->ring_size);
+		device->ring = NULL;
+	}
+	return ret;
+}
+
+/**
+ * @brief Wait for the next segment of a continuous acquisition
+ * @param device	- sis33 device
+ * @param timeout_ms	- timeout in milliseconds; -1 to wait forever
+ *
+ * @return pointer to the slot on success, NULL on failure
+ *
+ * The slot stays valid until sis33_cont_put_slot() is called. When the
+ * acquisition has stopped and there are no more slots, this fails with
+ * errno set to ENODATA; when the timeout expires, with ETIME.
+ * \see sis33_cont_start
+ */
+struct sis33_ring_slot *sis33_cont_get_slot(sis33_t *device, int timeout_ms)
+{
+	volatile struct sis33_ring *ring = device->ring;
+	struct pollfd pfd;
+	int ret;
+
+	LIBSIS33_DEBUG(4, "handle %p timeout_ms %d\n", device, timeout_ms);
+	if (ring == NULL) {
+		__sis33_param_error(LIBSIS33_EINVAL);
+		return NULL;
+	}
+	while (ring->head == ring->tail) {
+		if (ring->stopped) {
+			errno = ENODATA;
+			__sis33_libc_error(__func__);
+			return NULL;
+		}
+		pfd.fd = device->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		ret = poll(&pfd, 1, timeout_ms);
+		if (ret < 0) {
+			__sis33_libc_error(__func__);
+			return NULL;
+		}
+		if (ret == 0) {
+			errno = ETIME;
+			__sis33_libc_error(__func__);
+			return NULL;
+		}
+		if (pfd.revents & POLLHUP && ring->head == ring->tail) {
+			errno = ENODATA;
+			__sis33_libc_error(__func__);
+			return NULL;
+		}
+	}
+	/* read the slot only after the head that published it */
+	__sync_synchronize();
+	return (void *)((char *)device->ring + ring->data_offset + (ring->tail % ring->nr_slots) * ring->slot_size);
+}
+
+/**
+ * @brief Release the slot returned by sis33_cont_get_slot()
+ * @param device	- sis33 device
+ *
+ * @return 0 on success, -1 on failure
+ */
+int sis33_cont_put_slot(sis33_t *device)
+{
+	volatile struct sis33_ring *ring = device->ring;
+
+	LIBSIS33_DEBUG(4, "handle %p\n", device);
+	if (ring == NULL || ring->head == ring->tail) {
+		__sis33_param_error(LIBSIS33_EINVAL);
+		return -1;
+	}
+	/* we're done with the slot before the driver can overwrite it */
+	__sync_synchronize();
+	ring->tail++;
+	return 0;
+}
+
+/* events described on the stack at a time by sis33_cont_read() */
+#define SIS33_CONT_READ_CHUNK	64
+
+/**
+ * @brief Copy and normalize the samples of a channel from a ring slot
+ * @param device	- sis33 device
+ * @param slot		- slot returned by sis33_cont_get_slot()
+ * @param channel	- channel to get the samples from
+ * @param acqs		- array of acquisition buffers
+ * @param n_acqs	- number of acquisition buffers
+ *
+ * @return Number of events copied on success, -1 on failure.
+ *
+ * The buffers must be able to hold the slot's ev_length samples. The samples
+ * are stored as sis33_fetch() would.
+ */
+int sis33_cont_read(sis33_t *device, const struct sis33_ring_slot *slot, unsigned int channel,
+		    struct sis33_acq *acqs, unsigned int n_acqs)
+{
+	const struct sis33_ring_event *event;
+	const uint16_t *samples;
+	struct sis33_acq src[SIS33_CONT_READ_CHUNK];
+	size_t ev_size;
+	unsigned int chunk;
+	unsigned int done;
+	unsigned int idx;
+	unsigned int n;
+	unsigned int i;
+	unsigned int j;
+
+	LIBSIS33_DEBUG(4, "handle %p slot %p channel %u acqs %p n_acqs %u\n",
+		device, slot, channel, acqs, n_acqs);
+	if (device->ring == NULL || channel >= 32 || !(slot->channel_mask & (1U << channel))) {
+		__sis33_param_error(LIBSIS33_EINVAL);
+		return -1;
+	}
+	ev_size = slot->ev_length * sizeof(uint16_t);
+	n = slot->nr_events < n_acqs ? slot->nr_events : n_acqs;
+	for (i = 0; i < n; i++) {
+		if (acqs[i].data == NULL || acqs[i].size < ev_size) {
+			__sis33_param_error(LIBSIS33_EINVAL);
+			return -1;
+		}
+	}
+	/* index of the channel among those in the slot */
+	idx = __builtin_popcount(slot->channel_mask & ((1U << channel) - 1)) * device->ring->slot_events;
+	event = (const struct sis33_ring_event *)(slot + 1) + idx;
+	samples = (const uint16_t *)((const char *)slot + slot->samples_offset) + idx * slot->ev_length;
+	memset(src, 0, sizeof(src));
+	/* the samples are normalized straight from the ring, a chunk at a time */
+	for (done = 0; done < n; done += chunk) {
+		chunk = n - done < SIS33_CONT_READ_CHUNK ? n - done : SIS33_CONT_READ_CHUNK;
+		for (i = 0; i < chunk; i++) {
+			j = done + i;
+			src[i].data		= (uint16_t *)(samples + j * slot->ev_length);
+			src[i].size		= ev_size;
+			src[i].nr_samples	= event[j].nr_samples;
+			src[i].first_samp	= event[j].first_samp;
+			src[i].prevticks	= event[j].prevticks;
+			src[i].be		= slot->be;
+		}
+		if (sis33acq_normalize_threads(src, &acqs[done], chunk, __sis33_normalize_threads)) {
+			__sis33_libc_error(__func__);
+			return -1;
+		}
+	}
+	return n;
+}
+
+/**
+ * @brief Get the counters of a continuous acquisition
+ * @param device	- sis33 device
+ * @param completed	- segments acquired. Can be NULL
+ * @param dropped	- segments dropped because the ring was full. Can be NULL
+ * @param errors	- segments dropped because they couldn't be read. Can be NULL
+ *
+ * @return 0 on success, -1 on failure
+ */
+int sis33_cont_get_counters(sis33_t *device, unsigned int *completed, unsigned int *dropped,
+			    unsigned int *errors)
+{
+	volatile struct sis33_ring *ring = device->ring;
+
+	LIBSIS33_DEBUG(4, "handle %p\n", device);
+	if (ring == NULL) {
+		__sis33_param_error(LIBSIS33_EINVAL);
+		return -1;
+	}
+	if (completed)
+		*completed = ring->completed;
+	if (dropped)
+		*dropped = ring->dropped;
+	if (errors)
+		*errors = ring->errors;
+	return 0;
+}
+
 /**
  * @brief get the number of bits of a device
  * @param device	- sis33 device
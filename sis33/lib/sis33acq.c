@@ -9,6 +9,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include "sis33acq.h"
 
@@ -31,63 +33,363 @@ static inline uint32_t be_to_cpu(uint32_t hwval)
 		return hwval;
 }
 
-static void acq_swap(void *buf, size_t size)
+/*
+ * Normalizing an acquisition means putting its samples in the host's
+ * endianness and rotating them so that the first valid one comes first.
+ *
+ * Big endian data come in 32-bit words holding two samples each, so that
+ * once swapped, sample j is the byte-swapped raw sample j ^ 1. The samples
+ * after the last whole word, if any, are left as they are.
+ *
+ * Both steps are done in one pass: sample i of the result is the swapped
+ * sample (first_samp + i) % n, which is read from the raw buffer and stored
+ * straight away. In place there is no buffer to store it to, so the samples
+ * are swapped in place first and then rotated by swapping blocks; neither
+ * allocates memory.
+ *
+ * The swap is done 8 samples at a time with byte shuffles: SSSE3 if the CPU
+ * has it (checked at run time), NEON where the compiler targets it.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define SIS33ACQ_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SIS33ACQ_NEON
+#include <arm_neon.h>
+#endif
+
+/* samples moved through the stack when rotating in place */
+#define SIS33ACQ_CHUNK		2048
+/* minimum number of bytes per thread in sis33acq_normalize_threads() */
+#define SIS33ACQ_MT_MIN		(256 * 1024)
+/* maximum number of threads in sis33acq_normalize_threads() */
+#define SIS33ACQ_MT_MAX		16
+
+/*
+ * dst[k] = swapped sample j + k, for k < count. j + count must not exceed
+ * @nw, the number of samples in whole words. dst may be raw + j if j is even.
+ */
+typedef void (*swap_copy_fn)(uint16_t *dst, const uint16_t *raw, unsigned int j,
+			     unsigned int count, unsigned int nw);
+
+static void swap_copy_scalar(uint16_t *dst, const uint16_t *raw, unsigned int j,
+			     unsigned int count, unsigned int nw)
 {
-	uint32_t *data = buf;
-	int i;
+	uint16_t a, b;
+	unsigned int k = 0;
 
-	for (i = 0; i < size / sizeof(uint32_t); i++)
-		data[i] = be_to_cpu(data[i]);
+	if (count && j & 1) {
+		dst[0] = bswap_16(raw[j - 1]);
+		k = 1;
+	}
+	/* by pairs: both samples are read before either is written */
+	for (; k + 2 <= count; k += 2) {
+		a = raw[j + k];
+		b = raw[j + k + 1];
+		dst[k] = bswap_16(b);
+		dst[k + 1] = bswap_16(a);
+	}
+	if (k < count)
+		dst[k] = bswap_16(raw[j + k + 1]);
 }
 
-static void sis33acq_list_swap(struct sis33_acq_list *list, int elems)
+#ifdef SIS33ACQ_X86
+__attribute__((target("ssse3")))
+static void swap_copy_ssse3(uint16_t *dst, const uint16_t *raw, unsigned int j,
+			    unsigned int count, unsigned int nw)
 {
-	struct sis33_acq *acq;
-	int i;
+	const __m128i mask = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+					   11, 10, 9, 8, 15, 14, 13, 12);
+	__m128i cur, next;
+	unsigned int k = 0;
 
-	for (i = 0; i < elems; i++) {
-		acq = &list->acqs[i];
-		if (acq->be && get_endian() == LITTLE_ENDIAN) {
-			acq_swap(acq->data, acq->size);
-			acq->be = 0;
+	if (j & 1) {
+		/*
+		 * Swap from the word-aligned sample before j, and shift the
+		 * result by a sample, carrying the vector over to the next
+		 * iteration.
+		 */
+		const uint16_t *p = raw + j - 1;
+
+		if (count >= 8 && j + 15 <= nw) {
+			cur = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), mask);
+			for (; k + 8 <= count && j + k + 15 <= nw; k += 8) {
+				next = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + k + 8)), mask);
+				_mm_storeu_si128((__m128i *)(dst + k), _mm_alignr_epi8(next, cur, 2));
+				cur = next;
+			}
+		}
+	} else {
+		for (; k + 8 <= count; k += 8) {
+			cur = _mm_loadu_si128((const __m128i *)(raw + j + k));
+			_mm_storeu_si128((__m128i *)(dst + k), _mm_shuffle_epi8(cur, mask));
+		}
+	}
+	swap_copy_scalar(dst + k, raw, j + k, count - k, nw);
+}
+#endif /* SIS33ACQ_X86 */
+
+#ifdef SIS33ACQ_NEON
+static void swap_copy_neon(uint16_t *dst, const uint16_t *raw, unsigned int j,
+			   unsigned int count, unsigned int nw)
+{
+	uint8x16_t cur, next;
+	unsigned int k = 0;
+
+	if (j & 1) {
+		const uint16_t *p = raw + j - 1;
+
+		if (count >= 8 && j + 15 <= nw) {
+			cur = vrev32q_u8(vld1q_u8((const uint8_t *)p));
+			for (; k + 8 <= count && j + k + 15 <= nw; k += 8) {
+				next = vrev32q_u8(vld1q_u8((const uint8_t *)(p + k + 8)));
+				vst1q_u8((uint8_t *)(dst + k), vextq_u8(cur, next, 2));
+				cur = next;
+			}
+		}
+	} else {
+		for (; k + 8 <= count; k += 8) {
+			cur = vld1q_u8((const uint8_t *)(raw + j + k));
+			vst1q_u8((uint8_t *)(dst + k), vrev32q_u8(cur));
+		}
+	}
+	swap_copy_scalar(dst + k, raw, j + k, count - k, nw);
+}
+#endif /* SIS33ACQ_NEON */
+
+static swap_copy_fn swap_copy;
+
+static swap_copy_fn swap_copy_best(void)
+{
+#if defined(SIS33ACQ_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3"))
+		return swap_copy_ssse3;
+#elif defined(SIS33ACQ_NEON)
+	return swap_copy_neon;
+#endif
+	return swap_copy_scalar;
+}
+
+static inline swap_copy_fn get_swap_copy(void)
+{
+	/* racy but harmless: every thread would store the same pointer */
+	if (swap_copy == NULL)
+		swap_copy = swap_copy_best();
+	return swap_copy;
+}
+
+/* dst[k] = normalized sample j + k, for j + k < n */
+static void copy_range(uint16_t *dst, const uint16_t *raw, unsigned int j,
+		       unsigned int count, unsigned int nw, int swap)
+{
+	unsigned int c = 0;
+
+	if (swap && j < nw) {
+		c = count < nw - j ? count : nw - j;
+		get_swap_copy()(dst, raw, j, c, nw);
+	}
+	memcpy(dst + c, raw + j + c, (count - c) * sizeof(uint16_t));
+}
+
+static void memswap16(uint16_t *a, uint16_t *b, unsigned int n)
+{
+	uint16_t tmp[SIS33ACQ_CHUNK];
+	unsigned int len;
+
+	while (n) {
+		len = n < SIS33ACQ_CHUNK ? n : SIS33ACQ_CHUNK;
+		memcpy(tmp, a, len * sizeof(uint16_t));
+		memcpy(a, b, len * sizeof(uint16_t));
+		memcpy(b, tmp, len * sizeof(uint16_t));
+		a += len;
+		b += len;
+		n -= len;
+	}
+}
+
+/* rotate @a left by @first samples, without allocating memory */
+static void rotate(uint16_t *a, unsigned int n, unsigned int first)
+{
+	uint16_t tmp[SIS33ACQ_CHUNK];
+	unsigned int rest;
+
+	while (first) {
+		rest = n - first;
+		if (first <= SIS33ACQ_CHUNK) {
+			memcpy(tmp, a, first * sizeof(uint16_t));
+			memmove(a, a + first, rest * sizeof(uint16_t));
+			memcpy(a + rest, tmp, first * sizeof(uint16_t));
+			return;
+		}
+		if (rest <= SIS33ACQ_CHUNK) {
+			memcpy(tmp, a + first, rest * sizeof(uint16_t));
+			memmove(a + rest, a, first * sizeof(uint16_t));
+			memcpy(a, tmp, rest * sizeof(uint16_t));
+			return;
+		}
+		/*
+		 * Swap the shorter part with the other end of the longer one,
+		 * which leaves it in place (Gries and Mills); what remains is
+		 * a smaller rotation.
+		 */
+		if (first <= rest) {
+			memswap16(a, a + rest, first);
+			n = rest;
+		} else {
+			memswap16(a, a + first, rest);
+			a += rest;
+			n = first;
+			first -= rest;
 		}
 	}
 }
 
-static int sis33acq_reorder(struct sis33_acq *acq)
+/* normalize @src into @dst, which may be @src */
+static int acq_normalize(const struct sis33_acq *src, struct sis33_acq *dst)
 {
-	uint8_t *buf;
-	size_t len1;
+	unsigned int n = src->size / sizeof(uint16_t);
+	unsigned int first = src->first_samp;
+	unsigned int nw = src->size / sizeof(uint32_t) * 2;
+	int swap = src->be && get_endian() == LITTLE_ENDIAN;
 
-	buf = malloc(acq->size);
-	if (buf == NULL)
+	if (first && first >= n) {
+		errno = EINVAL;
 		return -1;
-	len1 = acq->size - acq->first_samp * sizeof(uint16_t);
-	memcpy(buf, &acq->data[acq->first_samp], len1);
-	memcpy(buf + len1, acq->data, acq->size - len1);
-	memcpy(acq->data, buf, acq->size);
-	acq->first_samp = 0;
-	free(buf);
+	}
+	if (dst != src) {
+		if (dst->data == NULL || dst->size < src->size) {
+			errno = EINVAL;
+			return -1;
+		}
+		copy_range(dst->data, src->data, first, n - first, nw, swap);
+		copy_range(dst->data + n - first, src->data, 0, first, nw, swap);
+		dst->nr_samples	= src->nr_samples;
+		dst->prevticks	= src->prevticks;
+	} else {
+		if (swap)
+			get_swap_copy()(dst->data, dst->data, 0, nw, nw);
+		if (first)
+			rotate(dst->data, n, first);
+	}
+	dst->first_samp = 0;
+	dst->be = src->be && !swap;
 	return 0;
 }
 
-static int sis33acq_list_reorder(struct sis33_acq_list *list, int elems)
+/**
+ * sis33acq_normalize_copy - normalize acquisitions into other buffers
+ * @src:	acquisitions to normalize; they're left untouched
+ * @dst:	acquisitions to store the result to; their data buffers must
+ *		be at least as big as those of @src
+ * @elems:	number of acquisitions
+ *
+ * The samples are read from @src only once.
+ *
+ * returns 0 on success, -1 on failure (errno set)
+ */
+int sis33acq_normalize_copy(const struct sis33_acq *src, struct sis33_acq *dst, int elems)
 {
-	struct sis33_acq *acq;
 	int i;
 
 	for (i = 0; i < elems; i++) {
-		acq = &list->acqs[i];
-		if (acq->first_samp && sis33acq_reorder(acq))
-				return -1;
+		if (acq_normalize(&src[i], &dst[i]))
+			return -1;
 	}
 	return 0;
 }
 
+int sis33acq_normalize(struct sis33_acq *acqs, int elems)
+{
+	return sis33acq_normalize_copy(acqs, acqs, elems);
+}
+
 int sis33acq_list_normalize(struct sis33_acq_list *list, int elems)
 {
-	sis33acq_list_swap(list, elems);
-	return sis33acq_list_reorder(list, elems);
+	return sis33acq_normalize(list->acqs, elems);
+}
+
+struct sis33acq_job {
+	const struct sis33_acq	*src;
+	struct sis33_acq	*dst;
+	int			elems;
+	int			ret;
+	int			err;
+};
+
+static void *sis33acq_job_run(void *arg)
+{
+	struct sis33acq_job *job = arg;
+
+	job->ret = sis33acq_normalize_copy(job->src, job->dst, job->elems);
+	if (job->ret)
+		job->err = errno;
+	return NULL;
+}
+
+/**
+ * sis33acq_normalize_threads - normalize acquisitions with several threads
+ * @src:	acquisitions to normalize
+ * @dst:	acquisitions to store the result to; may be @src
+ * @elems:	number of acquisitions
+ * @nr_threads:	maximum number of threads, the calling one included
+ *
+ * The acquisitions are split among up to SIS33ACQ_MT_MAX threads; fewer
+ * threads are used if each one would get less than SIS33ACQ_MT_MIN bytes.
+ *
+ * returns 0 on success, -1 on failure (errno set)
+ */
+int sis33acq_normalize_threads(const struct sis33_acq *src, struct sis33_acq *dst, int elems, int nr_threads)
+{
+	struct sis33acq_job jobs[SIS33ACQ_MT_MAX];
+	pthread_t threads[SIS33ACQ_MT_MAX];
+	size_t bytes = 0;
+	int started;
+	int ret = 0;
+	int err = 0;
+	int per;
+	int i;
+
+	for (i = 0; i < elems; i++)
+		bytes += src[i].size;
+	if (nr_threads > SIS33ACQ_MT_MAX)
+		nr_threads = SIS33ACQ_MT_MAX;
+	if (nr_threads > elems)
+		nr_threads = elems;
+	if (nr_threads > bytes / SIS33ACQ_MT_MIN)
+		nr_threads = bytes / SIS33ACQ_MT_MIN;
+	if (nr_threads <= 1)
+		return sis33acq_normalize_copy(src, dst, elems);
+
+	per = (elems + nr_threads - 1) / nr_threads;
+	for (i = 0; i < nr_threads; i++) {
+		int first = i * per;
+
+		jobs[i].src	= src + first;
+		jobs[i].dst	= dst + first;
+		jobs[i].elems	= first >= elems ? 0 : (elems - first < per ? elems - first : per);
+	}
+	/* job 0 runs on this thread; the others' too if they can't be started */
+	for (started = 1; started < nr_threads; started++) {
+		if (pthread_create(&threads[started], NULL, sis33acq_job_run, &jobs[started]))
+			break;
+	}
+	for (i = started; i < nr_threads; i++)
+		sis33acq_job_run(&jobs[i]);
+	sis33acq_job_run(&jobs[0]);
+	for (i = 1; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < nr_threads; i++) {
+		if (jobs[i].ret) {
+			ret = -1;
+			err = jobs[i].err;
+		}
+	}
+	if (ret)
+		errno = err;
+	return ret;
 }
 
 struct sis33_acq *sis33acq_zalloc(unsigned int nr_events, unsigned int ev_length)
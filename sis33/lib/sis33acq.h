@@ -22,6 +22,9 @@ static inline unsigned short myswap32(unsigned short val)
 #define BIG_ENDIAN 1
 #endif
 
+int sis33acq_normalize(struct sis33_acq *acqs, int elems);
+int sis33acq_normalize_copy(const struct sis33_acq *src, struct sis33_acq *dst, int elems);
+int sis33acq_normalize_threads(const struct sis33_acq *src, struct sis33_acq *dst, int elems, int nr_threads);
 int sis33acq_list_normalize(struct sis33_acq_list *list, int elems);
 struct sis33_acq *sis33acq_zalloc(unsigned int nr_events, unsigned int ev_length);
 void sis33acq_free(struct sis33_acq *acqs, unsigned int n_acqs);
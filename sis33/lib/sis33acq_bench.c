@@ -0,0 +1,282 @@
+/*
+ * sis33acq_bench.c
+ * Benchmark of the normalization of sis33 acquisitions
+ *
+ * Events of big endian samples, each starting at a random first_samp, are
+ * normalized with:
+ *
+ * - old: what libsis33 used to do: swap every word, and then rotate through
+ *   a buffer allocated for each event;
+ * - inplace: sis33acq_normalize();
+ * - copy: sis33acq_normalize_copy(), from the raw events to other buffers,
+ *   as sis33_cont_read() does from the ring;
+ * - threads: sis33acq_normalize_threads() in place, with up to -t threads.
+ *
+ * The in-place methods have to start from raw data each time, so their
+ * timings include a memcpy of the events; memcpy alone is shown as a
+ * reference. Every result is checked against the old method's; before that,
+ * all the event lengths up to 64 samples are checked with every first_samp.
+ *
+ * Copyright (c) 2010 Emilio G. Cota <cota@braap.org>
+ * Released under the GPL v2. (and only v2, not any later version)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "sis33acq.h"
+
+static unsigned int ev_length = 1 << 16;	/* samples */
+static unsigned int nr_events = 64;
+static int nr_threads = 4;
+static int loops = 20;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* the normalization before sis33acq_normalize_copy() */
+static int old_normalize(struct sis33_acq *acqs, int elems)
+{
+	struct sis33_acq *acq;
+	uint32_t *data;
+	uint8_t *buf;
+	size_t len1;
+	int i, j;
+
+	for (i = 0; i < elems; i++) {
+		acq = &acqs[i];
+		if (!acq->be)
+			continue;
+		data = (uint32_t *)acq->data;
+		for (j = 0; j < acq->size / sizeof(uint32_t); j++)
+			data[j] = myswap32(data[j]);
+		acq->be = 0;
+	}
+	for (i = 0; i < elems; i++) {
+		acq = &acqs[i];
+		if (!acq->first_samp)
+			continue;
+		buf = malloc(acq->size);
+		if (buf == NULL)
+			return -1;
+		len1 = acq->size - acq->first_samp * sizeof(uint16_t);
+		memcpy(buf, &acq->data[acq->first_samp], len1);
+		memcpy(buf + len1, acq->data, acq->size - len1);
+		memcpy(acq->data, buf, acq->size);
+		acq->first_samp = 0;
+		free(buf);
+	}
+	return 0;
+}
+
+static struct sis33_acq *acqs_alloc(unsigned int n, unsigned int length)
+{
+	struct sis33_acq *acqs;
+	unsigned int i;
+
+	acqs = calloc(n, sizeof(*acqs));
+	if (acqs == NULL)
+		return NULL;
+	for (i = 0; i < n; i++) {
+		uint16_t *p = malloc((length + 1) * sizeof(uint16_t));
+
+		if (p == NULL)
+			return NULL;
+		/* not 16-byte aligned, as the samples in the ring may not be */
+		acqs[i].data = p + 1;
+		acqs[i].size = length * sizeof(uint16_t);
+	}
+	return acqs;
+}
+
+/* copy data and headers of @src to @dst */
+static void restore(struct sis33_acq *dst, const struct sis33_acq *src, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		memcpy(dst[i].data, src[i].data, src[i].size);
+		dst[i].first_samp	= src[i].first_samp;
+		dst[i].be		= src[i].be;
+	}
+}
+
+static int same(const struct sis33_acq *a, const struct sis33_acq *b, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		if (memcmp(a[i].data, b[i].data, a[i].size) || a[i].first_samp || b[i].first_samp)
+			return 0;
+	}
+	return 1;
+}
+
+/* every first_samp of the lengths up to 64 samples */
+static int check_small(void)
+{
+	struct sis33_acq *raw, *ref, *out;
+	unsigned int len, f, i;
+
+	raw = acqs_alloc(1, 64);
+	ref = acqs_alloc(1, 64);
+	out = acqs_alloc(1, 64);
+	if (raw == NULL || ref == NULL || out == NULL)
+		return -1;
+	for (i = 0; i < 64; i++)
+		raw->data[i] = rand();
+	for (len = 1; len <= 64; len++) {
+		raw->size = ref->size = out->size = len * sizeof(uint16_t);
+		for (f = 0; f < len; f++) {
+			raw->first_samp = f;
+			raw->be = 1;
+			restore(ref, raw, 1);
+			if (old_normalize(ref, 1))
+				return -1;
+			restore(out, raw, 1);
+			if (sis33acq_normalize(out, 1) || !same(ref, out, 1)) {
+				printf("WRONG: in place, length %u first_samp %u\n", len, f);
+				return -1;
+			}
+			memset(out->data, 0, out->size);
+			if (sis33acq_normalize_copy(raw, out, 1) || !same(ref, out, 1)) {
+				printf("WRONG: copy, length %u first_samp %u\n", len, f);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void report(const char *name, int64_t t)
+{
+	double bytes = (double)loops * nr_events * ev_length * sizeof(uint16_t);
+
+	printf("%-12s %10.1f MB/s %10.3f ms/loop\n", name, bytes * 1000 / t, t / 1e6 / loops);
+}
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s [options]\n"
+		"  -l <n>  samples per event (default %u)\n"
+		"  -e <n>  events (default %u)\n"
+		"  -t <n>  maximum number of threads (default %d)\n"
+		"  -n <n>  loops per measurement (default %d)\n",
+		prog, ev_length, nr_events, nr_threads, loops);
+}
+
+int main(int argc, char *argv[])
+{
+	struct sis33_acq *raw, *ref, *work;
+	char name[32];
+	unsigned int i, j;
+	int64_t t;
+	int c, k;
+
+	while ((c = getopt(argc, argv, "l:e:t:n:h")) != -1) {
+		switch (c) {
+		case 'l':
+			ev_length = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			nr_events = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'n':
+			loops = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			exit(c != 'h');
+		}
+	}
+	if (!ev_length || !nr_events || nr_threads < 1 || loops < 1) {
+		usage(argv[0]);
+		exit(1);
+	}
+
+	if (check_small()) {
+		fprintf(stderr, "small events: failed\n");
+		exit(1);
+	}
+
+	raw = acqs_alloc(nr_events, ev_length);
+	ref = acqs_alloc(nr_events, ev_length);
+	work = acqs_alloc(nr_events, ev_length);
+	if (raw == NULL || ref == NULL || work == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < nr_events; i++) {
+		for (j = 0; j < ev_length; j++)
+			raw[i].data[j] = rand();
+		raw[i].first_samp = rand() % ev_length;
+		raw[i].be = 1;
+	}
+	restore(ref, raw, nr_events);
+	if (old_normalize(ref, nr_events)) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	printf("%u events of %u samples\n", nr_events, ev_length);
+
+	t = now_ns();
+	for (k = 0; k < loops; k++)
+		restore(work, raw, nr_events);
+	report("memcpy", now_ns() - t);
+
+	t = now_ns();
+	for (k = 0; k < loops; k++) {
+		restore(work, raw, nr_events);
+		old_normalize(work, nr_events);
+	}
+	report("old", now_ns() - t);
+
+	t = now_ns();
+	for (k = 0; k < loops; k++) {
+		restore(work, raw, nr_events);
+		sis33acq_normalize(work, nr_events);
+	}
+	report("inplace", now_ns() - t);
+	if (!same(ref, work, nr_events))
+		printf("WRONG: inplace\n");
+
+	t = now_ns();
+	for (k = 0; k < loops; k++)
+		sis33acq_normalize_copy(raw, work, nr_events);
+	report("copy", now_ns() - t);
+	if (!same(ref, work, nr_events))
+		printf("WRONG: copy\n");
+
+	for (c = 2; c <= nr_threads; c *= 2) {
+		t = now_ns();
+		for (k = 0; k < loops; k++) {
+			restore(work, raw, nr_events);
+			sis33acq_normalize_threads(work, work, nr_events, c);
+		}
+		sprintf(name, "threads(%d)", c);
+		report(name, now_ns() - t);
+		if (!same(ref, work, nr_events))
+			printf("WRONG: %s\n", name);
+
+		t = now_ns();
+		for (k = 0; k < loops; k++)
+			sis33acq_normalize_threads(raw, work, nr_events, c);
+		sprintf(name, "copy(%d)", c);
+		report(name, now_ns() - t);
+		if (!same(ref, work, nr_events))
+			printf("WRONG: %s\n", name);
+	}
+	return 0;
+}
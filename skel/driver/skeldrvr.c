@@ -86,6 +86,7 @@ static const char *SkelStandardIoctlNames[] = {
 	[_IOC_NR(SkelDrvrIoctlJTAG_CLOSE)]	= "JTAG_CLOSE",
 	[_IOC_NR(SkelDrvrIoctlRAW_BLOCK_READ)] = "RAW_BLOCK_READ",
 	[_IOC_NR(SkelDrvrIoctlRAW_BLOCK_WRITE)] = "RAW_BLOCK_WRITE",
+	[_IOC_NR(SkelDrvrIoctlGET_DMA_BUFS)]	= "GET_DMA_BUFS",
 };
 #define SkelDrvrSTANDARD_IOCTL_CALLS ARRAY_SIZE(SkelStandardIoctlNames)
 
@@ -135,7 +136,7 @@ static const char *GetIoctlName(int nr)
 	first = _IOC_NR(nr) - _IOC_NR(SkelDrvrIoctlSET_DEBUG);
 
 	/* skel's IOCTL */
-	if (WITHIN_RANGE(0, first, _IOC_NR(SkelDrvrIoctlLAST_STANDARD)) &&
+	if (WITHIN_RANGE(0, first, SkelDrvrSTANDARD_IOCTL_CALLS - 1) &&
 	    _IOC_TYPE(nr) == SKEL_IOCTL_MAGIC)
 		return SkelStandardIoctlNames[_IOC_NR(nr)];
 
@@ -276,9 +277,76 @@ static S32 GetVersion(SkelDrvrModuleContext *mcon, SkelDrvrVersion *ver)
 }
 
 /*
- * This RawIo implementation permits transfer of blocks of data to or from user space
- * to the hardware via an inermiediate paging kernel buffer. The RawIoBlock structure
- * controls how the transfer takes place.
+ * PIO loops for raw block transfers, one per data width and byte order so
+ * that the inner loop carries no switch. @step is the module byte stride
+ * between items (0 for a FIFO) and @n the number of items.
+ */
+typedef void (*skel_pio_t)(char *mp, void *buf, int n, int step);
+
+#define SKEL_PIO_READ(name, type, rd)					\
+static void name(char *mp, void *buf, int n, int step)		\
+{									\
+	type *kp = buf;							\
+									\
+	for (; n >= 4; n -= 4, kp += 4, mp += 4 * step) {		\
+		kp[0] = rd(mp);						\
+		kp[1] = rd(mp + step);					\
+		kp[2] = rd(mp + 2 * step);				\
+		kp[3] = rd(mp + 3 * step);				\
+	}								\
+	for (; n > 0; n--, kp++, mp += step)				\
+		*kp = rd(mp);						\
+}
+
+#define SKEL_PIO_WRITE(name, type, wr)					\
+static void name(char *mp, void *buf, int n, int step)		\
+{									\
+	type *kp = buf;							\
+									\
+	for (; n >= 4; n -= 4, kp += 4, mp += 4 * step) {		\
+		wr(kp[0], mp);						\
+		wr(kp[1], mp + step);					\
+		wr(kp[2], mp + 2 * step);				\
+		wr(kp[3], mp + 3 * step);				\
+	}								\
+	for (; n > 0; n--, kp++, mp += step)				\
+		wr(*kp, mp);						\
+}
+
+SKEL_PIO_READ(pio_read8, uint8_t, cdcm_ioread8)
+SKEL_PIO_READ(pio_read16be, uint16_t, cdcm_ioread16be)
+SKEL_PIO_READ(pio_read16le, uint16_t, cdcm_ioread16le)
+SKEL_PIO_READ(pio_read32be, uint32_t, cdcm_ioread32be)
+SKEL_PIO_READ(pio_read32le, uint32_t, cdcm_ioread32le)
+
+SKEL_PIO_WRITE(pio_write8, uint8_t, cdcm_iowrite8)
+SKEL_PIO_WRITE(pio_write16be, uint16_t, cdcm_iowrite16be)
+SKEL_PIO_WRITE(pio_write16le, uint16_t, cdcm_iowrite16le)
+SKEL_PIO_WRITE(pio_write32be, uint32_t, cdcm_iowrite32be)
+SKEL_PIO_WRITE(pio_write32le, uint32_t, cdcm_iowrite32le)
+
+static skel_pio_t pio_select(int dw, int bendf, int write)
+{
+	switch (dw) {
+	case 8:
+		return write ? pio_write8 : pio_read8;
+	case 16:
+		if (write)
+			return bendf ? pio_write16be : pio_write16le;
+		return bendf ? pio_read16be : pio_read16le;
+	case 32:
+		if (write)
+			return bendf ? pio_write32be : pio_write32le;
+		return bendf ? pio_read32be : pio_read32le;
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * This RawIo implementation permits transfer of blocks of data to or from user
+ * space to the hardware. The RawIoBlock structure controls how the transfer
+ * takes place.
  *
  * RawIoBlock:
  *
@@ -291,29 +359,28 @@ static S32 GetVersion(SkelDrvrModuleContext *mcon, SkelDrvrVersion *ver)
  *
  * flag is zero on read and non zero on write
  *
+ * Large linear or FIFO transfers on VME are done by DMA straight to/from
+ * the user's buffer (see skel_vme_rawio_dma()). Everything else is done by
+ * PIO, staged through a SKEL_RAWIO_CHUNK bytes buffer on the stack.
  */
 
 static unsigned int RawIoBlock(SkelDrvrModuleContext *mcon,
 			       SkelDrvrRawIoTransferBlock *riob, int flag)
 {
-#define TRANSFERS 1024
-
+	uint32_t kbuf[SKEL_RAWIO_CHUNK / sizeof(uint32_t)];
 	InsLibAnyAddressSpace *anyas = NULL;
 	InsLibModlDesc *modld = NULL;
-	char *cp;
+	skel_pio_t pio;
 
 	int tszbt;		/* One transfer data item size in bits */
 	int tszby;		/* One transfer data item size in bytes  */
 	int tremg;		/* Transfer data items remaining  */
-	int uindx;		/* Byte index into user array */
-	int kindx;		/* Byte index in kernel buffer */
-	int hskip;		/* Skip hardware byte index */
+	int hstep;		/* Module byte stride between items */
+	int chunk;		/* Items per kernel buffer */
 	int bendf;		/* Big Endian flag */
-	int ksize;		/* Kernal buffer size */
-	void *mmap;		/* Hardware module memory map */
-	void *kbuf;		/* Kernel transfer buffer */
-	void *kp;		/* Running kernel buffer pointer */
-	void *mp;		/* Running modle buffer pointer */
+	int n;
+	char *mp;		/* Running module address */
+	char *up;		/* Running user buffer pointer */
 
 	modld = mcon->Modld;
 	anyas = InsLibGetAddressSpace(modld, riob->SpaceNumber);
@@ -325,6 +392,24 @@ static unsigned int RawIoBlock(SkelDrvrModuleContext *mcon,
 		return SYSERR;
 	}
 
+	tszbt = riob->DataWidth & 0x3F;	/* Can be 8, 16, 32 etc */
+	if (tszbt <= 0)
+		tszbt = anyas->DataWidth;	/* Not specified take default */
+	bendf = (anyas->Endian == InsLibEndianBIG);	/* Set BIG endian boolean */
+
+	pio = pio_select(tszbt, bendf, flag);
+	if (pio == NULL) {
+		report_module(mcon, SkelDrvrDebugFlagMODULE,
+			      "%s: Illegal data width %d", __FUNCTION__, tszbt);
+		pseterr(EINVAL);
+		return SYSERR;
+	}
+	tszby = tszbt / 8;	/* Size of one transfer entity in bytes */
+	tremg = riob->BytesTr / tszby;	/* Number of transfers to perform */
+	if (tremg <= 0)
+		tremg = 1;	/* At least one transfer */
+	hstep = riob->AddrIncr * tszby;
+
 	/*
 	 * In some cases (mainly PCI), the size of the mapping is not
 	 * provided in the XML file. In Lynx there's no easy way to
@@ -332,125 +417,67 @@ static unsigned int RawIoBlock(SkelDrvrModuleContext *mcon,
 	 * not to cause a bus error.
 	 */
 
-	if (anyas->WindowSize && riob->Offset >= anyas->WindowSize) {
+	if (anyas->WindowSize &&
+	    riob->Offset + (tremg - 1) * hstep + tszby > anyas->WindowSize) {
 		report_module(mcon, SkelDrvrDebugFlagMODULE,
 			      "%s: Offset out of range", __FUNCTION__);
 		pseterr(EINVAL);
 		return SYSERR;
 	}
 
-	tszbt = riob->DataWidth & 0x3F;	/* Can be 8, 16, 32 etc */
-	if (tszbt <= 0)
-		tszbt = anyas->DataWidth;	/* Not specified take default */
-	tszby = tszbt / 8;	/* Size of one transfer entity in bytes */
-	tremg = riob->BytesTr / tszby;	/* Number of transfers to perform */
-	if (tremg <= 0)
-		tremg = 1;	/* At least one transfer */
-
-	if (tremg < TRANSFERS)
-		ksize = tremg *tszby;	/* One transfer from small buffer */
-	else
-		ksize = TRANSFERS *tszby;	/* Multiple transfers from kernel buffer */
-	kbuf = sysbrk(ksize);	/* Allocate memory for TRANSFER items */
-	if (kbuf == NULL) {
-		pseterr(ENOMEM);
+	n = skel_vme_rawio_dma(mcon, anyas, riob, tszbt, flag);
+	if (n == 0)
+		return OK;
+	if (n < 0) {
+		if (n == -EIO &&
+		    update_mcon_status(mcon, SkelDrvrStandardStatusBUS_FAULT))
+			return SYSERR;
+		pseterr(-n);
 		return SYSERR;
 	}
 
-	cp = anyas->Mapped;	/* Point to address map */
-	mmap = &cp[riob->Offset];	/* and get the address at offset */
-
-	bendf = (anyas->Endian == InsLibEndianBIG);	/* Set BIG endian boolean */
-	uindx = 0;
-	kindx = 0;
-	hskip = 0;		/* Index into map array */
-
-	/*
-	 * If writing fill up the kernel buffer from user space
-	 */
-
-	if (flag)
-		cdcm_copy_from_user(kbuf, riob->Data, ksize);	/* Get User memory if writing */
-
-	/*
-	 * While transfers remaining loop until all done
-	 */
-
-	while (tremg-- > 0) {
+	if (anyas->Mapped == NULL) {
+		report_module(mcon, SkelDrvrDebugFlagMODULE,
+			      "%s: Address space not mapped", __FUNCTION__);
+		pseterr(ENXIO);
+		return SYSERR;
+	}
 
-		kp = kbuf + kindx;	/* Next kernel buffer address */
-		mp = mmap + hskip;	/* Next module address */
+	mp = (char *)anyas->Mapped + riob->Offset;
+	up = riob->Data;
+	chunk = sizeof(kbuf) / tszby;
 
-		if (flag) {
-			switch (tszbt) {
-			default:
-			case 8:
-				cdcm_iowrite8(*(char *) kp, mp);
-				break;
-			case 16:
-				if (bendf)
-					cdcm_iowrite16be(*(short *) kp, mp);
-				else
-					cdcm_iowrite16le(*(short *) kp, mp);
-				break;
-			case 32:
-				if (bendf)
-					cdcm_iowrite32be(*(int *) kp, mp);
-				else
-					cdcm_iowrite32le(*(int *) kp, mp);
-				break;
-			}
-		} else {
-			switch (tszbt) {
-			default:
-			case 8:
-				*(char *) kp = cdcm_ioread8(mmap);
-				break;
-			case 16:
-				if (bendf)
-					*(short *) kp = cdcm_ioread16be(mp);
-				else
-					*(short *) kp = cdcm_ioread16le(mp);
-				break;
-			case 32:
-				if (bendf)
-					*(int *) kp = cdcm_ioread32be(mp);
-				else
-					*(int *) kp = cdcm_ioread32le(mp);
-				break;
+	if (!recoset()) {
+		while (tremg > 0) {
+			n = tremg < chunk ? tremg : chunk;
+			if (flag) {
+				if (cdcm_copy_from_user(kbuf, up, n * tszby))
+					break;
+				pio(mp, kbuf, n, hstep);
+			} else {
+				pio(mp, kbuf, n, hstep);
+				if (cdcm_copy_to_user(up, kbuf, n * tszby))
+					break;
 			}
+			up += n * tszby;
+			mp += n * hstep;
+			tremg -= n;
 		}
+	} else {
+		noreco();
+		SK_ERROR("BUS-ERROR @ module#%d", mcon->ModuleNumber);
+		if (update_mcon_status(mcon, SkelDrvrStandardStatusBUS_FAULT))
+			return SYSERR;
 
-		/*
-		 * Deal wit indexes into buffers
-		 */
-
-		hskip += riob->AddrIncr *tszby;	/* Module hardware skip index */
-		kindx += tszby;	/* Kernel buffer index */
-
-		/*
-		 * Flush the kernel buffer
-		 */
-
-		if (kindx >= ksize) {
-			if (flag)
-				cdcm_copy_from_user(kbuf, &riob->Data[uindx], ksize);	/* Flush out data to user */
-			else
-				cdcm_copy_to_user(&riob->Data[uindx], kbuf, ksize);	/* Flush in data from user */
-
-			uindx += ksize;	/* Next block to copy */
-			kindx = 0;	/* Running kernel buffer index reset for next loop or exit */
-		}
+		pseterr(ENXIO);
+		return SYSERR;
 	}
+	noreco();
 
-	/*
-	 * If reading copy any remaining data to user space
-	 */
-
-	if ((!flag) && (kindx))
-		cdcm_copy_to_user(&riob->Data[uindx], kbuf, kindx);
-
-	sysfree(kbuf, ksize);
+	if (tremg > 0) {
+		pseterr(EFAULT);
+		return SYSERR;
+	}
 	return OK;
 }
 
@@ -567,14 +594,13 @@ static unsigned int RawIo(SkelDrvrModuleContext *mcon,
 static void Reset(SkelDrvrModuleContext *mcon)
 {
 	SkelDrvrModConn *connected = &mcon->Connected;
-	unsigned long flags;
-
 
+	skel_shadow_invalidate(mcon);
 	SkelUserHardwareReset(mcon);
 
-	cdcm_spin_lock_irqsave(&connected->lock, flags);
+	cdcm_mutex_lock(&connected->mutex);
 	SkelUserEnableInterrupts(mcon, connected->enabled_ints);
-	cdcm_spin_unlock_irqrestore(&connected->lock, flags);
+	cdcm_mutex_unlock(&connected->mutex);
 
 	sreset(&mcon->Semaphore);
 	ssignal(&mcon->Semaphore);
@@ -620,60 +646,45 @@ static inline void q_put(const SkelDrvrReadBuf *rb, SkelDrvrClientContext *ccon)
 }
 
 /**
- * @brief put the 'read buffer' @rb on the queues of clients
+ * @brief fill the queues of clients connected to the interrupt given by mask
  *
- * @param rb - read buffer to be put in the queues
- * @param client_list - list of clients whos queues are to be appended
+ * @param connected - connections on the module struct
+ * @param rb - read buffer to put in the queues
+ * @param imask - interrupt mask
+ *
+ * Lock-free with respect to Connect/DisConnect: the subscriber arrays are
+ * only read, under RCU. Only each client's queue lock is taken.
  */
-static inline void put_queues(const SkelDrvrReadBuf *rb,
-			      struct list_head *client_list)
-{
-	struct client_link *entry;
-
-	list_for_each_entry(entry, client_list, list)
-		q_put(rb, entry->context);
-}
-
-/* Note: call this function with @connected's lock held */
-static inline void __fill_clients_queues(SkelDrvrModConn *connected,
-					 const SkelDrvrReadBuf *rb,
-					 const uint32_t imask)
+static inline void fill_clients_queues(SkelDrvrModConn *connected,
+				       const SkelDrvrReadBuf *rb,
+				       uint32_t imask)
 {
-	struct list_head *client_list;
-	uint32_t interrupt;
+	struct skel_subs *subs;
 	SkelDrvrReadBuf rbuf = *rb; /* local copy of rb */
-	int i;
+	uint32_t interrupt;
+	unsigned long flags;
+	int i, j, nr;
 
-	for (i = 0; i < SkelDrvrINTERRUPTS; i++) {
+	cdcm_rcu_read_lock(flags);
+	for (i = 0; imask && i < SkelDrvrINTERRUPTS; i++) {
+
+		interrupt = imask & (1U << i);
+		if (!interrupt)
+			continue;
+		imask &= ~interrupt;
 
-		interrupt = imask & (1 << i);
-		client_list = &connected->clients[i];
-		if (!interrupt || list_empty(client_list))
+		subs = cdcm_rcu_dereference(connected->subs[i]);
+		if (subs == NULL)
 			continue;
 
 		/* set one bit at a time on the clients' queues */
 
 		rbuf.Connection.ConMask = interrupt;
-		put_queues(&rbuf, client_list);
+		nr = subs->nr;
+		for (j = 0; j < nr; j++)
+			q_put(&rbuf, subs->ccon[j]);
 	}
-}
-
-/**
- * @brief fill the queues of clients connected to the interrupt given by mask
- *
- * @param connected - connections on the module struct
- * @param rb - read buffer to put in the queues
- * @param imask - interrupt mask
- */
-static inline void fill_clients_queues(SkelDrvrModConn *connected,
-				       const SkelDrvrReadBuf *rb,
-				       const uint32_t imask)
-{
-	unsigned long flags;
-
-	cdcm_spin_lock_irqsave(&connected->lock, flags);
-	__fill_clients_queues(connected, rb, imask);
-	cdcm_spin_unlock_irqrestore(&connected->lock, flags);
+	cdcm_rcu_read_unlock(flags);
 }
 
 /**
@@ -724,6 +735,274 @@ int skel_isr(void *cookie)
 	return IntrHandler(cookie);
 }
 
+#ifdef __linux__
+
+/**
+ * @brief allocate a DMA buffer that the module's clients can mmap
+ *
+ * @param mcon - module context
+ * @param size - size in bytes
+ *
+ * Meant to be called from SkelUserModuleInit(). The buffer is physically
+ * contiguous, so it can be the source or destination of a vme_do_dma_kernel()
+ * transfer. Clients learn its mmap() offset with GET_DMA_BUFS. Skel releases
+ * it when the module is removed.
+ *
+ * @return kernel address of the buffer - on success
+ * @return NULL - on failure
+ */
+void *skel_dmabuf_alloc(SkelDrvrModuleContext *mcon, unsigned long size)
+{
+	SkelDrvrDmaBufs *bufs = &mcon->DmaBufs;
+	unsigned long offset;
+	void *kaddr;
+
+	if (bufs->Buffers >= SkelDrvrMAX_DMA_BUFS) {
+		report_module(mcon, SkelDrvrDebugFlagMODULE,
+			      "No room for another DMA buffer");
+		return NULL;
+	}
+
+	kaddr = cdcm_dmabuf_alloc(size, &offset);
+	if (kaddr == NULL)
+		return NULL;
+
+	mcon->DmaBufAddr[bufs->Buffers] = kaddr;
+	bufs->Bufs[bufs->Buffers].Size = size;
+	bufs->Bufs[bufs->Buffers].Offset = offset;
+	bufs->Buffers++;
+
+	return kaddr;
+}
+
+static void skel_dmabuf_free_all(SkelDrvrModuleContext *mcon)
+{
+	SkelDrvrDmaBufs *bufs = &mcon->DmaBufs;
+	int i;
+
+	for (i = 0; i < bufs->Buffers; i++) {
+		if (cdcm_dmabuf_free(mcon->DmaBufAddr[i]))
+			SK_WARN("Module#%d: DMA buffer %d still mapped",
+				mcon->ModuleNumber, i);
+		mcon->DmaBufAddr[i] = NULL;
+	}
+	bufs->Buffers = 0;
+}
+
+#else /* Lynx: no mmap of kernel buffers */
+
+void *skel_dmabuf_alloc(SkelDrvrModuleContext *mcon, unsigned long size)
+{
+	return NULL;
+}
+
+static void skel_dmabuf_free_all(SkelDrvrModuleContext *mcon)
+{
+}
+
+#endif /* __linux__ */
+
+/*
+ * Register shadow
+ *
+ * Drivers list in SkelConf.shadow the registers they own, i.e. those the
+ * hardware never changes on its own. skel_shadow_ioread32() serves them from
+ * RAM after the first access, saving a bus cycle per read; any other offset
+ * goes straight to the hardware. skel_shadow_iowrite32() writes through.
+ * The shadow is invalidated whenever skel resets the module, and the
+ * registers a RAW_WRITE or RAW_BLOCK_WRITE covers after the write.
+ */
+
+/* index of @offset in the shadow, or -1 if it is not shadowed */
+static int shadow_slot(uint32_t offset)
+{
+	const struct skel_shadow_range *r;
+	int slot = 0;
+
+	if (offset & 3)
+		return -1;
+	for (r = SkelConf.shadow; r->count; r++) {
+		if (offset >= r->offset && offset < r->offset + r->count * 4)
+			return slot + (offset - r->offset) / 4;
+		slot += r->count;
+	}
+	return -1;
+}
+
+static void skel_shadow_init(SkelDrvrModuleContext *mcon)
+{
+	const struct skel_shadow_range *r;
+	struct skel_shadow *sh;
+	int nregs = 0;
+	int words;
+	int size;
+
+	if (SkelConf.shadow == NULL)
+		return;
+	for (r = SkelConf.shadow; r->count; r++)
+		nregs += r->count;
+	if (!nregs)
+		return;
+
+	words = (nregs + 31) / 32;
+	size = sizeof(*sh) + (nregs + words) * sizeof(uint32_t);
+	sh = (struct skel_shadow *)sysbrk(size);
+	if (sh == NULL) {
+		SK_WARN("Module#%d: no memory for the register shadow",
+			mcon->ModuleNumber);
+		return;
+	}
+	memset(sh, 0, size);
+	cdcm_spin_lock_init(&sh->lock);
+	sh->nregs = nregs;
+	sh->vals = sh->data;
+	sh->valid = sh->data + nregs;
+	mcon->Shadow = sh;
+}
+
+static void skel_shadow_free(SkelDrvrModuleContext *mcon)
+{
+	struct skel_shadow *sh = mcon->Shadow;
+
+	if (sh == NULL)
+		return;
+	mcon->Shadow = NULL;
+	sysfree((void *)sh, sizeof(*sh) +
+		(sh->nregs + (sh->nregs + 31) / 32) * sizeof(uint32_t));
+}
+
+/**
+ * @brief read a 32-bit register, from the shadow if possible
+ *
+ * @param mcon   - module context
+ * @param map    - register map the offsets in SkelConf.shadow refer to
+ * @param offset - byte offset of the register
+ *
+ * @return the register's value, in bus order
+ */
+uint32_t skel_shadow_ioread32(SkelDrvrModuleContext *mcon, void *map,
+			      uint32_t offset)
+{
+	struct skel_shadow *sh = mcon->Shadow;
+	unsigned long flags;
+	uint32_t bit;
+	uint32_t val;
+	int i;
+
+	if (sh == NULL || (i = shadow_slot(offset)) < 0)
+		return cdcm_ioread32((char *)map + offset);
+
+	bit = 1 << (i % 32);
+	cdcm_spin_lock_irqsave(&sh->lock, flags);
+	if (sh->valid[i / 32] & bit) {
+		val = sh->vals[i];
+	} else {
+		val = cdcm_ioread32((char *)map + offset);
+		sh->vals[i] = val;
+		sh->valid[i / 32] |= bit;
+	}
+	cdcm_spin_unlock_irqrestore(&sh->lock, flags);
+	return val;
+}
+
+/**
+ * @brief write a 32-bit register, updating the shadow
+ *
+ * @param mcon   - module context
+ * @param val    - value to write, in bus order
+ * @param map    - register map the offsets in SkelConf.shadow refer to
+ * @param offset - byte offset of the register
+ */
+void skel_shadow_iowrite32(SkelDrvrModuleContext *mcon, uint32_t val,
+			   void *map, uint32_t offset)
+{
+	struct skel_shadow *sh = mcon->Shadow;
+	unsigned long flags;
+	int i;
+
+	if (sh == NULL || (i = shadow_slot(offset)) < 0) {
+		cdcm_iowrite32(val, (char *)map + offset);
+		return;
+	}
+
+	cdcm_spin_lock_irqsave(&sh->lock, flags);
+	cdcm_iowrite32(val, (char *)map + offset);
+	sh->vals[i] = val;
+	sh->valid[i / 32] |= 1 << (i % 32);
+	cdcm_spin_unlock_irqrestore(&sh->lock, flags);
+}
+
+/**
+ * @brief forget the shadowed values of a module
+ *
+ * @param mcon - module context
+ *
+ * skel calls this before SkelUserHardwareReset(). Drivers that reset or
+ * reconfigure the module behind skel's back must call it as well.
+ */
+void skel_shadow_invalidate(SkelDrvrModuleContext *mcon)
+{
+	struct skel_shadow *sh = mcon->Shadow;
+	unsigned long flags;
+
+	if (sh == NULL)
+		return;
+	cdcm_spin_lock_irqsave(&sh->lock, flags);
+	memset(sh->valid, 0, ((sh->nregs + 31) / 32) * sizeof(uint32_t));
+	cdcm_spin_unlock_irqrestore(&sh->lock, flags);
+}
+
+/*
+ * Forget the shadowed registers that overlap [@offset, @offset + @len).
+ * Raw writes go around the shadow; they may be to another address space
+ * than the shadowed one, in which case this only costs a re-read.
+ */
+static void skel_shadow_invalidate_range(SkelDrvrModuleContext *mcon,
+					 uint32_t offset, uint32_t len)
+{
+	struct skel_shadow *sh = mcon->Shadow;
+	const struct skel_shadow_range *r;
+	unsigned long flags;
+	uint32_t reg, end;
+	int slot = 0;
+	int i;
+
+	if (sh == NULL || !len)
+		return;
+	end = offset + len < offset ? ~0U : offset + len;
+	cdcm_spin_lock_irqsave(&sh->lock, flags);
+	for (r = SkelConf.shadow; r->count; r++) {
+		for (i = 0; i < r->count; i++) {
+			reg = r->offset + i * 4;
+			if (reg < end && reg + 4 > offset)
+				sh->valid[(slot + i) / 32] &= ~(1 << ((slot + i) % 32));
+		}
+		slot += r->count;
+	}
+	cdcm_spin_unlock_irqrestore(&sh->lock, flags);
+}
+
+/* bytes of the address space that a RAW_BLOCK transfer spans */
+static uint32_t rawio_block_span(SkelDrvrModuleContext *mcon,
+				 SkelDrvrRawIoTransferBlock *riob)
+{
+	InsLibAnyAddressSpace *anyas;
+	int tszby, tremg;
+
+	anyas = InsLibGetAddressSpace(mcon->Modld, riob->SpaceNumber);
+	if (!anyas)
+		return 0;
+	tszby = (riob->DataWidth & 0x3F) / 8;
+	if (tszby <= 0)
+		tszby = anyas->DataWidth / 8;
+	if (tszby <= 0)
+		return 0;
+	tremg = riob->BytesTr / tszby;
+	if (tremg <= 0)
+		tremg = 1;
+	return (tremg - 1) * riob->AddrIncr * tszby + tszby;
+}
+
 /**
  * @brief remove a module, given by its module context
  *
@@ -742,6 +1021,11 @@ static void RemoveModule(SkelDrvrModuleContext *mcon)
 	/* unhook user's stuff */
 	SkelUserModuleRelease(mcon);
 
+	/* DMA buffers the user left allocated */
+	skel_dmabuf_free_all(mcon);
+
+	skel_shadow_free(mcon);
+
 	switch (mcon->Modld->BusType) {
 	case InsLibBusTypePMC:
 	case InsLibBusTypePCI:
@@ -821,6 +1105,43 @@ static struct client_link *__get_client(SkelDrvrClientContext *ccon,
 	return found;
 }
 
+static inline unsigned long skel_subs_size(int nr)
+{
+	return sizeof(struct skel_subs) + nr * sizeof(SkelDrvrClientContext *);
+}
+
+static struct skel_subs *skel_subs_alloc(int nr)
+{
+	struct skel_subs *subs;
+
+	subs = (struct skel_subs *)sysbrk(skel_subs_size(nr));
+	if (subs) {
+		subs->nr = nr;
+		subs->max = nr;
+	}
+	return subs;
+}
+
+static void skel_subs_free(struct skel_subs *subs)
+{
+	if (subs)
+		sysfree((void *)subs, skel_subs_size(subs->max));
+}
+
+/* index of @ccon in @subs, or -1 if it's not there */
+static int skel_subs_find(struct skel_subs *subs, SkelDrvrClientContext *ccon)
+{
+	int i;
+
+	if (subs == NULL)
+		return -1;
+	for (i = 0; i < subs->nr; i++) {
+		if (subs->ccon[i] == ccon)
+			return i;
+	}
+	return -1;
+}
+
 /**
  * @brief connect a client to an interrupt
  *
@@ -831,10 +1152,9 @@ static void Connect(SkelDrvrClientContext *ccon, SkelDrvrConnection *conx)
 {
 	SkelDrvrModuleContext	*mcon;
 	SkelDrvrModConn		*connected;
-	struct client_link *alloc_link;
-	struct client_link *link;
-	unsigned int j, imsk;
-	unsigned long flags;
+	struct skel_subs *retired[SkelDrvrINTERRUPTS];
+	struct skel_subs *old, *new;
+	unsigned int j, imsk, nr;
 
 	if (!conx->Module)
 		mcon = get_mcon(ccon->ModuleNumber);
@@ -847,43 +1167,38 @@ static void Connect(SkelDrvrClientContext *ccon, SkelDrvrConnection *conx)
 	connected = &mcon->Connected;
 	imsk = conx->ConMask;
 
+	cdcm_mutex_lock(&connected->mutex);
 	for (j = 0; j < SkelDrvrINTERRUPTS; j++) {
-		if (!(imsk & (1 << j)))
+		retired[j] = NULL;
+		if (!(imsk & (1U << j)))
 			continue;
-		/*
-		 * We may not need this link, but we cannot allocate memory
-		 * (sleep) in an atomic section, so we pre-allocate it here.
-		 */
-		alloc_link = (struct client_link *)sysbrk(sizeof(*alloc_link));
 
-		cdcm_spin_lock_irqsave(&connected->lock, flags);
-		/*
-		 * Algorithm:
-		 * Check if the client is already in the list of connections
-		 * If it is, free the allocated link
-		 * If it isn't, add it to the list using the allocated link
-		 */
-		link = __get_client(ccon, &connected->clients[j]);
-		if (link) {
-			if (alloc_link) {
-				sysfree((void *)alloc_link, sizeof(*alloc_link));
-				alloc_link = NULL;
-			}
-		} else {
-			if (alloc_link == NULL) {
-				SK_WARN("ENOMEM adding a client link");
-			} else {
-				alloc_link->context = ccon;
-				list_add(&alloc_link->list, &connected->clients[j]);
-			}
-		}
-		/* if any of these is set, we succeeded in adding the connection */
-		if (link || alloc_link) {
-			connected->enabled_ints |= imsk;
-			SkelUserEnableInterrupts(mcon, connected->enabled_ints);
+		old = connected->subs[j];
+		if (skel_subs_find(old, ccon) >= 0)
+			continue; /* already connected */
+
+		/* publish a copy of the subscribers with @ccon appended */
+		nr = old ? old->nr : 0;
+		new = skel_subs_alloc(nr + 1);
+		if (new == NULL) {
+			SK_WARN("ENOMEM adding a client link");
+			continue;
 		}
-		cdcm_spin_unlock_irqrestore(&connected->lock, flags);
+		if (nr)
+			memcpy(new->ccon, old->ccon, nr * sizeof(new->ccon[0]));
+		new->ccon[nr] = ccon;
+
+		cdcm_rcu_assign_pointer(connected->subs[j], new);
+		connected->enabled_ints |= 1U << j;
+		retired[j] = old;
 	}
+	SkelUserEnableInterrupts(mcon, connected->enabled_ints);
+	cdcm_mutex_unlock(&connected->mutex);
+
+	/* one grace period for all the arrays we replaced */
+	cdcm_synchronize_rcu();
+	for (j = 0; j < SkelDrvrINTERRUPTS; j++)
+		skel_subs_free(retired[j]);
 }
 
 /**
@@ -895,14 +1210,16 @@ static void Connect(SkelDrvrClientContext *ccon, SkelDrvrConnection *conx)
  * If no module is specificied, current client's module is taken.
  * An empty interrupt mask means 'disconnect from all the interrupts for
  * this module'
+ * On return no ISR can be using @ccon through this module's connections.
  */
 static void DisConnect(SkelDrvrClientContext *ccon, SkelDrvrConnection *conx)
 {
 	SkelDrvrModuleContext	*mcon;
 	SkelDrvrModConn		*connected;
-	struct client_link *link;
+	struct skel_subs *retired[SkelDrvrINTERRUPTS];
+	struct skel_subs *old, *new;
 	unsigned int j, imsk;
-	unsigned long flags;
+	int i, k, n;
 
 	if (!conx->Module)
 		mcon = get_mcon(ccon->ModuleNumber);
@@ -920,32 +1237,58 @@ static void DisConnect(SkelDrvrClientContext *ccon, SkelDrvrConnection *conx)
 
 	imsk = conx->ConMask;
 
-	cdcm_spin_lock_irqsave(&connected->lock, flags);
+	cdcm_mutex_lock(&connected->mutex);
 
 	for (j = 0; j < SkelDrvrINTERRUPTS; j++) {
+		retired[j] = NULL;
 
-		/* check interrupt mask and that there are clients connected */
+		/* check interrupt mask and that the client is connected */
 
-		if (!(imsk & (1 << j)) || list_empty(&connected->clients[j]))
+		if (!(imsk & (1U << j)))
+			continue;
+		old = connected->subs[j];
+		i = skel_subs_find(old, ccon);
+		if (i < 0)
 			continue;
 
-		link = __get_client(ccon, &connected->clients[j]);
-		if (!link)
+		if (old->nr == 1) {
+			/*
+			 * no more clients connected to it: disable the
+			 * interrupt on the module
+			 */
+			cdcm_rcu_assign_pointer(connected->subs[j], NULL);
+			connected->enabled_ints &= ~(1U << j);
+			retired[j] = old;
 			continue;
-		list_del(&link->list);
-		sysfree((void *)link, sizeof(*link));
+		}
 
-		/*
-		 * if there are no more clients connected to it, disable the
-		 * interrupt on the module
-		 */
-		if (list_empty(&connected->clients[j])) {
-			connected->enabled_ints &= ~imsk;
-			SkelUserEnableInterrupts(mcon, connected->enabled_ints);
+		new = skel_subs_alloc(old->nr - 1);
+		if (new == NULL) {
+			/*
+			 * Remove it in place: move the last entry over it.
+			 * A reader may see the last client twice, but never
+			 * a freed one, since we wait for the ISRs below.
+			 */
+			old->ccon[i] = old->ccon[old->nr - 1];
+			cdcm_wmb();
+			old->nr--;
+			continue;
 		}
+		for (k = 0, n = 0; k < old->nr; k++) {
+			if (k != i)
+				new->ccon[n++] = old->ccon[k];
+		}
+		cdcm_rcu_assign_pointer(connected->subs[j], new);
+		retired[j] = old;
 	}
+	SkelUserEnableInterrupts(mcon, connected->enabled_ints);
 
-	cdcm_spin_unlock_irqrestore(&connected->lock, flags);
+	cdcm_mutex_unlock(&connected->mutex);
+
+	/* wait for the ISRs that may still see @ccon in the old arrays */
+	cdcm_synchronize_rcu();
+	for (j = 0; j < SkelDrvrINTERRUPTS; j++)
+		skel_subs_free(retired[j]);
 }
 
 /**
@@ -984,8 +1327,8 @@ static inline void set_mcon_defaults(SkelDrvrModuleContext *mcon)
 	/* initialise the spinlock */
 	cdcm_spin_lock_init(&mcon->lock);
 
-	/* initialise the connection's lock */
-	cdcm_spin_lock_init(&mcon->Connected.lock);
+	/* initialise the connection's mutex */
+	cdcm_mutex_init(&mcon->Connected.mutex);
 
 	/* initialise the mutex */
 	cdcm_mutex_init(&mcon->mutex);
@@ -995,7 +1338,7 @@ static inline void set_mcon_defaults(SkelDrvrModuleContext *mcon)
 	ssignal(&mcon->Semaphore);
 
 	for (i = 0; i < SkelDrvrINTERRUPTS; i++)
-		INIT_LIST_HEAD(&mcon->Connected.clients[i]);
+		mcon->Connected.subs[i] = NULL;
 
 	/*
 	 * Set the module status to NO_ISR as a default.
@@ -1065,6 +1408,10 @@ static int AddModule(SkelDrvrModuleContext *mcon)
 	if (!mod_ok) /* AddModule didn't work */
 		return 0;
 
+	/* before the user's init, so that its register writes are shadowed */
+	if (!(mcon->StandardStatus & SkelDrvrStandardStatusEMULATION))
+		skel_shadow_init(mcon);
+
 	/* user's module installation bottom-half */
 	mod_ok = SkelUserModuleInit(mcon);
 
@@ -1255,24 +1602,20 @@ static void __skel_remove_ccon(SkelDrvrClientContext *ccon)
 
 /*
  * Close down a client context
- * Wa->list_lock should be called upon calling this function
+ * Note: this function may sleep (it waits for the ISRs to release @ccon), so
+ * don't call it with Wa->list_lock held.
  */
-
-static void __do_close(SkelDrvrClientContext *ccon)
-{
-	DisConnectAll(ccon);
-	SkelUserClientRelease(ccon);
-	__skel_remove_ccon(ccon);
-	sysfree((void *) ccon, sizeof(SkelDrvrClientContext));
-}
-
 static void do_close(SkelDrvrClientContext *ccon)
 {
 	unsigned long flags;
 
 	cdcm_spin_lock_irqsave(&Wa->list_lock, flags);
-	__do_close(ccon);
+	__skel_remove_ccon(ccon);
 	cdcm_spin_unlock_irqrestore(&Wa->list_lock, flags);
+
+	DisConnectAll(ccon);
+	SkelUserClientRelease(ccon);
+	sysfree((void *) ccon, sizeof(SkelDrvrClientContext));
 }
 
 /*
@@ -1305,22 +1648,27 @@ static inline void do_cleanup(void)
 
 static void do_cleanup(void)
 {
+	SkelDrvrClientContext *dead;
 	struct client_link *entry;
-	struct client_link *tcl;
 	unsigned long flags;
-	int err;
 
-	/* Clean up dead processes */
+	/* Clean up dead processes, one at a time: do_close() may sleep */
 
-	cdcm_spin_lock_irqsave(&Wa->list_lock, flags);
-	list_for_each_entry_safe(entry, tcl, &Wa->clients, list) {
-		if (_kill(entry->context->Pid, SIGCONT) == SYSERR) {
-			err = geterr();
-			if (err == ESRCH)
-				__do_close(entry->context);
+	do {
+		dead = NULL;
+		cdcm_spin_lock_irqsave(&Wa->list_lock, flags);
+		list_for_each_entry(entry, &Wa->clients, list) {
+			if (_kill(entry->context->Pid, SIGCONT) == SYSERR &&
+			    geterr() == ESRCH) {
+				dead = entry->context;
+				break;
+			}
 		}
-	}
-	cdcm_spin_unlock_irqrestore(&Wa->list_lock, flags);
+		cdcm_spin_unlock_irqrestore(&Wa->list_lock, flags);
+
+		if (dead)
+			do_close(dead);
+	} while (dead);
 }
 
 #endif
@@ -1773,14 +2121,15 @@ static void set_queue_flag(SkelDrvrQueue *q, int value)
 static int skel_fill_client_connections(SkelDrvrModuleContext *mcon,
 					SkelDrvrClientConnections *ccn)
 {
-	struct list_head *client_list;
-	struct client_link *entry;
-	int i;
+	struct skel_subs *subs;
+	int i, j;
 
 	for (i = 0; i < SkelDrvrINTERRUPTS; i++) {
-		client_list = &mcon->Connected.clients[i];
-		list_for_each_entry(entry, client_list, list) {
-			if (entry->context->Pid != ccn->Pid)
+		subs = mcon->Connected.subs[i];
+		if (subs == NULL)
+			continue;
+		for (j = 0; j < subs->nr; j++) {
+			if (subs->ccon[j]->Pid != ccn->Pid)
 				continue;
 			ccn->Connections[ccn->Size].Module = mcon->ModuleNumber;
 			ccn->Connections[ccn->Size].ConMask = 1 << i;
@@ -1818,7 +2167,6 @@ static int skel_get_client_connections(SkelDrvrClientContext *ccon,
 {
 	SkelDrvrModConn *connected;
 	SkelDrvrModuleContext *module;
-	unsigned long flags;
 	int ret;
 	int i;
 
@@ -1831,9 +2179,9 @@ static int skel_get_client_connections(SkelDrvrClientContext *ccon,
 		if (!module->InUse)
 			continue;
 		connected = &module->Connected;
-		cdcm_spin_lock_irqsave(&connected->lock, flags);
+		cdcm_mutex_lock(&connected->mutex);
 		ret = skel_fill_client_connections(module, ccn);
-		cdcm_spin_unlock_irqrestore(&connected->lock, flags);
+		cdcm_mutex_unlock(&connected->mutex);
 		if (ret)
 			break;
 	}
@@ -1858,6 +2206,7 @@ SkelDrvrDebug                *db;
 S32 lav, *lap;  /* Long Value pointed to by Arg */
 U16 sav;        /* Short argument and for Jtag IO */
 int rcnt, wcnt; /* Readable, Writable byte counts at arg address */
+int cc;         /* Return code of raw writes */
 
    /* Check argument contains a valid address for reading or writing. */
    /* We can not allow bus errors to occur inside the driver due to   */
@@ -2067,8 +2416,12 @@ int rcnt, wcnt; /* Readable, Writable byte counts at arg address */
       case SkelDrvrIoctlRAW_WRITE:
 	 riob = (SkelDrvrRawIoBlock *) arg;
 	 if (SkelConf.rawio)
-		 return SkelConf.rawio(mcon, riob, 1);
-	 return RawIo(mcon,riob,1);
+		 cc = SkelConf.rawio(mcon, riob, 1);
+	 else
+		 cc = RawIo(mcon,riob,1);
+	 skel_shadow_invalidate_range(mcon, riob->Offset,
+				      riob->DataWidth ? riob->DataWidth / 8 : 4);
+	 return cc;
       break;
 
 	case SkelDrvrIoctlRAW_BLOCK_READ:
@@ -2078,9 +2431,18 @@ int rcnt, wcnt; /* Readable, Writable byte counts at arg address */
 
 	case SkelDrvrIoctlRAW_BLOCK_WRITE:
 		riobt = (SkelDrvrRawIoTransferBlock *) arg;
-		return RawIoBlock(mcon, riobt, 1);
+		cc = RawIoBlock(mcon, riobt, 1);
+		skel_shadow_invalidate_range(mcon, riobt->Offset,
+					     rawio_block_span(mcon, riobt));
+		return cc;
 		break;
 
+	case SkelDrvrIoctlGET_DMA_BUFS:
+		if (mcon == NULL)
+			break;
+		memcpy(arg, &mcon->DmaBufs, sizeof(SkelDrvrDmaBufs));
+		return OK;
+
       default:
 	      if (is_user_ioctl(cm)) {
 		      SkelUserReturn uret;
@@ -20,6 +20,13 @@
  * some of them need types defined in this header file.
  */
 
+/*
+ * Raw block PIO transfers are staged through an on-stack buffer of this
+ * many bytes: enough to amortise the user copies, small enough for the
+ * kernel stack.
+ */
+#define SKEL_RAWIO_CHUNK 256
+
 /* =============================================== */
 /* Up to 32 incomming events per client are queued */
 
@@ -74,22 +81,38 @@ struct client_link {
 	SkelDrvrClientContext *context; /* Clients context */
 };
 
+/**
+ * \brief clients connected to one interrupt of a module
+ * @nr   - number of entries in @ccon
+ * @max  - number of entries allocated; the array is freed with it
+ * @ccon - connected clients
+ *
+ * A subscriber set is never modified once published (see below), except
+ * for the in-place removal done by DisConnect() when it runs out of memory,
+ * which leaves @nr smaller than @max.
+ */
+struct skel_subs {
+	int			nr;
+	int			max;
+	SkelDrvrClientContext	*ccon[];
+};
+
 /**
  * \brief keep client's connections on a module
- * @lock - protects the struct
- * @clients      - connected clients kept in an array of linked lists, one list per interrupt
+ * @mutex        - serialises Connect/DisConnect. Never taken by the ISR
+ * @subs         - connected clients, one RCU-protected array per interrupt
  * @enabled_ints - mask of enabled interrupts
  *
- * When a client_link is in the @clients list, that means the client exists --
- * this is guaranteed by the fact that a client is always disconnected from
- * ALL interrupts BEFORE being removed (see SkelDrvrClose()).
- * Note: @lock may be acquired with Wa->list_lock already held. But not the
- * other way around!
+ * The ISR reads @subs under cdcm_rcu_read_lock() only. Writers build a new
+ * array, publish it with cdcm_rcu_assign_pointer() and free the old one after
+ * cdcm_synchronize_rcu(). Hence when a client is in a @subs array, the client
+ * exists -- it is always disconnected from ALL interrupts BEFORE being freed
+ * (see do_close()).
  */
 typedef struct {
-	cdcm_spinlock_t	lock;
-	struct list_head    clients[SkelDrvrINTERRUPTS]; /* List of connected clients per interrupt */
-	uint32_t	enabled_ints;
+	struct cdcm_mutex	mutex;
+	struct skel_subs	*subs[SkelDrvrINTERRUPTS];
+	uint32_t		enabled_ints;
 } SkelDrvrModConn;
 
 /* =============================================== */
@@ -110,9 +133,43 @@ typedef struct {
    SkelDrvrDebugFlag      Debug;                         /* Global debug options */
    SkelDrvrStandardStatus StandardStatus;                /* Standard status */
    U32                    FlashOpen;                     /* Flash memory is open */
+   SkelDrvrDmaBufs        DmaBufs;                       /* mmap'able DMA buffers */
+   void                  *DmaBufAddr[SkelDrvrMAX_DMA_BUFS]; /* and their kernel addresses */
+   struct skel_shadow    *Shadow;                        /* Register shadow or NULL */
    void                  *UserData;
  } SkelDrvrModuleContext;
 
+/**
+ * @brief range of host-owned 32-bit registers to be shadowed
+ *
+ * @param offset -- byte offset of the first register in the register map
+ * @param count  -- number of consecutive 32-bit registers
+ *
+ * Host-owned registers are those only ever changed by the driver, i.e.
+ * configuration, never status or counters.
+ * A table of these, terminated by a zero @count, is given in SkelConf.shadow.
+ */
+struct skel_shadow_range {
+	uint32_t	offset;
+	uint32_t	count;
+};
+
+/**
+ * @brief per-module register shadow
+ *
+ * @param lock  -- protects @valid and @vals against concurrent access/reset
+ * @param nregs -- number of shadowed registers
+ * @param vals  -- last value written to/read from each register, bus order
+ * @param valid -- bitmap: the corresponding entry in @vals is valid
+ */
+struct skel_shadow {
+	cdcm_spinlock_t	lock;
+	int		nregs;
+	uint32_t	*vals;
+	uint32_t	*valid;
+	uint32_t	data[];
+};
+
 /* =============================================== */
 /* Drivers working area                            */
 
@@ -320,6 +377,27 @@ int get_vme_addr(SkelDrvrModuleContext *mcon, int am, int dw, uint32_t *addr);
 SkelDrvrModuleContext *get_mcon(int modnr);
 SkelDrvrClientContext *get_ccon(struct cdcm_file *f);
 const char *GetDebugFlagName(SkelDrvrDebugFlag debf);
+void *skel_dmabuf_alloc(SkelDrvrModuleContext *mcon, unsigned long size);
+
+/*
+ * Register access through the module's shadow (see SkelConf.shadow).
+ * Values are in bus order, like cdcm_ioread32/cdcm_iowrite32; the be/le
+ * variants below mirror those in cdcmIo.h.
+ */
+uint32_t skel_shadow_ioread32(SkelDrvrModuleContext *mcon, void *map,
+			      uint32_t offset);
+void skel_shadow_iowrite32(SkelDrvrModuleContext *mcon, uint32_t val,
+			   void *map, uint32_t offset);
+void skel_shadow_invalidate(SkelDrvrModuleContext *mcon);
+
+#define skel_shadow_ioread32be(M, A, O) \
+	cdcm_be32_to_cpu(skel_shadow_ioread32((M), (A), (O)))
+#define skel_shadow_ioread32le(M, A, O) \
+	cdcm_le32_to_cpu(skel_shadow_ioread32((M), (A), (O)))
+#define skel_shadow_iowrite32be(M, V, A, O) \
+	skel_shadow_iowrite32((M), cdcm_cpu_to_be32((V)), (A), (O))
+#define skel_shadow_iowrite32le(M, V, A, O) \
+	skel_shadow_iowrite32((M), cdcm_cpu_to_le32((V)), (A), (O))
 
 /**
 * @brief report debugging info to a client
@@ -347,6 +425,7 @@ struct skel_conf {
 	int (*write)(void *, struct cdcm_file *, char *, int);
 	int (*intrhandler)(void *);
 	int (*rawio)(SkelDrvrModuleContext *mcon, SkelDrvrRawIoBlock *riob, int write);
+	const struct skel_shadow_range *shadow;
 };
 
 /*
@@ -320,6 +320,147 @@ int get_vme_addr(SkelDrvrModuleContext *mcon, int am, int dw, uint32_t *addr)
 
 }
 
+#ifdef __linux__
+
+/*
+ * Raw block transfers smaller than this (in bytes) are done by PIO;
+ * below it setting up the DMA engine costs more than it saves.
+ * A driver can override it from its skeluser.h.
+ */
+#ifndef SKEL_RAWIO_DMA_MIN
+#define SKEL_RAWIO_DMA_MIN	512
+#endif
+
+/*
+ * Swap in place the @size-byte items of a user buffer. Used after a DMA
+ * read from a region whose byte order is not the host's.
+ */
+static int rawio_swab_user(char *up, int len, int size)
+{
+	uint32_t buf[SKEL_RAWIO_CHUNK / sizeof(uint32_t)];
+	int i, n;
+
+	while (len > 0) {
+		n = len < (int)sizeof(buf) ? len : (int)sizeof(buf);
+		if (cdcm_copy_from_user(buf, up, n))
+			return -EFAULT;
+		if (size == 2) {
+			for (i = 0; i < n / 2; i++)
+				swab16s((uint16_t *)buf + i);
+		} else {
+			for (i = 0; i < n / 4; i++)
+				swab32s(buf + i);
+		}
+		if (cdcm_copy_to_user(up, buf, n))
+			return -EFAULT;
+		up  += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * @brief do a raw block transfer by DMA, if the transfer allows it
+ *
+ * @param mcon  - module context
+ * @param anyas - address space of the transfer
+ * @param riob  - raw block transfer descriptor
+ * @param dw    - data width in bits
+ * @param write - non-zero when writing to the module
+ *
+ * Linear (AddrIncr 1) and FIFO (AddrIncr 0) transfers of at least
+ * SKEL_RAWIO_DMA_MIN bytes are done by the bridge's DMA engine, straight
+ * to/from the user's buffer. DMA moves bytes as they are on the bus, so
+ * reads from a region of foreign endianness are swapped afterwards;
+ * writes to such a region are left to PIO.
+ * Note that this is the only way to reach the block (BLT/MBLT) regions,
+ * since those are not mapped.
+ *
+ * @return 1 - the transfer is not suitable for DMA; do it by PIO
+ * @return 0 - on success
+ * @return -errno - on failure
+ */
+static int skel_vme_rawio_dma(SkelDrvrModuleContext *mcon,
+			      InsLibAnyAddressSpace *anyas,
+			      SkelDrvrRawIoTransferBlock *riob, int dw,
+			      int write)
+{
+	InsLibVmeAddressSpace *vas = (InsLibVmeAddressSpace *)anyas;
+	unsigned long uaddr = (unsigned long)riob->Data;
+	struct vme_dma_attr *vme;
+	struct vme_dma desc;
+	int size = dw / 8;
+	int swap;
+	int err;
+
+	if (mcon->Modld->BusType != InsLibBusTypeVME)
+		return 1;
+	if (riob->AddrIncr > 1 || riob->BytesTr < SKEL_RAWIO_DMA_MIN)
+		return 1;
+	if (riob->BytesTr % size || riob->Offset % size)
+		return 1;
+	/* the bridge only takes 32-bit buffer addresses */
+	if (uaddr != (unsigned int)uaddr)
+		return 1;
+
+#ifdef CDCM_LITTLE_ENDIAN
+	swap = size > 1 && anyas->Endian == InsLibEndianBIG;
+#else
+	swap = size > 1 && anyas->Endian == InsLibEndianLITTLE;
+#endif
+	if (swap && write)
+		return 1;
+
+	memset(&desc, 0, sizeof(desc));
+	desc.length   = riob->BytesTr;
+	desc.novmeinc = !riob->AddrIncr;
+
+	desc.ctrl.pci_block_size   = VME_DMA_BSIZE_4096;
+	desc.ctrl.pci_backoff_time = VME_DMA_BACKOFF_0;
+	desc.ctrl.vme_block_size   = VME_DMA_BSIZE_4096;
+	desc.ctrl.vme_backoff_time = VME_DMA_BACKOFF_0;
+
+	if (write) {
+		desc.dir       = VME_DMA_TO_DEVICE;
+		desc.src.addrl = uaddr;
+		vme = &desc.dst;
+	} else {
+		desc.dir       = VME_DMA_FROM_DEVICE;
+		desc.dst.addrl = uaddr;
+		vme = &desc.src;
+	}
+	vme->data_width = dw;
+	vme->am         = vas->AddressModifier;
+	vme->addrl      = vas->BaseAddress + riob->Offset;
+
+	report_module(mcon, SkelDrvrDebugFlagMODULE,
+		      "%s: DMA am 0x%x vme 0x%x len %d", __FUNCTION__,
+		      vme->am, vme->addrl, desc.length);
+
+	err = vme_do_dma(&desc);
+	if (err) {
+		report_module(mcon, SkelDrvrDebugFlagWARNING,
+			      "%s: vme_do_dma failed (%d)", __FUNCTION__, err);
+		return err == -EINTR ? err : -EIO;
+	}
+
+	if (swap)
+		return rawio_swab_user(riob->Data, riob->BytesTr, size);
+	return 0;
+}
+
+#else
+
+static int skel_vme_rawio_dma(SkelDrvrModuleContext *mcon,
+			      InsLibAnyAddressSpace *anyas,
+			      SkelDrvrRawIoTransferBlock *riob, int dw,
+			      int write)
+{
+	return 1;
+}
+
+#endif /* __linux__ */
+
 #else
 
 static void unmap_vmeas(SkelDrvrModuleContext *mcon, int force) {
@@ -334,4 +475,12 @@ static int AddVmeModule(SkelDrvrModuleContext *mcon) {
    return 0;
 }
 
+static int skel_vme_rawio_dma(SkelDrvrModuleContext *mcon,
+			      InsLibAnyAddressSpace *anyas,
+			      SkelDrvrRawIoTransferBlock *riob, int dw,
+			      int write)
+{
+	return 1;
+}
+
 #endif
@@ -0,0 +1,338 @@
+/**
+ * @file cdcm.h
+ *
+ * @brief User-space stand-in for CDCM, used by the skel simulator
+ *
+ * Drivers built for the simulator include this file instead of the real
+ * <cdcm/cdcm.h>. It provides the subset of the CDCM/LynxOS API that skel and
+ * skel drivers use, implemented on top of pthreads (see simcdcm.c).
+ * The VME bus is faked: find_controller() hands out RAM, vme_intset()
+ * records the ISR so that skelsim can inject interrupts, and vme_do_dma()
+ * is a memcpy to/from that RAM.
+ *
+ * Copyright (c) 2010 CERN
+ * @author Emilio G. Cota <emilio.garcia.cota@cern.ch>
+ *
+ * @section license_sec License
+ * Released under the GPL v2. (and only v2, not any later version)
+ */
+#ifndef _CDCM_H_INCLUDE_
+#define _CDCM_H_INCLUDE_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+#include <list.h>
+
+/*
+ * Endianness
+ */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CDCM_LITTLE_ENDIAN 1234
+#else
+#define CDCM_BIG_ENDIAN 4321
+#endif
+
+/*
+ * Kernel-isms
+ */
+#define HZ		100
+#define tickspersec	HZ
+#define PAGE_SIZE	4096UL
+#define KERN_ERR	""
+#define KERN_WARNING	""
+#define KERN_INFO	""
+#define KERN_DEBUG	""
+#define printk		printf
+#define kkprintf	printf
+#define cprintf		printf
+#define ksprintf	sprintf
+#define __FUNCTION__	__func__
+
+#define bcopy(s1, s2, n)	memcpy(s2, s1, n)
+#define bzero(s, n)		memset(s, 0, n)
+
+#define cdcm_ticks_to_ms(x) ((x) * 1000 / HZ)
+#define cdcm_ms_to_ticks(x) ((x) * HZ / 1000)
+
+/* return codes */
+#ifndef OK
+#define OK	0
+#endif
+#ifndef SYSERR
+#define SYSERR	(-1)
+#endif
+
+/* semaphore flags */
+#define SEM_SIGIGNORE	-1
+#define SEM_SIGRETRY	0
+#define SEM_SIGABORT	1
+
+/*
+ * errno of the calling 'process', set by pseterr()
+ */
+extern __thread int cdcm_err;
+
+/*
+ * LynxOS system API
+ */
+int   recoset(void);
+void  noreco(void);
+int   pseterr(int);
+char *sysbrk(unsigned long);
+void  sysfree(char *, unsigned long);
+int   nanotime(unsigned long *);
+void  usec_sleep(unsigned long);
+int   swait(int *, int);
+int   tswait(int *, int, int);
+int   ssignal(int *);
+int   ssignaln(int *, int);
+void  sreset(int *);
+int   scount(int *);
+int   timeout(int (*)(void *), void *, int);
+int   cancel_timeout(int);
+long  rbounds(unsigned long);
+long  wbounds(unsigned long);
+
+
+/* 'interrupts' are served by a thread, so a global lock does the job */
+extern pthread_mutex_t cdcm_sim_cpu_lock;
+#define disable(x)	do { (x) = 0; pthread_mutex_lock(&cdcm_sim_cpu_lock); } while (0)
+#define restore(x)	do { (void)(x); pthread_mutex_unlock(&cdcm_sim_cpu_lock); } while (0)
+#define enable		restore
+
+int cdcm_copy_from_user(void *, void *, int);
+int cdcm_copy_to_user(void *, void *, int);
+
+/*
+ * Locking
+ */
+typedef struct {
+	pthread_spinlock_t lock;
+} cdcm_spinlock_t;
+
+#define cdcm_spin_lock_init(cdcm) \
+	pthread_spin_init(&(cdcm)->lock, PTHREAD_PROCESS_PRIVATE)
+#define cdcm_spin_lock_irqsave(cdcm, flags)		\
+	do {						\
+		(flags) = 0;				\
+		pthread_spin_lock(&(cdcm)->lock);	\
+	} while (0)
+#define cdcm_spin_unlock_irqrestore(cdcm, flags)	\
+	do {						\
+		(void)(flags);				\
+		pthread_spin_unlock(&(cdcm)->lock);	\
+	} while (0)
+
+struct cdcm_mutex {
+	pthread_mutex_t mutex;
+};
+
+#define cdcm_mutex_init(cdcm)	pthread_mutex_init(&(cdcm)->mutex, NULL)
+#define cdcm_mutex_lock(cdcm)	pthread_mutex_lock(&(cdcm)->mutex)
+#define cdcm_mutex_unlock(cdcm)	pthread_mutex_unlock(&(cdcm)->mutex)
+#define cdcm_mutex_lock_interruptible(cdcm) \
+	pthread_mutex_lock(&(cdcm)->mutex)
+
+/*
+ * RCU: readers bump a global counter; a grace period ends when it drops to
+ * zero. Crude, but correct, and readers stay lock-free.
+ */
+extern int cdcm_sim_rcu_readers;
+void cdcm_synchronize_rcu(void);
+
+#define cdcm_rcu_read_lock(flags)					\
+	do {								\
+		(flags) = 0;						\
+		__atomic_add_fetch(&cdcm_sim_rcu_readers, 1,		\
+				   __ATOMIC_SEQ_CST);			\
+	} while (0)
+#define cdcm_rcu_read_unlock(flags)					\
+	do {								\
+		(void)(flags);						\
+		__atomic_sub_fetch(&cdcm_sim_rcu_readers, 1,		\
+				   __ATOMIC_RELEASE);			\
+	} while (0)
+#define cdcm_rcu_dereference(p)		__atomic_load_n(&(p), __ATOMIC_CONSUME)
+#define cdcm_rcu_assign_pointer(p, v)	__atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+/*
+ * I/O: the 'hardware' is RAM
+ */
+#define cdcm_mb()	__sync_synchronize()
+#define cdcm_rmb()	__sync_synchronize()
+#define cdcm_wmb()	__sync_synchronize()
+
+#define cdcm_ioread8(A)		(*(volatile uint8_t *)(A))
+#define cdcm_ioread16(A)	(*(volatile uint16_t *)(A))
+#define cdcm_ioread32(A)	(*(volatile uint32_t *)(A))
+#define cdcm_iowrite8(V, A)	(*(volatile uint8_t *)(A) = (V))
+#define cdcm_iowrite16(V, A)	(*(volatile uint16_t *)(A) = (V))
+#define cdcm_iowrite32(V, A)	(*(volatile uint32_t *)(A) = (V))
+
+#ifdef CDCM_LITTLE_ENDIAN
+#define cdcm_be16_to_cpu(x)	__builtin_bswap16((uint16_t)(x))
+#define cdcm_be32_to_cpu(x)	__builtin_bswap32((uint32_t)(x))
+#define cdcm_le16_to_cpu(x)	((uint16_t)(x))
+#define cdcm_le32_to_cpu(x)	((uint32_t)(x))
+#else
+#define cdcm_be16_to_cpu(x)	((uint16_t)(x))
+#define cdcm_be32_to_cpu(x)	((uint32_t)(x))
+#define cdcm_le16_to_cpu(x)	__builtin_bswap16((uint16_t)(x))
+#define cdcm_le32_to_cpu(x)	__builtin_bswap32((uint32_t)(x))
+#endif
+#define cdcm_cpu_to_be16	cdcm_be16_to_cpu
+#define cdcm_cpu_to_be32	cdcm_be32_to_cpu
+#define cdcm_cpu_to_le16	cdcm_le16_to_cpu
+#define cdcm_cpu_to_le32	cdcm_le32_to_cpu
+
+#define cdcm_ioread16be(A)	cdcm_be16_to_cpu(cdcm_ioread16((A)))
+#define cdcm_ioread32be(A)	cdcm_be32_to_cpu(cdcm_ioread32((A)))
+#define cdcm_ioread16le(A)	cdcm_le16_to_cpu(cdcm_ioread16((A)))
+#define cdcm_ioread32le(A)	cdcm_le32_to_cpu(cdcm_ioread32((A)))
+#define cdcm_iowrite16be(V, A)	cdcm_iowrite16(cdcm_cpu_to_be16((V)), (A))
+#define cdcm_iowrite32be(V, A)	cdcm_iowrite32(cdcm_cpu_to_be32((V)), (A))
+#define cdcm_iowrite16le(V, A)	cdcm_iowrite16(cdcm_cpu_to_le16((V)), (A))
+#define cdcm_iowrite32le(V, A)	cdcm_iowrite32(cdcm_cpu_to_le32((V)), (A))
+
+#define swab16s(p)	(*(p) = __builtin_bswap16(*(p)))
+#define swab32s(p)	(*(p) = __builtin_bswap32(*(p)))
+
+/*
+ * mmap'able DMA buffers: plain memory here
+ */
+void *cdcm_dmabuf_alloc(unsigned long size, unsigned long *offset);
+int cdcm_dmabuf_free(void *kaddr);
+
+/*
+ * Files and entry points
+ */
+struct cdcm_file {
+	dev_t dev;
+	int access_mode;
+	long long position;
+	char *buffer;
+};
+
+#define SREAD	0
+#define SWRITE	1
+#define SEXCEPT	2
+struct cdcm_sel {
+	int *iosem;
+	int **sel_sem;
+	long mask;
+	long *pmask;
+};
+#define sel cdcm_sel
+
+struct dldd {
+	int	(*dldd_open)(void *, int, struct cdcm_file *);
+	int	(*dldd_close)(void *, struct cdcm_file *);
+	int	(*dldd_read)(void *, struct cdcm_file *, char *, int);
+	int	(*dldd_write)(void *, struct cdcm_file *, char *, int);
+	int	(*dldd_select)(void *, struct cdcm_file *, int, struct cdcm_sel *);
+	int	(*dldd_ioctl)(void *, struct cdcm_file *, int, char *);
+	char	*(*dldd_install)(void *);
+	int	(*dldd_uninstall)(void *);
+};
+
+#define minor(d)	((int)((d) & 0xff))
+
+/*
+ * Fake VME bus
+ */
+#ifdef CONFIG_BUS_VME
+
+#define VME_PG_SHARED	0x00
+#define VME_PG_PRIVATE	0x02
+
+struct pdparam_master {
+	unsigned long iack;
+	unsigned long rdpref;
+	unsigned long wrpost;
+	unsigned long swap;
+	unsigned long sgmin;
+	unsigned long dum[3];
+};
+
+unsigned long find_controller(unsigned long vmeaddr, unsigned long len,
+			      unsigned long am, unsigned long offset,
+			      unsigned long size, struct pdparam_master *param);
+unsigned long return_controller(unsigned long logaddr, unsigned long len);
+int vme_intset(int vct, int (*handler)(void *), char *arg, long *sav);
+int vme_intclr(int vct, long *sav);
+
+enum vme_data_width {
+	VME_D8	= 8,
+	VME_D16	= 16,
+	VME_D32	= 32,
+	VME_D64	= 64
+};
+
+enum vme_dma_block_size {
+	VME_DMA_BSIZE_32 = 0,
+	VME_DMA_BSIZE_64,
+	VME_DMA_BSIZE_128,
+	VME_DMA_BSIZE_256,
+	VME_DMA_BSIZE_512,
+	VME_DMA_BSIZE_1024,
+	VME_DMA_BSIZE_2048,
+	VME_DMA_BSIZE_4096
+};
+
+enum vme_dma_backoff {
+	VME_DMA_BACKOFF_0 = 0,
+	VME_DMA_BACKOFF_1,
+	VME_DMA_BACKOFF_2,
+	VME_DMA_BACKOFF_4,
+	VME_DMA_BACKOFF_8,
+	VME_DMA_BACKOFF_16,
+	VME_DMA_BACKOFF_32,
+	VME_DMA_BACKOFF_64
+};
+
+struct vme_dma_attr {
+	enum vme_data_width	data_width;
+	unsigned int		am;
+	unsigned int		v2esst_mode;
+	unsigned int		bcast_select;
+	unsigned int		addru;
+	unsigned int		addrl;
+};
+
+struct vme_dma_ctrl {
+	enum vme_dma_block_size	vme_block_size;
+	enum vme_dma_backoff	vme_backoff_time;
+	enum vme_dma_block_size	pci_block_size;
+	enum vme_dma_backoff	pci_backoff_time;
+};
+
+enum vme_dma_dir {
+	VME_DMA_TO_DEVICE = 1,
+	VME_DMA_FROM_DEVICE
+};
+
+struct vme_dma {
+	unsigned int		status;
+	unsigned int		length;
+	unsigned int		novmeinc;
+	enum vme_dma_dir	dir;
+	struct vme_dma_attr	src;
+	struct vme_dma_attr	dst;
+	struct vme_dma_ctrl	ctrl;
+};
+
+int vme_do_dma(struct vme_dma *desc);
+int vme_do_dma_kernel(struct vme_dma *desc);
+
+#endif /* CONFIG_BUS_VME */
+
+#endif /* _CDCM_H_INCLUDE_ */
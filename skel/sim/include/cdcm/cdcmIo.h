@@ -0,0 +1,2 @@
+/* skel simulator: everything is in cdcm/cdcm.h */
+#include <cdcm/cdcm.h>
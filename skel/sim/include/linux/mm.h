@@ -0,0 +1,43 @@
+/*
+ * skel simulator: enough of the page API for drivers that pin user
+ * buffers. A user page is its own kernel mapping.
+ */
+#ifndef _SKELSIM_LINUX_MM_H
+#define _SKELSIM_LINUX_MM_H
+
+#include <linux/vmalloc.h>
+#include <unistd.h>
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE	4096UL
+#endif
+#define PAGE_SHIFT	12
+#define PAGE_MASK	(~(PAGE_SIZE - 1))
+
+struct page {
+	void *addr;
+};
+
+struct mm_struct {
+	int mmap_sem;
+};
+
+struct task_struct {
+	struct mm_struct *mm;
+};
+
+extern struct task_struct *current;
+
+#define down_read(s)	do { (void)(s); } while (0)
+#define up_read(s)	do { (void)(s); } while (0)
+#define kmap(p)		((p)->addr)
+#define kunmap(p)	do { (void)(p); } while (0)
+#define SetPageDirty(p)	do { (void)(p); } while (0)
+#define udelay(us)	do { (void)(us); } while (0)
+
+int get_user_pages(struct task_struct *tsk, struct mm_struct *mm,
+		   unsigned long start, int nr_pages, int write, int force,
+		   struct page **pages, void **vmas);
+void page_cache_release(struct page *page);
+
+#endif /* _SKELSIM_LINUX_MM_H */
@@ -0,0 +1,2 @@
+/* skel simulator: see linux/mm.h */
+#include <linux/mm.h>
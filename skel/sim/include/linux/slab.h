@@ -0,0 +1,2 @@
+/* skel simulator: see vmalloc.h */
+#include <linux/vmalloc.h>
@@ -0,0 +1,21 @@
+/*
+ * skel simulator: libinstkernel.c allocates with kmalloc/vmalloc.
+ * In user space both are malloc.
+ */
+#ifndef _SKELSIM_LINUX_VMALLOC_H
+#define _SKELSIM_LINUX_VMALLOC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GFP_KERNEL	0
+#define kmalloc(s, f)	malloc(s)
+#ifndef kfree
+#define kfree(p)	free(p)
+#endif
+#define vmalloc(s)	malloc(s)
+#define vfree(p)	free(p)
+#define printk		printf
+
+#endif /* _SKELSIM_LINUX_VMALLOC_H */
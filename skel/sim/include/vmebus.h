@@ -0,0 +1,36 @@
+/*
+ * skel simulator: the VME bridge API is declared in cdcm/cdcm.h;
+ * here go the bridge's names for the address modifiers.
+ */
+#ifndef _SKELSIM_VMEBUS_H
+#define _SKELSIM_VMEBUS_H
+
+#include <cdcm/cdcm.h>
+#include <vme_am.h>
+
+#define VME_A64_MBLT		AM_A64_MBLT
+#define VME_A64_SCT		AM_A64_SACCT
+#define VME_A64_BLT		AM_A64_BLT
+#define VME_A32_USER_MBLT	AM_A32_UMBLT
+#define VME_A32_USER_DATA_SCT	AM_A32_UDA
+#define VME_A32_USER_PRG_SCT	AM_A32_UPA
+#define VME_A32_USER_BLT	AM_A32_UBLT
+#define VME_A32_SUP_MBLT	AM_A32_SMBLT
+#define VME_A32_SUP_DATA_SCT	AM_A32_SDA
+#define VME_A32_SUP_PRG_SCT	AM_A32_SPA
+#define VME_A32_SUP_BLT		AM_A32_SBLT
+#define VME_A16_USER		AM_A16_UACC
+#define VME_A16_SUP		AM_A16_SACC
+#define VME_CR_CSR		AM_A24_CR_CSR
+#define VME_A40_SCT		AM_A40_ACC
+#define VME_A40_BLT		AM_A40_BLT
+#define VME_A24_USER_MBLT	AM_A24_UMBLT
+#define VME_A24_USER_DATA_SCT	AM_A24_UDA
+#define VME_A24_USER_PRG_SCT	AM_A24_UPA
+#define VME_A24_USER_BLT	AM_A24_UBLT
+#define VME_A24_SUP_MBLT	AM_A24_SMBLT
+#define VME_A24_SUP_DATA_SCT	AM_A24_SDA
+#define VME_A24_SUP_PRG_SCT	AM_A24_SPA
+#define VME_A24_SUP_BLT		AM_A24_SBLT
+
+#endif /* _SKELSIM_VMEBUS_H */
@@ -0,0 +1,556 @@
+/**
+ * @file simcdcm.c
+ *
+ * @brief User-space implementation of the CDCM subset used by skel
+ *
+ * See include/cdcm/cdcm.h. Memory is malloc, semaphores are condition
+ * variables and the VME bus is a list of RAM windows.
+ *
+ * Copyright (c) 2010 CERN
+ * @author Emilio G. Cota <emilio.garcia.cota@cern.ch>
+ *
+ * @section license_sec License
+ * Released under the GPL v2. (and only v2, not any later version)
+ */
+#include <limits.h>
+#include <time.h>
+
+#include <cdcm/cdcm.h>
+#include <linux/mm.h>
+#include "skelsim.h"
+
+__thread int cdcm_err;
+pthread_mutex_t cdcm_sim_cpu_lock = PTHREAD_MUTEX_INITIALIZER;
+int cdcm_sim_rcu_readers;
+
+int recoset(void)
+{
+	return 0;
+}
+
+void noreco(void)
+{
+}
+
+int pseterr(int err)
+{
+	cdcm_err = err;
+	return err;
+}
+
+char *sysbrk(unsigned long size)
+{
+	return malloc(size);
+}
+
+void sysfree(char *cp, unsigned long size)
+{
+	free(cp);
+}
+
+long rbounds(unsigned long addr)
+{
+	return INT_MAX;
+}
+
+long wbounds(unsigned long addr)
+{
+	return INT_MAX;
+}
+
+int cdcm_copy_from_user(void *to, void *from, int size)
+{
+	memcpy(to, from, size);
+	return 0;
+}
+
+int cdcm_copy_to_user(void *to, void *from, int size)
+{
+	memcpy(to, from, size);
+	return 0;
+}
+
+int nanotime(unsigned long *sec)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if (sec)
+		*sec = ts.tv_sec;
+	return ts.tv_nsec;
+}
+
+void usec_sleep(unsigned long usecs)
+{
+	usleep(usecs);
+}
+
+void cdcm_synchronize_rcu(void)
+{
+	__sync_synchronize();
+	while (__atomic_load_n(&cdcm_sim_rcu_readers, __ATOMIC_ACQUIRE))
+		sched_yield();
+}
+
+/*
+ * Semaphores
+ *
+ * The int is the count; waiters sleep on one of a few hashed condition
+ * variables. sreset() bumps the bucket's generation so that its sleepers
+ * return.
+ */
+#define SEM_BUCKETS 64
+
+static struct sem_bucket {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	unsigned long	gen;
+} sem_buckets[SEM_BUCKETS];
+
+static void __attribute__((constructor)) sem_init(void)
+{
+	pthread_condattr_t attr;
+	int i;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	for (i = 0; i < SEM_BUCKETS; i++) {
+		pthread_mutex_init(&sem_buckets[i].lock, NULL);
+		pthread_cond_init(&sem_buckets[i].cond, &attr);
+	}
+	pthread_condattr_destroy(&attr);
+}
+
+static inline struct sem_bucket *sem_bucket(int *sem)
+{
+	return &sem_buckets[((uintptr_t)sem >> 2) % SEM_BUCKETS];
+}
+
+/* @ticks < 0: wait forever */
+static int __swait(int *sem, int ticks)
+{
+	struct sem_bucket *b = sem_bucket(sem);
+	struct timespec ts;
+	unsigned long gen;
+	int ret = 0;
+
+	if (ticks >= 0) {
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		ts.tv_sec  += ticks / HZ;
+		ts.tv_nsec += (ticks % HZ) * (1000000000 / HZ);
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+	}
+
+	pthread_mutex_lock(&b->lock);
+	gen = b->gen;
+	while (*sem <= 0 && b->gen == gen) {
+		if (ticks < 0) {
+			pthread_cond_wait(&b->cond, &b->lock);
+		} else if (pthread_cond_timedwait(&b->cond, &b->lock, &ts)) {
+			ret = 1;
+			break;
+		}
+	}
+	if (!ret && b->gen == gen)
+		(*sem)--;
+	pthread_mutex_unlock(&b->lock);
+	return ret;
+}
+
+int swait(int *sem, int flag)
+{
+	return __swait(sem, -1) ? SYSERR : OK;
+}
+
+int tswait(int *sem, int flag, int ticks)
+{
+	if (sem == NULL) {
+		usleep(ticks * (1000000 / HZ));
+		return 1;
+	}
+	if (ticks == 0) {
+		struct sem_bucket *b = sem_bucket(sem);
+		int ret = 1;
+
+		pthread_mutex_lock(&b->lock);
+		if (*sem > 0) {
+			(*sem)--;
+			ret = 0;
+		}
+		pthread_mutex_unlock(&b->lock);
+		return ret;
+	}
+	return __swait(sem, ticks < 0 ? -1 : ticks);
+}
+
+int ssignaln(int *sem, int count)
+{
+	struct sem_bucket *b = sem_bucket(sem);
+
+	pthread_mutex_lock(&b->lock);
+	*sem += count;
+	pthread_cond_broadcast(&b->cond);
+	pthread_mutex_unlock(&b->lock);
+	return OK;
+}
+
+int ssignal(int *sem)
+{
+	return ssignaln(sem, 1);
+}
+
+void sreset(int *sem)
+{
+	struct sem_bucket *b = sem_bucket(sem);
+
+	pthread_mutex_lock(&b->lock);
+	*sem = 0;
+	b->gen++;
+	pthread_cond_broadcast(&b->cond);
+	pthread_mutex_unlock(&b->lock);
+}
+
+int scount(int *sem)
+{
+	return *sem;
+}
+
+/*
+ * Lynx timeouts: not needed by skel; fail loudly if a driver uses them.
+ */
+int timeout(int (*func)(void *), void *arg, int ticks)
+{
+	fprintf(stderr, "simcdcm: timeout() not supported\n");
+	return SYSERR;
+}
+
+int cancel_timeout(int id)
+{
+	return SYSERR;
+}
+
+/*
+ * DMA buffers: plain page-aligned memory
+ */
+void *cdcm_dmabuf_alloc(unsigned long size, unsigned long *offset)
+{
+	static unsigned long next = PAGE_SIZE;
+	void *p;
+
+	if (posix_memalign(&p, PAGE_SIZE, size))
+		return NULL;
+	memset(p, 0, size);
+	*offset = __atomic_fetch_add(&next, (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1),
+				     __ATOMIC_RELAXED);
+	return p;
+}
+
+int cdcm_dmabuf_free(void *kaddr)
+{
+	free(kaddr);
+	return 0;
+}
+
+/*
+ * Pinning user pages: there is one address space, so a page is its
+ * own kernel mapping.
+ */
+static struct mm_struct sim_mm;
+static struct task_struct sim_task = { .mm = &sim_mm };
+struct task_struct *current = &sim_task;
+
+int get_user_pages(struct task_struct *tsk, struct mm_struct *mm,
+		   unsigned long start, int nr_pages, int write, int force,
+		   struct page **pages, void **vmas)
+{
+	int i;
+
+	for (i = 0; i < nr_pages; i++) {
+		pages[i] = malloc(sizeof(struct page));
+		if (pages[i] == NULL)
+			break;
+		pages[i]->addr = (void *)(start + i * PAGE_SIZE);
+	}
+	return i;
+}
+
+void page_cache_release(struct page *page)
+{
+	free(page);
+}
+
+/*
+ * Fake VME bus
+ */
+#ifdef CONFIG_BUS_VME
+
+struct sim_window {
+	unsigned long		am;
+	unsigned long		base;
+	unsigned long		len;
+	void			*ram;
+	struct sim_window	*next;
+};
+
+static struct sim_window *windows;
+static pthread_mutex_t windows_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Presets: register contents a module has at power-up, e.g. its
+ * configuration ROM. Applied when a window covering them is mapped.
+ */
+struct sim_preset {
+	unsigned long		am;
+	unsigned long		addr;
+	uint32_t		val;
+	int			width;
+	struct sim_preset	*next;
+};
+
+static struct sim_preset *presets;
+
+/* address space of an address modifier: 16, 24, 32, 40, 64 or 0 (CR/CSR) */
+static int am_space(unsigned long am)
+{
+	switch (am) {
+	case 0x29:
+	case 0x2d:
+		return 16;
+	case 0x2f:
+		return 0;
+	case 0x00 ... 0x03:
+		return 64;
+	case 0x08 ... 0x0f:
+		return 32;
+	case 0x34 ... 0x37:
+		return 40;
+	case 0x38 ... 0x3f:
+		return 24;
+	default:
+		return -1;
+	}
+}
+
+/* store @val as the bus would deliver it: big endian */
+static void bus_store(void *ram, uint32_t val, int width)
+{
+	switch (width) {
+	case 8:
+		*(uint8_t *)ram = val;
+		break;
+	case 16:
+		*(uint16_t *)ram = __builtin_bswap16(val);
+		break;
+	default:
+		*(uint32_t *)ram = __builtin_bswap32(val);
+	}
+}
+
+static void apply_presets(struct sim_window *w)
+{
+	struct sim_preset *p;
+
+	for (p = presets; p; p = p->next) {
+		if (am_space(p->am) == am_space(w->am) && p->addr >= w->base &&
+		    p->addr + p->width / 8 <= w->base + w->len)
+			bus_store((char *)w->ram + p->addr - w->base, p->val,
+				  p->width);
+	}
+}
+
+int simcdcm_vme_preset(unsigned long am, unsigned long addr, uint32_t val,
+		       int width)
+{
+	struct sim_preset *p, **pp;
+
+	if (am_space(am) < 0 || (width != 8 && width != 16 && width != 32))
+		return -EINVAL;
+	p = malloc(sizeof(*p));
+	if (p == NULL)
+		return -ENOMEM;
+	p->am = am;
+	p->addr = addr;
+	p->val = val;
+	p->width = width;
+
+	p->next = NULL;
+
+	/* keep them in order: a later preset overrides an earlier one */
+	pthread_mutex_lock(&windows_lock);
+	for (pp = &presets; *pp; pp = &(*pp)->next)
+		;
+	*pp = p;
+	pthread_mutex_unlock(&windows_lock);
+	return 0;
+}
+
+unsigned long find_controller(unsigned long vmeaddr, unsigned long len,
+			      unsigned long am, unsigned long offset,
+			      unsigned long size, struct pdparam_master *param)
+{
+	struct sim_window *w;
+
+	if (!len || am_space(am) < 0)
+		return (unsigned long)-1;
+
+	w = calloc(1, sizeof(*w));
+	if (w == NULL)
+		return (unsigned long)-1;
+	if (posix_memalign(&w->ram, PAGE_SIZE, len)) {
+		free(w);
+		return (unsigned long)-1;
+	}
+	memset(w->ram, 0, len);
+	w->am = am;
+	w->base = vmeaddr;
+	w->len = len;
+
+	pthread_mutex_lock(&windows_lock);
+	apply_presets(w);
+	w->next = windows;
+	windows = w;
+	pthread_mutex_unlock(&windows_lock);
+
+	return (unsigned long)w->ram + offset;
+}
+
+unsigned long return_controller(unsigned long logaddr, unsigned long len)
+{
+	struct sim_window **pw, *w;
+
+	pthread_mutex_lock(&windows_lock);
+	for (pw = &windows; (w = *pw) != NULL; pw = &w->next) {
+		if ((unsigned long)w->ram == logaddr) {
+			*pw = w->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&windows_lock);
+	if (w == NULL)
+		return (unsigned long)-1;
+	free(w->ram);
+	free(w);
+	return 0;
+}
+
+/*
+ * Translate a VME address into the RAM behind it.
+ * Any AM of the same address space as the window's reaches it, so that
+ * a DMA with a BLT modifier hits the window mapped with the data one.
+ */
+static void *vme_to_ram(unsigned long am, unsigned long addr, unsigned long len)
+{
+	struct sim_window *w;
+	void *ram = NULL;
+
+	pthread_mutex_lock(&windows_lock);
+	for (w = windows; w; w = w->next) {
+		if (am_space(w->am) == am_space(am) && addr >= w->base &&
+		    addr + len <= w->base + w->len) {
+			ram = (char *)w->ram + (addr - w->base);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&windows_lock);
+	return ram;
+}
+
+static struct {
+	int	(*handler)(void *);
+	void	*arg;
+} vme_vectors[256];
+
+int vme_intset(int vct, int (*handler)(void *), char *arg, long *sav)
+{
+	if (vct < 0 || vct > 255 || vme_vectors[vct].handler)
+		return -EBUSY;
+	vme_vectors[vct].arg = arg;
+	vme_vectors[vct].handler = handler;
+	return 0;
+}
+
+int vme_intclr(int vct, long *sav)
+{
+	if (vct < 0 || vct > 255 || vme_vectors[vct].handler == NULL)
+		return -EINVAL;
+	vme_vectors[vct].handler = NULL;
+	vme_vectors[vct].arg = NULL;
+	return 0;
+}
+
+/* called by skelsim from its interrupt thread */
+int simcdcm_vme_irq(int vct)
+{
+	int (*handler)(void *);
+
+	if (vct < 0 || vct > 255)
+		return -EINVAL;
+	handler = vme_vectors[vct].handler;
+	if (handler == NULL)
+		return -ENOENT;
+	return handler(vme_vectors[vct].arg);
+}
+
+void *simcdcm_vme_ram(unsigned long am, unsigned long addr, unsigned long len)
+{
+	return vme_to_ram(am, addr, len);
+}
+
+static int __vme_do_dma(struct vme_dma *desc)
+{
+	struct vme_dma_attr *vme;
+	unsigned long buf;
+	char *ram;
+	int size;
+	unsigned int i;
+
+	if (!desc->length)
+		return -EINVAL;
+	if (desc->dir == VME_DMA_FROM_DEVICE) {
+		vme = &desc->src;
+		buf = (unsigned long)desc->dst.addru << 32 | desc->dst.addrl;
+	} else if (desc->dir == VME_DMA_TO_DEVICE) {
+		vme = &desc->dst;
+		buf = (unsigned long)desc->src.addru << 32 | desc->src.addrl;
+	} else {
+		return -EINVAL;
+	}
+
+	size = vme->data_width / 8;
+	ram = vme_to_ram(vme->am, vme->addrl,
+			 desc->novmeinc ? size : desc->length);
+	if (ram == NULL)
+		return -EIO;
+
+	if (!desc->novmeinc) {
+		if (desc->dir == VME_DMA_FROM_DEVICE)
+			memcpy((void *)buf, ram, desc->length);
+		else
+			memcpy(ram, (void *)buf, desc->length);
+		return 0;
+	}
+
+	/* FIFO: keep hitting the same address */
+	for (i = 0; i < desc->length; i += size) {
+		if (desc->dir == VME_DMA_FROM_DEVICE)
+			memcpy((char *)buf + i, ram, size);
+		else
+			memcpy(ram, (char *)buf + i, size);
+	}
+	return 0;
+}
+
+int vme_do_dma(struct vme_dma *desc)
+{
+	return __vme_do_dma(desc);
+}
+
+int vme_do_dma_kernel(struct vme_dma *desc)
+{
+	return __vme_do_dma(desc);
+}
+
+#endif /* CONFIG_BUS_VME */
@@ -0,0 +1,425 @@
+/**
+ * @file skelsim.c
+ *
+ * @brief Run a skel driver in user space
+ *
+ * Plays the part of cdcmDrvr.c: installs the driver from an XML file,
+ * keeps a table of open files and copies arguments in and out of the
+ * entry points the way the kernel does. See skelsim.h.
+ *
+ * Copyright (c) 2010 CERN
+ * @author Emilio G. Cota <emilio.garcia.cota@cern.ch>
+ *
+ * @section license_sec License
+ * Released under the GPL v2. (and only v2, not any later version)
+ */
+#include <time.h>
+
+#include <cdcm/cdcm.h>
+#include <skeldrvrP.h>
+#include <libinstkernel.h>
+
+#include "skelsim.h"
+
+extern struct dldd entry_points;
+extern SkelDrvrWorkingArea *Wa;
+
+InsLibHostDesc *InsLibParseInstallFile(char *, int);
+
+#define SKELSIM_FILES	64
+
+static struct cdcm_file *files[SKELSIM_FILES];
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char *statics;
+
+int64_t skelsim_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* translate a driver's return value into a syscall's */
+static int sys_ret(int ret)
+{
+	if (ret == SYSERR) {
+		errno = cdcm_err ? cdcm_err : EIO;
+		return -1;
+	}
+	return ret;
+}
+
+static struct cdcm_file *get_file(int fd)
+{
+	if (fd < 0 || fd >= SKELSIM_FILES || files[fd] == NULL) {
+		errno = EBADF;
+		return NULL;
+	}
+	return files[fd];
+}
+
+/*
+ * Interrupts
+ *
+ * Injected vectors are queued to a thread that plays the CPU taking the
+ * interrupt, so that a client blocked in read() is woken up from another
+ * context like on a real machine.
+ */
+struct irq_job {
+	int	vector;
+	int	count;
+	int	period_us;
+};
+
+#define IRQ_JOBS 64
+
+static struct {
+	pthread_t	thread;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	pthread_cond_t	idle;
+	struct irq_job	jobs[IRQ_JOBS];
+	int		head;
+	int		tail;
+	int		busy;
+	int		stop;
+	int		running;
+} irq = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.idle = PTHREAD_COND_INITIALIZER,
+};
+
+static int64_t last_irq_ns;
+
+int64_t skelsim_last_irq_ns(void)
+{
+	return __atomic_load_n(&last_irq_ns, __ATOMIC_ACQUIRE);
+}
+
+int skelsim_irq(int vector)
+{
+	int ret;
+
+	__atomic_store_n(&last_irq_ns, skelsim_now_ns(), __ATOMIC_RELEASE);
+	ret = simcdcm_vme_irq(vector);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+	return 0;
+}
+
+static void *irq_thread(void *arg)
+{
+	struct irq_job job;
+	int i;
+
+	pthread_mutex_lock(&irq.lock);
+	for (;;) {
+		while (irq.head == irq.tail && !irq.stop)
+			pthread_cond_wait(&irq.cond, &irq.lock);
+		if (irq.stop)
+			break;
+		job = irq.jobs[irq.tail];
+		irq.busy = 1;
+		pthread_mutex_unlock(&irq.lock);
+
+		for (i = 0; i < job.count; i++) {
+			if (i && job.period_us)
+				usleep(job.period_us);
+			skelsim_irq(job.vector);
+		}
+
+		pthread_mutex_lock(&irq.lock);
+		irq.tail = (irq.tail + 1) % IRQ_JOBS;
+		irq.busy = 0;
+		if (irq.head == irq.tail)
+			pthread_cond_broadcast(&irq.idle);
+	}
+	pthread_mutex_unlock(&irq.lock);
+	return NULL;
+}
+
+int skelsim_irq_async(int vector, int count, int period_us)
+{
+	int next;
+
+	pthread_mutex_lock(&irq.lock);
+	next = (irq.head + 1) % IRQ_JOBS;
+	if (!irq.running || next == irq.tail) {
+		pthread_mutex_unlock(&irq.lock);
+		errno = irq.running ? EAGAIN : ENODEV;
+		return -1;
+	}
+	irq.jobs[irq.head].vector = vector;
+	irq.jobs[irq.head].count = count;
+	irq.jobs[irq.head].period_us = period_us;
+	irq.head = next;
+	pthread_cond_signal(&irq.cond);
+	pthread_mutex_unlock(&irq.lock);
+	return 0;
+}
+
+void skelsim_irq_drain(void)
+{
+	pthread_mutex_lock(&irq.lock);
+	while (irq.head != irq.tail || irq.busy)
+		pthread_cond_wait(&irq.idle, &irq.lock);
+	pthread_mutex_unlock(&irq.lock);
+}
+
+/*
+ * Install/uninstall
+ */
+int skelsim_install(char *xmlfile, char *drvname)
+{
+	InsLibHostDesc *hostd;
+	InsLibDrvrDesc *drvrd;
+	char *st;
+
+	if (statics) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	hostd = InsLibParseInstallFile(xmlfile, 0);
+	if (hostd == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	drvrd = InsLibGetDriver(hostd, drvname);
+	if (drvrd == NULL) {
+		InsLibFreeHost(hostd);
+		errno = ENOENT;
+		return -1;
+	}
+
+	/* the driver takes its own copy */
+	st = entry_points.dldd_install(&drvrd);
+	InsLibFreeHost(hostd);
+	if (st == (char *)SYSERR) {
+		errno = cdcm_err ? cdcm_err : ENODEV;
+		return -1;
+	}
+	statics = st;
+
+	pthread_mutex_lock(&irq.lock);
+	irq.stop = 0;
+	irq.head = irq.tail = 0;
+	if (pthread_create(&irq.thread, NULL, irq_thread, NULL) == 0)
+		irq.running = 1;
+	pthread_mutex_unlock(&irq.lock);
+
+	return 0;
+}
+
+int skelsim_uninstall(void)
+{
+	if (statics == NULL) {
+		errno = ENODEV;
+		return -1;
+	}
+
+	pthread_mutex_lock(&irq.lock);
+	if (irq.running) {
+		irq.stop = 1;
+		pthread_cond_signal(&irq.cond);
+		pthread_mutex_unlock(&irq.lock);
+		pthread_join(irq.thread, NULL);
+		pthread_mutex_lock(&irq.lock);
+		irq.running = 0;
+	}
+	pthread_mutex_unlock(&irq.lock);
+
+	if (sys_ret(entry_points.dldd_uninstall(statics)) < 0)
+		return -1;
+	statics = NULL;
+	return 0;
+}
+
+/*
+ * File operations
+ */
+
+/* @path is only looked at for the minor number: "/dev/null.1" -> 1 */
+int skelsim_open(const char *path, int flags)
+{
+	struct cdcm_file *flp;
+	const char *p;
+	int minor = 0;
+	int fd;
+
+	if (statics == NULL) {
+		errno = ENODEV;
+		return -1;
+	}
+	if (path && (p = strrchr(path, '.')) != NULL)
+		minor = atoi(p + 1);
+
+	flp = calloc(1, sizeof(*flp));
+	if (flp == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	flp->dev = minor;
+	flp->access_mode = flags & O_ACCMODE;
+
+	pthread_mutex_lock(&files_lock);
+	for (fd = 0; fd < SKELSIM_FILES; fd++) {
+		if (files[fd] == NULL) {
+			files[fd] = flp;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&files_lock);
+	if (fd == SKELSIM_FILES) {
+		free(flp);
+		errno = EMFILE;
+		return -1;
+	}
+
+	cdcm_err = 0;
+	if (entry_points.dldd_open(statics, minor, flp) != OK) {
+		pthread_mutex_lock(&files_lock);
+		files[fd] = NULL;
+		pthread_mutex_unlock(&files_lock);
+		free(flp);
+		errno = ENODEV;
+		return -1;
+	}
+	return fd;
+}
+
+int skelsim_close(int fd)
+{
+	struct cdcm_file *flp = get_file(fd);
+	int ret;
+
+	if (flp == NULL)
+		return -1;
+
+	cdcm_err = 0;
+	ret = entry_points.dldd_close(statics, flp);
+
+	pthread_mutex_lock(&files_lock);
+	files[fd] = NULL;
+	pthread_mutex_unlock(&files_lock);
+	free(flp);
+
+	if (ret != OK) {
+		errno = ENODEV;
+		return -1;
+	}
+	return 0;
+}
+
+int skelsim_ioctl(int fd, unsigned long cmd, void *arg)
+{
+	struct cdcm_file *flp = get_file(fd);
+	int iodir = _IOC_DIR(cmd);
+	int iosz = _IOC_SIZE(cmd);
+	char *iobuf = NULL;
+	int ret;
+
+	if (flp == NULL)
+		return -1;
+
+	if (iodir != _IOC_NONE) {
+		iobuf = malloc(iosz ? iosz : 1);
+		if (iobuf == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		if (iodir & _IOC_WRITE)
+			memcpy(iobuf, arg, iosz);
+	}
+
+	cdcm_err = 0;
+	ret = entry_points.dldd_ioctl(statics, flp, cmd, iobuf);
+	if (ret != SYSERR && (iodir & _IOC_READ))
+		memcpy(arg, iobuf, iosz);
+	free(iobuf);
+	return sys_ret(ret);
+}
+
+int skelsim_read(int fd, void *buf, int len)
+{
+	struct cdcm_file *flp = get_file(fd);
+	char *iobuf;
+	int ret;
+
+	if (flp == NULL)
+		return -1;
+	iobuf = malloc(len);
+	if (iobuf == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	cdcm_err = 0;
+	ret = entry_points.dldd_read(statics, flp, iobuf, len);
+	if (ret == SYSERR) {
+		free(iobuf);
+		errno = EAGAIN;
+		return -1;
+	}
+	memcpy(buf, iobuf, len);
+	free(iobuf);
+	return ret;
+}
+
+int skelsim_write(int fd, const void *buf, int len)
+{
+	struct cdcm_file *flp = get_file(fd);
+	char *iobuf;
+	int ret;
+
+	if (flp == NULL)
+		return -1;
+	iobuf = malloc(len);
+	if (iobuf == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memcpy(iobuf, buf, len);
+
+	/* a simulated interrupt counts as one for latency measurements */
+	__atomic_store_n(&last_irq_ns, skelsim_now_ns(), __ATOMIC_RELEASE);
+	cdcm_err = 0;
+	ret = entry_points.dldd_write(statics, flp, iobuf, len);
+	free(iobuf);
+	if (ret == SYSERR) {
+		errno = EAGAIN;
+		return -1;
+	}
+	return ret;
+}
+
+/*
+ * Access to the fake hardware
+ */
+
+/* kernel address of a module's address space, i.e. its RAM */
+void *skelsim_map(int module, int space)
+{
+	InsLibAnyAddressSpace *asp;
+	SkelDrvrModuleContext *mcon;
+
+	if (Wa == NULL)
+		return NULL;
+	mcon = get_mcon(module);
+	if (mcon == NULL || mcon->Modld == NULL)
+		return NULL;
+	asp = InsLibGetAddressSpace(mcon->Modld, space);
+	if (asp == NULL)
+		return NULL;
+	return asp->Mapped;
+}
+
+void *skelsim_vme_ram(unsigned long am, unsigned long addr, unsigned long len)
+{
+	return simcdcm_vme_ram(am, addr, len);
+}
@@ -0,0 +1,59 @@
+/**
+ * @file skelsim.h
+ *
+ * @brief Run a skel driver in user space
+ *
+ * The driver (skeldrvr.c plus the user's part) is linked against a
+ * user-space CDCM (simcdcm.c) whose VME bus is plain RAM. skelsim_*()
+ * behave like the system calls on the driver's node; they return -1 and
+ * set errno on failure. Interrupts are raised from a separate thread, as
+ * on real hardware.
+ *
+ * Copyright (c) 2010 CERN
+ * @author Emilio G. Cota <emilio.garcia.cota@cern.ch>
+ *
+ * @section license_sec License
+ * Released under the GPL v2. (and only v2, not any later version)
+ */
+#ifndef _SKELSIM_H_
+#define _SKELSIM_H_
+
+#include <stdint.h>
+
+int skelsim_install(char *xmlfile, char *drvname);
+int skelsim_uninstall(void);
+
+int skelsim_open(const char *path, int flags);
+int skelsim_close(int fd);
+int skelsim_ioctl(int fd, unsigned long cmd, void *arg);
+int skelsim_read(int fd, void *buf, int len);
+int skelsim_write(int fd, const void *buf, int len);
+
+void *skelsim_map(int module, int space);
+void *skelsim_vme_ram(unsigned long am, unsigned long addr, unsigned long len);
+
+int skelsim_irq(int vector);
+int skelsim_irq_async(int vector, int count, int period_us);
+void skelsim_irq_drain(void);
+int64_t skelsim_last_irq_ns(void);
+int64_t skelsim_now_ns(void);
+
+/* simcdcm.c */
+int simcdcm_vme_irq(int vct);
+void *simcdcm_vme_ram(unsigned long am, unsigned long addr, unsigned long len);
+int simcdcm_vme_preset(unsigned long am, unsigned long addr, uint32_t val,
+		       int width);
+
+/*
+ * Programs that run both against the simulator and a real driver
+ * define SKELSIM_REDIRECT and include this after the system headers.
+ */
+#ifdef SKELSIM_REDIRECT
+#define open(p, f, ...)	skelsim_open(p, f)
+#define close(fd)	skelsim_close(fd)
+#define ioctl(fd, c, a)	skelsim_ioctl(fd, c, (void *)(a))
+#define read(fd, b, l)	skelsim_read(fd, b, l)
+#define write(fd, b, l)	skelsim_write(fd, b, l)
+#endif
+
+#endif /* _SKELSIM_H_ */
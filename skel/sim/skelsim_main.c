@@ -0,0 +1,427 @@
+/**
+ * @file skelsim_main.c
+ *
+ * @brief Script interpreter for the skel simulator
+ *
+ * Reads commands from a file (or stdin), one per line or separated by
+ * ';'. '#' starts a comment. Numbers can be given in any base strtoul()
+ * understands.
+ *
+ *   preset <am> <vmeaddr> <value> [width]   power-up contents of the
+ *                              fake hardware, e.g. a configuration ROM;
+ *                              give them before install
+ *   install <xml> [driver]     install the driver described in <xml>
+ *   uninstall
+ *   open [minor]               open a client; it becomes the current one
+ *   close
+ *   use <handle>               switch to another open client
+ *   module <lun>               SET_MODULE
+ *   connect <lun> <mask>       CONNECT
+ *   disconnect [lun]           CONNECT with an empty mask; all modules
+ *                              if no lun is given
+ *   timeout <ticks>            SET_TIMEOUT, in 10ms ticks (0 polls)
+ *   poke <lun> <space> <offset> <value> [width]   write the fake hardware
+ *   peek <lun> <space> <offset> [width]
+ *   irq <vector> [count [period_us]]   raise interrupt(s) from the
+ *                                      interrupt thread
+ *   irqsync <vector>           raise an interrupt in this thread
+ *   drain                      wait for pending interrupts to be raised
+ *   simulate <lun> <mask>      write() a simulated interrupt
+ *   read [n]                   read n events, print them with the latency
+ *                              since the last interrupt was raised
+ *   status                     GET_STATUS
+ *   loop <n> <commands...>     run the rest of the line n times, print
+ *                              ns/iteration
+ *   sleep <ms>
+ *   echo <text>
+ *   quit
+ *
+ * Copyright (c) 2010 CERN
+ * @author Emilio G. Cota <emilio.garcia.cota@cern.ch>
+ *
+ * @section license_sec License
+ * Released under the GPL v2. (and only v2, not any later version)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+#include <skeluser.h>
+#include <skeluser_ioctl.h>
+#include <skel.h>
+
+#include "skelsim.h"
+
+#define MAX_ARGS 16
+
+static int cur = -1;	/* current client */
+static int quiet;	/* set while looping */
+static int lineno;
+
+static int do_line(char *line);
+
+static unsigned long num(const char *s)
+{
+	return strtoul(s, NULL, 0);
+}
+
+static int fail(const char *what)
+{
+	fprintf(stderr, "line %d: %s: %s\n", lineno, what, strerror(errno));
+	return -1;
+}
+
+static int need(int argc, int min, const char *usage)
+{
+	if (argc >= min)
+		return 0;
+	fprintf(stderr, "line %d: usage: %s\n", lineno, usage);
+	return -1;
+}
+
+static int need_client(void)
+{
+	if (cur >= 0)
+		return 0;
+	fprintf(stderr, "line %d: no client open\n", lineno);
+	return -1;
+}
+
+static void *reg_addr(char *argv[])
+{
+	unsigned long offset = num(argv[3]);
+	char *map;
+
+	map = skelsim_map(num(argv[1]), num(argv[2]));
+	if (map == NULL) {
+		fprintf(stderr, "line %d: module %s has no space %s\n",
+			lineno, argv[1], argv[2]);
+		return NULL;
+	}
+	return map + offset;
+}
+
+static int cmd_poke(int argc, char *argv[])
+{
+	uint32_t val;
+	void *addr;
+	int width;
+
+	if (need(argc, 5, "poke <lun> <space> <offset> <value> [width]"))
+		return -1;
+	width = argc > 5 ? num(argv[5]) : 32;
+	addr = reg_addr(argv);
+	if (addr == NULL)
+		return -1;
+	val = num(argv[4]);
+	/* registers hold what the bus would deliver: big endian */
+	switch (width) {
+	case 8:
+		*(volatile uint8_t *)addr = val;
+		break;
+	case 16:
+		*(volatile uint16_t *)addr = htobe16(val);
+		break;
+	default:
+		*(volatile uint32_t *)addr = htobe32(val);
+	}
+	return 0;
+}
+
+static int cmd_peek(int argc, char *argv[])
+{
+	uint32_t val;
+	void *addr;
+	int width;
+
+	if (need(argc, 4, "peek <lun> <space> <offset> [width]"))
+		return -1;
+	width = argc > 4 ? num(argv[4]) : 32;
+	addr = reg_addr(argv);
+	if (addr == NULL)
+		return -1;
+	switch (width) {
+	case 8:
+		val = *(volatile uint8_t *)addr;
+		break;
+	case 16:
+		val = be16toh(*(volatile uint16_t *)addr);
+		break;
+	default:
+		val = be32toh(*(volatile uint32_t *)addr);
+	}
+	if (!quiet)
+		printf("0x%08x\n", val);
+	return 0;
+}
+
+static int cmd_read(int argc, char *argv[])
+{
+	SkelDrvrReadBuf rb;
+	int64_t lat;
+	int i, n;
+
+	if (need_client())
+		return -1;
+	n = argc > 1 ? num(argv[1]) : 1;
+	for (i = 0; i < n; i++) {
+		int ret = skelsim_read(cur, &rb, sizeof(rb));
+
+		lat = skelsim_now_ns() - skelsim_last_irq_ns();
+		if (ret < 0)
+			return fail("read");
+		if (ret == 0) {
+			if (!quiet)
+				printf("timeout\n");
+			return 0;
+		}
+		if (!quiet)
+			printf("module %d mask 0x%08x time %u.%09u latency %lld ns\n",
+			       rb.Connection.Module, rb.Connection.ConMask,
+			       rb.Time.Second, rb.Time.NanoSecond,
+			       (long long)lat);
+	}
+	return 0;
+}
+
+static int cmd_loop(int argc, char *argv[])
+{
+	char line[256] = "";
+	int64_t t0, t1;
+	int i, n;
+
+	if (need(argc, 3, "loop <n> <command...>"))
+		return -1;
+	n = num(argv[1]);
+	for (i = 2; i < argc; i++) {
+		strncat(line, argv[i], sizeof(line) - strlen(line) - 2);
+		strcat(line, " ");
+	}
+
+	quiet++;
+	t0 = skelsim_now_ns();
+	for (i = 0; i < n; i++) {
+		char buf[256];
+
+		strcpy(buf, line);
+		if (do_line(buf))
+			break;
+	}
+	t1 = skelsim_now_ns();
+	quiet--;
+
+	printf("%s: %d iterations, %lld ns/iteration\n", argv[2], i,
+	       i ? (long long)(t1 - t0) / i : 0LL);
+	return i == n ? 0 : -1;
+}
+
+static int cmd_connect(int argc, char *argv[], int connect)
+{
+	SkelDrvrConnection conx;
+
+	if (connect && need(argc, 3, "connect <lun> <mask>"))
+		return -1;
+	if (need_client())
+		return -1;
+	conx.Module = argc > 1 ? num(argv[1]) : 0;
+	conx.ConMask = connect ? num(argv[2]) : 0;
+	if (skelsim_ioctl(cur, SkelDrvrIoctlCONNECT, &conx) < 0)
+		return fail("CONNECT");
+	return 0;
+}
+
+static int do_cmd(int argc, char *argv[])
+{
+	const char *c = argv[0];
+
+	if (!strcmp(c, "preset")) {
+		int ret;
+
+		if (need(argc, 4, "preset <am> <vmeaddr> <value> [width]"))
+			return -1;
+		ret = simcdcm_vme_preset(num(argv[1]), num(argv[2]),
+					 num(argv[3]),
+					 argc > 4 ? num(argv[4]) : 32);
+		if (ret) {
+			errno = -ret;
+			return fail("preset");
+		}
+	} else if (!strcmp(c, "install")) {
+		if (need(argc, 2, "install <xml> [driver]"))
+			return -1;
+		if (skelsim_install(argv[1], argc > 2 ? argv[2] : NULL))
+			return fail("install");
+	} else if (!strcmp(c, "uninstall")) {
+		if (skelsim_uninstall())
+			return fail("uninstall");
+	} else if (!strcmp(c, "open")) {
+		char path[64];
+
+		snprintf(path, sizeof(path), "/dev/skelsim.%s",
+			 argc > 1 ? argv[1] : "1");
+		cur = skelsim_open(path, O_RDWR);
+		if (cur < 0)
+			return fail("open");
+		if (!quiet)
+			printf("handle %d\n", cur);
+	} else if (!strcmp(c, "close")) {
+		if (need_client())
+			return -1;
+		if (skelsim_close(cur))
+			return fail("close");
+		cur = -1;
+	} else if (!strcmp(c, "use")) {
+		if (need(argc, 2, "use <handle>"))
+			return -1;
+		cur = num(argv[1]);
+	} else if (!strcmp(c, "module")) {
+		uint32_t lun;
+
+		if (need(argc, 2, "module <lun>") || need_client())
+			return -1;
+		lun = num(argv[1]);
+		if (skelsim_ioctl(cur, SkelDrvrIoctlSET_MODULE, &lun) < 0)
+			return fail("SET_MODULE");
+	} else if (!strcmp(c, "connect")) {
+		return cmd_connect(argc, argv, 1);
+	} else if (!strcmp(c, "disconnect")) {
+		return cmd_connect(argc, argv, 0);
+	} else if (!strcmp(c, "timeout")) {
+		uint32_t tmo;
+
+		if (need(argc, 2, "timeout <ticks>") || need_client())
+			return -1;
+		tmo = num(argv[1]);
+		if (skelsim_ioctl(cur, SkelDrvrIoctlSET_TIMEOUT, &tmo) < 0)
+			return fail("SET_TIMEOUT");
+	} else if (!strcmp(c, "poke")) {
+		return cmd_poke(argc, argv);
+	} else if (!strcmp(c, "peek")) {
+		return cmd_peek(argc, argv);
+	} else if (!strcmp(c, "irq")) {
+		if (need(argc, 2, "irq <vector> [count [period_us]]"))
+			return -1;
+		if (skelsim_irq_async(num(argv[1]), argc > 2 ? num(argv[2]) : 1,
+				      argc > 3 ? num(argv[3]) : 0))
+			return fail("irq");
+	} else if (!strcmp(c, "irqsync")) {
+		if (need(argc, 2, "irqsync <vector>"))
+			return -1;
+		if (skelsim_irq(num(argv[1])))
+			return fail("irqsync");
+	} else if (!strcmp(c, "drain")) {
+		skelsim_irq_drain();
+	} else if (!strcmp(c, "simulate")) {
+		SkelDrvrConnection conx;
+
+		if (need(argc, 3, "simulate <lun> <mask>") || need_client())
+			return -1;
+		conx.Module = num(argv[1]);
+		conx.ConMask = num(argv[2]);
+		if (skelsim_write(cur, &conx, sizeof(conx)) < 0)
+			return fail("write");
+	} else if (!strcmp(c, "read")) {
+		return cmd_read(argc, argv);
+	} else if (!strcmp(c, "status")) {
+		SkelDrvrStatus st;
+
+		if (need_client())
+			return -1;
+		if (skelsim_ioctl(cur, SkelDrvrIoctlGET_STATUS, &st) < 0)
+			return fail("GET_STATUS");
+		if (!quiet)
+			printf("standard 0x%x hardware 0x%x\n",
+			       st.StandardStatus, st.HardwareStatus);
+	} else if (!strcmp(c, "sleep")) {
+		if (need(argc, 2, "sleep <ms>"))
+			return -1;
+		usleep(num(argv[1]) * 1000);
+	} else if (!strcmp(c, "echo")) {
+		int i;
+
+		for (i = 1; i < argc; i++)
+			printf("%s%s", argv[i], i == argc - 1 ? "" : " ");
+		printf("\n");
+	} else if (!strcmp(c, "quit")) {
+		exit(0);
+	} else {
+		fprintf(stderr, "line %d: unknown command '%s'\n", lineno, c);
+		return -1;
+	}
+	return 0;
+}
+
+static int do_cmd_line(char *cmd)
+{
+	char *argv[MAX_ARGS];
+	char *p, *save;
+	int argc = 0;
+
+	for (p = strtok_r(cmd, " \t\n", &save); p && argc < MAX_ARGS;
+	     p = strtok_r(NULL, " \t\n", &save))
+		argv[argc++] = p;
+	if (!argc)
+		return 0;
+	if (!strcmp(argv[0], "loop"))
+		return cmd_loop(argc, argv);
+	return do_cmd(argc, argv);
+}
+
+static int do_line(char *line)
+{
+	char *cmd, *save;
+	char *p;
+
+	p = strchr(line, '#');
+	if (p)
+		*p = '\0';
+
+	/* loop takes the rest of the line */
+	p = strstr(line, "loop");
+	if (p && (p == line || strchr(" \t;", p[-1]))) {
+		if (p != line) {
+			p[-1] = '\0';
+			if (do_line(line))
+				return -1;
+		}
+		return do_cmd_line(p);
+	}
+
+	for (cmd = strtok_r(line, ";", &save); cmd;
+	     cmd = strtok_r(NULL, ";", &save)) {
+		if (do_cmd_line(cmd))
+			return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *in = stdin;
+	char line[256];
+	int err = 0;
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	if (argc > 1 && strcmp(argv[1], "-")) {
+		in = fopen(argv[1], "r");
+		if (in == NULL) {
+			perror(argv[1]);
+			return 1;
+		}
+	}
+
+	while (fgets(line, sizeof(line), in)) {
+		lineno++;
+		if (do_line(line)) {
+			err = 1;
+			break;
+		}
+	}
+	return err;
+}
@@ -108,13 +108,13 @@ InsLibVmeAddressSpace  *vmeas = NULL;
 void SetReg(U32 *map, U32 offset, U32 valu, SkelDrvrModuleContext *mcon) {
    mcon->Registers[offset/4] = valu;
    if (mcon->StandardStatus & SkelDrvrStandardStatusEMULATION) return;
-   cdcm_iowrite32(cdcm_cpu_to_be32((U32) valu), &(map[offset/4]));
+   skel_shadow_iowrite32be(mcon, (U32) valu, map, offset);
 }
 
 U32 GetReg(U32 *map, U32 offset, SkelDrvrModuleContext *mcon) {
    if (mcon->StandardStatus & SkelDrvrStandardStatusEMULATION)
       return (U32) mcon->Registers[offset/4];
-   return (U32) cdcm_be32_to_cpu(cdcm_ioread32(&(map[offset/4])));
+   return (U32) skel_shadow_ioread32be(mcon, map, offset);
 }
 
 /* =========================================================== */
@@ -997,4 +997,18 @@ void SkelUserClientRelease(SkelDrvrClientContext *ccon)
 {
 }
 
-struct skel_conf SkelConf; /* no special config for this driver */
+/*
+ * Configuration registers only the driver writes; GetReg() serves
+ * them from the register shadow instead of going out on the bus.
+ */
+static const struct skel_shadow_range vd80_shadow[] = {
+   { VD80_GCR2, 1 },
+   { VD80_CCR,  2 },	/* CCR, TCR1 */
+   { VD80_PTCR, 1 },
+   { VD80_TCR3, 1 },
+   { 0, 0 }
+};
+
+struct skel_conf SkelConf = {
+   .shadow = vd80_shadow
+};
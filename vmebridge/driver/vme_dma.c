@@ -15,6 +15,8 @@
  */
 
 #include <linux/pagemap.h>
+#include <linux/vmalloc.h>
+#include <linux/uio.h>
 #include <linux/version.h>
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,26)
@@ -79,7 +81,19 @@ static int sgl_fill_kernel_pages(struct page **pages, unsigned long kaddr,
 {
 	int i;
 
-	/* Note: this supports lowmem pages only */
+	/*
+	 * vmalloc'ed buffers (e.g. rings mapped to user-space) are looked up
+	 * page by page; otherwise this supports lowmem pages only.
+	 */
+	if (is_vmalloc_addr((void *)kaddr)) {
+		for (i = 0; i < nr_pages; i++) {
+			pages[i] = vmalloc_to_page((void *)(kaddr + PAGE_SIZE * i));
+			if (pages[i] == NULL)
+				return -EINVAL;
+		}
+		return nr_pages;
+	}
+
 	if (!virt_addr_valid(kaddr))
 		return -EINVAL;
 
@@ -89,9 +103,18 @@ static int sgl_fill_kernel_pages(struct page **pages, unsigned long kaddr,
 	return nr_pages;
 }
 
+/* number of pages spanned by a buffer */
+static unsigned int sgl_nr_pages(unsigned long uaddr, size_t length)
+{
+	if (!length)
+		return 0;
+	return ((uaddr & ~PAGE_MASK) + length + ~PAGE_MASK) >> PAGE_SHIFT;
+}
+
 /**
  * sgl_map_user_pages() - Pin user pages and put them into a scatter gather list
- * @sgl: Scatter gather list to fill
+ * @sgl: Scatter gather list to fill (already initialised)
+ * @pages: Array of at least @nr_pages entries, for temporary use
  * @nr_pages: Number of pages
  * @uaddr: User buffer address
  * @count: Length of user buffer
@@ -100,18 +123,15 @@ static int sgl_fill_kernel_pages(struct page **pages, unsigned long kaddr,
  *
  *  This function pins the pages of the userspace buffer and fill in the
  * scatter gather list.
+ *
+ *  Returns the number of pages, or a negative error code.
  */
-static int sgl_map_user_pages(struct scatterlist *sgl,
+static int sgl_map_user_pages(struct scatterlist *sgl, struct page **pages,
 			      const unsigned int nr_pages, unsigned long uaddr,
 			      size_t length, int rw, int to_user)
 {
 	int rc;
 	int i;
-	struct page **pages;
-
-	if ((pages = kmalloc(nr_pages * sizeof(struct page *),
-			     GFP_KERNEL)) == NULL)
-		return -ENOMEM;
 
 	if (to_user) {
 		rc = sgl_fill_user_pages(pages, uaddr, nr_pages, rw);
@@ -120,7 +140,6 @@ static int sgl_map_user_pages(struct scatterlist *sgl,
 			for (i = 0; i < rc; i++)
 				page_cache_release(pages[i]);
 			rc = -ENOMEM;
-			goto out_free;
 		}
 	} else {
 		rc = sgl_fill_kernel_pages(pages, uaddr, nr_pages, rw);
@@ -128,11 +147,9 @@ static int sgl_map_user_pages(struct scatterlist *sgl,
 
 	if (rc < 0)
 		/* We completely failed to get the pages */
-		goto out_free;
+		return rc;
 
 	/* Populate the scatter/gather list */
-	sg_init_table(sgl, nr_pages);
-
 	/* Take a shortcut here when we only have a single page transfer */
 	if (nr_pages > 1) {
 		unsigned int off = offset_in_page(uaddr);
@@ -150,10 +167,6 @@ static int sgl_map_user_pages(struct scatterlist *sgl,
 	} else
 		sg_set_page (&sgl[0], pages[0], length, offset_in_page(uaddr));
 
-out_free:
-	/* We do not need the pages array anymore */
-	kfree(pages);
-
 	return nr_pages;
 }
 
@@ -187,46 +200,79 @@ static void sgl_unmap_user_pages(struct scatterlist *sgl,
 /**
  * vme_dma_setup() - Setup a DMA transfer
  * @desc: DMA channel to setup
+ * @iov:	buffers on the PCI side of the transfer, one after the other
+ * @nr_segs:	number of buffers
  * @to_user:	1 if the transfer is to/from a user-space buffer.
  *		0 if it is to/from a kernel buffer.
  *
- *  Setup a DMA transfer.
+ *  Setup a DMA transfer. The pages of all the buffers are pinned and put
+ * in a single scatter gather list.
  *
  *  Returns 0 on success, or a standard kernel error code on failure.
  */
-static int vme_dma_setup(struct dma_channel *channel, int to_user)
+static int vme_dma_setup(struct dma_channel *channel, const struct iovec *iov,
+			 unsigned long nr_segs, int to_user)
 {
 	int rc = 0;
 	struct vme_dma *desc = &channel->desc;
-	unsigned int length = desc->length;
-	unsigned int uaddr;
-	int nr_pages;
-
-	/* Create the scatter gather list */
-	uaddr = (desc->dir == VME_DMA_TO_DEVICE) ?
-		desc->src.addrl : desc->dst.addrl;
-
-	/* Check for overflow */
-	if ((uaddr + length) < uaddr)
+	struct page **pages;
+	unsigned long uaddr;
+	unsigned int nr_pages = 0;
+	unsigned int max_pages = 0;
+	unsigned int n;
+	unsigned long i;
+
+	for (i = 0; i < nr_segs; i++) {
+		uaddr = (unsigned long)iov[i].iov_base;
+
+		/* Check for overflow */
+		if ((uaddr + iov[i].iov_len) < uaddr)
+			return -EINVAL;
+
+		n = sgl_nr_pages(uaddr, iov[i].iov_len);
+		nr_pages += n;
+		if (n > max_pages)
+			max_pages = n;
+	}
+	if (!nr_pages)
 		return -EINVAL;
 
-	nr_pages = ((uaddr & ~PAGE_MASK) + length + ~PAGE_MASK) >> PAGE_SHIFT;
-
+	/* Create the scatter gather list */
 	if ((channel->sgl = kmalloc(nr_pages * sizeof(struct scatterlist),
 				    GFP_KERNEL)) == NULL)
 		return -ENOMEM;
 
-	/* Map the user pages into the scatter gather list */
-	channel->sg_pages = sgl_map_user_pages(channel->sgl, nr_pages, uaddr,
-					       length,
-					       (desc->dir==VME_DMA_FROM_DEVICE),
-					       to_user);
-
-	if (channel->sg_pages <= 0) {
-		rc = channel->sg_pages;
+	if ((pages = kmalloc(max_pages * sizeof(struct page *),
+			     GFP_KERNEL)) == NULL) {
+		rc = -ENOMEM;
 		goto out_free_sgl;
 	}
 
+	/* Map the user pages into the scatter gather list */
+	sg_init_table(channel->sgl, nr_pages);
+	channel->sg_pages = 0;
+
+	for (i = 0; i < nr_segs; i++) {
+		uaddr = (unsigned long)iov[i].iov_base;
+		n = sgl_nr_pages(uaddr, iov[i].iov_len);
+		if (!n)
+			continue;
+
+		rc = sgl_map_user_pages(channel->sgl + channel->sg_pages,
+					pages, n, uaddr, iov[i].iov_len,
+					(desc->dir==VME_DMA_FROM_DEVICE),
+					to_user);
+		if (rc < 0)
+			break;
+		channel->sg_pages += rc;
+	}
+
+	/* We do not need the pages array anymore */
+	kfree(pages);
+
+	if (rc < 0)
+		goto out_unmap_pages;
+
 	/* Map the sg list entries onto the PCI bus */
 	channel->sg_mapped = pci_map_sg(vme_bridge->pdev, channel->sgl,
 					channel->sg_pages, desc->dir);
@@ -243,6 +289,7 @@ out_unmap_sgl:
 	pci_unmap_sg(vme_bridge->pdev, channel->sgl, channel->sg_mapped,
 		     desc->dir);
 
+out_unmap_pages:
 	sgl_unmap_user_pages(channel->sgl, channel->sg_pages, 0, to_user);
 
 out_free_sgl:
@@ -327,10 +374,13 @@ static void vme_dma_channel_release(struct dma_channel *channel)
 }
 
 /*
+ * @iov:	buffers on the PCI side of the transfer
+ * @nr_segs:	number of buffers
  * @to_user:	1 - the transfer is to/from a user-space buffer
  *		0 - the transfer is to/from a kernel buffer
  */
-static int __vme_do_dma(struct vme_dma *desc, int to_user)
+static int __vme_do_dma(struct vme_dma *desc, const struct iovec *iov,
+			unsigned long nr_segs, int to_user)
 {
 	int rc = 0;
 	struct dma_channel *channel;
@@ -364,7 +414,7 @@ static int __vme_do_dma(struct vme_dma *desc, int to_user)
 	memcpy(&channel->desc, desc, sizeof(struct vme_dma));
 
 	/* Setup the DMA transfer */
-	rc = vme_dma_setup(channel, to_user);
+	rc = vme_dma_setup(channel, iov, nr_segs, to_user);
 
 	if (rc)
 		goto out_release_channel;
@@ -404,6 +454,20 @@ out_release_channel:
 	return rc;
 }
 
+/* a transfer to/from the single buffer on the PCI side of @desc */
+static int vme_do_dma_single(struct vme_dma *desc, int to_user)
+{
+	struct iovec iov;
+	unsigned int addr;
+
+	addr = (desc->dir == VME_DMA_TO_DEVICE) ?
+		desc->src.addrl : desc->dst.addrl;
+	iov.iov_base = (void __user *)(unsigned long)addr;
+	iov.iov_len = desc->length;
+
+	return __vme_do_dma(desc, &iov, 1, to_user);
+}
+
 /**
  * vme_do_dma() - Do a DMA transfer
  * @desc: DMA transfer descriptor
@@ -416,7 +480,7 @@ out_release_channel:
  */
 int vme_do_dma(struct vme_dma *desc)
 {
-	return __vme_do_dma(desc, 1);
+	return vme_do_dma_single(desc, 1);
 }
 EXPORT_SYMBOL_GPL(vme_do_dma);
 
@@ -428,10 +492,42 @@ EXPORT_SYMBOL_GPL(vme_do_dma);
  */
 int vme_do_dma_kernel(struct vme_dma *desc)
 {
-	return __vme_do_dma(desc, 0);
+	return vme_do_dma_single(desc, 0);
 }
 EXPORT_SYMBOL_GPL(vme_do_dma_kernel);
 
+/**
+ * vme_do_dma_iov() - Do a DMA transfer to/from several user-space buffers
+ * @desc: DMA transfer descriptor. Its PCI address is not used.
+ * @iov: User-space buffers
+ * @nr_segs: Number of buffers
+ *
+ *  The VME side of the transfer is contiguous, starting at the VME address
+ * of @desc. The PCI side is the buffers in @iov, one after the other: their
+ * pages are pinned in a single pass and the whole lot is moved with a single
+ * chained transfer. @desc->length is set to the total length.
+ *
+ *  Returns 0 on success, or a standard kernel error code on failure.
+ */
+int vme_do_dma_iov(struct vme_dma *desc, const struct iovec *iov,
+		   unsigned long nr_segs)
+{
+	size_t length = 0;
+	unsigned long i;
+
+	for (i = 0; i < nr_segs; i++) {
+		if (length + iov[i].iov_len < length)
+			return -EINVAL;
+		length += iov[i].iov_len;
+	}
+	if (length > UINT_MAX)
+		return -EINVAL;
+	desc->length = length;
+
+	return __vme_do_dma(desc, iov, nr_segs, 1);
+}
+EXPORT_SYMBOL_GPL(vme_do_dma_iov);
+
 /**
  * vme_dma_ioctl() - ioctl file method for the VME DMA device
  * @file: Device file descriptor
@@ -24,6 +24,7 @@
 #ifdef __KERNEL__
 #include <linux/device.h>
 #include <linux/kernel.h>
+#include <linux/uio.h>
 #endif /* __KERNEL__ */
 
 #include <linux/types.h>
@@ -398,6 +399,8 @@ extern int vme_release_mapping(struct vme_mapping *, int);
 
 extern int vme_do_dma(struct vme_dma *);
 extern int vme_do_dma_kernel(struct vme_dma *);
+extern int vme_do_dma_iov(struct vme_dma *, const struct iovec *,
+			  unsigned long);
 
 
 extern int vme_bus_error_check(int);
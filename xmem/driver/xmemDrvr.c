@@ -94,6 +94,17 @@
 #include <xmemDrvr.h>
 #include <xmemDrvrP.h>
 
+/* PIO accessors for xmemCopy.h */
+#define XmemIoRd8(a)		cdcm_ioread8((void *)(a))
+#define XmemIoWr8(v, a)		cdcm_iowrite8((v), (void *)(a))
+#define XmemIoRd32(a)		cdcm_ioread32le((void *)(a))
+#define XmemIoWr32(v, a)	cdcm_iowrite32le((v), (void *)(a))
+#ifdef cdcm_ioread64
+#define XmemIoRd64(a)		cdcm_ioread64le((void *)(a))
+#define XmemIoWr64(v, a)	cdcm_iowrite64le((v), (void *)(a))
+#endif
+#include <xmemCopy.h>
+
 #ifdef __linux__
 #define XMEM_BUG_ON(x)	BUG_ON(x)
 #else
@@ -159,6 +170,10 @@ static const char *ioc_names[] = {
 	[_IOC_NR(XmemDrvrRAW_CLOSE)]		= "Close VMIC SDRAM",
 	[_IOC_NR(XmemDrvrSET_DMA_THRESHOLD)]	= "Set Dma Threshold",
 	[_IOC_NR(XmemDrvrGET_DMA_THRESHOLD)]	= "Get Dma Threshold",
+	[_IOC_NR(XmemDrvrSET_NONBLOCK)]		= "Set Non-Blocking Read",
+	[_IOC_NR(XmemDrvrGET_NONBLOCK)]		= "Get Non-Blocking Read",
+	[_IOC_NR(XmemDrvrGET_FLUSH_STATS)]	= "Get Flush Statistics",
+	[_IOC_NR(XmemDrvrGET_MMAP_INFO)]	= "Get Mmap Info",
 	[_IOC_NR(XmemDrvrLAST_IOCTL)]		= "Last IOCTL"
 };
 
@@ -169,98 +184,79 @@ static const char *ioc_names[] = {
  * @param src: copy from
  * @param size: size of the transfer
  *
- * Note that if the size to be copied is smaller than sizeof(long),
- * no copy will be performed.
+ * The bytes past the last whole long are copied one by one.
  *
  */
 static void LongCopy(unsigned long *dst, unsigned long *src, unsigned long size)
 {
+	unsigned char *cdst, *csrc;
 	int sb;
 	int i;
 
 	sb = size/sizeof(unsigned long);
 	for (i = 0; i < sb; i++) dst[i] = src[i];
-}
 
-/**
- * LongCopyToXmem - copies size bytes in chunks of longs to the Xmem.
- *
- * @param vmic_to: copy to
- * @param v_from: copy from
- * @param size: size of the transfer
- *
- * Note that if the size to be copied is smaller than sizeof(long),
- * no copy will be performed.
- *
- */
-static void LongCopyToXmem(void *vmic_to, void *v_from, unsigned long size)
-{
-	int count;
-	u_int32_t *tbuf = (u_int32_t *)v_from;
-	u_int32_t *ioaddr = (u_int32_t *)vmic_to;
-
-	count = size / sizeof(u_int32_t);
-	if (count <= 0) return;
-	do {
-		cdcm_iowrite32le(*tbuf, ioaddr);
-		tbuf++;
-		ioaddr++;
-	} while (--count != 0);
+	cdst = (unsigned char *)&dst[sb];
+	csrc = (unsigned char *)&src[sb];
+	for (i = 0; i < size % sizeof(unsigned long); i++) cdst[i] = csrc[i];
 }
 
-/**
- * LongCopyFromXmem - copies size bytes in chunks of longs from the Xmem.
- *
- * @param vmic_from: copy from
- * @param v_to: copy to
- * @param size: size of the transfer
- *
- * Note that if the size to be copied is smaller than sizeof(long),
- * no copy will be performed.
+/*
+ * Client queues
  *
+ * Each client has its own ring, protected by its own spinlock so that
+ * the ISR and the readers of other clients don't contend.
  */
-static void LongCopyFromXmem(void *vmic_from, void *v_to, unsigned long size)
+static void q_init(XmemDrvrClientContext *ccon)
 {
-	int count;
-	u_int32_t *tbuf = (u_int32_t *)v_to;
-	u_int32_t *ioaddr = (u_int32_t *)vmic_from;
-
-	count = size / sizeof(u_int32_t);
-	if (count <= 0) return;
-	do {
-		*tbuf++ = cdcm_ioread32le(ioaddr);
-		ioaddr++;
-	} while (--count != 0);
+	XmemDrvrQueue *fifo = &ccon->Queue;
+
+	cdcm_spin_lock_init(&fifo->lock);
+	fifo->Missed	= 0;
+	fifo->elems	= 0;
+	fifo->out	= 0;
+	fifo->in	= 0;
+	fifo->Waiting	= 0;
+	sreset(&ccon->Semaphore);
 }
 
-static void __q_put(const XmemDrvrReadBuf *rb, XmemDrvrClientContext *ccon)
+static void q_put(const XmemDrvrReadBuf *rb, XmemDrvrClientContext *ccon)
 {
 	XmemDrvrQueue *fifo = &ccon->Queue;
+	unsigned long flags;
 
+	cdcm_spin_lock_irqsave(&fifo->lock, flags);
 	if (fifo->elems >= XmemDrvrQUEUE_SIZE) {
 		fifo->Missed++;
 	} else {
 		fifo->Entries[fifo->in] = *rb;
 		fifo->in = (fifo->in + 1) % XmemDrvrQUEUE_SIZE;
 		++fifo->elems;
-		ssignal(&ccon->Semaphore);
+		if (fifo->Waiting) {
+			fifo->Waiting = 0;
+			ssignal(&ccon->Semaphore);
+		}
 	}
+	cdcm_spin_unlock_irqrestore(&fifo->lock, flags);
 }
 
-static int __q_get(XmemDrvrReadBuf *rb, XmemDrvrClientContext *ccon)
+/* Copy up to @n entries to @rb. Called with the queue lock held */
+static int __q_get(XmemDrvrReadBuf *rb, int n, XmemDrvrClientContext *ccon)
 {
 	XmemDrvrQueue *fifo = &ccon->Queue;
+	int i;
 
-	XMEM_BUG_ON(!fifo->elems);
-	if (!fifo->elems)
-		return 0;
-
-	*rb = fifo->Entries[fifo->out];
-	fifo->out = (fifo->out + 1) % XmemDrvrQUEUE_SIZE;
-	--fifo->elems;
-	return 1;
+	if (n > fifo->elems)
+		n = fifo->elems;
+	for (i = 0; i < n; i++) {
+		rb[i] = fifo->Entries[fifo->out];
+		fifo->out = (fifo->out + 1) % XmemDrvrQUEUE_SIZE;
+	}
+	fifo->elems -= n;
+	return n;
 }
 
+/* Called with the queue lock held */
 static void __q_reset(XmemDrvrClientContext *ccon)
 {
 	XmemDrvrQueue *fifo = &ccon->Queue;
@@ -269,84 +265,6 @@ static void __q_reset(XmemDrvrClientContext *ccon)
 	fifo->elems	= 0;
 	fifo->out	= 0;
 	fifo->in	= 0;
-	sreset(&ccon->Semaphore);
-}
-
-/**
- * CancelTimeout - cancels a given timeout
- *
- * @param t: pointer to the ID of the timeout to be cancelled
- *
- * Care has been taken to avoid cancelling an already cancelled (or expired)
- * timeout by protecting the critical region properly.
- *
- */
-static void CancelTimeout(int *t)
-{
-	unsigned long ps;
-	int v;
-
-	disable(ps);
-	{
-		if ((v = *t)) {
-			*t = 0;
-			cancel_timeout(v);
-		}
-	}
-	restore(ps);
-}
-
-/**
- * ReadTimeout - handler function for ccon->Timer.
- *
- * @param c: pointer to the ID of the timeout
- *
- * @return 0 on success
- */
-static int ReadTimeout(void *c)
-{
-	XmemDrvrClientContext *ccon = (XmemDrvrClientContext*)c;
-	unsigned long ps;
-
-	disable(ps);
-	__q_reset(ccon);
-	ccon->Timer = 0;
-	restore(ps);
-	return 0;
-}
-
-/**
- * WrDmaTimeout - handler function for mcon->WrDmaSemaphore
- *
- * @param m: pointer to the ID of the timeout
- *
- * WrDmaSemaphore is signalled when the timeout expires.
- *
- * @return 0 on success
- */
-static int WrDmaTimeout(void *m)
-{
-	XmemDrvrModuleContext *mcon = (XmemDrvrModuleContext*)m;
-	mcon->WrTimer = 0;
-	ssignal(&mcon->WrDmaSemaphore);
-	return 0;
-}
-
-/**
- * RdDmaTimeout - handler function for mcon->RdDmaSemaphore
- *
- * @param m: pointer to the ID of the timeout
- *
- * RdDmaSemaphore is signalled when the timeout expires.
- *
- * @return 0 on success
- */
-static int RdDmaTimeout(void *m)
-{
-	XmemDrvrModuleContext *mcon = (XmemDrvrModuleContext*)m;
-	mcon->RdTimer = 0;
-	ssignal(&mcon->RdDmaSemaphore);
-	return 0;
 }
 
 static int ioc_nr_ok(int nr)
@@ -844,6 +762,27 @@ static XmemDrvrScr GetSetStatus(XmemDrvrModuleContext *mcon, XmemDrvrScr cmd,
 	return stat;
 }
 
+/**
+ * BumpGenerations - Bump the update generations of some segments
+ *
+ * @param mcon: module context
+ * @param usegs: mask of updated segments
+ *
+ * Clients that mapped mcon->Gen see the new values without a syscall.
+ */
+static void BumpGenerations(XmemDrvrModuleContext *mcon, unsigned long usegs)
+{
+	int i;
+
+	if (!mcon->Gen)
+		return;
+	for (i = 0; i < XmemDrvrSEGMENTS; i++) {
+		if (usegs & (1 << i))
+			mcon->Gen->Gen[i]++;
+	}
+	cdcm_wmb(); /* generations are visible before the clients are woken up */
+}
+
 /**
  * InterruptSelf - 'Simulate' an interrupt to the module itself.
  *
@@ -898,19 +837,17 @@ static void InterruptSelf(XmemDrvrSendBuf *sbuf, XmemDrvrModuleContext *mcon) {
 		break;
 	}
 
+	if (usegs)
+		BumpGenerations(mcon, usegs);
+
 	for (i = 0; i < XmemDrvrCLIENT_CONTEXTS; i++) {
 		ccon = &Wa->ClientContexts[i];
 		if (usegs)
 			ccon->UpdatedSegments |= usegs;
 		msk = mcon->Clients[i];
 
-		if (msk & rbf.Mask) {
-			unsigned long ps;
-
-			disable(ps);
-			__q_put(&rbf, ccon);
-			restore(ps);
-		}
+		if (msk & rbf.Mask)
+			q_put(&rbf, ccon);
 
 	}
 }
@@ -1068,205 +1005,209 @@ static int WrPermSeg(unsigned long segid, unsigned long node, int *nodeid)
 	return 1;
 }
 
-/* FIXME: BUG on PageCopy: if after settin up a DMA mapping the function fails,
- * we don't call unmap() before returning SYSERR.
- */
 /**
- * PageCopy - Copies a page to/from VMIC's SDRAM using DMA.
- *
- * @param siod: contains the size and addresses of the buffers involved
- * @param iod: direction of the transfer (XmemDrvr{READ,WRITE})
- * @param mapped: 1 if the buffer has already been DMA-mapped. 0 otherwise.
- *
- * This function has to be called from a region protected by
- * mcon->BusySemaphore, since it accesses the struct mcon->DmaOp. Therefore
- * BusySemaphore will be held at least by those regions willing to perform
- * DMA to/from the VMIC.
- * if(!mapped), the host machine will set up a DMA mapping that will return
- * the physical address of the page given in siod.
- * if(mapped), that means DmaOp has been set by the caller and therefore
- * mcon->DmaOp contains all the necessary information to perform the DMA.
+ * EnableDmaInterrupts - make sure the PLX interrupts on DMA completion
  *
- * @return OK on success
+ * @param mcon: module context
  */
-static int PageCopy(XmemDrvrSegIoDesc *siod, XmemDrvrIoDir iod,
-		const int mapped)
+static void EnableDmaInterrupts(XmemDrvrModuleContext *mcon)
 {
-	XmemDrvrModuleContext *mcon;
-	XmemDrvrSegDesc *sgds;
-	unsigned int midx, sgx, myid;
-	char *sram;
-	unsigned long dmamode, dptr, cmdma, intcsr;
-
-	sgx = 0;
-	midx = siod->Module - 1;
-	if (siod->UserArray == NULL && !mapped) goto address_err;
-	if (midx < 0 || midx >= Wa->Modules) goto device_err;
-	if (! siod->Id) goto device_err;
-	if (! GetSeg(siod->Id, &sgx)) goto nosegment;
+	unsigned long intcsr;
 
-	mcon = &Wa->ModuleContexts[midx];
 	DrmLocalReadWrite(mcon, PlxLocalINTCSR, &intcsr, 4, XmemDrvrREAD);
 	intcsr |= PlxIntcsrENABLE_PCI
 		| PlxIntcsrENABLE_LOCAL
 		| PlxIntcsrENABLE_DMA_CHAN_0
 		| PlxIntcsrENABLE_DMA_CHAN_1;
 	DrmLocalReadWrite(mcon, PlxLocalINTCSR, &intcsr, 4, XmemDrvrWRITE);
+}
 
-	sgds = &Wa->SegTable.Descriptors[sgx];
-	sram = sgds->Address + siod->Offset;
-	if (! mapped) {
-		mcon->DmaOp.Flag = iod == XmemDrvrWRITE;
-		mcon->DmaOp.Len = siod->Size;
-		mcon->DmaOp.Buffer = siod->UserArray;
-		mcon->DmaOp.Dma = cdcm_pci_map(mcon, siod->UserArray,
-					mcon->DmaOp.Len, mcon->DmaOp.Flag);
-	}
-	if (mcon->DmaOp.Dma == 0)
-		goto nomapping;
-
-	/* FIXME: code is repeated below. Do it properly! */
-	switch (iod) {
-	case XmemDrvrWRITE:
-		/* Write to the VMIC's SDRAM from host machine
-		 * We use the PLX' DMACHANNEL1 for writing
-		 */
-		if (! WrPermSeg(siod->Id, mcon->NodeId, &myid)) goto access_err;
-		dmamode = PlxDmaMode16BIT
-			| PlxDmaMode32BIT
-			| PlxDmaModeINP_ENB
-			| PlxDmaModeCONT_BURST_ENB
-			| PlxDmaModeLOCL_BURST_ENB
-			| PlxDmaModeINT_PIN_SELECT
-			| PlxDmaModeDONE_INT_ENB;
-		DrmLocalReadWrite(mcon, PlxLocalDMAMODE1, &dmamode, 4, XmemDrvrWRITE);
-		DrmLocalReadWrite(mcon, PlxLocalDMAPADR1, (unsigned long *)&mcon->DmaOp.Dma,
-				4, XmemDrvrWRITE);
-		DrmLocalReadWrite(mcon, PlxLocalDMALADR1, (unsigned long *)&sram, 4,
-				XmemDrvrWRITE);
-		DrmLocalReadWrite(mcon, PlxLocalDMASIZ1, (unsigned long *)&mcon->DmaOp.Len,
-				4, XmemDrvrWRITE);
-		/* Set transfer direction and termination interrupt */
-		dptr = PlxDmaDprTERM_INT_ENB & ~PlxDmaDprDIR_LOC_PCI;
-		DrmLocalReadWrite(mcon, PlxLocalDMADPR1, &dptr, 4, XmemDrvrWRITE);
-
-		mcon->WrTimer = timeout(WrDmaTimeout, (char *) mcon, XmemDrvrDMA_TIMEOUT);
-		if (mcon->WrTimer < 0) {
-			mcon->WrTimer = 0;
-			pseterr(EBUSY);
-			return SYSERR;
-		}
-
-		sreset(&mcon->WrDmaSemaphore);
-
-		cmdma = PlxDmaCsrENABLE | PlxDmaCsrSTART; /* Command: Start transfer */
-		DrmLocalReadWrite(mcon, PlxLocalDMACSR1, &cmdma, 1, XmemDrvrWRITE);
+/**
+ * DmaWait - waits for the DMA channel of a transfer to be done
+ *
+ * @param mcon: module context
+ * @param iod: direction of the transfer; reads use channel 0, writes 1
+ * @param bytes: size of the transfer, to scale the timeout
+ *
+ * If the transfer doesn't complete in time (or the wait is interrupted)
+ * the channel is aborted, so that it can be programmed again.
+ *
+ * @return OK on success
+ */
+static int DmaWait(XmemDrvrModuleContext *mcon, XmemDrvrIoDir iod,
+		unsigned long bytes)
+{
+	unsigned long csrreg, cmdma;
+	int *sem;
+	int ret;
 
-		if (swait(&mcon->WrDmaSemaphore, SEM_SIGABORT)) {
-			sreset(&mcon->WrDmaSemaphore);
-			pseterr(EINTR);
-			return SYSERR;
-		}
-		if (mcon->WrTimer) {
-			CancelTimeout(&mcon->WrTimer);
-		}
-		else {
-			cmdma = 0;
-			DrmLocalReadWrite(mcon, PlxLocalDMACSR1, &cmdma, 1, XmemDrvrREAD);
-			if ((cmdma & PlxDmaCsrDONE) == 0) {
-				pseterr(EBUSY);
-				return SYSERR;
-			}
-		}
-		if (! mapped)  /* mapping has to be cleared */
-			cdcm_pci_unmap(mcon, mcon->DmaOp.Dma, mcon->DmaOp.Len, mcon->DmaOp.Flag);
+	if (iod == XmemDrvrREAD) {
+		csrreg = PlxLocalDMACSR0;
+		sem    = &mcon->RdDmaSemaphore;
+	} else {
+		csrreg = PlxLocalDMACSR1;
+		sem    = &mcon->WrDmaSemaphore;
+	}
 
+	/* the DMA is bounded by its timeout: don't abort it on a signal */
+	ret = tswait(sem, SEM_SIGIGNORE,
+		XmemDrvrDMA_TIMEOUT + XmemDrvrDMA_TIMEOUT_MB * (bytes >> 20));
+	if (ret == OK)
 		return OK;
-		break;
 
-	case XmemDrvrREAD:
-		/* Read from the VMIC's SDRAM to host machine
-		 * We use the PLX' DMACHANNEL0 for writing
-		 */
-		dmamode = PlxDmaMode16BIT
-			| PlxDmaMode32BIT
-			| PlxDmaModeINP_ENB
-			| PlxDmaModeCONT_BURST_ENB
-			| PlxDmaModeLOCL_BURST_ENB
-			| PlxDmaModeINT_PIN_SELECT
-			| PlxDmaModeDONE_INT_ENB;
+	/* we may have missed the interrupt; otherwise, stop the channel */
+	cmdma = 0;
+	DrmLocalReadWrite(mcon, csrreg, &cmdma, 1, XmemDrvrREAD);
+	if (cmdma & PlxDmaCsrDONE)
+		return OK;
+	cmdma = 0;
+	DrmLocalReadWrite(mcon, csrreg, &cmdma, 1, XmemDrvrWRITE);
+	cmdma = PlxDmaCsrABORT;
+	DrmLocalReadWrite(mcon, csrreg, &cmdma, 1, XmemDrvrWRITE);
+	sreset(sem);
+
+	cprintf("xmemDrvr:DmaWait: DMA %s of %lu bytes %s\n",
+		iod == XmemDrvrREAD ? "read" : "write", bytes,
+		ret == TSWAIT_TIMEDOUT ? "timed out" : "interrupted");
+	pseterr(ret == TSWAIT_TIMEDOUT ? EBUSY : EINTR);
+	return SYSERR;
+}
 
-		DrmLocalReadWrite(mcon, PlxLocalDMAMODE0, &dmamode, 4, XmemDrvrWRITE);
-		DrmLocalReadWrite(mcon, PlxLocalDMAPADR0, (unsigned long *)&mcon->DmaOp.Dma,
-				4, XmemDrvrWRITE);
-		DrmLocalReadWrite(mcon, PlxLocalDMALADR0, (unsigned long *)&sram, 4,
-				XmemDrvrWRITE);
-		DrmLocalReadWrite(mcon, PlxLocalDMASIZ0, (unsigned long *)&mcon->DmaOp.Len,
-				4, XmemDrvrWRITE);
-		/* Set transfer direction and termination interrupt */
+/**
+ * DmaStart - starts a single block DMA to/from VMIC's SDRAM
+ *
+ * @param mcon: module context
+ * @param iod: direction of the transfer (XmemDrvr{READ,WRITE})
+ * @param padr: PCI address of the host buffer
+ * @param sram: address in the VMIC's SDRAM
+ * @param len: number of bytes to transfer
+ *
+ * Reads use the PLX' DMA channel 0 and writes channel 1, so that a read and
+ * a write can be in flight at the same time. Doesn't wait: call DmaWait()
+ * for that. Must be called with mcon->BusySemaphore held and the DMA
+ * interrupts enabled (see EnableDmaInterrupts()).
+ */
+static void DmaStart(XmemDrvrModuleContext *mcon, XmemDrvrIoDir iod,
+		unsigned long padr, unsigned long sram, unsigned long len)
+{
+	unsigned long dmamode, dptr, cmdma;
+
+	dmamode = PlxDmaMode16BIT
+		| PlxDmaMode32BIT
+		| PlxDmaModeINP_ENB
+		| PlxDmaModeCONT_BURST_ENB
+		| PlxDmaModeLOCL_BURST_ENB
+		| PlxDmaModeINT_PIN_SELECT
+		| PlxDmaModeDONE_INT_ENB;
+	cmdma = PlxDmaCsrENABLE | PlxDmaCsrSTART;
+
+	if (iod == XmemDrvrREAD) {
 		dptr = PlxDmaDprTERM_INT_ENB | PlxDmaDprDIR_LOC_PCI;
-		DrmLocalReadWrite(mcon,PlxLocalDMADPR0 ,&dptr, 4, XmemDrvrWRITE);
-
-		mcon->RdTimer = timeout(RdDmaTimeout, (char *)mcon, XmemDrvrDMA_TIMEOUT);
-		if (mcon->RdTimer < 0) {
-			mcon->RdTimer = 0;
-			pseterr(EBUSY);
-			return SYSERR;
-		}
+		DrmLocalReadWrite(mcon, PlxLocalDMAMODE0, &dmamode, 4, XmemDrvrWRITE);
+		DrmLocalReadWrite(mcon, PlxLocalDMAPADR0, &padr, 4, XmemDrvrWRITE);
+		DrmLocalReadWrite(mcon, PlxLocalDMALADR0, &sram, 4, XmemDrvrWRITE);
+		DrmLocalReadWrite(mcon, PlxLocalDMASIZ0, &len, 4, XmemDrvrWRITE);
+		DrmLocalReadWrite(mcon, PlxLocalDMADPR0, &dptr, 4, XmemDrvrWRITE);
 		sreset(&mcon->RdDmaSemaphore);
-
-		cmdma = PlxDmaCsrENABLE | PlxDmaCsrSTART; /* Command: Start transfer */
 		DrmLocalReadWrite(mcon, PlxLocalDMACSR0, &cmdma, 1, XmemDrvrWRITE);
+	} else {
+		dptr = PlxDmaDprTERM_INT_ENB;
+		DrmLocalReadWrite(mcon, PlxLocalDMAMODE1, &dmamode, 4, XmemDrvrWRITE);
+		DrmLocalReadWrite(mcon, PlxLocalDMAPADR1, &padr, 4, XmemDrvrWRITE);
+		DrmLocalReadWrite(mcon, PlxLocalDMALADR1, &sram, 4, XmemDrvrWRITE);
+		DrmLocalReadWrite(mcon, PlxLocalDMASIZ1, &len, 4, XmemDrvrWRITE);
+		DrmLocalReadWrite(mcon, PlxLocalDMADPR1, &dptr, 4, XmemDrvrWRITE);
+		sreset(&mcon->WrDmaSemaphore);
+		DrmLocalReadWrite(mcon, PlxLocalDMACSR1, &cmdma, 1, XmemDrvrWRITE);
+	}
+}
 
-		if (swait(&mcon->RdDmaSemaphore, SEM_SIGABORT)) {
-			sreset(&mcon->RdDmaSemaphore);
-			pseterr(EINTR);
-			return SYSERR;
-		}
-		if (mcon->RdTimer)
-			CancelTimeout(&mcon->RdTimer);
-		else {
-			cmdma = 0;
-			DrmLocalReadWrite(mcon, PlxLocalDMACSR0, &cmdma, 1, XmemDrvrREAD);
-			if ((cmdma & PlxDmaCsrDONE) == 0) {
-				pseterr(EBUSY);
-				return SYSERR;
-			}
-		}
-		if (! mapped)  /* mapping has to be cleared */
-			cdcm_pci_unmap(mcon, mcon->DmaOp.Dma, mcon->DmaOp.Len, mcon->DmaOp.Flag);
+/**
+ * ChainCopy - Copies a scattered buffer to/from VMIC's SDRAM in one DMA.
+ *
+ * @param mcon: module context
+ * @param sram: address in the VMIC's SDRAM
+ * @param pgs: number of entries in mcon->dmachain
+ * @param iod: direction of the transfer (XmemDrvr{READ,WRITE})
+ *
+ * The pieces of the buffer in mcon->dmachain (as set by
+ * cdcm_pci_mmchain_lock()) are put in a list of PLX descriptors, merging
+ * those that are physically contiguous. The PLX then walks the list on its
+ * own and interrupts only once, when it's done.
+ * As in DmaStart(), reads use DMA channel 0 and writes channel 1.
+ * Must be called with mcon->BusySemaphore held.
+ *
+ * @return OK on success
+ */
+static int ChainCopy(XmemDrvrModuleContext *mcon, unsigned long sram, int pgs,
+		XmemDrvrIoDir iod)
+{
+	PlxDmaDesc *desc = mcon->DmaDesc;
+	unsigned long modereg, dprreg, csrreg;
+	unsigned long padr, len, end, siz, bytes, next, dir;
+	unsigned long dmamode, dptr, cmdma;
+	int *sem;
+	int i, n;
+
+	if (iod == XmemDrvrREAD) {
+		modereg = PlxLocalDMAMODE0;
+		dprreg  = PlxLocalDMADPR0;
+		csrreg  = PlxLocalDMACSR0;
+		sem     = &mcon->RdDmaSemaphore;
+		dir     = PlxDmaDprDIR_LOC_PCI;
+	} else {
+		modereg = PlxLocalDMAMODE1;
+		dprreg  = PlxLocalDMADPR1;
+		csrreg  = PlxLocalDMACSR1;
+		sem     = &mcon->WrDmaSemaphore;
+		dir     = 0;
+	}
 
-		return OK;
-		break;
+	n = 0;
+	end = siz = bytes = 0;
+	for (i = 0; i < pgs; i++) {
+		padr = (unsigned long)mcon->dmachain[i].address;
+		len  = mcon->dmachain[i].count;
 
-	default:
-		goto arg_err;
-	}
-access_err:
-	cprintf("xmemDrvr:PageCopy: Write permission denied for segment ID=0x%X.\n",
-		(unsigned int)siod->Id);
-	pseterr(EACCES);
-	return SYSERR;
-address_err:
-	cprintf("xmemDrvr:PageCopy: Illegal address.\n");
-	pseterr(EFAULT);
-	return SYSERR;
-arg_err:
-	cprintf("xmemDrvr:PageCopy: Wrong argument.\n");
-	pseterr(EINVAL);
-	return SYSERR;
-device_err:
-	cprintf("xmemDrvr:PageCopy: No such device.");
-	pseterr(ENODEV);
-	return SYSERR;
-nosegment:
-	cprintf("xmemDrvr:PageCopy:No such segment defined:%d.\n", sgx);
-	pseterr(ENXIO);
-	return SYSERR;
-nomapping:
-	cprintf("xmemDrvr:PageCopy: unable to perform DMA mapping.\n");
-	pseterr(EIO);
-	return SYSERR;
+		if (n && padr == end) {
+			siz += len;
+		} else {
+			next = (unsigned long)mcon->DmaDescBus +
+				(n + 1) * sizeof(PlxDmaDesc);
+			siz = len;
+			desc[n].PADR = cdcm_cpu_to_le32(padr);
+			desc[n].LADR = cdcm_cpu_to_le32(sram + bytes);
+			desc[n].DPR  = cdcm_cpu_to_le32(next | dir | PlxDmaDprSPACE);
+			n++;
+		}
+		desc[n - 1].SIZ = cdcm_cpu_to_le32(siz);
+		end = padr + len;
+		bytes += len;
+	}
+	desc[n - 1].DPR |= cdcm_cpu_to_le32(PlxDmaDprEND_CHAIN);
+	cdcm_wmb(); /* the list must be in memory before the PLX fetches it */
+
+	EnableDmaInterrupts(mcon);
+
+	dmamode = PlxDmaMode16BIT
+		| PlxDmaMode32BIT
+		| PlxDmaModeINP_ENB
+		| PlxDmaModeCONT_BURST_ENB
+		| PlxDmaModeLOCL_BURST_ENB
+		| PlxDmaModeSCAT_GATHER
+		| PlxDmaModeINT_PIN_SELECT
+		| PlxDmaModeDONE_INT_ENB;
+	DrmLocalReadWrite(mcon, modereg, &dmamode, 4, XmemDrvrWRITE);
+	/* the direction is taken from each descriptor */
+	dptr = (unsigned long)mcon->DmaDescBus | PlxDmaDprSPACE;
+	DrmLocalReadWrite(mcon, dprreg, &dptr, 4, XmemDrvrWRITE);
+
+	sreset(sem);
+
+	cmdma = PlxDmaCsrENABLE | PlxDmaCsrSTART;
+	DrmLocalReadWrite(mcon, csrreg, &cmdma, 1, XmemDrvrWRITE);
+
+	return DmaWait(mcon, iod, bytes);
 }
 
 /**
@@ -1278,7 +1219,8 @@ nomapping:
  * @param mcon: module context
  *
  * If the size of the transfer is >= the DMA threshold, the physical pages
- * of the user's buffer are found and passed to PageCopy().
+ * of the user's buffer are found and transferred in a single chained DMA
+ * (see ChainCopy()).
  * If the size is smaller than the threshold, I/O is CPU-based.
  *
  * @return OK on success
@@ -1287,10 +1229,9 @@ static int SegmentCopy(XmemDrvrSegIoDesc *siod, XmemDrvrIoDir iod,
 		XmemDrvrClientContext *ccon, XmemDrvrModuleContext *mcon)
 {
 	XmemDrvrSendBuf  sbuf;
-	XmemDrvrSegIoDesc sio;
 	XmemDrvrSegDesc *sgds;
 	int err;
-	unsigned int pg, pgs, myid, sgx, sram;
+	unsigned int pgs, myid, sgx, sram;
 
 	err = OK;
 
@@ -1301,13 +1242,15 @@ static int SegmentCopy(XmemDrvrSegIoDesc *siod, XmemDrvrIoDir iod,
 	if (! siod->Id) goto nodevice;
 	if (! GetSeg(siod->Id, &sgx)) goto nosegment;
 
-	bzero((void *)&sio, sizeof(XmemDrvrSegIoDesc));
-	sio.Module = siod->Module;
-	sio.Id     = siod->Id;
-	sio.Offset = siod->Offset;
+	sgds = &Wa->SegTable.Descriptors[sgx];
+	if (siod->Offset + siod->Size > sgds->Size) goto range_err;
+	sram = (unsigned int) sgds->Address + siod->Offset;
 
 	if (siod->Size >= Wa->DmaThreshold) {
 		/* |--> then siod->UserArray is a pointer to user space. */
+		if (iod == XmemDrvrWRITE &&
+			!WrPermSeg(siod->Id, mcon->NodeId, &myid))
+			goto access_err;
 		/* Map and lock the pages of the user's buffer. */
 		pgs = cdcm_pci_mmchain_lock(mcon->Handle, &mcon->Dma, iod == XmemDrvrWRITE,
 					ccon->Pid, siod->UserArray, siod->Size, mcon->dmachain);
@@ -1315,40 +1258,19 @@ static int SegmentCopy(XmemDrvrSegIoDesc *siod, XmemDrvrIoDir iod,
 			cprintf("xmemDrvr: Page count from cdcm_pci_mmchain_lock: %d.\n", pgs);
 		if (pgs <= 0 || pgs > XmemDrvrMAX_DMA_CHAIN) goto badchain;
 
-		mcon->DmaOp.Flag = iod == XmemDrvrWRITE;
-		mcon->DmaOp.Buffer = siod->UserArray;
+		err = ChainCopy(mcon, sram, pgs, iod);
 
-		for (pg = 0; pg < pgs; pg++) {
-
-			mcon->DmaOp.Dma = mcon->dmachain[pg].address; /* this is a portable type */
-			mcon->DmaOp.Len = mcon->dmachain[pg].count;
-
-			if (ccon->Debug) {
-				cprintf("xmemDrvr:SegmentCopy:%d Addr:0x%X Size:%d Offset:0x%x\n",
-					pg + 1, (int)mcon->DmaOp.Dma, (int)mcon->DmaOp.Len,
-					(int)sio.Offset);
-			}
-
-			err = PageCopy(&sio, iod, 1); /* mapped = 1 */
-
-			if (err < 0)
-				break;
-			sio.Offset += mcon->dmachain[pg].count;
-		}
 		/* clear SG mapping (which also unlocks the pages) */
 		cdcm_pci_mem_unlock(mcon->Handle, &mcon->Dma, ccon->Pid, iod == XmemDrvrREAD);
 	}
 	else { /* siod->Size < Wa->DmaThreshold */
 		/* Here, siod->UserArray is a pointer to kernel space. */
-		sgds = &Wa->SegTable.Descriptors[sgx];
-		sram = (unsigned int) sgds->Address + siod->Offset;
-
 		if (iod == XmemDrvrWRITE) {
 			if (! WrPermSeg(siod->Id, mcon->NodeId, &myid)) goto access_err;
-			LongCopyToXmem(mcon->SDRam + sram, siod->UserArray, siod->Size);
+			XmemCopyToXmem(mcon->SDRam + sram, siod->UserArray, siod->Size);
 		}
 		else
-			LongCopyFromXmem(mcon->SDRam + sram, siod->UserArray, siod->Size);
+			XmemCopyFromXmem(mcon->SDRam + sram, siod->UserArray, siod->Size);
 	}
 
 	if (err == OK && iod == XmemDrvrWRITE && siod->UpdateFlg) {
@@ -1375,6 +1297,12 @@ address_err:
 	ssignal(&mcon->BusySemaphore);
 	pseterr(EFAULT);
 	return SYSERR;
+range_err:
+	cprintf("xmemDrvr:SegmentCopy: Offset+Size beyond segment ID=0x%X.\n",
+		(unsigned int)siod->Id);
+	ssignal(&mcon->BusySemaphore);
+	pseterr(EINVAL);
+	return SYSERR;
 badchain:
 	cprintf("xmemDrvr:SegmentCopy:Bad DMA chain list length:%d [1..%lu]\n",
 		pgs, XmemDrvrMAX_DMA_CHAIN);
@@ -1393,84 +1321,176 @@ nosegment:
 	return SYSERR;
 }
 
+/**
+ * FlushUsecs - current time in microseconds, for the flush statistics
+ *
+ * Wraps around; only differences between two readings are meaningful.
+ */
+static unsigned long FlushUsecs(void)
+{
+	unsigned long sec, nsec;
+
+	nsec = nanotime(&sec);
+	return sec * 1000000 + nsec / 1000;
+}
+
+/**
+ * FlushNextChunk - next piece of the segments to be flushed
+ *
+ * @param mask: segments to be flushed
+ * @param sgx: current segment; start at 0
+ * @param off: offset within the current segment; start at 0
+ * @param sram: address of the chunk in the VMIC's SDRAM
+ * @param len: size of the chunk, at most XmemDrvrFLUSH_CHUNK
+ *
+ * @return 1 if a chunk was found, 0 when all segments have been walked
+ */
+static int FlushNextChunk(unsigned long mask, int *sgx, unsigned long *off,
+		unsigned long *sram, unsigned long *len)
+{
+	XmemDrvrSegDesc *sgds;
+
+	for (; *sgx < XmemDrvrSEGMENTS; (*sgx)++, *off = 0) {
+		if (!((1 << *sgx) & mask))
+			continue;
+		sgds = &Wa->SegTable.Descriptors[*sgx];
+		if (*off >= sgds->Size)
+			continue;
+		*sram = (unsigned long)sgds->Address + *off;
+		*len = sgds->Size - *off;
+		if (*len > XmemDrvrFLUSH_CHUNK)
+			*len = XmemDrvrFLUSH_CHUNK;
+		*off += *len;
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * FlushWait - DmaWait() that accounts for the time spent waiting
+ *
+ * @param mcon: module context
+ * @param iod: direction of the transfer
+ * @param bytes: size of the transfer
+ * @param waited: incremented by the time waited, in microseconds
+ *
+ * @return OK on success
+ */
+static int FlushWait(XmemDrvrModuleContext *mcon, XmemDrvrIoDir iod,
+		unsigned long bytes, unsigned long *waited)
+{
+	unsigned long t = FlushUsecs();
+	int err;
+
+	err = DmaWait(mcon, iod, bytes);
+	*waited += FlushUsecs() - t;
+	return err;
+}
+
 /**
  * FlushSegments - flushes segments to network
  *
  * @param mcon: module context
  * @param mask: bitmask which contains which segments need to be flushed
  *
- * two mutexes are acquired in this functions: mcon->TempbufSemaphore and
- * mcon->BusySemaphore. The former provides  mutually exclusive access to
- * mcon->Tempbuf (which is used as a cache to send the segments in pieces)
- * and the latter has to be acquired before any call to PageCopy().
+ * The segments are read back from the SDRAM and written again, which makes
+ * the VMIC send them out, in chunks of XmemDrvrFLUSH_CHUNK bytes. The two
+ * chunks in mcon->FlushBuf are used in turns: while chunk N is written from
+ * one of them (DMA channel 1), chunk N+1 is read into the other one (DMA
+ * channel 0). Only mcon->BusySemaphore is held; mcon->Tempbuf isn't used.
+ * The outcome is recorded in mcon->FlushStats.
  *
- * @return OK on success
+ * Nothing is flushed unless the node may write every segment in @mask.
+ *
+ * @return OK on success; SYSERR (EACCES) if a segment isn't writable
  */
 static int FlushSegments(XmemDrvrModuleContext *mcon, unsigned long mask)
 {
-	XmemDrvrSegIoDesc  sio;
-	XmemDrvrSegDesc   *sgds;
+	XmemDrvrFlushStats *stats = &mcon->FlushStats;
 	XmemDrvrSendBuf    sbuf;
-	unsigned long msk, umsk;
-	int i, pg, err, rsze;
+	unsigned long umsk, off, sram, len, wsram, wlen;
+	unsigned long bytes, start, usecs, rdwait, wrwait;
+	unsigned long ps;
+	int sgx, buf, more, err, rerr, myid;
+
+	umsk = mask & Wa->SegTable.Used;
+	if (! umsk)
+		return OK;
+
+	for (sgx = 0; sgx < XmemDrvrSEGMENTS; sgx++) {
+		if (! (umsk & (1 << sgx)))
+			continue;
+		if (! WrPermSeg(1 << sgx, mcon->NodeId, &myid)) {
+			cprintf("xmemDrvr:FlushSegments: Write permission denied, segment ID=0x%X.\n",
+				1 << sgx);
+			pseterr(EACCES);
+			return SYSERR;
+		}
+	}
 
-	swait(&mcon->TempbufSemaphore, SEM_SIGIGNORE); /* acquire the mutex */
-	/* Tempbuf has been acquired */
 	swait(&mcon->BusySemaphore, SEM_SIGIGNORE); /* acquire the mutex */
 	/* Inside protected region ("Busy" state). */
 
+	start = FlushUsecs();
+	bytes = rdwait = wrwait = 0;
+	sgx = off = buf = 0;
+	err = OK;
 
-	/* FIXME: So much unnecessary nesting. */
-	umsk = 0;
-	for (i = 0; i < XmemDrvrSEGMENTS; i++) {
-		msk = 1 << i;
-		if ((msk & mask) && (msk & Wa->SegTable.Used)) {
-			umsk |= msk;
-			sgds = &Wa->SegTable.Descriptors[i];
-
-			bzero((void *) &sio, sizeof(XmemDrvrSegIoDesc));
-			sio.Module = mcon->ModuleIndex + 1;
-			sio.Id = msk;
-			sio.UserArray = mcon->Tempbuf;
-			sio.Offset = 0;
-
-			/* chop up the segment in pagesized chunks and send them out */
-			for (pg = 0; pg < sgds->Size; pg += PAGESIZE) {
-				if (sgds->Size > pg) rsze = sgds->Size - pg;
-				else                 rsze = sgds->Size;
-				if (rsze > PAGESIZE) rsze = PAGESIZE;
-				sio.Offset = pg;
-				sio.Size = rsze;
-
-				err = PageCopy(&sio, XmemDrvrREAD, 0); /* mapped = 0 */
-				if (err < 0) {
-					ssignal(&mcon->BusySemaphore);
-					ssignal(&mcon->TempbufSemaphore);
-					return err;
-				}
-				err = PageCopy(&sio, XmemDrvrWRITE, 0); /* mapped = 0 */
-				if (err < 0) {
-					ssignal(&mcon->BusySemaphore);
-					ssignal(&mcon->TempbufSemaphore);
-					return err;
-				}
-			}
-		}
+	EnableDmaInterrupts(mcon);
+
+	/* fill the pipeline */
+	more = FlushNextChunk(umsk, &sgx, &off, &sram, &len);
+	if (more) {
+		DmaStart(mcon, XmemDrvrREAD, mcon->FlushBufBus[buf], sram, len);
+		err = FlushWait(mcon, XmemDrvrREAD, len, &rdwait);
+	}
+
+	while (more && err == OK) {
+		/* write out the chunk just read, while reading in the next one */
+		wsram = sram;
+		wlen = len;
+		DmaStart(mcon, XmemDrvrWRITE, mcon->FlushBufBus[buf], wsram, wlen);
+
+		more = FlushNextChunk(umsk, &sgx, &off, &sram, &len);
+		if (more)
+			DmaStart(mcon, XmemDrvrREAD, mcon->FlushBufBus[buf ^ 1],
+				sram, len);
+
+		err = FlushWait(mcon, XmemDrvrWRITE, wlen, &wrwait);
+		if (more) {
+			rerr = FlushWait(mcon, XmemDrvrREAD, len, &rdwait);
+			if (err == OK)
+				err = rerr;
+		}
+		if (err == OK)
+			bytes += wlen;
+		buf ^= 1;
+	}
+
+	if (err == OK) {
+		usecs = FlushUsecs() - start;
+		disable(ps); /* GET_FLUSH_STATS doesn't wait for a flush */
+		stats->Flushes++;
+		stats->Bytes     = bytes;
+		stats->Time      = usecs;
+		stats->ReadWait  = rdwait;
+		stats->WriteWait = wrwait;
+		if (usecs > stats->MaxTime)
+			stats->MaxTime = usecs;
+		restore(ps);
 	}
 
-	/* release mutexes */
-	ssignal(&mcon->BusySemaphore);
-	ssignal(&mcon->TempbufSemaphore);
+	ssignal(&mcon->BusySemaphore); /* release the mutex */
 
-	if (umsk) {
-		sbuf.Module        = mcon->ModuleIndex + 1;
-		sbuf.UnicastNodeId = 0;
-		sbuf.MulticastMask = 0;
-		sbuf.Data          = umsk;
-		sbuf.InterruptType = XmemDrvrNicSEGMENT_UPDATE | XmemDrvrNicBROADCAST;
-		return SendInterrupt(&sbuf);
-	}
-	return OK;
+	if (err != OK)
+		return err;
+
+	sbuf.Module        = mcon->ModuleIndex + 1;
+	sbuf.UnicastNodeId = 0;
+	sbuf.MulticastMask = 0;
+	sbuf.Data          = umsk;
+	sbuf.InterruptType = XmemDrvrNicSEGMENT_UPDATE | XmemDrvrNicBROADCAST;
+	return SendInterrupt(&sbuf);
 }
 
 /**
@@ -1514,9 +1534,9 @@ static int RawIo(XmemDrvrModuleContext *mcon, XmemDrvrRawIoBlock *riob,
 	if (!recoset()) { /* Catch bus errors */
 
 		if (flag == XmemDrvrWRITE)
-			LongCopyToXmem(  vmap + offs, riob->UserArray, itms*sizeof(u_int32_t));
+			XmemCopyToXmem(  vmap + offs, riob->UserArray, itms*sizeof(u_int32_t));
 		else
-			LongCopyFromXmem(vmap + offs, riob->UserArray, itms*sizeof(u_int32_t));
+			XmemCopyFromXmem(vmap + offs, riob->UserArray, itms*sizeof(u_int32_t));
 
 	} else {
 		disable(ps);
@@ -1773,9 +1793,10 @@ void IntrHandler(void *m)
 			}
 		}
 
-		for (i = 0; i < XmemDrvrCLIENT_CONTEXTS; i++) {
-			unsigned long ps;
+		if (usegs)
+			BumpGenerations(mcon, usegs);
 
+		for (i = 0; i < XmemDrvrCLIENT_CONTEXTS; i++) {
 			ccon = &Wa->ClientContexts[i];
 
 			if (usegs) { /* Or in updated segments in clients */
@@ -1787,9 +1808,7 @@ void IntrHandler(void *m)
 			if (!(msk & isrc))
 				continue;
 
-			disable(ps);
-			__q_put(&rbf, ccon);
-			restore(ps);
+			q_put(&rbf, ccon);
 		} /* gone through all the interrupt sources */
 
 	}
@@ -1834,7 +1853,6 @@ int XmemDrvrOpen(void *s, int dnm, struct cdcm_file *flp)
 {
 	int cnum;                       /* Client number */
 	XmemDrvrClientContext *ccon;    /* Client context */
-	unsigned long ps;
 
 	/*
 	 * We allow one client per minor device, we use the minor device
@@ -1863,9 +1881,7 @@ int XmemDrvrOpen(void *s, int dnm, struct cdcm_file *flp)
 	ccon->UpdatedSegments = 0;
 	ccon->Debug           = XmemDrvrDebugNONE;
 
-	disable(ps);
-	__q_reset(ccon);
-	restore(ps);
+	q_init(ccon);
 
 #if 0
 	cprintf("xmemDrvr:Open:%d ClientSem:0x%X:%d PID:%d\n",
@@ -1915,9 +1931,6 @@ int XmemDrvrClose(void *s, struct cdcm_file *flp)
 		return SYSERR;
 	}
 
-	/* Cancel any pending timeouts */
-	CancelTimeout(&ccon->Timer);
-
 	/* Disconnect this client from events */
 	DisConnectAll(ccon);
 
@@ -1935,17 +1948,21 @@ int XmemDrvrClose(void *s, struct cdcm_file *flp)
  * @param u_buf: user buffer. results will go here
  * @param cnt: number of bytes to read
  *
+ * Returns as many queued events as fit in @u_buf, i.e. up to
+ * cnt / sizeof(XmemDrvrReadBuf). If the queue is empty, the client blocks
+ * until an event arrives or its timeout expires, unless it's in
+ * non-blocking mode (SET_NONBLOCK), in which case EAGAIN is returned.
+ *
  * @return number of bytes read
  */
 int XmemDrvrRead(void *s, struct cdcm_file *flp, char *u_buf, int cnt)
 {
 	XmemDrvrClientContext *ccon;    /* Client context */
 	XmemDrvrQueue         *queue;
-	XmemDrvrReadBuf       *rb;
 	XmemDrvrWorkingArea *wa = (XmemDrvrWorkingArea*)s;
 	int           cnum; /* Client number */
 	int           wcnt; /* Writable byte counts at arg address */
-	int           pid;
+	int           n;
 	unsigned long ps;
 	int ret;
 
@@ -1959,6 +1976,13 @@ int XmemDrvrRead(void *s, struct cdcm_file *flp, char *u_buf, int cnt)
 			pseterr(EINVAL);
 			return SYSERR;
 		}
+		if (cnt > wcnt)
+			cnt = wcnt;
+	}
+	n = cnt / sizeof(XmemDrvrReadBuf);
+	if (n <= 0) {
+		pseterr(EINVAL);
+		return SYSERR;
 	}
 
 	ccon = &wa->ClientContexts[cnum];
@@ -1969,77 +1993,57 @@ int XmemDrvrRead(void *s, struct cdcm_file *flp, char *u_buf, int cnt)
 		return SYSERR;
 	}
 
-	/*
-	 * Block any calls coming from unknown PIDs.
-	 * Only the PID that opened the driver is allowed to read.
-	 */
-
-	pid = getpid();
-	if (pid != ccon->Pid) {
-		cprintf("xmemDrvrRead: Spurious read PID:%d for PID:%d on FD:%d\n",
-			(int)pid, (int)ccon->Pid, (int)cnum);
-		pseterr(EBADF); /* Bad file number */
-		return SYSERR;
-	}
-
 	queue = &ccon->Queue;
 
-	disable(ps);
+	cdcm_spin_lock_irqsave(&queue->lock, ps);
 	if (queue->QueueOff)
 		__q_reset(ccon);
-	restore(ps);
-
-	if (ccon->Timeout) {
-		ccon->Timer = timeout(ReadTimeout, (char *)ccon, ccon->Timeout);
-		if (ccon->Timer < 0) {
-			disable(ps);
-			__q_reset(ccon);
-			ccon->Timer = 0;
-			restore(ps);
-			cprintf("xmemDrvr:Read: No timers available: Context:%d\n", cnum);
-			pseterr(EBUSY); /* No available timers */
-			return 0;
-		}
-	}
-
-	if (swait(&ccon->Semaphore, SEM_SIGABORT)) {
-		disable(ps);
-		__q_reset(ccon);
-		restore(ps);
-		if (ccon->Debug)
-			cprintf("xmemDrvr:Read:Error ret from swait:Context:%d\n", cnum);
-		pseterr(EINTR); /* We have been signaled */
-		return 0;
-	}
 
-	if (ccon->Timeout) {
-		if (ccon->Timer) {
-			CancelTimeout(&ccon->Timer);
+	if (!queue->elems) {
+		if (ccon->NonBlock) {
+			cdcm_spin_unlock_irqrestore(&queue->lock, ps);
+			pseterr(EAGAIN);
+			return SYSERR;
 		}
-		else {
-			disable(ps);
-			__q_reset(ccon);
-			restore(ps);
-			if (ccon->Debug)
-				cprintf("xmemDrvr:Read: TimeOut: Context:%d\n", cnum);
-			pseterr(ETIME);
+		queue->Waiting = 1;
+		cdcm_spin_unlock_irqrestore(&queue->lock, ps);
+
+		/* a zero timeout means wait forever */
+		ret = tswait(&ccon->Semaphore, SEM_SIGABORT,
+			     ccon->Timeout ? ccon->Timeout : -1);
+
+		cdcm_spin_lock_irqsave(&queue->lock, ps);
+		if (queue->Waiting) {
+			/* nobody signalled us */
+			queue->Waiting = 0;
+		} else if (ret) {
+			/*
+			 * q_put() signalled after we gave up waiting: take
+			 * the signal now so that the next read doesn't see it.
+			 */
+			tswait(&ccon->Semaphore, SEM_SIGIGNORE, 0);
+		}
+		if (!queue->elems) {
+			cdcm_spin_unlock_irqrestore(&queue->lock, ps);
+			if (ret == TSWAIT_TIMEDOUT) {
+				if (ccon->Debug)
+					cprintf("xmemDrvr:Read: TimeOut: Context:%d\n",
+						cnum);
+				pseterr(ETIME);
+			} else {
+				if (ccon->Debug)
+					cprintf("xmemDrvr:Read: Interrupted: Context:%d\n",
+						cnum);
+				pseterr(EINTR); /* We have been signaled */
+			}
 			return 0;
 		}
 	}
 
-	rb = (XmemDrvrReadBuf *)u_buf;
-	disable(ps);
-	if (__q_get(rb, ccon)) {
-		ret = sizeof(XmemDrvrReadBuf);
-	} else {
-		__q_reset(ccon);
-		if (ccon->Debug)
-			cprintf("xmemDrvr:Read: Queue Empty: Context:%d\n", cnum);
-		pseterr(EINTR);
-		ret = 0;
-	}
-	restore(ps);
-	return ret;
+	n = __q_get((XmemDrvrReadBuf *)u_buf, n, ccon);
+	cdcm_spin_unlock_irqrestore(&queue->lock, ps);
+
+	return n * sizeof(XmemDrvrReadBuf);
 }
 
 /**
@@ -2071,15 +2075,12 @@ int XmemDrvrWrite(void *s, struct cdcm_file *flp, char *u_buf, int cnt)
 {
 	XmemDrvrModuleContext *mcon;
 	XmemDrvrClientContext *ccon;
-	XmemDrvrQueue         *queue;
 	XmemDrvrReadBuf        rbf; /* read buffer (for the clients) */
 	XmemDrvrWriteBuf      *wbf; /* write buffer */
 	XmemDrvrWorkingArea *wa = (XmemDrvrWorkingArea*)s;
 	int           cnum;
-	int           pid;
 	int           midx;
 	unsigned int  i;
-	unsigned long ps;
 	unsigned long msk;
 
 	/*
@@ -2109,18 +2110,6 @@ int XmemDrvrWrite(void *s, struct cdcm_file *flp, char *u_buf, int cnt)
 	}
 	mcon = &wa->ModuleContexts[midx];
 
-	/*
-	 * Block any calls coming from unknown PIDs.
-	 * Only the PID that opened the driver is allowed to read.
-	 */
-	pid = getpid();
-	if (pid != ccon->Pid) {
-		cprintf("xmemDrvr:Write: Spurious read PID:%d for PID:%d on FD:%d\n",
-			(unsigned int)pid, (unsigned int)ccon->Pid, (unsigned int)cnum);
-		pseterr(EBADF); /* Bad file number */
-		return SYSERR;
-	}
-
 	/* Prepare the read buffer for suscribed clients */
 	bzero((void *)&rbf, sizeof(XmemDrvrWriteBuf));
 	rbf.Module = wbf->Module;
@@ -2132,8 +2121,6 @@ int XmemDrvrWrite(void *s, struct cdcm_file *flp, char *u_buf, int cnt)
 	for (i = 0; i < XmemDrvrCLIENT_CONTEXTS; i++) {
 
 		ccon = &Wa->ClientContexts[i];
-		queue = &ccon->Queue;
-
 		msk = mcon->Clients[i];
 
 		if (! (msk & XmemDrvrIntrSOFTWAKEUP))
@@ -2141,10 +2128,7 @@ int XmemDrvrWrite(void *s, struct cdcm_file *flp, char *u_buf, int cnt)
 
 
 		/* the client's connected to IntrSOFTWAKEUP --> fill in his queue */
-
-		disable(ps); /* acquire spinlock */
-		__q_put(&rbf, ccon);
-		restore(ps); /* release spinlock */
+		q_put(&rbf, ccon);
 
 	}
 
@@ -2185,6 +2169,66 @@ int XmemDrvrSelect(void *s, struct cdcm_file *flp, int wch, struct sel *ffs)
 }
 
 
+/**
+ * ExportMappings - Let the clients mmap() a module's SDRAM and generations
+ *
+ * @param mcon: module context
+ *
+ * The SDRAM is exported read-only and uncached, for the readers. It isn't
+ * exported for writing: a writable mapping would bypass WrPermSeg() for
+ * every segment, so writes keep going through the ioctls. This is not
+ * fatal if it fails; the clients can still use the read ioctls.
+ */
+static void ExportMappings(XmemDrvrModuleContext *mcon)
+{
+#ifdef __linux__
+	XmemDrvrMmapInfo *info = &mcon->MmapInfo;
+	unsigned long offset, size;
+	int cc;
+
+	info->Module = mcon->ModuleIndex + 1;
+	cc = cdcm_pci_export_bar(mcon->Handle, PCI_RESID_BAR3, CDCM_MMAP_RDONLY,
+				 &offset, &size);
+	if (cc)
+		goto out_err;
+	info->RdOffset = offset;
+	mcon->Gen = cdcm_dmabuf_alloc_flags(PAGESIZE, CDCM_MMAP_RDONLY,
+					    &offset);
+	if (!mcon->Gen) {
+		cc = -ENOMEM;
+		goto out_rd;
+	}
+	info->GenOffset = offset;
+	info->Size = size;
+	return;
+
+ out_rd:
+	cdcm_iomem_unexport(info->RdOffset);
+ out_err:
+	cprintf("xmemDrvr: Module %lu can't be mmap'ed: %d\n",
+		mcon->ModuleIndex + 1, cc);
+	bzero((void *)info, sizeof(XmemDrvrMmapInfo));
+#else /* Lynx: no mmap() support; MmapInfo.Size stays 0 */
+#endif
+}
+
+/**
+ * UnexportMappings - Undo ExportMappings()
+ *
+ * @param mcon: module context
+ */
+static void UnexportMappings(XmemDrvrModuleContext *mcon)
+{
+#ifdef __linux__
+	if (!mcon->MmapInfo.Size)
+		return;
+	cdcm_iomem_unexport(mcon->MmapInfo.RdOffset);
+	cdcm_dmabuf_free(mcon->Gen);
+	mcon->Gen = NULL;
+	mcon->MmapInfo.Size = 0;
+#endif
+}
+
 /**
  * XmemDrvrInstall - This routine is called at driver install with a
  * parameter pointer, addressing a table initialised with the info table
@@ -2201,7 +2245,7 @@ char* XmemDrvrInstall(void *info)
 	unsigned int vadr;
 	unsigned long ivec;
 	unsigned long bigend;
-	int midx, mid, cc;
+	int midx, mid, cc, i;
 
 	/* Allocate the driver working area. */
 	wa = (XmemDrvrWorkingArea *)sysbrk(sizeof(XmemDrvrWorkingArea));
@@ -2240,7 +2284,7 @@ char* XmemDrvrInstall(void *info)
 
 			/* Allocate space for the temporary buffer mcon->Tempbuf.
 			 * This buffer is used for copying up to PAGESIZE bytes of data from user
-			 * space, and is also used by FlushSegments() as a cache.
+			 * space.
 			 * If the user wants to transfer more than PAGESIZE bytes, DMA is used.
 			 * This means the DMA threshold mustn't be set beyond PAGESIZE.
 			 */
@@ -2251,6 +2295,27 @@ char* XmemDrvrInstall(void *info)
 				return ((char *)SYSERR);
 			}
 
+			/* DMA descriptors for chained DMA (see ChainCopy) */
+			mcon->DmaDesc = cdcm_pci_alloc_consistent(handle,
+					XmemDrvrMAX_DMA_CHAIN * sizeof(PlxDmaDesc),
+					&mcon->DmaDescBus);
+			if (!mcon->DmaDesc) {
+				cprintf("xmemDrvr: NOT ENOUGH MEMORY(mod[%d]->DmaDesc)\n", midx);
+				pseterr(ENOMEM);
+				return ((char *)SYSERR);
+			}
+
+			/* bounce buffers for FlushSegments() */
+			for (i = 0; i < 2; i++) {
+				mcon->FlushBuf[i] = cdcm_pci_alloc_consistent(handle,
+						XmemDrvrFLUSH_CHUNK, &mcon->FlushBufBus[i]);
+				if (!mcon->FlushBuf[i]) {
+					cprintf("xmemDrvr: NOT ENOUGH MEMORY(mod[%d]->FlushBuf)\n", midx);
+					pseterr(ENOMEM);
+					return ((char *)SYSERR);
+				}
+			}
+
 			/* initialise mutexes */
 			sreset( &mcon->BusySemaphore);
 			ssignal(&mcon->BusySemaphore);
@@ -2306,6 +2371,7 @@ char* XmemDrvrInstall(void *info)
 		}
 		mcon->Local = (PlxLocalMap *)vadr;
 
+		ExportMappings(mcon);
 
 		/*
 		 * Set up the BIGEND  local configuration register to do appropriate
@@ -2333,7 +2399,7 @@ int XmemDrvrUninstall(void *s)
 	XmemDrvrClientContext *ccon;
 	XmemDrvrWorkingArea *wa = (XmemDrvrWorkingArea*)s;
 	XmemDrvrModuleContext *mcon;
-	int i;
+	int i, j;
 
 	for (i = 0; i < Wa->Modules; i++) {
 		mcon = &wa->ModuleContexts[i];
@@ -2351,7 +2417,18 @@ int XmemDrvrUninstall(void *s)
 				drm_unmap_resource(mcon->Handle, PCI_RESID_BAR3);
 				mcon->SDRam = NULL;
 			}
+			UnexportMappings(mcon);
 			drm_unregister_isr(mcon->Handle);
+			if (mcon->DmaDesc)
+				cdcm_pci_free_consistent(mcon->Handle,
+					XmemDrvrMAX_DMA_CHAIN * sizeof(PlxDmaDesc),
+					mcon->DmaDesc, mcon->DmaDescBus);
+			for (j = 0; j < 2; j++) {
+				if (mcon->FlushBuf[j])
+					cdcm_pci_free_consistent(mcon->Handle,
+						XmemDrvrFLUSH_CHUNK,
+						mcon->FlushBuf[j], mcon->FlushBufBus[j]);
+			}
 			drm_free_handle(mcon->Handle);
 			bzero((void *) mcon, sizeof(XmemDrvrModuleContext));
 		}
@@ -2360,9 +2437,6 @@ int XmemDrvrUninstall(void *s)
 	for (i = 0; i < XmemDrvrCLIENT_CONTEXTS; i++) {
 		ccon = &wa->ClientContexts[i];
 		if (ccon->InUse) {
-			if (ccon->Timer) {
-				CancelTimeout(&ccon->Timer);
-			}
 			ssignal(&ccon->Semaphore); /* Wakeup client */
 			ccon->InUse = 0;
 		}
@@ -2429,6 +2503,7 @@ int XmemDrvrIoctl(void *s, struct cdcm_file * flp, int cm, char * arg)
 	XmemDrvrSendBuf                 *sbuf;
 	XmemDrvrRamAddress              *radr;
 	XmemDrvrSegTable                *stab;
+	XmemDrvrFlushStats              *fstats;
 	XmemDrvrSegIoDesc               *siod;
 	void				*argp = (void *)arg;
 	int i, j, size;
@@ -2554,14 +2629,13 @@ int XmemDrvrIoctl(void *s, struct cdcm_file * flp, int cm, char * arg)
 		return OK;
 
 	case XmemDrvrSET_QUEUE_FLAG: /* Set queueing capabilities on/off */
+		cdcm_spin_lock_irqsave(&ccon->Queue.lock, ps);
 		if (lav)
 			ccon->Queue.QueueOff = 1;
 		else
 			ccon->Queue.QueueOff = 0;
-
-		disable(ps);
 		__q_reset(ccon);
-		restore(ps);
+		cdcm_spin_unlock_irqrestore(&ccon->Queue.lock, ps);
 		return OK;
 
 	case XmemDrvrGET_QUEUE_FLAG: /* 1-->Q_off, 0-->Q_on */
@@ -2573,11 +2647,19 @@ int XmemDrvrIoctl(void *s, struct cdcm_file * flp, int cm, char * arg)
 		return OK;
 
 	case XmemDrvrGET_QUEUE_OVERFLOW: /* Number of missed events */
-		disable(ps);
+		cdcm_spin_lock_irqsave(&ccon->Queue.lock, ps);
 		*lap = ccon->Queue.Missed;
 		ccon->Queue.Missed = 0;
-		restore(ps);
+		cdcm_spin_unlock_irqrestore(&ccon->Queue.lock, ps);
+
+		return OK;
 
+	case XmemDrvrSET_NONBLOCK: /* read() doesn't wait on an empty queue */
+		ccon->NonBlock = lav ? 1 : 0;
+		return OK;
+
+	case XmemDrvrGET_NONBLOCK:
+		*lap = ccon->NonBlock;
 		return OK;
 
 	case XmemDrvrGET_MODULE_DESCRIPTOR:
@@ -2837,6 +2919,21 @@ int XmemDrvrIoctl(void *s, struct cdcm_file * flp, int cm, char * arg)
 		/* Flush segments out to other nodes after PendingInit */
 		return FlushSegments(mcon, *lap);
 
+	case XmemDrvrGET_FLUSH_STATS:
+		fstats = argp;
+		disable(ps);
+		*fstats = mcon->FlushStats;
+		restore(ps);
+		return OK;
+
+	case XmemDrvrGET_MMAP_INFO:
+		if (!mcon->MmapInfo.Size) {
+			pseterr(ENODEV);
+			return SYSERR;
+		}
+		*(XmemDrvrMmapInfo *)argp = mcon->MmapInfo;
+		return OK;
+
 	case XmemDrvrCONFIG_OPEN: /* Open the PLX9656 configuration */
 		mcon->ConfigOpen = 1;
 		return OK;
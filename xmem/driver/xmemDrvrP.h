@@ -53,13 +53,19 @@ typedef enum {
 #define XmemDrvrQUEUE_SIZE 128 		//!< Maximum queue size
 
 /*! Client's FIFO
+ *
+ * Filled from the ISR and drained by read(); everything here is protected
+ * by @lock. The semaphore in the client context is only signalled when
+ * @Waiting is set, i.e. when read() is blocked on an empty queue.
  */
 typedef struct {
+	cdcm_spinlock_t	lock;
 	unsigned short  QueueOff;
 	unsigned short  Missed;
 	int		elems;
 	int		in;
 	int		out;
+	int		Waiting;
 	XmemDrvrReadBuf Entries[XmemDrvrQUEUE_SIZE];
 } XmemDrvrQueue;
 
@@ -77,8 +83,8 @@ typedef struct {
 
 	unsigned long ModuleIndex;     //!< The VMIC module he is working with
 	unsigned long UpdatedSegments; //!< Updated segments mask
-	unsigned long Timeout;         //!< Timeout value in ms or zero
-	int  Timer;                    //!< Timer being used by client
+	unsigned long Timeout;         //!< Timeout value in ticks or zero
+	unsigned long NonBlock;        //!< read() returns EAGAIN if no events
 	int  Semaphore;                //!< Semaphore to block on read
 	XmemDrvrQueue Queue;           //!< Interrupt queue
 } XmemDrvrClientContext;
@@ -90,17 +96,8 @@ typedef struct {
  */
 //@{
 #define XmemDrvrDMA_TIMEOUT 10 //!< TIMEOUT = 1 --> delay of 10ms.
-
-/*! DMA Operations Struct
- *
- * This is a shared structure used to keep track of the DMA mappings
- */
-typedef struct {
-	char *Buffer;
-	cdcm_dma_t Dma;
-	unsigned long Len;
-	unsigned short Flag;
-} XmemDmaOp;
+#define XmemDrvrDMA_TIMEOUT_MB 1 //!< Extra timeout per MB of a chained DMA
+#define XmemDrvrFLUSH_CHUNK (16 * PAGESIZE) //!< Size of each FlushBuf
 
 /* Maximum number of dmachain elements that dmachain can handle */
 #define XmemDrvrMAX_DMA_CHAIN ((XmemDrvrMAX_SEGMENT_SIZE)/((PAGESIZE)+1))
@@ -120,8 +117,6 @@ typedef struct {
  * @RdDmaSemaphore: DMA 0 engine sem, used for reading
  * @WrDmaSemaphore: DMA 1 engine sem, used for writing
  * @BusySemaphore: module mutex
- * @RdTimer: Read DMA timer
- * @WrTimer: Write DMA timer
  * @BusyTimer: Module busy timer
  * @Map: Pointer to the real hardware
  * @SDRam: Direct access to VMIC SD Ram
@@ -129,12 +124,22 @@ typedef struct {
  * @Command: Command bits settings
  * @InterruptEnable: Enabled interrupts mask
  * @Clients: Clients' interrupts
- * @DmaOp: DMA mapping info
  * @Dma: for CDCM internal use only
  * @dmachain: stores the return value from mmchain. Protected by @BusySemaphore
+ * @DmaDesc: PLX DMA descriptors, one per dmachain entry at most.
+ *            Protected by @BusySemaphore
+ * @DmaDescBus: PCI address of @DmaDesc
  * @Tempbuf: temp buffer, allocated during the installation
  * @TempbufSemaphore: protect Tempbuf
  * @TempbufTimer: Tempbuf timer
+ * @FlushBuf: two bounce buffers used in turns by FlushSegments().
+ *            Protected by @BusySemaphore
+ * @FlushBufBus: PCI addresses of @FlushBuf
+ * @FlushStats: statistics of FlushSegments(). Updated and read with
+ *              interrupts disabled
+ * @Gen: update generations of the segments, mapped read-only by the clients
+ * @MmapInfo: mmap() offsets of the SDRAM and @Gen. Size is 0 if the
+ *            module can't be mapped
  */
 typedef struct {
 	unsigned long		InUse;
@@ -150,8 +155,6 @@ typedef struct {
 	int			RdDmaSemaphore;
 	int			WrDmaSemaphore;
 	int			BusySemaphore;
-	int			RdTimer;
-	int			WrTimer;
 	int			BusyTimer;
 	VmicRfmMap		*Map;
 	unsigned char		*SDRam;
@@ -159,12 +162,18 @@ typedef struct {
 	XmemDrvrScr		Command;
 	VmicLier		InterruptEnable;
 	XmemDrvrIntr		Clients[XmemDrvrCLIENT_CONTEXTS];
-	XmemDmaOp		DmaOp;
 	struct cdcm_dmabuf	Dma;
 	struct dmachain		dmachain[XmemDrvrMAX_DMA_CHAIN];
+	PlxDmaDesc		*DmaDesc;
+	cdcm_dma_t		DmaDescBus;
 	void			*Tempbuf;
 	int			TempbufSemaphore;
 	int			TempbufTimer;
+	void			*FlushBuf[2];
+	cdcm_dma_t		FlushBufBus[2];
+	XmemDrvrFlushStats	FlushStats;
+	XmemDrvrGenerations	*Gen;
+	XmemDrvrMmapInfo	MmapInfo;
 } XmemDrvrModuleContext;
 
 /*! @name Driver's Working Area
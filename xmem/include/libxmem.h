@@ -299,23 +299,41 @@ typedef struct {
 } XmemMessage;
 //@}
 
+/*! Granularity of XmemSendTableDelta, in elements: a 64-byte cache line */
+#define XmemDELTA_LINE_ELEMS 16
+
 /**
  * \brief Xmem Markers -- used for checking data coherency
  * @XmemMarkersDISABLE: Disable all coherency checks
  * @XmemMarkersENABLE: Enable basic (non-atomic) checks
  * @XmemMarkersATOMIC: Enable bounce buffers to ensure atomicity
  * @XmemMarkersCHECKSUM: Enable checksum validation of the transferred data
- *
- * Note that CHECKSUM depends on ATOMIC, and ATOMIC depends on the markers
- * being enabled.
+ * @XmemMarkersSEQLOCK: Use the header as a sequence counter to ensure
+ *                      atomicity without bounce buffers
+ *
+ * Note that CHECKSUM depends on ATOMIC or SEQLOCK, and these depend on the
+ * markers being enabled. SEQLOCK takes precedence over ATOMIC.
+ * With SEQLOCK, writers bump the counter before and after writing a table,
+ * and readers copy straight into the caller's buffer, retrying if the
+ * counter changed meanwhile. Tables written with SEQLOCK are still seen as
+ * coherent by readers using ENABLE or ATOMIC. The converse only holds for
+ * ATOMIC writers, which write the header, the table and the footer in that
+ * order: ENABLE writers write the header and footer before the table, so a
+ * SEQLOCK reader can take a table that is still being written for a
+ * coherent one. Don't mix ENABLE writers with SEQLOCK readers.
+ * The checksum is zlib's Adler-32 (see xmemAdler32.h); with ATOMIC it is
+ * computed while copying to or from the bounce buffer. A read that fails
+ * the checksum may thus have overwritten the caller's buffer, as with
+ * SEQLOCK.
  */
 typedef enum {
 	XmemMarkersDISABLE =	0x1,
 	XmemMarkersENABLE =	0x2,
 	XmemMarkersATOMIC =	0x4,
 	XmemMarkersCHECKSUM =	0x8,
+	XmemMarkersSEQLOCK =	0x10,
 
-	XmemMarkersALL =	0xF
+	XmemMarkersALL =	0x1F
 } XmemMarkersMask;
 
 
@@ -621,6 +639,58 @@ XmemError XmemSendTable(XmemTableId table, void *buf, int elems,
 
 
 
+/**
+ * XmemSendTableDelta - Send only the changed parts of a client's buffer
+ *
+ * @param table: table to be written to
+ * @param buf: client's buffer, with the whole record
+ * @param elems: number of elements (4 bytes) in the record
+ * @param offset: offset of the record
+ * @param dirty: bitmap of the changed lines, or NULL
+ * @param shadow: copy of the record as last sent, or NULL
+ * @param upflag: update message flag
+ *
+ * The record is split in lines of XmemDELTA_LINE_ELEMS elements. Bit i of
+ * @dirty (bit i%32 of word i/32) set means that line i has changed. If
+ * @dirty is NULL, the changed lines are found by comparing @buf with
+ * @shadow, which is then updated. With neither of them, or with
+ * XmemMarkersATOMIC set, this is the same as XmemSendTable.
+ *
+ * Nearby changed lines are written together, in as few transfers as
+ * possible, and a single table update message is sent if @upflag is set.
+ * With markers enabled, the receivers can find out which part of the
+ * record was written with XmemGetTableHint.
+ *
+ * @return Appropriate error message (XmemError)
+ */
+XmemError XmemSendTableDelta(XmemTableId table, void *buf, int elems,
+			     int offset, const uint32_t *dirty, void *shadow,
+			     int upflag);
+
+
+
+
+/**
+ * XmemGetTableHint - Find out which part of a record was last written
+ *
+ * @param table: table to read from
+ * @param elems: number of elements (4 bytes) in the record
+ * @param offset: offset of the record
+ * @param first: first element written
+ * @param count: number of elements written
+ *
+ * Meant to be called upon a table update. If the last write was done with
+ * XmemSendTableDelta, [@first, @first + @count) covers all the changed
+ * elements; otherwise, or with markers disabled, it's the whole record.
+ *
+ * @return Appropriate error message (XmemError)
+ */
+XmemError XmemGetTableHint(XmemTableId table, int elems, int offset,
+			   int *first, int *count);
+
+
+
+
 /**
  * XmemRecvTable - Update a client's buffer from a reflective memory table
  *
@@ -730,6 +800,85 @@ void *XmemGetSharedMemory(XmemTableId tid);
 
 
 
+/**
+ * XmemMapTable - Map a table into the client's address space
+ *
+ * @param table: table id, with a single bit set
+ * @param writable: map it for writing
+ *
+ * On VMIC a read-only table is mapped straight from the module's SDRAM
+ * through the driver. Reading it costs no system call and no copy; use
+ * XmemGetTableGeneration to find out when it changes. With markers enabled
+ * the pointer skips the header, and mapped reads don't check the markers.
+ *
+ * With @writable set (this node must be allowed to write the table),
+ * elsewhere, or if the driver can't map the module, the table's
+ * XmemGetSharedMemory segment is returned instead; it is read again from
+ * the table by XmemGetTableGeneration whenever the generation changes.
+ * The driver never maps the SDRAM for writing, so that it can check every
+ * write against the segment's permissions.
+ *
+ * Mapping a table again returns the same pointer, unless a read-only
+ * mapping of the SDRAM is asked to become writable.
+ *
+ * @return pointer to the table on success; NULL otherwise.
+ */
+void *XmemMapTable(XmemTableId table, int writable);
+
+
+
+
+/**
+ * XmemUnmapTable - Undo XmemMapTable
+ *
+ * @param table: table id
+ *
+ * The XmemGetSharedMemory segment, if that's what was mapped, stays.
+ *
+ * @return Appropriate error message (XmemError)
+ */
+XmemError XmemUnmapTable(XmemTableId table);
+
+
+
+
+/**
+ * XmemSendMappedTable - Publish the writes done to a mapped table
+ *
+ * @param table: table id
+ * @param upflag: update message flag
+ *
+ * This is XmemSendTable of the whole XmemGetSharedMemory segment. A table
+ * mapped read-only from the SDRAM can't be sent: XmemErrorWRITE_PROTECTED.
+ *
+ * @return Appropriate error message (XmemError)
+ */
+XmemError XmemSendMappedTable(XmemTableId table, int upflag);
+
+
+
+
+/**
+ * XmemGetTableGeneration - Get the update generation of a table
+ *
+ * @param table: table id, with a single bit set
+ * @param gen: where to store the generation
+ *
+ * The generation changes whenever a table update message is sent for the
+ * table, from any node. On VMIC it is read from a page the driver keeps
+ * mapped, without a system call. The values are only meaningful compared
+ * with each other, on the same node.
+ *
+ * If the table is mapped to its XmemGetSharedMemory segment and the
+ * generation changed since the segment was last read, it is read again.
+ *
+ * @return Appropriate error message (XmemError)
+ */
+XmemError XmemGetTableGeneration(XmemTableId table, uint32_t *gen);
+
+
+
+
 /**
  * XmemReadTableFile - read tables from files into shared memory segments
  *
@@ -0,0 +1,231 @@
+/**
+ * @file xmemAdler32.h
+ *
+ * @brief Adler-32 checksums of xmem tables, optionally fused with a copy
+ *
+ * The checksum is zlib's Adler-32, bit for bit: tables checksummed here are
+ * validated by nodes using zlib_adler32() (adler32.h) and vice versa.
+ *
+ * XmemAdler32Copy() computes it while copying the data to a destination
+ * buffer, so that a table copied through a bounce buffer is read only once.
+ * On x86 the bulk is done with SSSE3 or AVX2 when the CPU has them; this is
+ * checked at run time, on the first call. Elsewhere, or with an old
+ * compiler, the copy is a memcpy followed by zlib_adler32().
+ *
+ * The vector versions work on blocks of 32 bytes. For a block b[0..31]:
+ *	s1' = s1 + sum(b[i])
+ *	s2' = s2 + 32 * s1 + sum((32 - i) * b[i])
+ * Both sums are kept in vector lanes, s1 summed with psadbw and the
+ * weighted sum with pmaddubsw/pmaddwd; the 32 * s1 term is accumulated
+ * once per block and shifted in at the end. The lanes are folded and
+ * reduced modulo 65521 every NMAX bytes, as zlib does.
+ *
+ * Copyright (c) 2010 CERN
+ * @author Emilio G. Cota <emilio.garcia.cota@cern.ch>
+ *
+ * @section license_sec License
+ * Released under the GPL v2. (and only v2, not any later version)
+ */
+#ifndef _XMEM_ADLER32_H_
+#define _XMEM_ADLER32_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <adler32.h>
+
+#define XmemADLER32_INIT	1	/* Adler-32 of no data */
+
+#define XmemADLER32_BASE	65521
+/* bytes between reductions: the largest multiple of 32 below zlib's NMAX */
+#define XmemADLER32_NMAX	(5552 & ~31)
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define XmemADLER32_X86
+#include <immintrin.h>
+#endif
+
+typedef uint32_t (*XmemAdler32Fn)(uint32_t adler, void *dst,
+				  const void *src, unsigned long len);
+
+/* bytes left over by the vector loops */
+static inline uint32_t xmem_adler32_tail(uint32_t adler, unsigned char *dst,
+					 const unsigned char *src,
+					 unsigned long len)
+{
+	uint32_t s1 = adler & 0xffff;
+	uint32_t s2 = adler >> 16;
+
+	for (; len; len--) {
+		if (dst)
+			*dst++ = *src;
+		s1 += *src++;
+		s2 += s1;
+	}
+	return (s2 % XmemADLER32_BASE) << 16 | (s1 % XmemADLER32_BASE);
+}
+
+static inline uint32_t xmem_adler32_scalar(uint32_t adler, void *dst,
+					   const void *src, unsigned long len)
+{
+	if (dst) {
+		memcpy(dst, src, len);
+		src = dst;
+	}
+	return zlib_adler32(adler, src, len);
+}
+
+#ifdef XmemADLER32_X86
+
+static inline uint32_t xmem_hsum128(__m128i v)
+	__attribute__((target("ssse3")));
+static inline uint32_t xmem_hsum128(__m128i v)
+{
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(v);
+}
+
+static inline uint32_t xmem_adler32_ssse3(uint32_t adler, void *dst,
+					  const void *src, unsigned long len)
+	__attribute__((target("ssse3")));
+static inline uint32_t xmem_adler32_ssse3(uint32_t adler, void *dst,
+					  const void *src, unsigned long len)
+{
+	const __m128i w_hi = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+					   24, 23, 22, 21, 20, 19, 18, 17);
+	const __m128i w_lo = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9,
+					   8, 7, 6, 5, 4, 3, 2, 1);
+	const __m128i ones = _mm_set1_epi16(1);
+	const __m128i zero = _mm_setzero_si128();
+	const unsigned char *p = src;
+	unsigned char *d = dst;
+	uint32_t s1 = adler & 0xffff;
+	uint32_t s2 = adler >> 16;
+	__m128i vs1, vs2, vps, a, b;
+	unsigned long n;
+
+	while (len >= 32) {
+		n = len < XmemADLER32_NMAX ? len & ~31UL : XmemADLER32_NMAX;
+		len -= n;
+		s2 += s1 * n;
+		vs1 = vs2 = vps = zero;
+		for (; n; n -= 32, p += 32) {
+			a = _mm_loadu_si128((const __m128i *)p);
+			b = _mm_loadu_si128((const __m128i *)(p + 16));
+			if (d) {
+				_mm_storeu_si128((__m128i *)d, a);
+				_mm_storeu_si128((__m128i *)(d + 16), b);
+				d += 32;
+			}
+			vps = _mm_add_epi32(vps, vs1);
+			vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(a, zero));
+			vs1 = _mm_add_epi32(vs1, _mm_sad_epu8(b, zero));
+			vs2 = _mm_add_epi32(vs2,
+				_mm_madd_epi16(_mm_maddubs_epi16(a, w_hi), ones));
+			vs2 = _mm_add_epi32(vs2,
+				_mm_madd_epi16(_mm_maddubs_epi16(b, w_lo), ones));
+		}
+		vs2 = _mm_add_epi32(vs2, _mm_slli_epi32(vps, 5));
+		s1 = (s1 + xmem_hsum128(vs1)) % XmemADLER32_BASE;
+		s2 = (s2 + xmem_hsum128(vs2)) % XmemADLER32_BASE;
+	}
+	return xmem_adler32_tail(s2 << 16 | s1, d, p, len);
+}
+
+static inline uint32_t xmem_adler32_avx2(uint32_t adler, void *dst,
+					 const void *src, unsigned long len)
+	__attribute__((target("avx2")));
+static inline uint32_t xmem_adler32_avx2(uint32_t adler, void *dst,
+					 const void *src, unsigned long len)
+{
+	const __m256i w = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+					   24, 23, 22, 21, 20, 19, 18, 17,
+					   16, 15, 14, 13, 12, 11, 10, 9,
+					   8, 7, 6, 5, 4, 3, 2, 1);
+	const __m256i ones = _mm256_set1_epi16(1);
+	const __m256i zero = _mm256_setzero_si256();
+	const unsigned char *p = src;
+	unsigned char *d = dst;
+	uint32_t s1 = adler & 0xffff;
+	uint32_t s2 = adler >> 16;
+	__m256i vs1, vs2, vps, a;
+	unsigned long n;
+
+	while (len >= 32) {
+		n = len < XmemADLER32_NMAX ? len & ~31UL : XmemADLER32_NMAX;
+		len -= n;
+		s2 += s1 * n;
+		vs1 = vs2 = vps = zero;
+		for (; n; n -= 32, p += 32) {
+			a = _mm256_loadu_si256((const __m256i *)p);
+			if (d) {
+				_mm256_storeu_si256((__m256i *)d, a);
+				d += 32;
+			}
+			vps = _mm256_add_epi32(vps, vs1);
+			vs1 = _mm256_add_epi32(vs1, _mm256_sad_epu8(a, zero));
+			vs2 = _mm256_add_epi32(vs2,
+				_mm256_madd_epi16(_mm256_maddubs_epi16(a, w), ones));
+		}
+		vs2 = _mm256_add_epi32(vs2, _mm256_slli_epi32(vps, 5));
+		s1 = (s1 + xmem_hsum128(_mm_add_epi32(
+			_mm256_castsi256_si128(vs1),
+			_mm256_extracti128_si256(vs1, 1)))) % XmemADLER32_BASE;
+		s2 = (s2 + xmem_hsum128(_mm_add_epi32(
+			_mm256_castsi256_si128(vs2),
+			_mm256_extracti128_si256(vs2, 1)))) % XmemADLER32_BASE;
+	}
+	return xmem_adler32_tail(s2 << 16 | s1, d, p, len);
+}
+
+#endif /* XmemADLER32_X86 */
+
+/* the fastest version this CPU can run */
+static inline XmemAdler32Fn xmem_adler32_best(void)
+{
+#ifdef XmemADLER32_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return xmem_adler32_avx2;
+	if (__builtin_cpu_supports("ssse3"))
+		return xmem_adler32_ssse3;
+#endif
+	return xmem_adler32_scalar;
+}
+
+/**
+ * XmemAdler32Copy - update an Adler-32 checksum, copying the data
+ *
+ * @param adler: checksum so far, XmemADLER32_INIT to start
+ * @param dst: where to copy the data to, or NULL to only checksum them
+ * @param src: the data; no alignment required
+ * @param len: number of bytes
+ *
+ * @return the updated checksum
+ *
+ * The buffers must not overlap.
+ */
+static inline uint32_t XmemAdler32Copy(uint32_t adler, void *dst,
+				       const void *src, unsigned long len)
+{
+	static XmemAdler32Fn fn;
+
+	/* a race here only picks the same function twice */
+	if (fn == NULL)
+		fn = xmem_adler32_best();
+	return fn(adler, dst, src, len);
+}
+
+/**
+ * XmemAdler32 - Adler-32 checksum of a buffer
+ *
+ * @param buf: the data
+ * @param len: number of bytes
+ */
+static inline uint32_t XmemAdler32(const void *buf, unsigned long len)
+{
+	return XmemAdler32Copy(XmemADLER32_INIT, NULL, buf, len);
+}
+
+#endif /* _XMEM_ADLER32_H_ */
@@ -0,0 +1,201 @@
+/**
+ * @file xmemCopy.h
+ *
+ * @brief Programmed I/O copies to/from the VMIC's SDRAM
+ *
+ * The SDRAM holds little-endian 32-bit words: a buffer copied in is seen
+ * by the other nodes as the host's words, whatever the host's endianness.
+ * These routines keep that layout, but:
+ *
+ * - the bulk of the copy is done with 64-bit accesses where the platform
+ *   has them (little-endian only: a 64-bit access would swap the words
+ *   on big-endian hosts), otherwise with unrolled 32-bit accesses;
+ * - the SDRAM address doesn't need to be aligned: the head up to the
+ *   first word boundary, and the tail after the last whole word, are
+ *   copied one byte at a time, at the address the byte would have inside
+ *   its (little-endian) word.
+ *
+ * The driver uses them for transfers below the DMA threshold. They can
+ * also be used from user space on a mapping of the SDRAM; in that case,
+ * the default accessors below are plain volatile loads and stores.
+ *
+ * Copyright (c) 2010 CERN
+ * @author Emilio G. Cota <emilio.garcia.cota@cern.ch>
+ *
+ * @section license_sec License
+ * Released under the GPL v2. (and only v2, not any later version)
+ */
+#ifndef _XMEM_COPY_H_
+#define _XMEM_COPY_H_
+
+#if (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__) || \
+	(!defined(__BYTE_ORDER__) && defined(__powerpc__))
+#define XmemCOPY_BIG_ENDIAN
+#endif
+
+/*
+ * Accessors. The driver defines its own (CDCM's) before including this
+ * file; XmemIoRd64/XmemIoWr64 are optional.
+ */
+#ifndef XmemIoRd32
+
+#include <stdint.h>
+
+#ifdef XmemCOPY_BIG_ENDIAN
+#define XmemCOPY_LE32(x) \
+	((((x) & 0xff) << 24) | (((x) & 0xff00) << 8) | \
+	 (((x) >> 8) & 0xff00) | (((x) >> 24) & 0xff))
+#else
+#define XmemCOPY_LE32(x) (x)
+#endif
+
+#define XmemIoRd8(a)      (*(volatile uint8_t *)(a))
+#define XmemIoWr8(v, a)   (*(volatile uint8_t *)(a) = (v))
+#define XmemIoRd32(a)     XmemCOPY_LE32(*(volatile uint32_t *)(a))
+#define XmemIoWr32(v, a)  (*(volatile uint32_t *)(a) = XmemCOPY_LE32(v))
+
+#ifdef __LP64__
+#define XmemIoRd64(a)     (*(volatile uint64_t *)(a))
+#define XmemIoWr64(v, a)  (*(volatile uint64_t *)(a) = (v))
+#endif
+
+#endif /* !XmemIoRd32 */
+
+#if defined(XmemIoRd64) && !defined(XmemCOPY_BIG_ENDIAN)
+#define XmemCOPY_64
+#endif
+
+/* address of a byte inside its little-endian word */
+#ifdef XmemCOPY_BIG_ENDIAN
+#define XmemCOPY_BYTE(a) ((void *)((unsigned long)(a) ^ 3))
+#else
+#define XmemCOPY_BYTE(a) ((void *)(a))
+#endif
+
+/**
+ * XmemCopyToXmem - copy a buffer to the SDRAM
+ *
+ * @param xmem: address in the SDRAM
+ * @param buf: buffer to copy from; no alignment required
+ * @param size: number of bytes
+ */
+static inline void XmemCopyToXmem(void *xmem, const void *buf,
+				  unsigned long size)
+{
+	unsigned char *io = xmem;
+	const unsigned char *p = buf;
+	uint32_t w;
+#ifdef XmemCOPY_64
+	uint64_t q;
+#endif
+
+	for (; size && ((unsigned long)io & 3); size--, io++, p++)
+		XmemIoWr8(*p, XmemCOPY_BYTE(io));
+
+#ifdef XmemCOPY_64
+	if (size >= 4 && ((unsigned long)io & 4)) {
+		__builtin_memcpy(&w, p, 4);
+		XmemIoWr32(w, io);
+		io += 4;
+		p += 4;
+		size -= 4;
+	}
+	for (; size >= 32; size -= 32, io += 32, p += 32) {
+		__builtin_memcpy(&q, p, 8);
+		XmemIoWr64(q, io);
+		__builtin_memcpy(&q, p + 8, 8);
+		XmemIoWr64(q, io + 8);
+		__builtin_memcpy(&q, p + 16, 8);
+		XmemIoWr64(q, io + 16);
+		__builtin_memcpy(&q, p + 24, 8);
+		XmemIoWr64(q, io + 24);
+	}
+	for (; size >= 8; size -= 8, io += 8, p += 8) {
+		__builtin_memcpy(&q, p, 8);
+		XmemIoWr64(q, io);
+	}
+#else
+	for (; size >= 16; size -= 16, io += 16, p += 16) {
+		__builtin_memcpy(&w, p, 4);
+		XmemIoWr32(w, io);
+		__builtin_memcpy(&w, p + 4, 4);
+		XmemIoWr32(w, io + 4);
+		__builtin_memcpy(&w, p + 8, 4);
+		XmemIoWr32(w, io + 8);
+		__builtin_memcpy(&w, p + 12, 4);
+		XmemIoWr32(w, io + 12);
+	}
+#endif
+	for (; size >= 4; size -= 4, io += 4, p += 4) {
+		__builtin_memcpy(&w, p, 4);
+		XmemIoWr32(w, io);
+	}
+
+	for (; size; size--, io++, p++)
+		XmemIoWr8(*p, XmemCOPY_BYTE(io));
+}
+
+/**
+ * XmemCopyFromXmem - copy from the SDRAM to a buffer
+ *
+ * @param xmem: address in the SDRAM
+ * @param buf: buffer to copy to; no alignment required
+ * @param size: number of bytes
+ */
+static inline void XmemCopyFromXmem(const void *xmem, void *buf,
+				    unsigned long size)
+{
+	const unsigned char *io = xmem;
+	unsigned char *p = buf;
+	uint32_t w;
+#ifdef XmemCOPY_64
+	uint64_t q;
+#endif
+
+	for (; size && ((unsigned long)io & 3); size--, io++, p++)
+		*p = XmemIoRd8(XmemCOPY_BYTE(io));
+
+#ifdef XmemCOPY_64
+	if (size >= 4 && ((unsigned long)io & 4)) {
+		w = XmemIoRd32(io);
+		__builtin_memcpy(p, &w, 4);
+		io += 4;
+		p += 4;
+		size -= 4;
+	}
+	for (; size >= 32; size -= 32, io += 32, p += 32) {
+		q = XmemIoRd64(io);
+		__builtin_memcpy(p, &q, 8);
+		q = XmemIoRd64(io + 8);
+		__builtin_memcpy(p + 8, &q, 8);
+		q = XmemIoRd64(io + 16);
+		__builtin_memcpy(p + 16, &q, 8);
+		q = XmemIoRd64(io + 24);
+		__builtin_memcpy(p + 24, &q, 8);
+	}
+	for (; size >= 8; size -= 8, io += 8, p += 8) {
+		q = XmemIoRd64(io);
+		__builtin_memcpy(p, &q, 8);
+	}
+#else
+	for (; size >= 16; size -= 16, io += 16, p += 16) {
+		w = XmemIoRd32(io);
+		__builtin_memcpy(p, &w, 4);
+		w = XmemIoRd32(io + 4);
+		__builtin_memcpy(p + 4, &w, 4);
+		w = XmemIoRd32(io + 8);
+		__builtin_memcpy(p + 8, &w, 4);
+		w = XmemIoRd32(io + 12);
+		__builtin_memcpy(p + 12, &w, 4);
+	}
+#endif
+	for (; size >= 4; size -= 4, io += 4, p += 4) {
+		w = XmemIoRd32(io);
+		__builtin_memcpy(p, &w, 4);
+	}
+
+	for (; size; size--, io++, p++)
+		*p = XmemIoRd8(XmemCOPY_BYTE(io));
+}
+
+#endif /* _XMEM_COPY_H_ */
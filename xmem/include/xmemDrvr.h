@@ -226,6 +226,48 @@ typedef struct {
 } XmemDrvrClientConnections;
 
 
+/*! Segment flush statistics
+ *
+ * Used by XmemDrvrGET_FLUSH_STATS. Times are in microseconds. The waits
+ * only grow when reading and writing the segments don't overlap.
+ */
+typedef struct {
+	unsigned long Flushes;   //!< Successful flushes since install
+	unsigned long Bytes;     //!< Bytes flushed by the last flush
+	unsigned long Time;      //!< Duration of the last flush
+	unsigned long MaxTime;   //!< Longest flush
+	unsigned long ReadWait;  //!< Last flush: time waiting for DMA reads
+	unsigned long WriteWait; //!< Last flush: time waiting for DMA writes
+} XmemDrvrFlushStats;
+
+
+/*! Segment update generations
+ *
+ * One page per module, which the clients map read-only. Gen[i] is bumped
+ * by the driver whenever it sees an update of the segment with Id bit i,
+ * from any node (this one included).
+ */
+typedef struct {
+	unsigned int Gen[XmemDrvrSEGMENTS];
+} XmemDrvrGenerations;
+
+
+/*! Mappings of a module, for mmap()
+ *
+ * Used by XmemDrvrGET_MMAP_INFO. The offsets are those to pass to mmap()
+ * on the driver's node. The SDRAM can only be mapped read-only (uncached):
+ * writes go through the driver, which checks the segments' permissions.
+ * Fixed-width, so that 32-bit clients of a 64-bit kernel see the same.
+ */
+typedef struct {
+	uint32_t Module;    //!< The client's module, 1..n
+	uint32_t Spare;
+	uint64_t Size;      //!< Bytes of SDRAM that can be mapped
+	uint64_t RdOffset;  //!< SDRAM, read-only
+	uint64_t GenOffset; //!< XmemDrvrGenerations, read-only
+} XmemDrvrMmapInfo;
+
+
 /*! @name Send interrupt data to other nodes
  */
 //@{
@@ -595,7 +637,19 @@ typedef struct {
 #define XmemDrvrGET_DMA_THRESHOLD       XMEM_IOR(49, long)
 //!< Get Drivers DMA threshold
 
-#define XmemDrvrLAST_IOCTL 50
+#define XmemDrvrSET_NONBLOCK            XMEM_IOW(50, long)
+//!< 1==read() returns EAGAIN on an empty queue, 0==read() waits (default)
+
+#define XmemDrvrGET_NONBLOCK            XMEM_IOR(51, long)
+//!< Get the read() blocking mode
+
+#define XmemDrvrGET_FLUSH_STATS         XMEM_IOR(52, XmemDrvrFlushStats)
+//!< Get the statistics of the module's segment flushes
+
+#define XmemDrvrGET_MMAP_INFO           XMEM_IOR(53, XmemDrvrMmapInfo)
+//!< Get the mmap() offsets of the module's SDRAM and update generations
+
+#define XmemDrvrLAST_IOCTL 54
 //@}
 
 /*! Info Table
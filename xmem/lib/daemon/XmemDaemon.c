@@ -30,6 +30,9 @@
 #include <libxmem.h>
 #include <XmemDaemon.h>
 
+#include "XmemDaemonLog.c"
+#include "XmemDaemonSnap.c"
+
 
 extern int symp;
 
@@ -37,62 +40,16 @@ extern int symp;
 static XmemEventMask log_mask = XmemEventMaskMASK; /* Events to be logged */
 static XdEventLogEntries *event_log = NULL;
 static XdEventLogEntries *result = NULL;
+static int log_open = 0;
+
+/* Table snapshot */
+static XdSnapTable snap_tab[XmemMAX_TABLES];
+static char snap_path[256];
 
 int  VmicDaemonWait(int timeout);
 void VmicDaemonCall();
 
 
-/**
- * TimeToStr - Convert time to a standard string
- *
- * @param tod: time to convert
- *
- * The format is:
- *
- * Thu-18/Jan/2001 08:25:14
- *
- * day-dd/mon/yyyy hh:mm:ss
- *
- * @return pointer to a static string
- */
-char *TimeToStr(time_t tod)
-{
-	static char tbuf[128];
-
-	char tmp[128];
-	char *yr, *ti, *md, *mn, *dy;
-
-	bzero((void *)tbuf, 128);
-	bzero((void *)tmp, 128);
-
-	if (tod) {
-		ctime_r(&tod, tmp);
-
-		tmp[ 3] = 0;
-		dy = &(tmp[0]);
-
-		tmp[ 7] = 0;
-		mn = &(tmp[4]);
-
-		tmp[10] = 0;
-		md = &(tmp[8]);
-		if (md[0] == ' ')
-			md[0] = '0';
-
-		tmp[19] = 0;
-		ti = &(tmp[11]);
-
-		tmp[24] = 0;
-		yr = &(tmp[20]);
-
-		sprintf (tbuf, "%s-%s/%s/%s %s", dy, md, mn, yr, ti);
-	} else
-		sprintf(tbuf, "--- Zero ---");
-
-	return tbuf;
-}
-
-
 /**
  * GetEventLogTable - Get the event log table in shared memory
  *
@@ -217,88 +174,31 @@ char *CallbackToStr(XmemCallbackStruct *cbs)
 
 
 /**
- * LogEvent - Log an event in the log file
+ * LogEvent - Log an event
  *
  * @param cbs: callback struct with the information to log
  * @param text: text to log
  *
- * This routine writes EVENT_LOG_ENTRIES events into a log file each time it
- * has collected enough events.
+ * The event is queued for the log's writer thread (see XmemDaemonLog.c),
+ * so that the callback doesn't wait for the disc. If the log couldn't be
+ * opened, the text is only printed out.
  *
  * @return 1 on success; 0 otherwise
  */
 int LogEvent(XmemCallbackStruct *cbs, char *text)
 {
-	int 	idx, cnt, logit;
-	time_t 	tod;
-	FILE 	*fp;
-	char 	*elog;
-	XdEventLogEntry *evp;
-
-	if (event_log == NULL)
-		return 0;
-
-	idx       = event_log->NextEntry;
-	evp       = &event_log->Entries[idx];
-
-	tod       = time(NULL);
-	evp->Time = tod;
-
-	logit     = 0;
-
-	if (text) {
-		strncpy(evp->Text, text, EVENT_MESSAGE_SIZE - 1);
-		fprintf(stderr, "%s XmemDaemon: %s\n", TimeToStr(tod), text);
-		logit++;
-	}
-
-	if (cbs && log_mask & cbs->Mask) {
-		evp->CbEvent = *cbs;
-		// fprintf(stderr, "XmemDaemon: %s %s\n",
-		// TimeToStr(tod),CallbackToStr(cbs));
-		logit++;
-	}
-
-	if (!logit)
+	if (cbs && !(log_mask & cbs->Mask))
+		cbs = NULL;
+	if (!cbs && !text)
 		return 1;
 
-	if (++idx >= EVENT_LOG_ENTRIES) {
-		/* event_log filled up; write to the file */
-		umask(0);
-		elog = XmemGetFile(EVENT_LOG);
-		fp = fopen(elog, "w");
-
-		if (!fp) {
-			perror("XmemDaemon");
-			fprintf(stderr,
-				"XmemDaemon: Error: Can't OPEN:%s for WRITE\n",
-				elog);
-			bzero((void *)event_log, sizeof(XdEventLogEntries));
-			return 0;
-		}
-
-		evp = &event_log->Entries[idx];
-		cnt = fwrite(event_log, sizeof(XdEventLogEntries), 1, fp);
-
-		if (cnt <= 0) {
-			perror("XmemDaemon");
-			fprintf(stderr, "XmemDaemon: Error: Can't WRITE:%s\n",
-				elog);
-			fclose(fp);
-
-			bzero((void *) event_log, sizeof(XdEventLogEntries));
-			return 0;
-		}
-
-		fclose(fp);
-		bzero((void *) event_log, sizeof(XdEventLogEntries));
-
-		return 1;
+	if (!log_open) {
+		if (text)
+			fprintf(stderr, "%s XmemDaemon: %s\n",
+				TimeToStr(time(NULL)), text);
+		return 0;
 	}
-	else
-		event_log->NextEntry = idx;
-
-	return 1;
+	return XdLogPut(cbs, text) == 0;
 }
 
 /*
@@ -426,7 +326,9 @@ void callback(XmemCallbackStruct *cbs)
 			smemad = XmemGetSharedMemory(tid);
 			if (smemad) {
 				/* read from reflective memory */
+				XdSnapLock(tid);
 				XmemRecvTable(tid, smemad, longs, 0);
+				XdSnapUnlock(tid);
 
 				sprintf(txt,
 					"Received table: %s From updating node: %s",
@@ -435,6 +337,10 @@ void callback(XmemCallbackStruct *cbs)
 				LogEvent(NULL, txt);
 			}
 			if (user & ON_DISC && nodes & me) {
+				/* written back by the snapshot's writer */
+				if (XdSnapDirty(tid) == 0)
+					break;
+
 				acnds = XmemGetAllNodeIds() & nodes;
 				/* only the highest node ID issues the write */
 				if ((~me & acnds) > me)
@@ -488,44 +394,127 @@ void callback(XmemCallbackStruct *cbs)
 
 
 /*
- * __init_coldstart() reads the tables for the node from memory.
+ * __init_snapshot() fills in snap_tab with the ON_DISC tables of the node.
+ * Returns the mask of those tables.
  */
-void __init_coldstart()
+XmemTableId __init_snapshot()
 {
-	int 		i;
-	unsigned long 	msk, longs, user;
-	XmemError 	err;
+	int 		i, elems;
+	unsigned long 	msk;
+	uint32_t	user;
 	XmemNodeId 	me, nodes;
-	XmemTableId 	tid;
-
-	char 		txt[80];
-
+	XmemTableId 	tid, snap_tids;
+	void		*smemad;
+	char		*cp;
 
 	me = XmemWhoAmI();
+	cp = XmemGetNodeName(me);
+	if (!cp)
+		return 0;
+	snprintf(snap_path, sizeof(snap_path), "%s%s",
+		 XmemGetFile(SNAPSHOT_FILE), cp);
 
 	tid = XmemGetAllTableIds();
+	snap_tids = 0;
 
 	for (i = 0; i < XmemMAX_TABLES; i++) {
 		msk = 1 << i;
 		if (! (tid & msk))
 			continue;
 
-		XmemGetTableDesc(msk, &longs, &nodes, &user);
+		if (XmemGetTableDesc(msk, &elems, &nodes, &user))
+			continue;
 		if (! (nodes & me))
 			continue;
 		if (! (user & IN_SHMEM && user & ON_DISC))
 			continue;
 
-		sprintf(txt, "Reading table:%s id:%d from disc",
-			XmemGetTableName((XmemTableId)msk), (int)msk);
+		smemad = XmemGetSharedMemory(msk);
+		if (!smemad)
+			continue;
+		snap_tab[i].Bytes = elems * sizeof(uint32_t);
+		snap_tab[i].Addr  = smemad;
+		snap_tab[i].Name  = XmemGetTableName(msk);
+		snap_tids |= msk;
+	}
+	return snap_tids;
+}
+
+
+/*
+ * __init_coldstart() reads the tables for the node from disc: from the
+ * snapshot, or else from their own files. Returns the mask of the tables
+ * read from their own files, which the snapshot is missing.
+ *
+ * The table files aren't written while the snapshot is in use, so a table
+ * with no good copy in the snapshot is read from a file that may be stale:
+ * that's logged, and printed out, as an error.
+ */
+XmemTableId __init_coldstart(XmemTableId snap_tids)
+{
+	int 		i;
+	unsigned long 	msk, bytes;
+	XmemError 	err;
+	XmemTableId 	loaded, torn, from_files;
+	struct timespec	t0, t1;
+
+	char 		txt[128];
+
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	loaded = XdSnapLoad(snap_path, snap_tab, &torn);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	bytes = 0;
+	for (i = 0; i < XmemMAX_TABLES; i++) {
+		if (loaded & (1 << i))
+			bytes += snap_tab[i].Bytes;
+	}
+	if (loaded) {
+		sprintf(txt, "Read tables:0x%x (%lu bytes) from snapshot in %ldms",
+			(int)loaded, bytes,
+			(long)((t1.tv_sec - t0.tv_sec) * 1000 +
+			       (t1.tv_nsec - t0.tv_nsec) / 1000000));
 		LogEvent(NULL, txt);
+	}
+
+	from_files = 0;
+	for (i = 0; i < XmemMAX_TABLES; i++) {
+		msk = 1 << i;
+		if (! (snap_tids & msk))
+			continue;
+		if (torn & msk && loaded & msk) {
+			sprintf(txt, "WARNING: Table:%s id:%d torn in snapshot,"
+				" read its previous copy",
+				XmemGetTableName((XmemTableId)msk), (int)msk);
+			LogEvent(NULL, txt);
+		}
+		if (loaded & msk)
+			continue;
+
+		if (torn & msk) {
+			sprintf(txt, "ERROR: Table:%s id:%d torn in snapshot,"
+				" reading its file: it may be stale",
+				XmemGetTableName((XmemTableId)msk), (int)msk);
+			LogEvent(NULL, txt);
+			if (log_open)
+				fprintf(stderr, "XmemDaemon: %s\n", txt);
+		}
+		else {
+			sprintf(txt, "Reading table:%s id:%d from disc",
+				XmemGetTableName((XmemTableId)msk), (int)msk);
+			LogEvent(NULL, txt);
+		}
 
 		err = XmemReadTableFile(msk);
-		if (err == XmemErrorSUCCESS)
+		if (err == XmemErrorSUCCESS) {
+			from_files |= msk;
 			continue;
+		}
 
 		LogEvent(NULL, "WARNING: Failed to read table from disc");
 	}
+	return from_files;
 }
 
 
@@ -545,9 +534,14 @@ int main(int argc, char *argv[])
 	XmemEventMask emsk;
 	XmemError err;
 	XmemMessage mes;
+	XmemTableId snap_tids, from_files = 0;
 	int warmst;
 
 	event_log = GetEventLogTable();
+	if (XdLogOpen(XmemGetFile(EVENT_LOG), event_log) == 0) {
+		log_open = 1;
+		atexit(XdLogClose);
+	}
 
 	err = XmemInitialize(XmemDeviceANY);
 	if (err != XmemErrorSUCCESS) {
@@ -570,7 +564,21 @@ int main(int argc, char *argv[])
 		goto fatal;
 	}
 
+	snap_tids = __init_snapshot();
+
 	warmst = XmemCheckForWarmStart();
+	if (!warmst) {
+		/* before the snapshot is opened, in case it's laid out again */
+		LogEvent(NULL, "Cold Start: Initialize Tables: Begin ...");
+		from_files = __init_coldstart(snap_tids);
+	}
+	if (snap_tids && XdSnapOpen(snap_path, snap_tab) == 0) {
+		atexit(XdSnapClose);
+		XdSnapDirty(from_files);
+	}
+	else if (snap_tids)
+		LogEvent(NULL, "WARNING: Can't open snapshot, using table files");
+
 	if (warmst) {
 		LogEvent(NULL,"Warm Start: Begin ...");
 		/* Tell the world I exist */
@@ -580,9 +588,6 @@ int main(int argc, char *argv[])
 		/* ...it might be interesting to do this in a loop */
 	}
 	else {
-		LogEvent(NULL, "Cold Start: Initialize Tables: Begin ...");
-		/* For cold starts, read tables from disc */
-		__init_coldstart();
 		/*Tell the world to send me their tables and that I exist */
 		mes.MessageType = XmemMessageTypeINITIALIZE_ME;
 		mes.Data        = XmemInitMessageRESET;
@@ -29,6 +29,108 @@ typedef struct {
 } XdEventLogEntries;
 //@}
 
+/*! @name Binary event log
+ *
+ * LogEvent() only queues the event in a ring; a writer thread appends it to
+ * EVENT_LOG, a file of EVENT_LOG_FILE_SIZE bytes mapped in memory. When the
+ * file is full it is renamed EVENT_LOG.1 (the older ones shifting up to
+ * EVENT_LOG.<EVENT_LOG_FILES - 1>) and a new one is started. The events
+ * dropped while the ring was full are counted, and the count logged by the
+ * writer as a text record.
+ */
+//@{
+#define EVENT_LOG_MAGIC     0x58444c47	/* "XDLG" */
+#define EVENT_LOG_VERSION   1
+#define EVENT_LOG_RING      4096	/* queued events; a power of 2 */
+#define EVENT_LOG_FILE_SIZE (1024 * 1024)
+#define EVENT_LOG_FILES     4
+
+typedef struct {
+	unsigned int	Sequence;	/* of the record in the daemon's run */
+	unsigned int	Nsec;		/* nanoseconds of the Entry.Time second */
+	XdEventLogEntry Entry;
+} XdEventLogRecord;
+
+typedef struct {
+	unsigned int	Magic;
+	unsigned int	Version;
+	unsigned int	RecordSize;	/* sizeof(XdEventLogRecord) */
+	unsigned int	Capacity;	/* records that fit in the file */
+	unsigned int	Records;	/* records written so far */
+	unsigned int	Spare[3];
+} XdEventLogHeader;
+
+int  XdLogOpen(char *path, XdEventLogEntries *table);
+void XdLogClose(void);
+int  XdLogPut(XmemCallbackStruct *cbs, char *text);
+unsigned int XdLogDropped(void);
+char *TimeToStr(time_t tod);
+//@}
+
+/*! @name Table snapshot
+ *
+ * The ON_DISC tables of a node are kept in a single file, SNAPSHOT_FILE
+ * followed by the node's name, mapped in memory: a header with one entry
+ * per table (indexed by the table's bit), then the tables, each one on a
+ * SNAPSHOT_ALIGN boundary. A table has two slots; each write goes to the
+ * slot not holding its newest copy, and is on disc before the slot's
+ * Sequence makes it the newest. Each slot holds the Adler-32 checksum of
+ * its copy, so that a copy torn by a crash is found when loading it, and
+ * the previous copy is used instead.
+ *
+ * Updated tables are marked dirty, and a writer thread copies them into the
+ * file no later than SNAPSHOT_DELAY_MS after the first update, coalescing
+ * the updates in between. It copies a table holding its XdSnapLock, which
+ * whoever writes the table's shared memory must hold too. On a cold start
+ * the tables are read back by SNAPSHOT_LOADERS threads in parallel, with
+ * O_DIRECT where possible.
+ */
+//@{
+#define SNAPSHOT_FILE      "Xmem.snapshot."
+#define SNAPSHOT_MAGIC     0x58445350	/* "XDSP" */
+#define SNAPSHOT_VERSION   2
+#define SNAPSHOT_ALIGN     4096
+#define SNAPSHOT_DELAY_MS  100
+#define SNAPSHOT_LOADERS   4
+#define SNAPSHOT_SLOTS     2
+
+typedef struct {
+	unsigned int	Offset;		/* from the start of the file */
+	unsigned int	Checksum;	/* Adler-32 of the copy */
+	unsigned int	Sequence;	/* 0: no copy; the newest is the highest */
+	unsigned int	Time;		/* when it was written */
+} XdSnapSlot;
+
+typedef struct {
+	unsigned int	Bytes;		/* 0: not in the snapshot */
+	XdSnapSlot	Slots[SNAPSHOT_SLOTS];
+	char		Name[XmemNAME_SIZE];
+} XdSnapEntry;
+
+typedef struct {
+	unsigned int	Magic;
+	unsigned int	Version;
+	unsigned int	Size;		/* of the file */
+	unsigned int	Spare[5];
+	XdSnapEntry	Entries[XmemMAX_TABLES];
+} XdSnapHeader;
+
+/* a table of the snapshot, by bit: where it lives in this process */
+typedef struct {
+	unsigned int	Bytes;		/* 0: not in the snapshot */
+	void		*Addr;
+	char		*Name;
+} XdSnapTable;
+
+XmemTableId XdSnapLoad(char *path, XdSnapTable *tabs, XmemTableId *torn);
+int  XdSnapOpen(char *path, XdSnapTable *tabs);
+int  XdSnapDirty(XmemTableId tables);
+void XdSnapLock(XmemTableId table);
+void XdSnapUnlock(XmemTableId table);
+void XdSnapSync(void);
+void XdSnapClose(void);
+//@}
+
 /*! @name User bit definitions for the daemon
  */
 //@{
@@ -0,0 +1,456 @@
+/**
+ * @file XmemDaemonLog.c
+ *
+ * @brief Asynchronous event log of the Xmem Daemon
+ *
+ * LogEvent() is called from the xmem callback, which must not wait for the
+ * disc. The events are thus queued in a ring, which the callback (or any
+ * other thread) fills without taking a lock: a producer claims a slot by
+ * moving the ring's head forward, fills it, and then publishes it by
+ * setting the slot's sequence. When the ring is full the event is dropped
+ * and counted.
+ *
+ * A writer thread takes the events out of the ring, in order, and:
+ *
+ * - appends them to the binary log file, which is mapped in memory, so
+ *   that writing a record is a copy. The file is rotated by size, and an
+ *   existing log is appended to rather than truncated;
+ * - keeps the last EVENT_LOG_ENTRIES of them in the event log table in
+ *   shared memory, for the tools that look at it;
+ * - prints the text of the events to stderr.
+ *
+ * The writer sleeps on a pipe when the ring is empty; producers only write
+ * to the pipe when it does.
+ *
+ * This file is included by the programs that use it, after libxmem.h and
+ * XmemDaemon.h.
+ *
+ * @author Emilio G. Cota
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define LOG_WAKEUP_MS	1000	/* writer's timeout when the ring is empty */
+
+struct log_slot {
+	volatile unsigned int seq;	/* position + 1 when full */
+	XdEventLogRecord rec;
+};
+
+static struct log_slot ring[EVENT_LOG_RING];
+static volatile unsigned int ring_head;	/* next position to be claimed */
+static unsigned int ring_tail;		/* next position to be written */
+static volatile unsigned int dropped;	/* events lost, ring full */
+static volatile int writer_sleeping;
+static volatile int writer_stop;
+static int wakeup[2] = { -1, -1 };
+static pthread_t writer;
+static int writer_running;
+
+/* writer's state */
+static char log_path[256];
+static XdEventLogHeader *log_file;	/* the mapping of the log file */
+static XdEventLogRecord *log_records;
+static XdEventLogEntries *log_table;	/* in shared memory, or NULL */
+static unsigned int log_sequence;
+static unsigned int log_dropped;	/* drops already logged */
+
+/**
+ * TimeToStr - Convert time to a standard string
+ *
+ * @param tod: time to convert
+ *
+ * The format is:
+ *
+ * Thu-18/Jan/2001 08:25:14
+ *
+ * day-dd/mon/yyyy hh:mm:ss
+ *
+ * @return pointer to a static string
+ */
+char *TimeToStr(time_t tod)
+{
+	static char tbuf[128];
+
+	char tmp[128];
+	char *yr, *ti, *md, *mn, *dy;
+
+	bzero((void *)tbuf, 128);
+	bzero((void *)tmp, 128);
+
+	if (tod) {
+		ctime_r(&tod, tmp);
+
+		tmp[ 3] = 0;
+		dy = &(tmp[0]);
+
+		tmp[ 7] = 0;
+		mn = &(tmp[4]);
+
+		tmp[10] = 0;
+		md = &(tmp[8]);
+		if (md[0] == ' ')
+			md[0] = '0';
+
+		tmp[19] = 0;
+		ti = &(tmp[11]);
+
+		tmp[24] = 0;
+		yr = &(tmp[20]);
+
+		sprintf (tbuf, "%s-%s/%s/%s %s", dy, md, mn, yr, ti);
+	} else
+		sprintf(tbuf, "--- Zero ---");
+
+	return tbuf;
+}
+
+/**
+ * XdLogPut - Queue an event for the writer
+ *
+ * @param cbs: callback struct to log, or NULL
+ * @param text: text to log, or NULL
+ *
+ * Safe to call from any thread, and never blocks.
+ *
+ * @return 0 on success; -1 if the ring is full and the event was dropped
+ */
+int XdLogPut(XmemCallbackStruct *cbs, char *text)
+{
+	struct log_slot *slot;
+	struct timespec ts;
+	unsigned int pos;
+	int dif;
+
+	pos = ring_head;
+	for (;;) {
+		slot = &ring[pos & (EVENT_LOG_RING - 1)];
+		dif = (int)(slot->seq - pos);
+		if (dif == 0 &&
+			__sync_bool_compare_and_swap(&ring_head, pos, pos + 1))
+			break;
+		if (dif < 0) {
+			__sync_fetch_and_add(&dropped, 1);
+			return -1;
+		}
+		pos = ring_head;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	slot->rec.Entry.Time = ts.tv_sec;
+	slot->rec.Nsec = ts.tv_nsec;
+	if (cbs)
+		slot->rec.Entry.CbEvent = *cbs;
+	else
+		bzero((void *)&slot->rec.Entry.CbEvent,
+		      sizeof(XmemCallbackStruct));
+	if (text) {
+		strncpy(slot->rec.Entry.Text, text, EVENT_MESSAGE_SIZE - 1);
+		slot->rec.Entry.Text[EVENT_MESSAGE_SIZE - 1] = 0;
+	} else
+		slot->rec.Entry.Text[0] = 0;
+
+	__sync_synchronize();
+	slot->seq = pos + 1;
+	__sync_synchronize();	/* pairs with the writer going to sleep */
+
+	if (writer_sleeping && write(wakeup[1], "", 1) < 0)
+		; /* the pipe is full: the writer is being woken up anyway */
+	return 0;
+}
+
+/**
+ * XdLogDropped - Number of events dropped because the ring was full
+ *
+ * @return the count since the daemon started
+ */
+unsigned int XdLogDropped(void)
+{
+	return dropped;
+}
+
+/* take the next event out of the ring; returns 0 if there's none */
+static int XdLogGet(XdEventLogRecord *rec)
+{
+	struct log_slot *slot;
+
+	slot = &ring[ring_tail & (EVENT_LOG_RING - 1)];
+	if (slot->seq != ring_tail + 1)
+		return 0;
+	__sync_synchronize();
+	*rec = slot->rec;
+	__sync_synchronize();
+	slot->seq = ring_tail + EVENT_LOG_RING;
+	ring_tail++;
+	return 1;
+}
+
+static void XdLogUnmap(void)
+{
+	if (log_file == NULL)
+		return;
+	msync((void *)log_file, EVENT_LOG_FILE_SIZE, MS_ASYNC);
+	munmap((void *)log_file, EVENT_LOG_FILE_SIZE);
+	log_file = NULL;
+	log_records = NULL;
+}
+
+/* shift EVENT_LOG to EVENT_LOG.1, EVENT_LOG.1 to EVENT_LOG.2, ... */
+static void XdLogRotate(void)
+{
+	char from[sizeof(log_path) + 8], to[sizeof(log_path) + 8];
+	int i;
+
+	for (i = EVENT_LOG_FILES - 1; i > 0; i--) {
+		if (i > 1)
+			sprintf(from, "%s.%d", log_path, i - 1);
+		else
+			strcpy(from, log_path);
+		sprintf(to, "%s.%d", log_path, i);
+		rename(from, to);
+	}
+}
+
+/*
+ * Map the log file, appending to it if it's a log with room left; otherwise
+ * it's rotated and a new one created.
+ */
+static int XdLogMap(void)
+{
+	XdEventLogHeader *hdr;
+	struct stat st;
+	void *p;
+	int fd;
+
+	umask(0);
+	fd = open(log_path, O_RDWR | O_CREAT, 0666);
+	if (fd < 0)
+		goto errsys;
+	if (fstat(fd, &st) < 0)
+		goto errfd;
+
+	if (st.st_size == EVENT_LOG_FILE_SIZE) {
+		p = mmap(NULL, EVENT_LOG_FILE_SIZE, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED)
+			goto errfd;
+		hdr = p;
+		if (hdr->Magic == EVENT_LOG_MAGIC &&
+			hdr->Version == EVENT_LOG_VERSION &&
+			hdr->RecordSize == sizeof(XdEventLogRecord) &&
+			hdr->Records < hdr->Capacity) {
+			close(fd);
+			goto mapped;
+		}
+		munmap(p, EVENT_LOG_FILE_SIZE);
+	}
+	if (st.st_size) {
+		/* full, or not a log of this version (e.g. an old daemon's) */
+		close(fd);
+		XdLogRotate();
+		fd = open(log_path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+		if (fd < 0)
+			goto errsys;
+	}
+
+	if (ftruncate(fd, EVENT_LOG_FILE_SIZE) < 0)
+		goto errfd;
+	p = mmap(NULL, EVENT_LOG_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+		 fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		goto errsys;
+	hdr = p;
+	hdr->Version = EVENT_LOG_VERSION;
+	hdr->RecordSize = sizeof(XdEventLogRecord);
+	hdr->Capacity = (EVENT_LOG_FILE_SIZE - sizeof(XdEventLogHeader)) /
+		sizeof(XdEventLogRecord);
+	hdr->Records = 0;
+	__sync_synchronize();
+	hdr->Magic = EVENT_LOG_MAGIC;
+
+mapped:
+	log_file = hdr;
+	log_records = (XdEventLogRecord *)(hdr + 1);
+	return 0;
+
+errfd:
+	close(fd);
+errsys:
+	fprintf(stderr, "XmemDaemon: Error: Can't map log:%s: %s\n", log_path,
+		strerror(errno));
+	return -1;
+}
+
+static void XdLogWrite(XdEventLogRecord *rec)
+{
+	static time_t tod;
+	static char tstr[128];
+	XdEventLogEntry *evp;
+	int idx;
+
+	rec->Sequence = log_sequence++;
+
+	if (log_file && log_file->Records >= log_file->Capacity)
+		XdLogUnmap(); /* XdLogMap() rotates it */
+	if (log_file == NULL)
+		XdLogMap();
+	if (log_file) {
+		log_records[log_file->Records] = *rec;
+		__sync_synchronize();
+		log_file->Records++;
+	}
+
+	if (log_table) {
+		idx = log_table->NextEntry;
+		if (idx < 0 || idx >= EVENT_LOG_ENTRIES)
+			idx = 0;
+		evp = &log_table->Entries[idx];
+		*evp = rec->Entry;
+		log_table->NextEntry = (idx + 1) % EVENT_LOG_ENTRIES;
+	}
+
+	if (rec->Entry.Text[0]) {
+		/* ctime_r() is slow: format a second once */
+		if (rec->Entry.Time != tod) {
+			tod = rec->Entry.Time;
+			strcpy(tstr, TimeToStr(tod));
+		}
+		fprintf(stderr, "%s XmemDaemon: %s\n", tstr, rec->Entry.Text);
+	}
+}
+
+/* log the drops since the last time, if any */
+static void XdLogDrops(void)
+{
+	XdEventLogRecord rec;
+	struct timespec ts;
+	unsigned int lost;
+
+	lost = dropped;
+	if (lost == log_dropped)
+		return;
+
+	bzero((void *)&rec, sizeof(rec));
+	clock_gettime(CLOCK_REALTIME, &ts);
+	rec.Entry.Time = ts.tv_sec;
+	rec.Nsec = ts.tv_nsec;
+	snprintf(rec.Entry.Text, EVENT_MESSAGE_SIZE,
+		 "WARNING: %u events dropped: log ring full", lost - log_dropped);
+	log_dropped = lost;
+	XdLogWrite(&rec);
+}
+
+static void *XdLogWriter(void *arg)
+{
+	XdEventLogRecord rec;
+	struct pollfd pfd;
+	char buf[64];
+	int n;
+
+	pfd.fd = wakeup[0];
+	pfd.events = POLLIN;
+
+	for (;;) {
+		for (n = 0; XdLogGet(&rec); n++)
+			XdLogWrite(&rec);
+		XdLogDrops();
+		if (n)
+			continue;
+		if (writer_stop)
+			break;
+
+		writer_sleeping = 1;
+		__sync_synchronize();
+		if (ring[ring_tail & (EVENT_LOG_RING - 1)].seq ==
+			ring_tail + 1) {
+			writer_sleeping = 0;
+			continue;
+		}
+		poll(&pfd, 1, LOG_WAKEUP_MS);
+		writer_sleeping = 0;
+		while (read(wakeup[0], buf, sizeof(buf)) == sizeof(buf))
+			;
+		if (log_file)
+			msync((void *)log_file, EVENT_LOG_FILE_SIZE, MS_ASYNC);
+	}
+	XdLogUnmap();
+	return NULL;
+}
+
+/**
+ * XdLogOpen - Open the event log and start its writer thread
+ *
+ * @param path: path of the log file
+ * @param table: event log table in shared memory, or NULL
+ *
+ * @return 0 on success; -1 otherwise
+ */
+int XdLogOpen(char *path, XdEventLogEntries *table)
+{
+	int i;
+
+	if (writer_running)
+		return 0;
+
+	strncpy(log_path, path, sizeof(log_path) - 1);
+	log_table = table;
+	for (i = 0; i < EVENT_LOG_RING; i++)
+		ring[i].seq = i;
+	ring_head = ring_tail = 0;
+
+	if (pipe(wakeup) < 0)
+		goto errsys;
+	fcntl(wakeup[0], F_SETFL, O_NONBLOCK);
+	fcntl(wakeup[1], F_SETFL, O_NONBLOCK);
+
+	/* the file is mapped here so that the caller knows if it's there */
+	if (XdLogMap() < 0)
+		goto errpipe;
+
+	writer_stop = 0;
+	errno = pthread_create(&writer, NULL, XdLogWriter, NULL);
+	if (errno)
+		goto errmap;
+	writer_running = 1;
+	return 0;
+
+errmap:
+	XdLogUnmap();
+errpipe:
+	close(wakeup[0]);
+	close(wakeup[1]);
+errsys:
+	fprintf(stderr, "XmemDaemon: Error: Can't start the log: %s\n",
+		strerror(errno));
+	return -1;
+}
+
+/**
+ * XdLogClose - Write out the queued events and stop the writer thread
+ *
+ * Suitable for atexit().
+ */
+void XdLogClose(void)
+{
+	if (!writer_running)
+		return;
+	writer_stop = 1;
+	__sync_synchronize();
+	if (write(wakeup[1], "", 1) < 0)
+		;
+	pthread_join(writer, NULL);
+	writer_running = 0;
+	close(wakeup[0]);
+	close(wakeup[1]);
+}
@@ -0,0 +1,207 @@
+/**
+ * @file XmemDaemonLogBench.c
+ *
+ * @brief Latency of the daemon's callback under event storms
+ *
+ * Feeds storms of synthetic table updates to a callback that does what the
+ * daemon's does for them (format the text, log it), and times each call
+ * with:
+ *
+ * - no logging at all;
+ * - the old synchronous log: every EVENT_LOG_ENTRIES events, the whole
+ *   table is written out with fopen/fwrite/fclose;
+ * - the asynchronous log (XmemDaemonLog.c).
+ *
+ * The logs are written to a temporary directory, which is removed on exit.
+ * stderr is redirected to /dev/null during the runs, since both logs print
+ * out the texts.
+ *
+ * @author Emilio G. Cota
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <libxmem.h>
+#include <XmemDaemon.h>
+
+#include "XmemDaemonLog.c"
+
+static int storms = 20;
+static int events = 2000;	/* per storm */
+static int pause_ms = 50;	/* between storms */
+
+static char sync_path[256];
+static XdEventLogEntries sync_log;
+static int (*log_event)(XmemCallbackStruct *cbs, char *text);
+static int64_t *lat;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int no_log(XmemCallbackStruct *cbs, char *text)
+{
+	return 1;
+}
+
+/* LogEvent() as it was */
+static int sync_log_event(XmemCallbackStruct *cbs, char *text)
+{
+	XdEventLogEntry *evp;
+	time_t tod;
+	FILE *fp;
+	int idx;
+
+	idx = sync_log.NextEntry;
+	evp = &sync_log.Entries[idx];
+	tod = time(NULL);
+	evp->Time = tod;
+	strncpy(evp->Text, text, EVENT_MESSAGE_SIZE - 1);
+	fprintf(stderr, "%s XmemDaemon: %s\n", TimeToStr(tod), text);
+	evp->CbEvent = *cbs;
+
+	if (++idx >= EVENT_LOG_ENTRIES) {
+		fp = fopen(sync_path, "w");
+		if (!fp)
+			return 0;
+		fwrite(&sync_log, sizeof(XdEventLogEntries), 1, fp);
+		fclose(fp);
+		bzero((void *)&sync_log, sizeof(XdEventLogEntries));
+	} else
+		sync_log.NextEntry = idx;
+	return 1;
+}
+
+static int async_log_event(XmemCallbackStruct *cbs, char *text)
+{
+	return XdLogPut(cbs, text) == 0;
+}
+
+/* the daemon's callback for a table update, minus the table copy */
+static void callback(XmemCallbackStruct *cbs)
+{
+	char txt[80];
+
+	sprintf(txt, "Received table: T%lu From updating node: N%lu",
+		(unsigned long)cbs->Table, (unsigned long)cbs->Node);
+	log_event(cbs, txt);
+}
+
+static int cmp(const void *a, const void *b)
+{
+	int64_t x = *(int64_t *)a, y = *(int64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void run(char *name)
+{
+	XmemCallbackStruct cbs;
+	struct timespec ts;
+	int64_t t, sum = 0;
+	int i, j, n = 0;
+
+	ts.tv_sec = pause_ms / 1000;
+	ts.tv_nsec = (pause_ms % 1000) * 1000000;
+	for (i = 0; i < storms; i++) {
+		for (j = 0; j < events; j++) {
+			cbs.Mask = XmemEventMaskTABLE_UPDATE;
+			cbs.Table = 1 << (j % XmemMAX_TABLES);
+			cbs.Node = 1 << (i % XmemMAX_NODES);
+			cbs.Data = j;
+			t = now_ns();
+			callback(&cbs);
+			lat[n] = now_ns() - t;
+			sum += lat[n++];
+		}
+		nanosleep(&ts, NULL);
+	}
+	qsort(lat, n, sizeof(*lat), cmp);
+	printf("%-6s %9.0f %9lld %9lld %9lld %9lld\n", name, (double)sum / n,
+	       (long long)lat[n / 2], (long long)lat[n * 99 / 100],
+	       (long long)lat[n * 999 / 1000], (long long)lat[n - 1]);
+}
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s [options]\n"
+		"  -s <n>   storms (default %d)\n"
+		"  -e <n>   events per storm (default %d)\n"
+		"  -p <ms>  pause between storms (default %d)\n",
+		prog, storms, events, pause_ms);
+}
+
+int main(int argc, char *argv[])
+{
+	char dir[] = "/tmp/XmemDaemonLog.XXXXXX";
+	char path[300];
+	int c, err, i;
+
+	while ((c = getopt(argc, argv, "s:e:p:h")) != -1) {
+		switch (c) {
+		case 's':
+			storms = atoi(optarg);
+			break;
+		case 'e':
+			events = atoi(optarg);
+			break;
+		case 'p':
+			pause_ms = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			exit(c != 'h');
+		}
+	}
+	if (storms < 1 || events < 1 || pause_ms < 0) {
+		usage(argv[0]);
+		exit(1);
+	}
+	lat = malloc(sizeof(*lat) * storms * events);
+	if (lat == NULL || mkdtemp(dir) == NULL) {
+		perror("XmemDaemonLogBench");
+		exit(1);
+	}
+	snprintf(sync_path, sizeof(sync_path), "%s/sync.log", dir);
+	snprintf(path, sizeof(path), "%s/async.log", dir);
+	if (XdLogOpen(path, NULL) < 0)
+		exit(1);
+
+	printf("%d storms of %d events, %d ms apart; callback latency in ns\n",
+	       storms, events, pause_ms);
+	printf("%-6s %9s %9s %9s %9s %9s\n", "log", "avg", "50%", "99%",
+	       "99.9%", "max");
+	fflush(stdout);
+	err = dup(2);
+	freopen("/dev/null", "w", stderr);
+
+	log_event = no_log;
+	run("none");
+	log_event = sync_log_event;
+	run("sync");
+	log_event = async_log_event;
+	run("async");
+	XdLogClose();
+
+	fflush(stderr);
+	dup2(err, 2);
+	printf("async: %u events dropped\n", XdLogDropped());
+
+	unlink(sync_path);
+	unlink(path);
+	for (i = 1; i < EVENT_LOG_FILES; i++) {
+		snprintf(path, sizeof(path), "%s/async.log.%d", dir, i);
+		unlink(path);
+	}
+	rmdir(dir);
+	return 0;
+}
@@ -0,0 +1,608 @@
+/**
+ * @file XmemDaemonSnap.c
+ *
+ * @brief Table snapshot of the Xmem Daemon
+ *
+ * The daemon used to keep each ON_DISC table in a file of its own, read one
+ * after the other on a cold start, and rewrite a table's file from the
+ * callback on every update of the table. Here the tables live in a single
+ * file (see XmemDaemon.h):
+ *
+ * - XdSnapLoad() reads the tables of a snapshot in parallel, each loader
+ *   thread taking the next table left. The bulk of a table is read with
+ *   O_DIRECT straight into its destination when that is suitably aligned,
+ *   and the rest with plain reads. The newest copy of a table is read, or
+ *   the previous one if the newest has a wrong checksum; such tables are
+ *   reported as torn, so that the caller can say so.
+ *
+ * - XdSnapOpen() maps the snapshot for writing, creating it (or laying it
+ *   out again, keeping the tables still valid) when the tables changed.
+ *   The copies with a wrong checksum are dropped.
+ *
+ * - XdSnapDirty() marks tables as updated; this is all the callback does.
+ *   A writer thread waits SNAPSHOT_DELAY_MS for more updates, and then
+ *   copies the dirty tables into the file and checksums them. A table's
+ *   dirty bit is cleared before it's copied, so an update that comes in
+ *   meanwhile gets it written again. The copy is taken with the table's
+ *   XdSnapLock held, so it can't be torn by the callback receiving the
+ *   table; it goes to the table's older slot, so that the newest copy is
+ *   left alone until the new one is on disc.
+ *
+ * This file is included by the programs that use it, after libxmem.h and
+ * XmemDaemon.h.
+ *
+ * @author Emilio G. Cota
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <adler32.h>
+
+#define SNAP_DIRECT_ALIGN	512	/* O_DIRECT's alignment */
+
+#define SNAP_ROUND(x, a)	(((x) + (a) - 1) & ~((a) - 1))
+
+/* writer's state */
+static XdSnapHeader *snap;		/* the mapped file */
+static XdSnapTable snap_tabs[XmemMAX_TABLES];
+static XmemTableId snap_tables;		/* tables in the snapshot */
+static volatile XmemTableId snap_dirty;
+static volatile int snap_stop;
+static pthread_mutex_t snap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t snap_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t snap_wlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t snap_tlock[XmemMAX_TABLES] = {
+	[0 ... XmemMAX_TABLES - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+static pthread_t snap_writer;
+static int snap_writer_running;
+
+/* loaders' state */
+static XdSnapHeader snap_ldhdr;
+static XdSnapTable *snap_ldtabs;
+static volatile int snap_ldnext;
+static volatile XmemTableId snap_loaded;
+static volatile XmemTableId snap_torn;
+static int snap_fd = -1, snap_dfd = -1;	/* plain, O_DIRECT */
+
+static unsigned int SnapChecksum(void *buf, unsigned int bytes)
+{
+	return zlib_adler32(zlib_adler32(0, NULL, 0), buf, bytes);
+}
+
+/* lay out @tabs in @hdr; returns the size of the file */
+static unsigned int SnapLayout(XdSnapHeader *hdr, XdSnapTable *tabs)
+{
+	XdSnapEntry *e;
+	unsigned int off;
+	int i, s;
+
+	bzero((void *)hdr, sizeof(*hdr));
+	hdr->Magic = SNAPSHOT_MAGIC;
+	hdr->Version = SNAPSHOT_VERSION;
+	off = SNAP_ROUND(sizeof(*hdr), SNAPSHOT_ALIGN);
+	for (i = 0; i < XmemMAX_TABLES; i++) {
+		if (!tabs[i].Bytes)
+			continue;
+		e = &hdr->Entries[i];
+		e->Bytes = tabs[i].Bytes;
+		for (s = 0; s < SNAPSHOT_SLOTS; s++) {
+			e->Slots[s].Offset = off;
+			off += SNAP_ROUND(tabs[i].Bytes, SNAPSHOT_ALIGN);
+		}
+		if (tabs[i].Name)
+			strncpy(e->Name, tabs[i].Name, XmemNAME_SIZE - 1);
+	}
+	hdr->Size = off;
+	return off;
+}
+
+static int SnapHeaderOk(XdSnapHeader *hdr, off_t size)
+{
+	XdSnapEntry *e;
+	int i, s;
+
+	if (hdr->Magic != SNAPSHOT_MAGIC || hdr->Version != SNAPSHOT_VERSION ||
+		hdr->Size != size)
+		return 0;
+	for (i = 0; i < XmemMAX_TABLES; i++) {
+		e = &hdr->Entries[i];
+		for (s = 0; e->Bytes && s < SNAPSHOT_SLOTS; s++) {
+			if ((off_t)e->Slots[s].Offset + e->Bytes > size)
+				return 0;
+		}
+	}
+	return 1;
+}
+
+/* the slot of @e holding its newest copy; -1 if there's none */
+static int SnapNewest(XdSnapEntry *e)
+{
+	int s, newest = -1;
+
+	for (s = 0; s < SNAPSHOT_SLOTS; s++) {
+		if (!e->Slots[s].Sequence)
+			continue;
+		if (newest < 0 ||
+			e->Slots[s].Sequence > e->Slots[newest].Sequence)
+			newest = s;
+	}
+	return newest;
+}
+
+/* 1 if slot @s of @e, in the mapped snapshot @hdr, has the right checksum */
+static int SnapSlotOk(XdSnapHeader *hdr, XdSnapEntry *e, int s)
+{
+	XdSnapSlot *sl = &e->Slots[s];
+
+	return SnapChecksum((char *)hdr + sl->Offset, e->Bytes) == sl->Checksum;
+}
+
+/* read @bytes at @off; returns 0 on success, errno on failure */
+static int SnapRead(int fd, void *buf, size_t bytes, off_t off)
+{
+	ssize_t cc;
+
+	while (bytes) {
+		cc = pread(fd, buf, bytes, off);
+		if (cc < 0 && errno == EINTR)
+			continue;
+		if (cc <= 0)
+			return cc ? errno : EIO;
+		buf = (char *)buf + cc;
+		bytes -= cc;
+		off += cc;
+	}
+	return 0;
+}
+
+/* read slot @s of a table of the snapshot; 0 if its checksum is right */
+static int SnapLoadSlot(int i, int s)
+{
+	XdSnapEntry *e = &snap_ldhdr.Entries[i];
+	XdSnapSlot *sl = &e->Slots[s];
+	XdSnapTable *t = &snap_ldtabs[i];
+	size_t bulk = 0;
+	char *addr = t->Addr;
+
+	if (snap_dfd >= 0 && !((uintptr_t)addr & (SNAP_DIRECT_ALIGN - 1))) {
+		bulk = e->Bytes & ~(SNAP_DIRECT_ALIGN - 1);
+		if (SnapRead(snap_dfd, addr, bulk, sl->Offset))
+			bulk = 0; /* e.g. EINVAL: read it all the plain way */
+	}
+	if (SnapRead(snap_fd, addr + bulk, e->Bytes - bulk, sl->Offset + bulk))
+		return -1;
+	return SnapChecksum(addr, e->Bytes) == sl->Checksum ? 0 : -1;
+}
+
+/* read the newest good copy of a table of the snapshot */
+static void SnapLoadTable(int i)
+{
+	XdSnapEntry *e = &snap_ldhdr.Entries[i];
+	int s, newest;
+
+	newest = SnapNewest(e);
+	if (newest < 0)
+		return;
+	if (SnapLoadSlot(i, newest) == 0) {
+		__sync_fetch_and_or(&snap_loaded, 1 << i);
+		return;
+	}
+	__sync_fetch_and_or(&snap_torn, 1 << i);
+	for (s = 0; s < SNAPSHOT_SLOTS; s++) {
+		if (s == newest || !e->Slots[s].Sequence)
+			continue;
+		if (SnapLoadSlot(i, s) == 0) {
+			__sync_fetch_and_or(&snap_loaded, 1 << i);
+			return;
+		}
+	}
+}
+
+static void *SnapLoader(void *arg)
+{
+	int i;
+
+	while ((i = __sync_fetch_and_add(&snap_ldnext, 1)) < XmemMAX_TABLES) {
+		if (!snap_ldtabs[i].Bytes || !snap_ldtabs[i].Addr)
+			continue;
+		if (snap_ldhdr.Entries[i].Bytes != snap_ldtabs[i].Bytes)
+			continue;
+		SnapLoadTable(i);
+	}
+	return NULL;
+}
+
+/**
+ * XdSnapLoad - Read the tables of a snapshot
+ *
+ * @param path: the snapshot file
+ * @param tabs: tables to be read, by bit
+ * @param torn: if not NULL, set to the mask of the tables whose newest copy
+ *              has a wrong checksum. Those that are read anyway are read
+ *              from their previous copy.
+ *
+ * A table is read if it is in the snapshot with the same size, and was
+ * written to it at least once.
+ *
+ * @return mask of the tables read (and checked); 0 if none.
+ */
+XmemTableId XdSnapLoad(char *path, XdSnapTable *tabs, XmemTableId *torn)
+{
+	pthread_t loaders[SNAPSHOT_LOADERS];
+	struct stat st;
+	int i, n;
+
+	if (torn)
+		*torn = 0;
+	snap_fd = open(path, O_RDONLY);
+	if (snap_fd < 0)
+		return 0;
+	if (fstat(snap_fd, &st) < 0 ||
+		SnapRead(snap_fd, &snap_ldhdr, sizeof(snap_ldhdr), 0) ||
+		!SnapHeaderOk(&snap_ldhdr, st.st_size)) {
+		close(snap_fd);
+		snap_fd = -1;
+		return 0;
+	}
+#ifdef O_DIRECT
+	snap_dfd = open(path, O_RDONLY | O_DIRECT);
+#endif
+	posix_fadvise(snap_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	snap_ldtabs = tabs;
+	snap_ldnext = 0;
+	snap_loaded = 0;
+	snap_torn = 0;
+	for (n = 0; n < SNAPSHOT_LOADERS; n++) {
+		if (pthread_create(&loaders[n], NULL, SnapLoader, NULL))
+			break;
+	}
+	if (n == 0)
+		SnapLoader(NULL);
+	for (i = 0; i < n; i++)
+		pthread_join(loaders[i], NULL);
+
+	if (snap_dfd >= 0)
+		close(snap_dfd);
+	close(snap_fd);
+	snap_fd = snap_dfd = -1;
+	if (torn)
+		*torn = snap_torn;
+	return snap_loaded;
+}
+
+/*
+ * copy the tables of @tables into the file, and checksum them. Each copy
+ * goes to the older slot, and is synced before its Sequence makes it the
+ * newest one: a crash may tear it, but not the newest copy on disc.
+ */
+static void SnapWrite(XmemTableId tables)
+{
+	XdSnapEntry *e;
+	XdSnapSlot *sl;
+	unsigned long start, end;
+	unsigned int seq;
+	char *dst;
+	int i, s;
+
+	pthread_mutex_lock(&snap_wlock);
+	for (i = 0; i < XmemMAX_TABLES; i++) {
+		if (!(tables & (1 << i)))
+			continue;
+		e = &snap->Entries[i];
+		s = SnapNewest(e);
+		seq = s < 0 ? 1 : e->Slots[s].Sequence + 1;
+		sl = &e->Slots[s < 0 ? 0 : (s + 1) % SNAPSHOT_SLOTS];
+		sl->Sequence = 0;
+		dst = (char *)snap + sl->Offset;
+		pthread_mutex_lock(&snap_tlock[i]);
+		memcpy(dst, snap_tabs[i].Addr, e->Bytes);
+		pthread_mutex_unlock(&snap_tlock[i]);
+		sl->Checksum = SnapChecksum(dst, e->Bytes);
+		start = sl->Offset & ~(SNAPSHOT_ALIGN - 1);
+		end = SNAP_ROUND(sl->Offset + e->Bytes, SNAPSHOT_ALIGN);
+		msync((char *)snap + start, end - start, MS_SYNC);
+		sl->Time = time(NULL);
+		sl->Sequence = seq;
+	}
+	msync(snap, SNAP_ROUND(sizeof(*snap), SNAPSHOT_ALIGN), MS_ASYNC);
+	pthread_mutex_unlock(&snap_wlock);
+}
+
+static void *SnapWriter(void *arg)
+{
+	struct timespec delay;
+	XmemTableId tables;
+
+	delay.tv_sec = SNAPSHOT_DELAY_MS / 1000;
+	delay.tv_nsec = (SNAPSHOT_DELAY_MS % 1000) * 1000000;
+	for (;;) {
+		pthread_mutex_lock(&snap_lock);
+		while (!snap_dirty && !snap_stop)
+			pthread_cond_wait(&snap_cond, &snap_lock);
+		pthread_mutex_unlock(&snap_lock);
+		if (snap_stop)
+			break;
+		/* let the updates coming together be written together */
+		nanosleep(&delay, NULL);
+		tables = __sync_fetch_and_and(&snap_dirty, 0);
+		if (tables)
+			SnapWrite(tables);
+	}
+	return NULL;
+}
+
+/* map @path, of @size bytes, for writing; NULL on failure */
+static XdSnapHeader *SnapMap(char *path, unsigned int size, int create)
+{
+	void *p;
+	int fd;
+
+	umask(0);
+	fd = open(path, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0666);
+	if (fd < 0)
+		return NULL;
+	if (create && ftruncate(fd, size) < 0) {
+		close(fd);
+		return NULL;
+	}
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return NULL;
+	return p;
+}
+
+/*
+ * Lay out a new snapshot at @path, keeping the tables of the old one that
+ * are still there with the same size, and still valid.
+ */
+static XdSnapHeader *SnapCreate(char *path, XdSnapHeader *want)
+{
+	XdSnapHeader *hdr, *old = NULL;
+	XdSnapEntry *e, *oe;
+	char tmp[256];
+	struct stat st;
+	void *p;
+	int fd, i, s;
+
+	fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		if (fstat(fd, &st) == 0 &&
+			st.st_size >= sizeof(XdSnapHeader)) {
+			p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (p != MAP_FAILED) {
+				old = p;
+				if (!SnapHeaderOk(old, st.st_size)) {
+					munmap(p, st.st_size);
+					old = NULL;
+				}
+			}
+		}
+		close(fd);
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.new", path);
+	hdr = SnapMap(tmp, want->Size, 1);
+	if (hdr == NULL)
+		goto out;
+	memcpy(hdr, want, sizeof(*hdr));
+	for (i = 0; old && i < XmemMAX_TABLES; i++) {
+		e = &hdr->Entries[i];
+		oe = &old->Entries[i];
+		if (!e->Bytes || oe->Bytes != e->Bytes)
+			continue;
+		/* the newest good copy goes to the first slot */
+		s = SnapNewest(oe);
+		if (s >= 0 && !SnapSlotOk(old, oe, s))
+			s = (s + 1) % SNAPSHOT_SLOTS;
+		if (s < 0 || !oe->Slots[s].Sequence ||
+			!SnapSlotOk(old, oe, s))
+			continue;
+		memcpy((char *)hdr + e->Slots[0].Offset,
+		       (char *)old + oe->Slots[s].Offset, e->Bytes);
+		e->Slots[0].Checksum = oe->Slots[s].Checksum;
+		e->Slots[0].Sequence = oe->Slots[s].Sequence;
+		e->Slots[0].Time = oe->Slots[s].Time;
+	}
+	if (msync(hdr, want->Size, MS_SYNC) < 0 || rename(tmp, path) < 0) {
+		munmap(hdr, want->Size);
+		unlink(tmp);
+		hdr = NULL;
+	}
+ out:
+	if (old)
+		munmap(old, old->Size);
+	return hdr;
+}
+
+/**
+ * XdSnapOpen - Map a snapshot to write the tables to
+ *
+ * @param path: the snapshot file
+ * @param tabs: tables to be kept in the snapshot, by bit. Must remain
+ *              valid until XdSnapClose.
+ *
+ * If the file doesn't exist, or it holds different tables, it is laid out
+ * again. The copies with a wrong checksum are dropped, and reported on
+ * stderr. The tables with no copy left are written now; the others when
+ * marked with XdSnapDirty.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int XdSnapOpen(char *path, XdSnapTable *tabs)
+{
+	XdSnapHeader want;
+	XdSnapEntry *e;
+	struct stat st;
+	int i, s;
+
+	if (snap)
+		return 0;
+	SnapLayout(&want, tabs);
+
+	if (stat(path, &st) == 0 && st.st_size == want.Size) {
+		snap = SnapMap(path, want.Size, 0);
+		if (snap && !SnapHeaderOk(snap, st.st_size)) {
+			munmap(snap, want.Size);
+			snap = NULL;
+		}
+		for (i = 0; snap && i < XmemMAX_TABLES; i++) {
+			for (s = 0; s < SNAPSHOT_SLOTS; s++) {
+				if (snap->Entries[i].Bytes ==
+					want.Entries[i].Bytes &&
+					snap->Entries[i].Slots[s].Offset ==
+					want.Entries[i].Slots[s].Offset)
+					continue;
+				munmap(snap, want.Size);
+				snap = NULL;
+				break;
+			}
+		}
+	}
+	if (snap == NULL)
+		snap = SnapCreate(path, &want);
+	if (snap == NULL) {
+		fprintf(stderr, "XmemDaemon: Can't open snapshot %s: %s\n",
+			path, strerror(errno));
+		return -1;
+	}
+
+	memcpy(snap_tabs, tabs, sizeof(snap_tabs));
+	snap_tables = 0;
+	for (i = 0; i < XmemMAX_TABLES; i++) {
+		if (tabs[i].Bytes && tabs[i].Addr)
+			snap_tables |= 1 << i;
+	}
+	snap_dirty = 0;
+	for (i = 0; i < XmemMAX_TABLES; i++) {
+		if (!(snap_tables & (1 << i)))
+			continue;
+		e = &snap->Entries[i];
+		for (s = 0; s < SNAPSHOT_SLOTS; s++) {
+			if (!e->Slots[s].Sequence || SnapSlotOk(snap, e, s))
+				continue;
+			fprintf(stderr, "XmemDaemon: Snapshot %s: table %s: "
+				"dropped torn copy %u\n", path, e->Name,
+				e->Slots[s].Sequence);
+			e->Slots[s].Sequence = 0;
+		}
+		if (SnapNewest(e) < 0)
+			snap_dirty |= 1 << i;
+	}
+	snap_stop = 0;
+	if (pthread_create(&snap_writer, NULL, SnapWriter, NULL) == 0)
+		snap_writer_running = 1;
+	return 0;
+}
+
+/**
+ * XdSnapDirty - Mark tables as updated
+ *
+ * @param tables: mask of the tables
+ *
+ * The tables not in the snapshot are ignored.
+ *
+ * @return 0 if all the tables will be written; -1 otherwise, e.g. when the
+ * snapshot isn't open.
+ */
+int XdSnapDirty(XmemTableId tables)
+{
+	if (!snap)
+		return -1;
+	__sync_fetch_and_or(&snap_dirty, tables & snap_tables);
+	if (!snap_writer_running) {
+		XdSnapSync();
+	} else {
+		pthread_mutex_lock(&snap_lock);
+		pthread_cond_signal(&snap_cond);
+		pthread_mutex_unlock(&snap_lock);
+	}
+	return (tables & ~snap_tables) ? -1 : 0;
+}
+
+/**
+ * XdSnapLock - Lock a table's shared memory against the snapshot's writer
+ *
+ * @param table: the table, by bit
+ *
+ * To be held while writing the table's shared memory, so that the copy in
+ * the snapshot is never taken halfway through an update.
+ */
+void XdSnapLock(XmemTableId table)
+{
+	int i;
+
+	for (i = 0; i < XmemMAX_TABLES; i++) {
+		if (table & (1 << i)) {
+			pthread_mutex_lock(&snap_tlock[i]);
+			return;
+		}
+	}
+}
+
+/**
+ * XdSnapUnlock - Unlock a table locked with XdSnapLock
+ *
+ * @param table: the table, by bit
+ */
+void XdSnapUnlock(XmemTableId table)
+{
+	int i;
+
+	for (i = 0; i < XmemMAX_TABLES; i++) {
+		if (table & (1 << i)) {
+			pthread_mutex_unlock(&snap_tlock[i]);
+			return;
+		}
+	}
+}
+
+/**
+ * XdSnapSync - Write the dirty tables now
+ */
+void XdSnapSync(void)
+{
+	XmemTableId tables;
+
+	if (!snap)
+		return;
+	tables = __sync_fetch_and_and(&snap_dirty, 0);
+	if (tables)
+		SnapWrite(tables);
+}
+
+/**
+ * XdSnapClose - Write the dirty tables, and unmap the snapshot
+ */
+void XdSnapClose(void)
+{
+	unsigned int size;
+
+	if (!snap)
+		return;
+	if (snap_writer_running) {
+		pthread_mutex_lock(&snap_lock);
+		snap_stop = 1;
+		pthread_cond_signal(&snap_cond);
+		pthread_mutex_unlock(&snap_lock);
+		pthread_join(snap_writer, NULL);
+		snap_writer_running = 0;
+	}
+	XdSnapSync();
+	size = snap->Size;
+	msync(snap, size, MS_SYNC);
+	munmap(snap, size);
+	snap = NULL;
+}
@@ -0,0 +1,190 @@
+/**
+ * @file XmemLogRead.c
+ *
+ * @brief Print out the Xmem Daemon's binary event log
+ *
+ * Reads the log files written by the daemon (see XmemDaemonLog.c), by
+ * default Xmem.daemonlog in the xmem configuration path, or with -a that
+ * file and its rotated copies, the oldest first.
+ *
+ * @author Emilio G. Cota
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <libxmem.h>
+#include <XmemDaemon.h>
+
+#include "XmemDaemonLog.c"
+
+static char *event_names[XmemEventMASKS] = {
+	"Timeout", "SendTable", "User", "TableUpdate", "Initialized", "IO",
+	"Kill", "Software", "System", "SoftWakeup"
+};
+
+static unsigned int last;	/* records to print, 0 for all */
+
+static char *EventName(unsigned long mask)
+{
+	int i;
+
+	if (!mask)
+		return "-";
+	for (i = 0; i < XmemEventMASKS; i++)
+		if (mask & (1 << i))
+			return event_names[i];
+	return "?";
+}
+
+static void PrintRecord(XdEventLogRecord *rec)
+{
+	XmemCallbackStruct *cbs = &rec->Entry.CbEvent;
+
+	printf("%8u %s.%06u %-11s", rec->Sequence,
+	       TimeToStr(rec->Entry.Time), rec->Nsec / 1000,
+	       EventName(cbs->Mask));
+	if (cbs->Mask)
+		printf(" Node:0x%lx Table:0x%lx Data:0x%lx",
+		       (unsigned long)cbs->Node, (unsigned long)cbs->Table,
+		       (unsigned long)cbs->Data);
+	if (rec->Entry.Text[0])
+		printf(" %.*s", EVENT_MESSAGE_SIZE, rec->Entry.Text);
+	printf("\n");
+}
+
+/*
+ * Print the records of a log file; @skip is the number of records to skip
+ * (to print the last ones only). Returns the number of records in the file,
+ * or -1 on error.
+ */
+static int ReadLog(char *path, unsigned int skip)
+{
+	XdEventLogHeader *hdr;
+	XdEventLogRecord *recs;
+	struct stat st;
+	unsigned int i, n;
+	void *p;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(XdEventLogHeader)) {
+		close(fd);
+		fprintf(stderr, "%s: not an event log\n", path);
+		return -1;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		perror(path);
+		return -1;
+	}
+	hdr = p;
+	if (hdr->Magic != EVENT_LOG_MAGIC ||
+		hdr->Version != EVENT_LOG_VERSION ||
+		hdr->RecordSize != sizeof(XdEventLogRecord) ||
+		sizeof(*hdr) + (off_t)hdr->Capacity * hdr->RecordSize >
+		st.st_size) {
+		fprintf(stderr, "%s: not an event log of this version\n", path);
+		munmap(p, st.st_size);
+		return -1;
+	}
+
+	/* the daemon may be appending: take a snapshot of the count */
+	n = hdr->Records;
+	if (n > hdr->Capacity)
+		n = hdr->Capacity;
+	recs = (XdEventLogRecord *)(hdr + 1);
+	for (i = skip; i < n; i++)
+		PrintRecord(&recs[i]);
+	munmap(p, st.st_size);
+	return n;
+}
+
+/* number of records in a log file; 0 if it can't be read */
+static unsigned int CountLog(char *path)
+{
+	XdEventLogHeader hdr;
+	int fd, cc;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	cc = read(fd, &hdr, sizeof(hdr));
+	close(fd);
+	if (cc != sizeof(hdr) || hdr.Magic != EVENT_LOG_MAGIC)
+		return 0;
+	return hdr.Records < hdr.Capacity ? hdr.Records : hdr.Capacity;
+}
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s [-a] [-n <last>] [file]\n"
+		"  -a         also read the rotated logs (file.1, file.2...)\n"
+		"  -n <last>  print the last records only\n"
+		"  file       default: %s\n", prog, XmemGetFile(EVENT_LOG));
+}
+
+int main(int argc, char *argv[])
+{
+	char path[256], *log;
+	unsigned int total, count[EVENT_LOG_FILES], skip;
+	int all = 0, files, c, i;
+
+	while ((c = getopt(argc, argv, "an:h")) != -1) {
+		switch (c) {
+		case 'a':
+			all = 1;
+			break;
+		case 'n':
+			last = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			exit(c != 'h');
+		}
+	}
+	if (optind < argc)
+		log = argv[optind];
+	else
+		log = XmemGetFile(EVENT_LOG);
+	files = all ? EVENT_LOG_FILES : 1;
+
+	total = 0;
+	for (i = 0; i < files; i++) {
+		if (i)
+			snprintf(path, sizeof(path), "%s.%d", log, i);
+		else
+			snprintf(path, sizeof(path), "%s", log);
+		count[i] = CountLog(path);
+		total += count[i];
+	}
+	skip = last && last < total ? total - last : 0;
+
+	/* oldest first */
+	for (i = files - 1; i >= 0; i--) {
+		if (skip >= count[i]) {
+			skip -= count[i];
+			continue;
+		}
+		if (i)
+			snprintf(path, sizeof(path), "%s.%d", log, i);
+		else
+			snprintf(path, sizeof(path), "%s", log);
+		if (ReadLog(path, skip) < 0 && i == 0)
+			exit(1);
+		skip = 0;
+	}
+	return 0;
+}
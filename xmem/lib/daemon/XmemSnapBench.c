@@ -0,0 +1,289 @@
+/**
+ * @file XmemSnapBench.c
+ *
+ * @brief Cold start time: table files vs. the daemon's snapshot
+ *
+ * Writes a set of tables filled with random data both as one file per
+ * table and as a snapshot (XmemDaemonSnap.c), and then times reading them
+ * all back:
+ *
+ * - files: one after the other, with fopen/fread, as XmemReadTableFile()
+ *   does on a cold start;
+ * - snapshot: with XdSnapLoad(), checksums included.
+ *
+ * Before each run the files are dropped from the page cache (-c keeps them
+ * there), so that what is measured is the disc. The data read back is
+ * compared with what was written.
+ *
+ * It then times what the daemon's callback spends on -u table updates:
+ * rewriting the table's file, as XmemWriteTableFile() does, vs. marking
+ * the table dirty in the snapshot (plus the final write back, not done by
+ * the callback).
+ *
+ * The files are written to a temporary directory (-d to choose where),
+ * which is removed on exit.
+ *
+ * @author Emilio G. Cota
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <libxmem.h>
+#include <XmemDaemon.h>
+
+#include "XmemDaemonSnap.c"
+
+static int tables = 32;
+static int kbytes = 1024;	/* per table */
+static int runs = 5;
+static int updates = 100;
+static int cached;
+static char *where = "/tmp";
+
+static char dir[256];
+static char snap_file[300];
+static XdSnapTable tabs[XmemMAX_TABLES];
+static uint32_t *data[XmemMAX_TABLES];	/* as written */
+
+static int64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void table_file(int i, char *path, int len)
+{
+	snprintf(path, len, "%s/table%02d", dir, i);
+}
+
+static void drop_cache(char *path)
+{
+	int fd;
+
+	if (cached)
+		return;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return;
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+static void clear_tables(void)
+{
+	int i;
+
+	for (i = 0; i < tables; i++)
+		memset(tabs[i].Addr, 0, tabs[i].Bytes);
+}
+
+static int check_tables(void)
+{
+	int i, bad = 0;
+
+	for (i = 0; i < tables; i++)
+		bad += !!memcmp(tabs[i].Addr, data[i], tabs[i].Bytes);
+	return bad;
+}
+
+/* as XmemReadTableFile() */
+static int64_t load_files(void)
+{
+	char path[320];
+	int64_t t;
+	FILE *fp;
+	int i;
+
+	for (i = 0; i < tables; i++) {
+		table_file(i, path, sizeof(path));
+		drop_cache(path);
+	}
+	t = now_us();
+	for (i = 0; i < tables; i++) {
+		table_file(i, path, sizeof(path));
+		fp = fopen(path, "r");
+		if (!fp)
+			return -1;
+		if (fread(tabs[i].Addr, tabs[i].Bytes, 1, fp) <= 0) {
+			fclose(fp);
+			return -1;
+		}
+		fclose(fp);
+	}
+	return now_us() - t;
+}
+
+static int64_t load_snapshot(void)
+{
+	XmemTableId all, loaded;
+	int64_t t;
+
+	all = tables == 32 ? XmemALL_TABLES : (1U << tables) - 1;
+	drop_cache(snap_file);
+	t = now_us();
+	loaded = XdSnapLoad(snap_file, tabs, NULL);
+	t = now_us() - t;
+	return loaded == all ? t : -1;
+}
+
+static void run(char *name, int64_t (*load)(void))
+{
+	int64_t t, min = 0, sum = 0;
+	int i, bad = 0;
+
+	for (i = 0; i < runs; i++) {
+		clear_tables();
+		t = load();
+		if (t < 0) {
+			printf("%-9s failed\n", name);
+			return;
+		}
+		bad += check_tables();
+		sum += t;
+		if (!i || t < min)
+			min = t;
+	}
+	printf("%-9s %9.1f %9.1f %9.0f %s\n", name, (double)sum / runs / 1000,
+	       (double)min / 1000,
+	       (double)tables * kbytes / 1024 / ((double)sum / runs / 1e6),
+	       bad ? "BAD DATA" : "ok");
+}
+
+static void update(void)
+{
+	int64_t t, files = 0, snapshot = 0;
+	char path[320];
+	FILE *fp;
+	int i, n;
+
+	if (!updates || XdSnapOpen(snap_file, tabs) < 0)
+		return;
+	for (n = 0; n < updates; n++) {
+		i = rand() % tables;
+		table_file(i, path, sizeof(path));
+		t = now_us();
+		fp = fopen(path, "w");
+		if (fp) {
+			fwrite(tabs[i].Addr, tabs[i].Bytes, 1, fp);
+			fclose(fp);
+		}
+		files += now_us() - t;
+
+		t = now_us();
+		XdSnapDirty(1 << i);
+		snapshot += now_us() - t;
+	}
+	t = now_us();
+	XdSnapClose();
+	t = now_us() - t;
+	printf("%d updates, callback time in us: files %.1f snapshot %.1f "
+	       "(final write back: %.1f ms)\n", updates,
+	       (double)files / updates, (double)snapshot / updates,
+	       (double)t / 1000);
+}
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s [options]\n"
+		"  -t <n>   tables, up to %d (default %d)\n"
+		"  -s <kb>  KB per table (default %d)\n"
+		"  -r <n>   runs (default %d)\n"
+		"  -u <n>   table updates (default %d)\n"
+		"  -c       leave the files in the page cache\n"
+		"  -d <dir> where to write the files (default %s)\n",
+		prog, XmemMAX_TABLES, tables, kbytes, runs, updates, where);
+}
+
+int main(int argc, char *argv[])
+{
+	char path[320];
+	FILE *fp;
+	int c, i, j;
+
+	while ((c = getopt(argc, argv, "t:s:r:u:cd:h")) != -1) {
+		switch (c) {
+		case 't':
+			tables = atoi(optarg);
+			break;
+		case 's':
+			kbytes = atoi(optarg);
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		case 'u':
+			updates = atoi(optarg);
+			break;
+		case 'c':
+			cached = 1;
+			break;
+		case 'd':
+			where = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			exit(c != 'h');
+		}
+	}
+	if (tables < 1 || tables > XmemMAX_TABLES || kbytes < 1 || runs < 1 ||
+		updates < 0) {
+		usage(argv[0]);
+		exit(1);
+	}
+	snprintf(dir, sizeof(dir), "%s/XmemSnap.XXXXXX", where);
+	if (mkdtemp(dir) == NULL) {
+		perror("XmemSnapBench");
+		exit(1);
+	}
+	snprintf(snap_file, sizeof(snap_file), "%s/%s", dir, SNAPSHOT_FILE);
+
+	srand(time(NULL));
+	for (i = 0; i < tables; i++) {
+		tabs[i].Bytes = kbytes * 1024;
+		tabs[i].Name = "table";
+		/* page-aligned, as the shared memory segments */
+		if (posix_memalign(&tabs[i].Addr, 4096, tabs[i].Bytes) ||
+			posix_memalign((void **)&data[i], 4096, tabs[i].Bytes)) {
+			perror("XmemSnapBench");
+			exit(1);
+		}
+		for (j = 0; j < tabs[i].Bytes / 4; j++)
+			data[i][j] = rand();
+		memcpy(tabs[i].Addr, data[i], tabs[i].Bytes);
+
+		table_file(i, path, sizeof(path));
+		fp = fopen(path, "w");
+		if (!fp || fwrite(data[i], tabs[i].Bytes, 1, fp) != 1) {
+			perror(path);
+			exit(1);
+		}
+		fclose(fp);
+	}
+	/* a new snapshot writes all the tables when opened */
+	if (XdSnapOpen(snap_file, tabs) < 0)
+		exit(1);
+	XdSnapClose();
+
+	printf("%d tables of %d KB, %d runs%s; times in ms\n", tables, kbytes,
+	       runs, cached ? ", cached" : "");
+	printf("%-9s %9s %9s %9s\n", "load", "avg", "min", "MB/s");
+	run("files", load_files);
+	run("snapshot", load_snapshot);
+	update();
+
+	for (i = 0; i < tables; i++) {
+		table_file(i, path, sizeof(path));
+		unlink(path);
+	}
+	unlink(snap_file);
+	rmdir(dir);
+	return 0;
+}
@@ -920,20 +920,26 @@ char *name;
 int ShowDaemonEventLog(int arg) {
 
 XdEventLogEntry *evp;
-int i;
+int i, idx, cnt;
 
    arg++;
    event_log = GetEventLogTable();
    if (event_log) {
-      if (event_log->NextEntry) {
-	 for (i=0; i<event_log->NextEntry; i++) {
-	    evp = &(event_log->Entries[i]);
-			   printf("%02d: %s ",i,TimeToStr(evp->Time));
+
+      /* The table is a ring: the oldest entry is at NextEntry */
+
+      idx = event_log->NextEntry;
+      if ((idx < 0) || (idx >= EVENT_LOG_ENTRIES)) idx = 0;
+      cnt = 0;
+      for (i=0; i<EVENT_LOG_ENTRIES; i++) {
+	 evp = &(event_log->Entries[(idx + i) % EVENT_LOG_ENTRIES]);
+	 if (evp->Time == 0) continue;
+			   printf("%02d: %s ",cnt++,TimeToStr(evp->Time));
 			   printf("%s: ",CallbackToStr(&(evp->CbEvent)));
-	    if (evp->Text) printf("%s",(char *) &(evp->Text[0]));
+	 if (evp->Text) printf("%s",(char *) &(evp->Text[0]));
 			   printf("\n");
-	 }
-      } else printf("Empty: No logged events in memory\n");
+      }
+      if (cnt == 0) printf("Empty: No logged events in memory\n");
    }
    return arg;
 }
@@ -945,9 +951,10 @@ int ShowDaemonEventHistory(int arg) {
 
 ArgVal   *v;
 AtomType  at;
-XdEventLogEntries elog;
+XdEventLogHeader hdr;
+XdEventLogRecord rec;
 XdEventLogEntry *evp;
-int i, cnt;
+unsigned int i, cnt;
 char *elg;
 FILE *fp;
 XmemNodeId nid;
@@ -963,30 +970,44 @@ XmemNodeId nid;
    umask(0);
    elg = XmemGetFile(EVENT_LOG);
    fp = fopen(elg,"r");
-   if (fp) {
-      bzero((void *) &elog, sizeof(XdEventLogEntries));
-      cnt = fread(&elog, sizeof(XdEventLogEntries), 1, fp);
-      if (cnt <= 0) {
-	 perror("ShowDaemonEventHistory");
-	 fprintf(stderr,"ShowDaemonEventHistory: Error: Can't READ:%s\n",elg);
-	 fclose(fp);
-	 return arg;
-      }
-   } else {
+   if (fp == NULL) {
       perror("ShowDaemonEventHistory");
       fprintf(stderr,"ShowDaemonEventHistory: Error: Can't OPEN:%s for READ\n",elg);
       return arg;
    }
-   fclose(fp);
+
+   /* A header followed by the records, see XmemDaemonLog.c */
+
+   bzero((void *) &hdr, sizeof(XdEventLogHeader));
+   if (fread(&hdr, sizeof(XdEventLogHeader), 1, fp) != 1) {
+      perror("ShowDaemonEventHistory");
+      fprintf(stderr,"ShowDaemonEventHistory: Error: Can't READ:%s\n",elg);
+      fclose(fp);
+      return arg;
+   }
+   if ((hdr.Magic      != EVENT_LOG_MAGIC)
+   ||  (hdr.Version    != EVENT_LOG_VERSION)
+   ||  (hdr.RecordSize != sizeof(XdEventLogRecord))) {
+      fprintf(stderr,"ShowDaemonEventHistory: Error: %s: Not an event log of this version\n",elg);
+      fclose(fp);
+      return arg;
+   }
+
+   /* The daemon may be appending: stick to the records counted so far */
+
+   cnt = hdr.Records;
+   if (cnt > hdr.Capacity) cnt = hdr.Capacity;
 
    printf("Showing file:%s\n",elg);
-   for (i=0; i<elog.NextEntry; i++) {
-      evp = &(elog.Entries[i]);
+   evp = &(rec.Entry);
+   for (i=0; i<cnt; i++) {
+      if (fread(&rec, sizeof(XdEventLogRecord), 1, fp) != 1) break;
 		     printf("%02d: %s ",i,TimeToStr(evp->Time));
 		     printf("%s: ",CallbackToStr(&(evp->CbEvent)));
       if (evp->Text) printf("%s",(char *) &(evp->Text[0]));
 		     printf("\n");
    }
+   fclose(fp);
    return arg;
 }
 
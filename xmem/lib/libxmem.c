@@ -26,7 +26,11 @@
 
 #include <xmemDrvr.h>
 #include <libxmem.h>
-#include <adler32.h>
+#include <xmemAdler32.h>
+
+#ifdef XMEMSIM_REDIRECT
+#include <xmemsim.h>
+#endif
 
 /*! @name device specific backend code
  *
@@ -108,6 +112,9 @@ typedef struct {
 	XmemError     (*SendMessage)();
 	XmemTableId   (*CheckTables)();
 	XmemError     (*SendSoftWakeup)();
+	XmemError     (*MapTable)();
+	XmemError     (*UnmapTable)();
+	XmemError     (*GetGeneration)();
 } XmemLibRoutines;
 
 static int 		libinitialized = 0;
@@ -147,8 +154,9 @@ static char *estr[XmemErrorCOUNT] = {
  * physical XMEM addresses) as private (priv), and the addresses that users
  * operate with as public (pub).
  * NOTE: The simple markers implementation is not atomic; use the flag
- * XmemMarkersATOMIC if you really need to ensure atomicity, at the price of
- * using a bounce buffer for each access.
+ * XmemMarkersSEQLOCK if you really need to ensure atomicity. The flag
+ * XmemMarkersATOMIC does the same at the price of using a bounce buffer
+ * for each access.
  */
 
 struct header {
@@ -348,6 +356,9 @@ static XmemError InitDevice(XmemDevice device)
 		routines.SendMessage      = VmicSendMessage;
 		routines.CheckTables      = VmicCheckTables;
 		routines.SendSoftWakeup   = VmicSendSoftWakeup;
+		routines.MapTable         = VmicMapTable;
+		routines.UnmapTable       = VmicUnmapTable;
+		routines.GetGeneration    = VmicGetGeneration;
 		return VmicInitialize();
 
 	case XmemDeviceSHMEM:
@@ -360,6 +371,9 @@ static XmemError InitDevice(XmemDevice device)
 		routines.SendMessage      = ShmemSendMessage;
 		routines.CheckTables      = ShmemCheckTables;
 		routines.SendSoftWakeup   = ShmemSendSoftWakeup;
+		routines.MapTable         = NULL; /* XmemGetSharedMemory mirror */
+		routines.UnmapTable       = NULL;
+		routines.GetGeneration    = ShmemGetGeneration;
 		return ShmemInitialize();
 
 	case XmemDeviceNETWORK:
@@ -372,6 +386,9 @@ static XmemError InitDevice(XmemDevice device)
 		routines.SendMessage      = NetworkSendMessage;
 		routines.CheckTables      = NetworkCheckTables;
 		routines.SendSoftWakeup   = NetworkSendSoftWakeup;
+		routines.MapTable         = NULL; /* XmemGetSharedMemory mirror */
+		routines.UnmapTable       = NULL;
+		routines.GetGeneration    = NetworkGetGeneration;
 		return NetworkInitialize();
 
 	default:
@@ -381,11 +398,19 @@ static XmemError InitDevice(XmemDevice device)
 	return XmemErrorNOT_INITIALIZED;
 }
 
-static unsigned long calc_adler32(void *pub_buf, int pub_elems)
+static uint32_t calc_adler32(void *pub_buf, int pub_elems)
 {
-	unsigned long adler = zlib_adler32(0L, NULL, 0);
+	return XmemAdler32(pub_buf, pub_elems * sizeof(uint32_t));
+}
 
-	return zlib_adler32(adler, pub_buf, pub_elems * sizeof(uint32_t));
+/*
+ * copy @pub_elems elements from @src to @dst, returning their checksum.
+ * Only for sending: a receive must check before it copies.
+ */
+static uint32_t copy_adler32(void *dst, void *src, int pub_elems)
+{
+	return XmemAdler32Copy(XmemADLER32_INIT, dst, src,
+			       pub_elems * sizeof(uint32_t));
 }
 
 static XmemError evaluate_hf(struct header *header, struct footer *footer,
@@ -465,13 +490,17 @@ static XmemError send_table_atomic(XmemTableId table, void *buf, int pub_elems,
 	if (bounce == NULL)
 		return XmemErrorENOMEM;
 
-	/* copy the public data to the bounce buffer */
-	memcpy(bounce + XMEM_H_ELEMS, buf, pub_elems * sizeof(uint32_t));
-
 	/* fill in the markers */
 	header = (void *)bounce;
 	footer = (void *)(bounce + __f_eloff(pub_elems, pub_eloff));
-	fill_hf(header, footer, pub_elems, bounce + XMEM_H_ELEMS);
+	fill_hf(header, footer, pub_elems, NULL);
+
+	/* copy the public data to the bounce buffer, checksumming it */
+	if (markers_mask & XmemMarkersCHECKSUM)
+		header->checksum = copy_adler32(bounce + XMEM_H_ELEMS, buf,
+						pub_elems);
+	else
+		memcpy(bounce + XMEM_H_ELEMS, buf, pub_elems * sizeof(uint32_t));
 
 	/* copy the table to XMEM */
 	err = routines.SendTable(table, bounce, priv_elems,
@@ -536,14 +565,16 @@ static XmemError receive_table_atomic(XmemTableId table, void *buf,
 	if (err != XmemErrorSUCCESS)
 		goto out_err;
 
-	/* check markers */
+	/*
+	 * check markers and checksum on the bounce buffer: the user's buffer
+	 * (e.g. the daemon's shared memory) is left untouched on a failure
+	 */
 	header = (void *)bounce;
 	footer = (void *)(bounce + __f_eloff(pub_elems, pub_eloff));
 	err = evaluate_hf(header, footer, pub_elems, bounce + XMEM_H_ELEMS);
 	if (err != XmemErrorSUCCESS)
 		goto out_err;
 
-	/* copy from the bounce buffer to the user's buffer */
 	memcpy(buf, bounce + XMEM_H_ELEMS, pub_elems * sizeof(uint32_t));
 
 	free(bounce);
@@ -554,6 +585,328 @@ out_err:
 		free(bounce);
 	return err;
 }
+
+/*
+ * With XmemMarkersSEQLOCK the header's value is a sequence counter. A writer
+ * sets it to an odd value, writes the table, then sets both the footer and
+ * the header to the next (even) value. A reader reads the header, the table
+ * into the caller's buffer, the footer and the header again: the table is
+ * coherent if all three values are equal. Otherwise a writer got in the way,
+ * and the read is retried.
+ * Since the footer ends up equal to the header, tables written this way look
+ * coherent to readers using the other modes. Tables written with ATOMIC are
+ * checked here as well, since their header and footer are written around
+ * the table; those written with ENABLE are not, since send_table() writes
+ * both markers before the table.
+ */
+#define XMEM_SEQ_RETRIES	32	//!< reads before giving up
+#define XMEM_SEQ_BACKOFF_NS	10000	//!< wait when a write is in progress
+
+static XmemError send_table_seq(XmemTableId table, void *buf, int pub_elems,
+				int pub_eloff, int upflag)
+{
+	struct header	header;
+	struct footer	footer;
+	XmemError	err;
+
+	err = routines.RecvTable(table, &header, XMEM_H_ELEMS,
+				__h_eloff(pub_eloff));
+	if (err != XmemErrorSUCCESS)
+		return err;
+
+	/* odd: write in progress */
+	header.val = (header.val | 1) + 2;
+	header.size = pub_elems * sizeof(uint32_t);
+	err = routines.SendTable(table, &header, XMEM_H_ELEMS,
+				__h_eloff(pub_eloff), 0);
+	if (err != XmemErrorSUCCESS)
+		return err;
+
+	err = routines.SendTable(table, buf, pub_elems, phys_eloff(pub_eloff), 0);
+	if (err != XmemErrorSUCCESS)
+		return err;
+
+	header.val++;
+	footer.val = header.val;
+	if (markers_mask & XmemMarkersCHECKSUM)
+		header.checksum = calc_adler32(buf, pub_elems);
+
+	err = routines.SendTable(table, &footer, XMEM_F_ELEMS,
+				__f_eloff(pub_elems, pub_eloff), 0);
+	if (err != XmemErrorSUCCESS)
+		return err;
+
+	/* done: send SEGMENT_UPDATE if requested */
+	return routines.SendTable(table, &header, XMEM_H_ELEMS,
+				__h_eloff(pub_eloff), upflag);
+}
+
+static XmemError receive_table_seq(XmemTableId table, void *buf, int pub_elems,
+				   int pub_eloff)
+{
+	struct timespec	backoff = { 0, XMEM_SEQ_BACKOFF_NS };
+	struct header	header, header2;
+	struct footer	footer;
+	XmemError	err;
+	int		i;
+
+	for (i = 0; i < XMEM_SEQ_RETRIES; i++) {
+		err = routines.RecvTable(table, &header, XMEM_H_ELEMS,
+					__h_eloff(pub_eloff));
+		if (err != XmemErrorSUCCESS)
+			return err;
+
+		err = routines.RecvTable(table, buf, pub_elems,
+					phys_eloff(pub_eloff));
+		if (err != XmemErrorSUCCESS)
+			return err;
+
+		err = routines.RecvTable(table, &footer, XMEM_F_ELEMS,
+					__f_eloff(pub_elems, pub_eloff));
+		if (err != XmemErrorSUCCESS)
+			return err;
+
+		err = routines.RecvTable(table, &header2, XMEM_H_ELEMS,
+					__h_eloff(pub_eloff));
+		if (err != XmemErrorSUCCESS)
+			return err;
+
+		if (header.val == footer.val && header.val == header2.val)
+			return evaluate_hf(&header, &footer, pub_elems, buf);
+
+		if (header2.val != footer.val)
+			nanosleep(&backoff, NULL);
+	}
+	return XmemErrorINCOHERENT_MARKERS;
+}
+
+/*
+ * Delta sends
+ *
+ * Only the cache lines (XmemDELTA_LINE_ELEMS elements) that changed are
+ * written. Dirty lines closer than XMEM_DELTA_GAP lines are merged, since
+ * rewriting a few clean lines is cheaper than another transfer; if there
+ * are still more than XMEM_DELTA_RANGES ranges, the whole span is sent.
+ *
+ * With markers enabled, the header's size field tells the receivers which
+ * lines were written (XmemGetTableHint): a full write stores the record's
+ * size in bytes, as usual; a delta write stores XMEM_HINT_DELTA, the first
+ * line and the number of lines. Spans that don't fit are sent as full.
+ */
+#define XMEM_DELTA_GAP		2
+#define XMEM_DELTA_RANGES	16
+
+#define XMEM_HINT_DELTA		0x80000000
+#define XMEM_HINT_FIRST_MAX	0x7fff
+#define XMEM_HINT_COUNT_MAX	0xffff
+
+struct delta_range {
+	int	first;	/* in lines */
+	int	count;
+};
+
+static int line_is_dirty(const uint32_t *dirty, int line)
+{
+	return dirty[line / 32] & (1U << (line % 32));
+}
+
+/*
+ * Fill @r with the dirty ranges of a record of @elems elements, given a
+ * dirty bitmap or, if NULL, by comparing @buf with @shadow.
+ * Returns the number of ranges.
+ */
+static int delta_ranges(const uint32_t *buf, const uint32_t *shadow,
+			const uint32_t *dirty, int elems,
+			struct delta_range *r)
+{
+	int lines = (elems + XmemDELTA_LINE_ELEMS - 1) / XmemDELTA_LINE_ELEMS;
+	int line, last, n, len, d;
+
+	n = 0;
+	last = -1;
+	for (line = 0; line < lines; line++) {
+		if (dirty) {
+			d = line_is_dirty(dirty, line);
+		} else {
+			len = elems - line * XmemDELTA_LINE_ELEMS;
+			if (len > XmemDELTA_LINE_ELEMS)
+				len = XmemDELTA_LINE_ELEMS;
+			d = memcmp(buf + line * XmemDELTA_LINE_ELEMS,
+				shadow + line * XmemDELTA_LINE_ELEMS,
+				len * sizeof(uint32_t));
+		}
+		if (!d)
+			continue;
+		last = line;
+
+		if (n > XMEM_DELTA_RANGES)
+			continue;
+		if (n && line - (r[n - 1].first + r[n - 1].count) <=
+				XMEM_DELTA_GAP) {
+			r[n - 1].count = line - r[n - 1].first + 1;
+			continue;
+		}
+		if (n == XMEM_DELTA_RANGES) {
+			n++; /* too many: send the whole span */
+			continue;
+		}
+		r[n].first = line;
+		r[n].count = 1;
+		n++;
+	}
+	if (n > XMEM_DELTA_RANGES) {
+		r[0].count = last - r[0].first + 1;
+		n = 1;
+	}
+	return n;
+}
+
+static uint32_t delta_hint(struct delta_range *r, int n, int pub_elems)
+{
+	int first, count;
+
+	if (n == 0)
+		return pub_elems * sizeof(uint32_t);
+	first = r[0].first;
+	count = r[n - 1].first + r[n - 1].count - first;
+	if (first > XMEM_HINT_FIRST_MAX || count > XMEM_HINT_COUNT_MAX)
+		return pub_elems * sizeof(uint32_t);
+	return XMEM_HINT_DELTA | first << 16 | count;
+}
+
+/* write the ranges of @buf, without sending SEGMENT_UPDATE */
+static XmemError send_ranges(XmemTableId table, uint32_t *buf, int pub_elems,
+			     int pub_eloff, struct delta_range *r, int n)
+{
+	XmemError	err;
+	int		i, first, elems;
+
+	for (i = 0; i < n; i++) {
+		first = r[i].first * XmemDELTA_LINE_ELEMS;
+		elems = r[i].count * XmemDELTA_LINE_ELEMS;
+		if (first + elems > pub_elems)
+			elems = pub_elems - first;
+		err = routines.SendTable(table, buf + first, elems,
+					phys_eloff(pub_eloff) + first, 0);
+		if (err != XmemErrorSUCCESS)
+			return err;
+	}
+	return XmemErrorSUCCESS;
+}
+
+static XmemError send_update(XmemTableId table)
+{
+	XmemMessage mess;
+
+	mess.MessageType = XmemMessageTypeTABLE_UPDATE;
+	mess.Data        = table;
+	return routines.SendMessage(XmemALL_NODES, &mess);
+}
+
+/*
+ * Mapped tables (XmemMapTable)
+ *
+ * On VMIC a table is mapped read-only straight from the module's SDRAM.
+ * Otherwise, when it's mapped for writing, or if the driver can't map it,
+ * the XmemGetSharedMemory mirror is used instead; XmemGetTableGeneration
+ * reads the table into it again when the generation changes.
+ */
+#define XMEM_MAP_USED	0x1	/* mapped */
+#define XMEM_MAP_DIRECT	0x2	/* from the SDRAM, not a mirror */
+
+static struct {
+	void		*addr;	/* public start of the table */
+	int		flags;
+	uint32_t	gen;	/* mirror: generation it was read at */
+} map_tab[XmemMAX_TABLES];
+
+/* index of a table id with a single bit set; -1 otherwise */
+static int map_index(XmemTableId table)
+{
+	int i;
+
+	for (i = 0; i < XmemMAX_TABLES; i++) {
+		if (table == (1 << i))
+			return i;
+	}
+	return -1;
+}
+
+/* read a mirror from the table again */
+static XmemError map_refresh(XmemTableId table, int tnum)
+{
+	XmemNodeId	nodes;
+	uint32_t	user;
+	XmemError	err;
+	int		elems;
+
+	err = XmemGetTableDesc(table, &elems, &nodes, &user);
+	if (err != XmemErrorSUCCESS)
+		return err;
+	return XmemRecvTable(table, map_tab[tnum].addr, elems, 0);
+}
+
+/* as send_table_seq(), but writing only the given ranges */
+static XmemError send_delta_seq(XmemTableId table, uint32_t *buf,
+				int pub_elems, int pub_eloff,
+				struct delta_range *r, int n)
+{
+	struct header	header;
+	struct footer	footer;
+	XmemError	err;
+
+	err = routines.RecvTable(table, &header, XMEM_H_ELEMS,
+				__h_eloff(pub_eloff));
+	if (err != XmemErrorSUCCESS)
+		return err;
+
+	header.val = (header.val | 1) + 2;
+	header.size = delta_hint(r, n, pub_elems);
+	err = routines.SendTable(table, &header, XMEM_H_ELEMS,
+				__h_eloff(pub_eloff), 0);
+	if (err != XmemErrorSUCCESS)
+		return err;
+
+	err = send_ranges(table, buf, pub_elems, pub_eloff, r, n);
+	if (err != XmemErrorSUCCESS)
+		return err;
+
+	header.val++;
+	footer.val = header.val;
+	if (markers_mask & XmemMarkersCHECKSUM)
+		header.checksum = calc_adler32(buf, pub_elems);
+
+	err = routines.SendTable(table, &footer, XMEM_F_ELEMS,
+				__f_eloff(pub_elems, pub_eloff), 0);
+	if (err != XmemErrorSUCCESS)
+		return err;
+	return routines.SendTable(table, &header, XMEM_H_ELEMS,
+				__h_eloff(pub_eloff), 0);
+}
+
+/* as send_table(), but writing only the given ranges */
+static XmemError send_delta(XmemTableId table, uint32_t *buf, int pub_elems,
+			    int pub_eloff, struct delta_range *r, int n)
+{
+	struct header	header;
+	struct footer	footer;
+	XmemError	err;
+
+	fill_hf(&header, &footer, pub_elems, NULL);
+	header.size = delta_hint(r, n, pub_elems);
+
+	err = routines.SendTable(table, &header, XMEM_H_ELEMS,
+				__h_eloff(pub_eloff), 0);
+	if (err != XmemErrorSUCCESS)
+		return err;
+
+	err = routines.SendTable(table, &footer, XMEM_F_ELEMS,
+				__f_eloff(pub_elems, pub_eloff), 0);
+	if (err != XmemErrorSUCCESS)
+		return err;
+
+	return send_ranges(table, buf, pub_elems, pub_eloff, r, n);
+}
 //@}
 
 
@@ -584,6 +937,7 @@ XmemError XmemInitialize(XmemDevice device)
 	if (err != XmemErrorSUCCESS)
 		return err;
 
+	shmem_create = device == XmemDeviceSHMEM;
 	if (device == XmemDeviceANY) {
 		fdev = XmemDeviceVMIC;
 		ldev = XmemDeviceNETWORK;
@@ -695,6 +1049,9 @@ XmemError XmemSendTable(XmemTableId table, void *buf, int elems,
 					upflag);
 	}
 
+	if (markers_mask & XmemMarkersSEQLOCK)
+		return send_table_seq(table, buf, elems, offset, upflag);
+
 	if (markers_mask & XmemMarkersATOMIC)
 		return send_table_atomic(table, buf, elems, offset, upflag);
 
@@ -710,6 +1067,9 @@ XmemError XmemRecvTable(XmemTableId table, void *buf, int elems,
 	if (!libinitialized)
 		return XmemErrorNOT_INITIALIZED;
 
+	if (markers_mask & XmemMarkersSEQLOCK)
+		return receive_table_seq(table, buf, elems, offset);
+
 	if (markers_mask & XmemMarkersATOMIC)
 		return receive_table_atomic(table, buf, elems, offset);
 
@@ -721,6 +1081,85 @@ XmemError XmemRecvTable(XmemTableId table, void *buf, int elems,
 }
 
 
+XmemError XmemSendTableDelta(XmemTableId table, void *buf, int elems,
+			     int offset, const uint32_t *dirty, void *shadow,
+			     int upflag)
+{
+	struct delta_range	r[XMEM_DELTA_RANGES];
+	XmemError		err;
+	int			i, n, first, len;
+
+	if (!libinitialized)
+		return XmemErrorNOT_INITIALIZED;
+
+	if ((dirty == NULL && shadow == NULL) ||
+	    markers_mask & XmemMarkersATOMIC)
+		return XmemSendTable(table, buf, elems, offset, upflag);
+
+	n = delta_ranges(buf, shadow, dirty, elems, r);
+	if (n == 0)
+		return XmemErrorSUCCESS;
+
+	if (markers_mask & XmemMarkersDISABLE)
+		err = send_ranges(table, buf, elems, offset, r, n);
+	else if (markers_mask & XmemMarkersSEQLOCK)
+		err = send_delta_seq(table, buf, elems, offset, r, n);
+	else
+		err = send_delta(table, buf, elems, offset, r, n);
+	if (err != XmemErrorSUCCESS)
+		return err;
+
+	if (shadow) {
+		for (i = 0; i < n; i++) {
+			first = r[i].first * XmemDELTA_LINE_ELEMS;
+			len = r[i].count * XmemDELTA_LINE_ELEMS;
+			if (first + len > elems)
+				len = elems - first;
+			memcpy((uint32_t *)shadow + first, (uint32_t *)buf + first,
+			       len * sizeof(uint32_t));
+		}
+	}
+
+	if (upflag)
+		return send_update(table);
+	return XmemErrorSUCCESS;
+}
+
+
+XmemError XmemGetTableHint(XmemTableId table, int elems, int offset,
+			   int *first, int *count)
+{
+	struct header	header;
+	XmemError	err;
+	uint32_t	hint;
+
+	if (!libinitialized)
+		return XmemErrorNOT_INITIALIZED;
+
+	*first = 0;
+	*count = elems;
+	if (markers_mask & XmemMarkersDISABLE)
+		return XmemErrorSUCCESS;
+
+	err = routines.RecvTable(table, &header, XMEM_H_ELEMS,
+				__h_eloff(offset));
+	if (err != XmemErrorSUCCESS)
+		return err;
+
+	hint = header.size;
+	if (!(hint & XMEM_HINT_DELTA))
+		return XmemErrorSUCCESS;
+
+	*first = ((hint >> 16) & XMEM_HINT_FIRST_MAX) * XmemDELTA_LINE_ELEMS;
+	*count = (hint & XMEM_HINT_COUNT_MAX) * XmemDELTA_LINE_ELEMS;
+	if (*first > elems)
+		*first = elems;
+	if (*first + *count > elems)
+		*count = elems - *first;
+	return XmemErrorSUCCESS;
+}
+
+
 XmemError XmemSendMessage(XmemNodeId nodes, XmemMessage *mess)
 {
 	if (libinitialized)
@@ -868,6 +1307,125 @@ error:
 }
 
 
+void *XmemMapTable(XmemTableId table, int writable)
+{
+	XmemNodeId	nodes;
+	uint32_t	user, gen;
+	XmemError	err;
+	void		*addr;
+	int		elems, tnum;
+
+	if (!libinitialized) {
+		XmemErrorCallback(XmemErrorNOT_INITIALIZED, 0);
+		return NULL;
+	}
+	tnum = map_index(table);
+	if (tnum < 0) {
+		XmemErrorCallback(XmemErrorNO_SUCH_TABLE, 0);
+		return NULL;
+	}
+	if (map_tab[tnum].flags & XMEM_MAP_USED) {
+		if (!writable || !(map_tab[tnum].flags & XMEM_MAP_DIRECT))
+			return map_tab[tnum].addr;
+		XmemUnmapTable(table); /* map the mirror instead */
+	}
+
+	err = XmemGetTableDesc(table, &elems, &nodes, &user);
+	if (err != XmemErrorSUCCESS)
+		return NULL;
+	if (writable && !(nodes & my_nid)) {
+		XmemErrorCallback(XmemErrorWRITE_PROTECTED, 0);
+		return NULL;
+	}
+
+	/* writes go through the driver, which checks the permissions */
+	if (!writable && routines.MapTable &&
+		routines.MapTable(table, &addr) == XmemErrorSUCCESS) {
+		map_tab[tnum].addr = (uint32_t *)addr + phys_eloff(0);
+		map_tab[tnum].flags = XMEM_MAP_USED | XMEM_MAP_DIRECT;
+		return map_tab[tnum].addr;
+	}
+
+	/* fall back to the mirror, up to date with the current generation */
+	addr = XmemGetSharedMemory(table);
+	if (addr == NULL)
+		return NULL;
+	map_tab[tnum].addr = addr;
+	map_tab[tnum].flags = XMEM_MAP_USED;
+	gen = 0;
+	routines.GetGeneration(table, &gen);
+	if (map_refresh(table, tnum) != XmemErrorSUCCESS) {
+		map_tab[tnum].flags = 0;
+		return NULL;
+	}
+	map_tab[tnum].gen = gen;
+	return addr;
+}
+
+
+XmemError XmemUnmapTable(XmemTableId table)
+{
+	int tnum;
+
+	tnum = map_index(table);
+	if (tnum < 0 || !(map_tab[tnum].flags & XMEM_MAP_USED))
+		return XmemErrorCallback(XmemErrorNO_SUCH_TABLE, 0);
+	/* the mirror stays, as for XmemGetSharedMemory */
+	if (map_tab[tnum].flags & XMEM_MAP_DIRECT)
+		routines.UnmapTable();
+	map_tab[tnum].addr = NULL;
+	map_tab[tnum].flags = 0;
+	return XmemErrorSUCCESS;
+}
+
+
+XmemError XmemSendMappedTable(XmemTableId table, int upflag)
+{
+	XmemNodeId	nodes;
+	uint32_t	user;
+	XmemError	err;
+	int		elems, tnum;
+
+	if (!libinitialized)
+		return XmemErrorNOT_INITIALIZED;
+	tnum = map_index(table);
+	if (tnum < 0 || !(map_tab[tnum].flags & XMEM_MAP_USED))
+		return XmemErrorCallback(XmemErrorNO_SUCH_TABLE, 0);
+	err = XmemGetTableDesc(table, &elems, &nodes, &user);
+	if (err != XmemErrorSUCCESS)
+		return err;
+
+	/* the SDRAM is only mapped read-only */
+	if (map_tab[tnum].flags & XMEM_MAP_DIRECT)
+		return XmemErrorCallback(XmemErrorWRITE_PROTECTED, 0);
+	return XmemSendTable(table, map_tab[tnum].addr, elems, 0, upflag);
+}
+
+
+XmemError XmemGetTableGeneration(XmemTableId table, uint32_t *gen)
+{
+	XmemError	err;
+	int		tnum;
+
+	if (!libinitialized)
+		return XmemErrorNOT_INITIALIZED;
+	tnum = map_index(table);
+	if (tnum < 0)
+		return XmemErrorCallback(XmemErrorNO_SUCH_TABLE, 0);
+	err = routines.GetGeneration(table, gen);
+	if (err != XmemErrorSUCCESS)
+		return err;
+	if ((map_tab[tnum].flags & (XMEM_MAP_USED | XMEM_MAP_DIRECT)) ==
+		XMEM_MAP_USED && *gen != map_tab[tnum].gen) {
+		err = map_refresh(table, tnum);
+		if (err != XmemErrorSUCCESS)
+			return err;
+		map_tab[tnum].gen = *gen;
+	}
+	return XmemErrorSUCCESS;
+}
+
+
 XmemTableId XmemGetAllTableIds()
 {
 	return seg_tab.Used;
@@ -879,7 +1437,7 @@ char *XmemGetNodeName(XmemNodeId node)
 	int i;
 	unsigned long msk;
 
-	if (!xmem) /* global variable, means a device is open */
+	if (!libinitialized)
 		return (char *)0;
 	for (i = 0; i < XmemMAX_NODES; i++) {
 		msk = 1 << i;
@@ -896,7 +1454,7 @@ XmemNodeId XmemGetNodeId(XmemName name)
 	int 		i;
 	unsigned long	msk;
 
-	if (!xmem)
+	if (!libinitialized)
 		return 0;
 	for (i = 0; i < XmemMAX_NODES; i++) {
 		msk = 1 << i;
@@ -914,7 +1472,7 @@ char * XmemGetTableName(XmemTableId table)
 	int 		i;
 	unsigned long	msk;
 
-	if (!xmem)
+	if (!libinitialized)
 		return (char *)0;
 	for (i = 0; i < XmemMAX_TABLES; i++) {
 		msk = 1 << i;
@@ -932,7 +1490,7 @@ XmemTableId XmemGetTableId(XmemName name)
 	int		i;
 	unsigned long	msk;
 
-	if (!xmem)
+	if (!libinitialized)
 		return 0;
 	for (i = 0; i < XmemMAX_TABLES; i++) {
 		msk = 1 << i;
@@ -952,7 +1510,7 @@ XmemError XmemGetTableDesc(XmemTableId table, int *elems,
 	int 		i;
 	unsigned long	msk;
 
-	if (!xmem)
+	if (!libinitialized)
 		return XmemErrorCallback(XmemErrorNOT_INITIALIZED, 0);
 	for (i = 0; i < XmemMAX_TABLES; i++) {
 		msk = 1 << i;
@@ -1099,7 +1657,11 @@ XmemMarkersMask XmemSetMarkersMask(XmemMarkersMask mask)
 	}
 	mask &= XmemMarkersALL;
 
-	if (mask & XmemMarkersCHECKSUM && !(mask & XmemMarkersATOMIC))
+	if (mask & XmemMarkersSEQLOCK)
+		mask &= ~XmemMarkersATOMIC;
+
+	if (mask & XmemMarkersCHECKSUM &&
+	    !(mask & (XmemMarkersATOMIC | XmemMarkersSEQLOCK)))
 		mask &= ~XmemMarkersCHECKSUM;
 
 	if (mask != 0)
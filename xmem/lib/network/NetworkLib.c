@@ -1,143 +1,1253 @@
-/* ==================================================================== */
-/* Implement a library to handle reflective memory Network back end     */
-/* Julian Lewis 9th/Feb/2005                                            */
-/* ==================================================================== */
+/**
+ * @file NetworkLib.c
+ *
+ * @brief Reflective memory emulated over UDP multicast
+ *
+ * Every node keeps a mirror of all the tables. Writes go to the local
+ * mirror and are multicast to the other nodes, which apply them to theirs;
+ * messages are multicast in the same way and turned into the callback
+ * events the VMIC would raise.
+ *
+ * Table writes and events are items, packed in datagrams of up to
+ * NET_PACKET bytes. A datagram goes out when it's full, when an event is
+ * added to it, when the table is "flushed" (XmemSendTable with a NULL
+ * buffer), or at the latest NET_LINGER_US after its first item: a burst
+ * of small writes thus takes few datagrams.
+ *
+ * Each node numbers its datagrams. A receiver applies a sender's datagrams
+ * in order; when it sees a gap (a datagram, or a heartbeat, numbered past
+ * the next one expected) it holds what arrives next, and asks the sender
+ * for the missing ones with a NACK; the sender retransmits them from its
+ * history of the last NET_HISTORY datagrams, or says they're gone. When a
+ * gap can't be filled the receiver moves past it and raises an XmemEventMaskIO event with
+ * XmemIoErrorCONTACT. Heartbeats, every NET_HEARTBEAT_MS, also tell which
+ * nodes are up.
+ *
+ * Several processes may share a node number, each with its own mirror: a
+ * sender is known by its node number and its incarnation, and NACKs and
+ * their answers are addressed to both.
+ *
+ * Table data are sent as little-endian words, like the VMIC's SDRAM holds
+ * them. A thread receives the datagrams; the callbacks are called from
+ * XmemWait and XmemPoll, in the caller's thread.
+ *
+ * The node Id is taken from $XMEM_NET_NODE (1 to 32) or else from the
+ * node table entry named as this host. $XMEM_NET_GROUP, $XMEM_NET_PORT,
+ * $XMEM_NET_IF and $XMEM_NET_TTL override the multicast group, the port,
+ * the address of the interface to use, and the multicast TTL.
+ *
+ * @author Julian Lewis
+ *
+ * @date Created on 09/02/2005
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
-/* ==================================================================== */
-/* Try to initialize the specified device                               */
+#define NET_GROUP		"239.192.88.65"
+#define NET_PORT		5565
+#define NET_MAGIC		0x584d4e54	/* "XMNT" */
+#define NET_PACKET		1400	/* bytes per datagram, at most */
+#define NET_HISTORY		512	/* datagrams kept for retransmission */
+#define NET_REORDER		64	/* datagrams held while a gap is open */
+#define NET_QUEUE		256	/* events waiting for XmemWait/Poll */
+#define NET_PEERS		(2 * XmemMAX_NODES) /* senders tracked */
+#define NET_RCVBUF		(2 << 20) /* socket buffer, for bursts */
+#define NET_LINGER_US		500
+#define NET_HEARTBEAT_MS	100
+#define NET_NODE_TIMEOUT_MS	1000	/* a node not heard of is down */
+#define NET_NACK_MS		10	/* interval between NACKs of a gap */
+#define NET_NACK_TRIES		10	/* NACKs before giving a gap up */
 
-XmemError NetworkInitialize() { /* Initialize hardware/software */
+/* datagram types */
+#define NET_DATA		1
+#define NET_NACK		2
+#define NET_HEARTBEAT		3
+#define NET_GONE		4
 
-   return XmemErrorNOT_INITIALIZED;
+/* item types */
+#define NET_ITEM_TABLE		1
+#define NET_ITEM_EVENT		2
+
+/*
+ * All fields are in network byte order.
+ * DATA: seq is the datagram's number, items follow.
+ * NACK: asks node arg[1], incarnation arg[2], for the arg[0] datagrams
+ * starting at seq.
+ * HEARTBEAT: seq is the number of the last datagram sent.
+ * GONE: tells node arg[1], incarnation arg[2], that seq is the oldest
+ * datagram still in the history, in answer to a NACK asking for older ones.
+ */
+struct net_header {
+	uint32_t magic;
+	uint8_t  type;
+	uint8_t  node;		/* sender's node number, 1..32 */
+	uint16_t items;
+	uint32_t incarnation;	/* changes when the sender restarts */
+	uint32_t seq;
+	uint32_t arg[3];
+};
+
+/*
+ * TABLE: len bytes of data (little-endian words) at byte offset arg[0].
+ * EVENT: arg[] = { destination nodes, XmemEventMask, data }.
+ */
+struct net_item {
+	uint16_t type;
+	uint16_t len;
+	uint32_t table;
+	uint32_t arg[3];
+};
+
+struct net_sent {
+	uint32_t seq;
+	int	 len;
+	char	 data[NET_PACKET];
+};
+
+struct net_peer {
+	int	 valid;
+	int	 node;		/* its node number, 1..32 */
+	uint32_t incarnation;
+	uint32_t next;		/* number of the next datagram to apply */
+	uint32_t last;		/* highest number known to be sent */
+	int64_t	 heard;		/* when last heard of, in us */
+	int64_t	 nacked;	/* when the open gap was last NACK'ed */
+	int	 tries;		/* NACKs sent for the open gap */
+	char	 *held;		/* NET_REORDER datagrams, allocated on need */
+	int	 held_len[NET_REORDER];
+};
+
+static int net_sock = -1;
+static int net_pipe[2] = { -1, -1 };	/* wakes up the thread to send */
+static struct sockaddr_in net_group;
+static int net_node;		/* my node number, 1..32 */
+static uint32_t net_incarnation;
+static pthread_mutex_t net_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t net_cond = PTHREAD_COND_INITIALIZER;
+
+static char *net_tables[XmemDrvrSEGMENTS];	/* mirrors, by descriptor */
+static XmemTableId net_tmsk;			/* for CheckTables */
+static uint32_t net_gen[XmemMAX_TABLES];	/* updates seen, per table */
+
+static char net_pending[NET_PACKET];	/* datagram being filled */
+static int net_pending_len;
+static int64_t net_pending_since;
+static uint32_t net_seq = 1;		/* number of the next datagram */
+static struct net_sent *net_history;
+static int64_t net_heartbeat;		/* when the last one was sent */
+
+static struct net_peer net_peers[NET_PEERS];
+
+static XmemCallbackStruct net_queue[NET_QUEUE];
+static int net_queue_head, net_queue_count;
+
+
+#if (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__) || \
+	(!defined(__BYTE_ORDER__) && defined(__powerpc__))
+static void NetCopyWords(void *dst, const void *src, int bytes)
+{
+	const uint32_t *s = src;
+	uint32_t *d = dst;
+	uint32_t w;
+
+	for (; bytes > 0; bytes -= 4) {
+		w = *s++;
+		*d++ = (w << 24) | ((w & 0xff00) << 8) |
+			((w >> 8) & 0xff00) | (w >> 24);
+	}
 }
+#else
+#define NetCopyWords(dst, src, bytes) memcpy(dst, src, bytes)
+#endif
 
-/* ==================================================================== */
-/* Get all currently up and running nodes.                              */
-/* The set of up and running nodes is determined dynamically through a  */
-/* handshake protocol between nodes.                                    */
 
-XmemNodeId NetworkGetAllNodeIds() {
+static int64_t NetUsecs(void)
+{
+	struct timespec ts;
 
-   return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
-/* ==================================================================== */
-/* Get the name of a node from its node Id, this is usually the name of */
-/* the host on which the node is implemented.                           */
 
-char * NetworkGetNodeName(XmemNodeId node) {
+/**
+ * NetDesc - Get the descriptor of a table
+ *
+ * @param tid: table Id
+ *
+ * @return index of the descriptor in seg_tab; -1 if there's none
+ */
+static int NetDesc(XmemTableId tid)
+{
+	int i;
 
-   return (char *) 0;
+	if (!(seg_tab.Used & tid))
+		return -1;
+	for (i = 0; i < XmemDrvrSEGMENTS; i++)
+		if (seg_tab.Descriptors[i].Id == tid)
+			return i;
+	return -1;
 }
 
-/* ==================================================================== */
-/* Get the Id of a node from its name.                                  */
 
-XmemNodeId NetworkGetNodeId(XmemName name) {
+/**
+ * NetQueue - Queue an event for XmemWait/XmemPoll
+ *
+ * @param cbs: the event
+ *
+ * Called with net_lock held. Like the driver, only the events there is a
+ * callback for are queued; when the queue is full the oldest one is lost.
+ */
+static void NetQueue(XmemCallbackStruct *cbs)
+{
+	int i;
+
+	if (cbs->Mask == XmemEventMaskTABLE_UPDATE) {
+		net_tmsk |= cbs->Table;
+		for (i = 0; i < XmemMAX_TABLES; i++)
+			if (cbs->Table & (1 << i))
+				net_gen[i]++;
+	}
+	if (!(callmask & cbs->Mask))
+		return;
+	if (net_queue_count == NET_QUEUE) {
+		net_queue_head = (net_queue_head + 1) % NET_QUEUE;
+		net_queue_count--;
+	}
+	net_queue[(net_queue_head + net_queue_count) % NET_QUEUE] = *cbs;
+	net_queue_count++;
+	pthread_cond_signal(&net_cond);
+}
 
-   return 0;
+
+/**
+ * NetSend - Send a datagram to the group
+ *
+ * @param buf: the datagram
+ * @param len: its length
+ *
+ * @return 0 on success, -1 (and errno set) on failure
+ */
+static int NetSend(void *buf, int len)
+{
+	if (sendto(net_sock, buf, len, 0, (struct sockaddr *)&net_group,
+			sizeof(net_group)) != len)
+		return -1;
+	return 0;
 }
 
-/* ==================================================================== */
-/* Get all currently defined table Ids. There can be up to 32 tables    */
-/* each ones Id corresponds to a single bit in an unsigned long.        */
 
-XmemTableId NetworkGetAllTableIds() {
+/**
+ * NetWake - Have the thread look at the pending datagram
+ *
+ * @param : none
+ */
+static void NetWake(void)
+{
+	char c = 0;
+
+	/* a full pipe means the thread has been woken up already */
+	if (write(net_pipe[1], &c, 1) < 0)
+		return;
+}
+
+
+/**
+ * NetFlush - Send the pending datagram
+ *
+ * @param : none
+ *
+ * Called with net_lock held. The datagram is kept in the history in case
+ * a node asks for it again.
+ *
+ * @return 0 on success, -1 (and errno set) on failure
+ */
+static int NetFlush(void)
+{
+	struct net_header *hdr = (void *)net_pending;
+	struct net_sent *sent;
+	int len = net_pending_len;
 
-   return 0;
+	if (!len)
+		return 0;
+	net_pending_len = 0;
+	hdr->seq = htonl(net_seq);
+	sent = &net_history[net_seq % NET_HISTORY];
+	sent->seq = net_seq;
+	sent->len = len;
+	memcpy(sent->data, net_pending, len);
+	net_seq++;
+	return NetSend(sent->data, len);
 }
 
-/* ==================================================================== */
-/* Get the name of a table from its table Id. Tables are defined from   */
-/* a configuration file.                                                */
 
-char * NetworkGetTableName(XmemTableId table) {
+/**
+ * NetAppend - Add an item to the pending datagram
+ *
+ * @param type: NET_ITEM_TABLE or NET_ITEM_EVENT
+ * @param table: table Id
+ * @param a0, a1, a2: the item's arguments
+ * @param data: table data, in host order
+ * @param len: bytes of table data
+ *
+ * Called with net_lock held; the datagram is sent first if the item
+ * doesn't fit.
+ *
+ * @return 0 on success, -1 (and errno set) on failure
+ */
+static int NetAppend(int type, uint32_t table, uint32_t a0, uint32_t a1,
+		     uint32_t a2, const void *data, int len)
+{
+	struct net_header *hdr = (void *)net_pending;
+	struct net_item *item;
 
-   return (char *) 0;
+	if (net_pending_len + sizeof(*item) + len > NET_PACKET &&
+		NetFlush() < 0)
+		return -1;
+	if (!net_pending_len) {
+		bzero(hdr, sizeof(*hdr));
+		hdr->magic = htonl(NET_MAGIC);
+		hdr->type = NET_DATA;
+		hdr->node = net_node;
+		hdr->incarnation = htonl(net_incarnation);
+		net_pending_len = sizeof(*hdr);
+		net_pending_since = NetUsecs();
+	}
+	item = (void *)(net_pending + net_pending_len);
+	item->type   = htons(type);
+	item->len    = htons(len);
+	item->table  = htonl(table);
+	item->arg[0] = htonl(a0);
+	item->arg[1] = htonl(a1);
+	item->arg[2] = htonl(a2);
+	if (len)
+		NetCopyWords(item + 1, data, len);
+	net_pending_len += sizeof(*item) + len;
+	hdr->items = htons(ntohs(hdr->items) + 1);
+	return 0;
 }
 
-/* ==================================================================== */
-/* Get the Id of a table from its name.                                 */
 
-XmemTableId NetworkGetTableId(XmemName name ) {
+/**
+ * NetApply - Apply a datagram from another node
+ *
+ * @param buf: the datagram
+ * @param len: its length
+ *
+ * Called with net_lock held. Writes to tables not defined here, or out of
+ * their bounds, are ignored.
+ */
+static void NetApply(char *buf, int len)
+{
+	struct net_header *hdr = (void *)buf;
+	struct net_item *item;
+	XmemCallbackStruct cbs;
+	uint32_t off, tid;
+	int i, n, ilen, d;
 
-   return 0;
+	n = ntohs(hdr->items);
+	buf += sizeof(*hdr);
+	len -= sizeof(*hdr);
+	for (i = 0; i < n && len >= sizeof(*item); i++) {
+		item = (void *)buf;
+		ilen = ntohs(item->len);
+		if (sizeof(*item) + ilen > len)
+			break;
+		tid = ntohl(item->table);
+		switch (ntohs(item->type)) {
+		case NET_ITEM_TABLE:
+			off = ntohl(item->arg[0]);
+			d = NetDesc(tid);
+			/* off comes off the wire: don't let off + ilen wrap */
+			if (d < 0 || off > seg_tab.Descriptors[d].Size ||
+				ilen > seg_tab.Descriptors[d].Size - off)
+				break;
+			NetCopyWords(net_tables[d] + off, item + 1, ilen & ~3);
+			break;
+		case NET_ITEM_EVENT:
+			if (!(ntohl(item->arg[0]) & my_nid))
+				break;
+			cbs.Mask  = ntohl(item->arg[1]);
+			cbs.Table = tid;
+			cbs.Node  = 1 << (hdr->node - 1);
+			cbs.Data  = ntohl(item->arg[2]);
+			NetQueue(&cbs);
+			break;
+		default:
+			break;
+		}
+		buf += sizeof(*item) + ilen;
+		len -= sizeof(*item) + ilen;
+	}
 }
 
-/* ==================================================================== */
-/* Get the description of a table, namley its size, and which nodes can */
-/* write to it.                                                         */
 
-XmemError NetworkGetTableDesc(XmemTableId    table,
-			      unsigned long *size,
-			      XmemNodeId    *nodes) {
+/**
+ * NetLost - Give up on the datagrams missing from a peer
+ *
+ * @param p: the peer
+ * @param next: number of the next datagram to apply
+ *
+ * Called with net_lock held.
+ */
+static void NetLost(struct net_peer *p, uint32_t next)
+{
+	XmemCallbackStruct cbs;
 
-   return XmemErrorNOT_INITIALIZED;
+	bzero((void *)&cbs, sizeof(cbs));
+	cbs.Mask = XmemEventMaskIO;
+	cbs.Node = 1 << (p->node - 1);
+	cbs.Data = XmemIoErrorCONTACT;
+	NetQueue(&cbs);
+	p->next = next;
+	p->tries = 0;
 }
 
-/* ==================================================================== */
-/* Register your call back to handle Xmem Events.                       */
 
-XmemError NetworkRegisterCallback(void (*cb(XmemCallbackStruct *cbs)),
-				  XmemEventMask mask) {
+/**
+ * NetHeld - Get a held datagram
+ *
+ * @param p: the peer
+ * @param seq: number of the datagram
+ *
+ * @return the datagram; NULL if it isn't held
+ */
+static char *NetHeld(struct net_peer *p, uint32_t seq)
+{
+	struct net_header *hdr;
+	int slot = seq % NET_REORDER;
 
-   return XmemErrorNOT_INITIALIZED;
+	if (!p->held || !p->held_len[slot])
+		return NULL;
+	hdr = (void *)(p->held + slot * NET_PACKET);
+	return ntohl(hdr->seq) == seq ? (char *)hdr : NULL;
 }
 
-/* ==================================================================== */
-/* Wait for an Xmem Event with time out, an incomming event will call   */
-/* any registered callback.                                             */
 
-XmemEventMask NetworkWait(int timeout) {
+/**
+ * NetDrain - Apply the held datagrams that are next in order
+ *
+ * @param p: the peer
+ *
+ * Called with net_lock held.
+ */
+static void NetDrain(struct net_peer *p)
+{
+	char *buf;
+	int slot;
 
-   return 0;
+	while ((buf = NetHeld(p, p->next)) != NULL) {
+		slot = p->next % NET_REORDER;
+		NetApply(buf, p->held_len[slot]);
+		p->held_len[slot] = 0;
+		p->next++;
+		p->tries = 0;
+	}
 }
 
-/* ==================================================================== */
-/* Poll for any Xmem Events, an incomming event will call any callback  */
-/* that is registered for that event.                                   */
 
-XmemEventMask NetworkPoll() {
+/**
+ * NetNack - Ask a peer for the datagrams of its open gap
+ *
+ * @param p: the peer
+ * @param now: current time, in us
+ *
+ * Called with net_lock held. After NET_NACK_TRIES unanswered NACKs, the
+ * gap is given up: the held datagrams after it are applied.
+ */
+static void NetNack(struct net_peer *p, int64_t now)
+{
+	struct net_header hdr;
+	uint32_t s, count;
 
-   return 0;
+	if ((int32_t)(p->last - p->next) < 0 ||
+		now - p->nacked < NET_NACK_MS * 1000)
+		return;
+	if (p->tries >= NET_NACK_TRIES) {
+		/* skip to the first datagram held, if any */
+		for (s = p->next + 1; (int32_t)(s - p->last) <= 0; s++)
+			if (NetHeld(p, s))
+				break;
+		NetLost(p, s);
+		NetDrain(p);
+		if ((int32_t)(p->last - p->next) < 0)
+			return;
+	}
+	/* no more than can be held */
+	count = p->last - p->next + 1;
+	if (count > NET_REORDER)
+		count = NET_REORDER;
+	bzero(&hdr, sizeof(hdr));
+	hdr.magic = htonl(NET_MAGIC);
+	hdr.type = NET_NACK;
+	hdr.node = net_node;
+	hdr.incarnation = htonl(net_incarnation);
+	hdr.seq = htonl(p->next);
+	hdr.arg[0] = htonl(count);
+	hdr.arg[1] = htonl(p->node);
+	hdr.arg[2] = htonl(p->incarnation);
+	NetSend(&hdr, sizeof(hdr));
+	p->nacked = now;
+	p->tries++;
 }
 
-/* ==================================================================== */
-/* Send your buffer to a reflective memory table. A table update event  */
-/* is broadcast automatically.                                          */
 
-XmemError NetworkSendTable(XmemTableId table, void *buf) {
+/**
+ * NetFind - Find the state of a sender
+ *
+ * @param hdr: datagram received from it
+ *
+ * @return the sender's state; NULL if it isn't known
+ *
+ * Called with net_lock held.
+ */
+static struct net_peer *NetFind(struct net_header *hdr)
+{
+	struct net_peer *p;
 
-   return XmemErrorNOT_INITIALIZED;
+	for (p = net_peers; p < net_peers + NET_PEERS; p++)
+		if (p->valid && p->node == hdr->node &&
+			p->incarnation == ntohl(hdr->incarnation))
+			return p;
+	return NULL;
 }
 
-/* ==================================================================== */
-/* Update your buffer from a reflective memory table.                   */
 
-XmemError NetworkRecvTable(XmemTableId table, void *buf) {
+/**
+ * NetPeer - Get the state of a sender, starting it if it's new
+ *
+ * @param hdr: datagram received from it
+ * @param next: where to start if it's new
+ *
+ * A new sender takes a free slot or else the one heard of least recently:
+ * a sender that restarted gets a new incarnation, and its old one ages out.
+ *
+ * Called with net_lock held.
+ */
+static struct net_peer *NetPeer(struct net_header *hdr, uint32_t next)
+{
+	struct net_peer *p, *q;
 
-   return XmemErrorNOT_INITIALIZED;
+	p = NetFind(hdr);
+	if (!p) {
+		p = net_peers;
+		for (q = net_peers; q < net_peers + NET_PEERS; q++) {
+			if (!q->valid) {
+				p = q;
+				break;
+			}
+			if (q->heard < p->heard)
+				p = q;
+		}
+		p->valid = 1;
+		p->node = hdr->node;
+		p->incarnation = ntohl(hdr->incarnation);
+		p->next = next;
+		p->last = next - 1;
+		p->nacked = 0;
+		p->tries = 0;
+		bzero(p->held_len, sizeof(p->held_len));
+	}
+	p->heard = NetUsecs();
+	return p;
 }
 
-/* ==================================================================== */
-/* Send a message to other nodes. If the node parameter is zero, then   */
-/* nothing happens, if its equal to 0xFFFFFFFF the message is sent via  */
-/* broadcast, else multicast or unicast is used.                        */
 
-XmemError NetworkSendMessage(XmemNodeId nodes, XmemMessage *mess) {
+/**
+ * NetReceive - Handle a datagram
+ *
+ * @param buf: the datagram
+ * @param len: its length
+ *
+ * Called with net_lock held.
+ */
+static void NetReceive(char *buf, int len)
+{
+	struct net_header *hdr = (void *)buf;
+	struct net_peer *p;
+	struct net_sent *sent;
+	uint32_t seq, s, count, oldest;
+	int32_t d;
+
+	if (len < sizeof(*hdr) || ntohl(hdr->magic) != NET_MAGIC ||
+		hdr->node < 1 || hdr->node > XmemMAX_NODES)
+		return;
+	if (hdr->node == net_node &&
+		ntohl(hdr->incarnation) == net_incarnation)
+		return; /* looped back */
+	seq = ntohl(hdr->seq);
 
-   return XmemErrorNOT_INITIALIZED;
+	switch (hdr->type) {
+	case NET_DATA:
+		p = NetPeer(hdr, seq);
+		d = seq - p->next;
+		if (d < 0)
+			return; /* already applied */
+		if ((int32_t)(seq - p->last) > 0)
+			p->last = seq;
+		if (d >= NET_REORDER) {
+			/* too far ahead to hold: it'll have to be resent */
+			NetNack(p, NetUsecs());
+			return;
+		}
+		if (d == 0) {
+			NetApply(buf, len);
+			p->next++;
+			p->tries = 0;
+			NetDrain(p);
+			return;
+		}
+		if (!p->held) {
+			p->held = malloc(NET_REORDER * NET_PACKET);
+			if (!p->held)
+				return;
+		}
+		memcpy(p->held + (seq % NET_REORDER) * NET_PACKET, buf, len);
+		p->held_len[seq % NET_REORDER] = len;
+		NetNack(p, NetUsecs());
+		break;
+	case NET_HEARTBEAT:
+		p = NetPeer(hdr, seq + 1);
+		if ((int32_t)(seq - p->last) > 0)
+			p->last = seq;
+		NetNack(p, NetUsecs());
+		break;
+	case NET_NACK:
+		if (ntohl(hdr->arg[1]) != net_node ||
+			ntohl(hdr->arg[2]) != net_incarnation)
+			break;
+		/* count comes off the wire: no more than the history holds */
+		count = ntohl(hdr->arg[0]);
+		if (count > NET_HISTORY)
+			count = NET_HISTORY;
+		oldest = net_seq - NET_HISTORY;
+		if ((int32_t)(oldest - 1) < 0)
+			oldest = 1;
+		if ((int32_t)(seq - oldest) < 0) {
+			hdr->type = NET_GONE;
+			hdr->arg[1] = htonl(hdr->node);
+			hdr->arg[2] = hdr->incarnation;
+			hdr->node = net_node;
+			hdr->incarnation = htonl(net_incarnation);
+			hdr->seq = htonl(oldest);
+			NetSend(hdr, sizeof(*hdr));
+			count -= oldest - seq;
+			seq = oldest;
+			if ((int32_t)count <= 0)
+				break;
+		}
+		for (s = seq; s - seq < count; s++) {
+			sent = &net_history[s % NET_HISTORY];
+			if (sent->len && sent->seq == s)
+				NetSend(sent->data, sent->len);
+		}
+		break;
+	case NET_GONE:
+		if (ntohl(hdr->arg[1]) != net_node ||
+			ntohl(hdr->arg[2]) != net_incarnation)
+			break;
+		p = NetFind(hdr);
+		if (!p || (int32_t)(seq - p->next) <= 0)
+			break;
+		NetLost(p, seq);
+		NetDrain(p);
+		p->nacked = 0;
+		NetNack(p, NetUsecs());
+		break;
+	default:
+		break;
+	}
 }
 
-/* ==================================================================== */
-/* Check which tables were updated.                                     */
 
-XmemTableId NetworkCheckTables() {
+/**
+ * NetThread - Receive datagrams; send lingering data, heartbeats, NACKs
+ *
+ * @param arg: unused
+ */
+static void *NetThread(void *arg)
+{
+	struct pollfd 		pfd[2];
+	struct net_header 	hdr;
+	char 			buf[NET_PACKET], c;
+	int64_t 		now;
+	int 			i, len, tmo;
+
+	pfd[0].fd = net_sock;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = net_pipe[0];
+	pfd[1].events = POLLIN;
+	tmo = NET_HEARTBEAT_MS;
+	for (;;) {
+		if (poll(pfd, 2, tmo) < 0 && errno != EINTR)
+			break;
+		while (read(net_pipe[0], &c, 1) > 0)
+			;
+		pthread_mutex_lock(&net_lock);
+		while ((len = recv(net_sock, buf, sizeof(buf),
+					MSG_DONTWAIT)) > 0)
+			NetReceive(buf, len);
 
-   return XmemErrorNOT_INITIALIZED;
+		now = NetUsecs();
+		tmo = NET_HEARTBEAT_MS;
+		if (net_pending_len) {
+			if (now - net_pending_since >= NET_LINGER_US)
+				NetFlush();
+			else
+				tmo = 1;
+		}
+		if (now - net_heartbeat >= NET_HEARTBEAT_MS * 1000) {
+			bzero(&hdr, sizeof(hdr));
+			hdr.magic = htonl(NET_MAGIC);
+			hdr.type = NET_HEARTBEAT;
+			hdr.node = net_node;
+			hdr.incarnation = htonl(net_incarnation);
+			hdr.seq = htonl(net_seq - 1);
+			NetSend(&hdr, sizeof(hdr));
+			net_heartbeat = now;
+		}
+		for (i = 0; i < NET_PEERS; i++) {
+			if (!net_peers[i].valid)
+				continue;
+			NetNack(&net_peers[i], now);
+			if ((int32_t)(net_peers[i].last - net_peers[i].next) >= 0
+				&& tmo > NET_NACK_MS)
+				tmo = NET_NACK_MS;
+		}
+		pthread_mutex_unlock(&net_lock);
+	}
+	return NULL;
 }
 
-XmemError NetworkSendSoftWakeup(uint32_t nodeid, uint32_t data)
+
+/**
+ * NetNodeNumber - Find out the node number of this host
+ *
+ * @param : none
+ *
+ * @return the node number (1 to 32); 0 if it's unknown
+ */
+static int NetNodeNumber(void)
 {
+	char 	host[64], *cp;
+	int 	i, nid;
+
+	cp = getenv("XMEM_NET_NODE");
+	if (cp) {
+		nid = atoi(cp);
+		return nid >= 1 && nid <= XmemMAX_NODES ? nid : 0;
+	}
+	if (gethostname(host, sizeof(host)) < 0)
+		return 0;
+	host[sizeof(host) - 1] = '\0';
+	cp = strchr(host, '.');
+	if (cp)
+		*cp = '\0';
+	for (i = 0; i < XmemDrvrNODES; i++) {
+		if (!(node_tab.Used & node_tab.Descriptors[i].Id) ||
+			strcasecmp(host, node_tab.Descriptors[i].Name))
+			continue;
+		for (nid = 1; nid <= XmemMAX_NODES; nid++)
+			if (node_tab.Descriptors[i].Id == 1 << (nid - 1))
+				return nid;
+	}
 	return 0;
 }
+
+
+/**
+ * NetworkInitialize - Join the multicast group and start receiving
+ *
+ * @param : none
+ *
+ * @return Appropriate error code (XmemError)
+ */
+XmemError NetworkInitialize()
+{
+	struct sockaddr_in 	addr;
+	struct ip_mreq 		mreq;
+	pthread_t 		thread;
+	unsigned char 		ttl, loop;
+	char 			*cp;
+	int 			i, one;
+
+	if (net_sock >= 0)
+		return XmemErrorSUCCESS;
+	net_node = NetNodeNumber();
+	if (!net_node)
+		return XmemErrorNOT_INITIALIZED;
+
+	bzero(&net_group, sizeof(net_group));
+	net_group.sin_family = AF_INET;
+	cp = getenv("XMEM_NET_GROUP");
+	net_group.sin_addr.s_addr = inet_addr(cp ? cp : NET_GROUP);
+	cp = getenv("XMEM_NET_PORT");
+	net_group.sin_port = htons(cp ? atoi(cp) : NET_PORT);
+	bzero(&mreq, sizeof(mreq));
+	mreq.imr_multiaddr = net_group.sin_addr;
+	cp = getenv("XMEM_NET_IF");
+	mreq.imr_interface.s_addr = cp ? inet_addr(cp) : htonl(INADDR_ANY);
+	cp = getenv("XMEM_NET_TTL");
+	ttl = cp ? atoi(cp) : 1;
+	loop = 1;
+	one = 1;
+
+	for (i = 0; i < XmemDrvrSEGMENTS; i++) {
+		if (!(seg_tab.Used & seg_tab.Descriptors[i].Id))
+			continue;
+		net_tables[i] = calloc(1, seg_tab.Descriptors[i].Size);
+		if (!net_tables[i])
+			goto nomem;
+	}
+	net_history = calloc(NET_HISTORY, sizeof(struct net_sent));
+	if (!net_history)
+		goto nomem;
+
+	net_sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (net_sock < 0)
+		goto err;
+	bzero(&addr, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = net_group.sin_port;
+	if (setsockopt(net_sock, SOL_SOCKET, SO_REUSEADDR, &one,
+			sizeof(one)) < 0 ||
+		bind(net_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+		setsockopt(net_sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+			sizeof(mreq)) < 0 ||
+		setsockopt(net_sock, IPPROTO_IP, IP_MULTICAST_IF,
+			&mreq.imr_interface, sizeof(mreq.imr_interface)) < 0 ||
+		setsockopt(net_sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl,
+			sizeof(ttl)) < 0 ||
+		setsockopt(net_sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop,
+			sizeof(loop)) < 0)
+		goto err;
+	/* a smaller buffer only means more retransmissions */
+	i = NET_RCVBUF;
+	setsockopt(net_sock, SOL_SOCKET, SO_RCVBUF, &i, sizeof(i));
+	if (pipe(net_pipe) < 0) {
+		net_pipe[0] = net_pipe[1] = -1;
+		goto err;
+	}
+	fcntl(net_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(net_pipe[1], F_SETFL, O_NONBLOCK);
+
+	net_incarnation = getpid() ^ (uint32_t)NetUsecs();
+	my_nid = 1 << (net_node - 1);
+	if (pthread_create(&thread, NULL, NetThread, NULL))
+		goto err;
+	pthread_detach(thread);
+	return XmemErrorSUCCESS;
+nomem:
+	errno = ENOMEM;
+err:
+	XmemErrorCallback(XmemErrorSYSTEM, errno);
+	if (net_pipe[0] >= 0) {
+		close(net_pipe[0]);
+		close(net_pipe[1]);
+		net_pipe[0] = net_pipe[1] = -1;
+	}
+	if (net_sock >= 0)
+		close(net_sock);
+	net_sock = -1;
+	free(net_history);
+	net_history = NULL;
+	for (i = 0; i < XmemDrvrSEGMENTS; i++) {
+		free(net_tables[i]);
+		net_tables[i] = NULL;
+	}
+	return XmemErrorNOT_INITIALIZED;
+}
+
+
+/**
+ * NetworkGetAllNodeIds - Get all currently up and running nodes
+ *
+ * @param : none
+ *
+ * @return this node, and the nodes heard of in the last NET_NODE_TIMEOUT_MS
+ */
+XmemNodeId NetworkGetAllNodeIds()
+{
+	XmemNodeId 	nodes;
+	int64_t 	now;
+	int 		i;
+
+	if (net_sock < 0)
+		return 0;
+	nodes = my_nid;
+	now = NetUsecs();
+	pthread_mutex_lock(&net_lock);
+	for (i = 0; i < NET_PEERS; i++)
+		if (net_peers[i].valid &&
+			now - net_peers[i].heard < NET_NODE_TIMEOUT_MS * 1000)
+			nodes |= 1 << (net_peers[i].node - 1);
+	pthread_mutex_unlock(&net_lock);
+	return nodes;
+}
+
+
+/**
+ * NetworkRegisterCallback - Register a callback to handle Xmem Events
+ *
+ * @param cb: callback
+ * @param mask: events to subscribe to; 0 unsubscribes from all events
+ *
+ * @return Appropriate error code (XmemError)
+ */
+XmemError NetworkRegisterCallback(void (*cb)(XmemCallbackStruct *cbs),
+				  XmemEventMask mask)
+{
+	if (net_sock < 0)
+		return XmemErrorCallback(XmemErrorNOT_INITIALIZED, 0);
+	pthread_mutex_lock(&net_lock);
+	if (!(mask & XmemEventMaskMASK)) {
+		callback = NULL;
+		callmask = 0;
+		net_queue_count = 0;
+	} else {
+		callmask |= mask & XmemEventMaskMASK;
+		callback = cb;
+	}
+	pthread_mutex_unlock(&net_lock);
+	return XmemErrorSUCCESS;
+}
+
+
+/**
+ * NetworkReadEvents - Handle the queued events
+ *
+ * @param : none
+ *
+ * Called with net_lock held, which is released around the callbacks.
+ *
+ * @return Mask with the events handled
+ */
+static XmemEventMask NetworkReadEvents(void)
+{
+	XmemCallbackStruct 	cbs[NET_QUEUE];
+	XmemEventMask 		emsk = 0;
+	int 			i, n;
+
+	n = net_queue_count;
+	for (i = 0; i < n; i++)
+		cbs[i] = net_queue[(net_queue_head + i) % NET_QUEUE];
+	net_queue_head = (net_queue_head + n) % NET_QUEUE;
+	net_queue_count = 0;
+	pthread_mutex_unlock(&net_lock);
+	for (i = 0; i < n; i++) {
+		emsk |= cbs[i].Mask;
+		if (callmask & cbs[i].Mask)
+			callback(&cbs[i]);
+	}
+	pthread_mutex_lock(&net_lock);
+	return emsk;
+}
+
+
+/**
+ * NetworkWait - Wait for an Event with timeout
+ *
+ * @param timeout: desired timeout for the wait (in chunks of 10ms); 0 means
+ * forever
+ *
+ * All the queued events are handled in one go.
+ *
+ * @return Mask with the incoming events handled (including timeout)
+ * @return 0 if there was an error
+ */
+XmemEventMask NetworkWait(int timeout)
+{
+	struct timespec 	end;
+	XmemCallbackStruct 	cbs;
+	XmemEventMask 		emsk = 0;
+
+	if (!callmask)
+		return 0;
+	if (net_sock < 0)
+		return XmemErrorCallback(XmemErrorNOT_INITIALIZED, 0);
+	clock_gettime(CLOCK_REALTIME, &end);
+	end.tv_sec  += timeout / 100;
+	end.tv_nsec += (timeout % 100) * 10000000;
+	if (end.tv_nsec >= 1000000000) {
+		end.tv_sec++;
+		end.tv_nsec -= 1000000000;
+	}
+	pthread_mutex_lock(&net_lock);
+	while (!net_queue_count) {
+		if (!timeout)
+			pthread_cond_wait(&net_cond, &net_lock);
+		else if (pthread_cond_timedwait(&net_cond, &net_lock,
+						&end) == ETIMEDOUT)
+			break;
+	}
+	if (net_queue_count)
+		emsk = NetworkReadEvents();
+	pthread_mutex_unlock(&net_lock);
+	if (emsk)
+		return emsk;
+	bzero((void *)&cbs, sizeof(XmemCallbackStruct));
+	cbs.Mask = XmemEventMaskTIMEOUT;
+	if (callmask & XmemEventMaskTIMEOUT)
+		callback(&cbs);
+	return XmemEventMaskTIMEOUT;
+}
+
+
+/**
+ * NetworkPoll - Poll for any incoming Xmem Events
+ *
+ * @param : none
+ *
+ * @return Mask with the events handled
+ * @return 0 if there's an error or there were no events
+ */
+XmemEventMask NetworkPoll()
+{
+	XmemEventMask emsk;
+
+	if (net_sock < 0 || !callmask)
+		return 0;
+	pthread_mutex_lock(&net_lock);
+	emsk = NetworkReadEvents();
+	pthread_mutex_unlock(&net_lock);
+	return emsk;
+}
+
+
+/**
+ * NetworkSendMessage - Send a message to other nodes
+ *
+ * @param nodes: receiving nodes
+ * @param mess: message
+ *
+ * The message is sent at once, together with any table data waiting to
+ * be sent, which is thus seen by the receivers before the message. It is
+ * also delivered locally when this node is one of the receivers.
+ *
+ * @return Appropriate error code (XmemError)
+ */
+XmemError NetworkSendMessage(XmemNodeId nodes, XmemMessage *mess)
+{
+	XmemCallbackStruct cbs;
+	int err;
+
+	if (net_sock < 0)
+		return XmemErrorCallback(XmemErrorNOT_INITIALIZED, 0);
+	bzero((void *)&cbs, sizeof(XmemCallbackStruct));
+	cbs.Node = my_nid;
+	switch (mess->MessageType) {
+	case XmemMessageTypeSEND_TABLE:
+		cbs.Mask  = XmemEventMaskSEND_TABLE;
+		cbs.Table = mess->Data;
+		break;
+	case XmemMessageTypeUSER:
+		cbs.Mask = XmemEventMaskUSER;
+		cbs.Data = mess->Data;
+		break;
+	case XmemMessageTypeTABLE_UPDATE:
+		cbs.Mask  = XmemEventMaskTABLE_UPDATE;
+		cbs.Table = mess->Data;
+		break;
+	case XmemMessageTypeINITIALIZE_ME:
+		cbs.Mask = XmemEventMaskINITIALIZED;
+		cbs.Data = mess->Data;
+		break;
+	case XmemMessageTypeKILL:
+		cbs.Mask = XmemEventMaskKILL;
+		cbs.Data = mess->Data;
+		break;
+	default:
+		return XmemErrorCallback(XmemErrorNO_SUCH_MESSAGE, 0);
+	}
+	if (!nodes)
+		return XmemErrorSUCCESS;
+	pthread_mutex_lock(&net_lock);
+	if (nodes & my_nid)
+		NetQueue(&cbs);
+	err = NetAppend(NET_ITEM_EVENT, cbs.Table, nodes, cbs.Mask, cbs.Data,
+			NULL, 0);
+	if (!err)
+		err = NetFlush();
+	pthread_mutex_unlock(&net_lock);
+	if (err)
+		return XmemErrorCallback(XmemErrorSYSTEM, errno);
+	return XmemErrorSUCCESS;
+}
+
+
+/**
+ * NetworkSendTable - Send a buffer to a reflective memory table
+ *
+ * @param tid: table to be written to
+ * @param buf: buffer containing the data
+ * @param elems: number of elements (4 bytes) to transfer
+ * @param offset: offset within the table
+ * @param upflag: update message flag
+ *
+ * The data may linger for up to NET_LINGER_US before being sent, unless
+ * an update is sent too. If @buf is NULL, the data waiting is sent now.
+ *
+ * @return Appropriate error code (XmemError)
+ */
+XmemError NetworkSendTable(XmemTableId tid, void *buf, int elems,
+			   int offset, int upflag)
+{
+	XmemMessage 	mess;
+	char 		*src;
+	int 		d, off, len, chunk, was, err = 0;
+
+	if (net_sock < 0)
+		return XmemErrorCallback(XmemErrorNOT_INITIALIZED, 0);
+	d = NetDesc(tid);
+	off = offset * sizeof(uint32_t);
+	len = elems * sizeof(uint32_t);
+	if (d < 0 || offset < 0 || elems < 0 ||
+		off + len > seg_tab.Descriptors[d].Size)
+		return XmemErrorCallback(XmemErrorSYSTEM, EINVAL);
+	if (buf != NULL && !(seg_tab.Descriptors[d].Nodes & my_nid))
+		return XmemErrorCallback(XmemErrorWRITE_PROTECTED, 0);
+
+	pthread_mutex_lock(&net_lock);
+	was = net_pending_len;
+	if (buf == NULL) {
+		err = NetFlush();
+	} else {
+		memcpy(net_tables[d] + off, buf, len);
+		chunk = (NET_PACKET - sizeof(struct net_header) -
+			sizeof(struct net_item)) & ~3;
+		for (src = buf; len && !err; src += chunk, off += chunk) {
+			if (chunk > len)
+				chunk = len;
+			err = NetAppend(NET_ITEM_TABLE, tid, off, 0, 0, src,
+					chunk);
+			len -= chunk;
+		}
+		/* unless the update follows, the thread sends it later */
+		if (!err && !upflag && !was && net_pending_len)
+			NetWake();
+	}
+	pthread_mutex_unlock(&net_lock);
+	if (err)
+		return XmemErrorCallback(XmemErrorSYSTEM, errno);
+	if (upflag) {
+		mess.MessageType = XmemMessageTypeTABLE_UPDATE;
+		mess.Data        = tid;
+		return NetworkSendMessage(XmemALL_NODES, &mess);
+	}
+	return XmemErrorSUCCESS;
+}
+
+
+/**
+ * NetworkRecvTable - Update buffer from a reflective memory table
+ *
+ * @param tid: table to read from
+ * @param buf: buffer to be updated
+ * @param elems: number of elements (4 bytes) to transfer
+ * @param offset: offset within the table
+ *
+ * The copy is taken from the local mirror, never while a datagram is
+ * being applied to it.
+ *
+ * @return Appropriate Error code (XmemError)
+ */
+XmemError NetworkRecvTable(XmemTableId tid, void *buf, int elems,
+			   int offset)
+{
+	int d, off, len;
+
+	if (net_sock < 0)
+		return XmemErrorCallback(XmemErrorNOT_INITIALIZED, 0);
+	d = NetDesc(tid);
+	off = offset * sizeof(uint32_t);
+	len = elems * sizeof(uint32_t);
+	if (d < 0 || offset < 0 || elems < 0 ||
+		off + len > seg_tab.Descriptors[d].Size)
+		return XmemErrorCallback(XmemErrorSYSTEM, EINVAL);
+	pthread_mutex_lock(&net_lock);
+	memcpy(buf, net_tables[d] + off, len);
+	pthread_mutex_unlock(&net_lock);
+	return XmemErrorSUCCESS;
+}
+
+
+/**
+ * NetworkCheckTables - Check which tables were updated
+ *
+ * @param : none
+ *
+ * @return mask with the tables for which an update was received since the
+ * previous call
+ */
+XmemTableId NetworkCheckTables()
+{
+	XmemTableId tmsk;
+
+	if (net_sock < 0)
+		return 0;
+	pthread_mutex_lock(&net_lock);
+	tmsk = net_tmsk;
+	net_tmsk = 0;
+	pthread_mutex_unlock(&net_lock);
+	return tmsk;
+}
+
+
+/**
+ * NetworkSendSoftWakeup - Wake up the clients of this node
+ *
+ * @param nodeid: sender's node id
+ * @param data: data for the woken up clients
+ *
+ * @return Appropriate error code (XmemError)
+ */
+XmemError NetworkSendSoftWakeup(uint32_t nodeid, uint32_t data)
+{
+	XmemCallbackStruct cbs;
+
+	if (net_sock < 0)
+		return XmemErrorCallback(XmemErrorNOT_INITIALIZED, 0);
+	bzero((void *)&cbs, sizeof(XmemCallbackStruct));
+	cbs.Mask  = XmemEventMaskSOFTWAKEUP;
+	cbs.Node  = nodeid ? 1 << (nodeid - 1) : 0;
+	cbs.Table = data;
+	pthread_mutex_lock(&net_lock);
+	NetQueue(&cbs);
+	pthread_mutex_unlock(&net_lock);
+	return XmemErrorSUCCESS;
+}
+
+
+/**
+ * NetworkGetGeneration - Get the update generation of a table
+ *
+ * @param tid: table id, with a single bit set
+ * @param gen: the generation is put here
+ *
+ * This is the count of the updates of the table seen by this process.
+ *
+ * @return Appropriate error code (XmemError)
+ */
+XmemError NetworkGetGeneration(XmemTableId tid, uint32_t *gen)
+{
+	int i;
+
+	if (net_sock < 0)
+		return XmemErrorNOT_INITIALIZED;
+	for (i = 0; i < XmemMAX_TABLES; i++) {
+		if (tid & (1 << i)) {
+			pthread_mutex_lock(&net_lock);
+			*gen = net_gen[i];
+			pthread_mutex_unlock(&net_lock);
+			return XmemErrorSUCCESS;
+		}
+	}
+	return XmemErrorNO_SUCH_TABLE;
+}
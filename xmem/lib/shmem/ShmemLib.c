@@ -1,195 +1,642 @@
-/* ==================================================================== */
-/* Implement a library to handle reflective memory Shmem back end.      */
-/* This device emulates reflective memory via the symp driver.          */
-/* Julian Lewis 14th Jan 2008                                           */
-/* ==================================================================== */
-
-/* Simple synchronization driver */
-
-#include <sympdrvr.h>
-
-int symp = 0;
-static SympDrvrIoBuf iob;
-static XmemCallbackStruct *cbs = (XmemCallbackStruct *) &(iob.IoBuf);
-static XmemTableId tmsk = 0;
-
-/* ==================================================================== */
-/* Try to initialize the specified device                               */
-
-XmemError ShmemInitialize() { /* Initialize hardware/software */
-
-char fnm[32];
-int  i, fn;
-
-   if (xmem == 0) {
-      for (i = 1; i <= SympDrvrCLIENT_CONTEXTS; i++) {
-	 sprintf(fnm,"/dev/symp.%1d",i);
-	 if ((fn = open(fnm,O_RDWR,0)) > 0) {
-	    symp = fn;
-	    xmem = symp;
-	    my_nid = 1;
-	    return XmemErrorSUCCESS;
-	 }
-      }
-      XmemErrorCallback(XmemErrorNOT_INITIALIZED,0);
-   }
-   return XmemErrorSUCCESS;
+/**
+ * @file ShmemLib.c
+ *
+ * @brief Reflective memory emulated in POSIX shared memory
+ *
+ * The processes of a host that initialise the library on XmemDeviceSHMEM
+ * share one shared memory object, which holds:
+ *
+ * - for every table, a sequence counter and a count of the updates sent.
+ *   The counter is a seqlock: it is odd while the table is being written,
+ *   and a read is retried until the counter is the same, and even, before
+ *   and after the copy. A reader thus never gets a torn buffer;
+ * - a ring in which every event (message) sent is published. Each process
+ *   keeps its own position in the ring, so every process sees every event,
+ *   as with the VMIC. A process that falls a whole ring behind loses the
+ *   oldest events, as it would when the driver's queue overflows;
+ * - the tables, at the offsets given in the segment table file, i.e. laid
+ *   out as in the VMIC's SDRAM.
+ *
+ * Waiting processes sleep on a futex that is bumped whenever an event is
+ * published; there are no system calls on the table I/O path.
+ *
+ * The object is named SHMEM_NAME, or $XMEM_SHMEM if set. The node Id of
+ * the process is $XMEM_SHMEM_NODE (1 to 32, default 1); running processes
+ * with different node Ids on the same object emulates several nodes.
+ *
+ * @author Julian Lewis
+ *
+ * @date Created on 14/01/2008
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#define SHMEM_NAME	"/xmem.shmem"
+#define SHMEM_MAGIC	0x584d5348	/* "XMSH" */
+#define SHMEM_EVENTS	256		/* events in the ring; a power of 2 */
+#define SHMEM_SPINS	1000		/* busy retries before yielding */
+#define SHMEM_YIELDS	100000		/* yields before giving up */
+
+struct shmem_event {
+	uint32_t seq;	/* index of the event + 1; 0 while it's written */
+	uint32_t nodes;	/* destination nodes */
+	uint32_t mask;	/* XmemEventMask */
+	uint32_t table;
+	uint32_t node;	/* sender */
+	uint32_t data;
+};
+
+struct shmem_header {
+	uint32_t magic;
+	uint32_t head;		/* index of the next event to be published */
+	uint32_t futex;		/* bumped after each event is published */
+	uint32_t waiters;	/* processes sleeping on the futex */
+	uint32_t seq[XmemMAX_TABLES];		/* per-table seqlock */
+	uint32_t updates[XmemMAX_TABLES];	/* per-table update count */
+	struct shmem_event events[SHMEM_EVENTS];
+};
+
+int symp = 0; /* non-zero on the SHMEM device; XmemDaemon looks at it */
+static struct shmem_header *shmem = NULL;
+static char *shmem_tables;	/* start of the tables in the object */
+static int shmem_create = 0;	/* create the object if it doesn't exist */
+static uint32_t shmem_next;	/* index of the next event to read */
+static uint32_t shmem_seen[XmemMAX_TABLES]; /* updates seen by CheckTables */
+
+
+/**
+ * ShmemBackoff - wait a bit before retrying a spin
+ *
+ * @param tries: number of retries so far
+ *
+ * @return 0 to retry, -1 to give up
+ */
+static int ShmemBackoff(int tries)
+{
+	if (tries < SHMEM_SPINS)
+		return 0;
+	if (tries > SHMEM_SPINS + SHMEM_YIELDS)
+		return -1;
+	sched_yield();
+	return 0;
 }
 
-/* ==================================================================== */
-/* Get all currently up and running nodes.                              */
-/* The set of up and running nodes is determined dynamically through a  */
-/* handshake protocol between nodes.                                    */
-
-XmemNodeId ShmemGetAllNodeIds() {
 
-   return my_nid;
+#ifdef __linux__
+static void ShmemFutexWait(uint32_t *addr, uint32_t val,
+			   const struct timespec *ts)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT, val, ts, NULL, 0);
 }
 
-/* ==================================================================== */
-/* Register your call back to handle Xmem Events.                       */
-
-XmemError ShmemRegisterCallback(void (*cb)(XmemCallbackStruct *cbs),
-			       XmemEventMask mask) {
-
-   callmask = (unsigned long) mask;
-   if (ioctl(symp,SympDrvrCONNECT,&callmask) < 0)
-      return XmemErrorCallback(XmemErrorSYSTEM,errno);
-
-   callback = cb;
-   return XmemErrorSUCCESS;
+static void ShmemFutexWake(uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0);
 }
+#else
+/* no futexes: sleep for a tick, or for the remaining time */
+static void ShmemFutexWait(uint32_t *addr, uint32_t val,
+			   const struct timespec *ts)
+{
+	struct timespec tick = { 0, 1000000 };
 
-/* ==================================================================== */
-/* Wait for an Xmem Event with time out, an incomming event will call   */
-/* any registered callback.                                             */
-
-XmemEventMask ShmemWait(int timeout) {
-
-int cc;
-
-   if (callmask == 0) return 0;
-
-   if (ioctl(symp,SympDrvrSET_TIMEOUT,&timeout) < 0)
-      return XmemErrorCallback(XmemErrorSYSTEM,errno);
+	if (ts && (ts->tv_sec == 0 && ts->tv_nsec < tick.tv_nsec))
+		tick = *ts;
+	if (*(volatile uint32_t *)addr == val)
+		nanosleep(&tick, NULL);
+}
 
-   cc = read(symp,&iob,sizeof(SympDrvrIoBuf));
-   if (cc <= 0) {
-      bzero((void *) cbs, sizeof(XmemCallbackStruct));
-      cbs->Mask = XmemEventMaskTIMEOUT;
-      if (callmask & XmemEventMaskTIMEOUT) callback(cbs);
-      return XmemEventMaskTIMEOUT;
-   }
-   if (cbs->Mask & XmemEventMaskTABLE_UPDATE) {
-      tmsk |= (1 << (cbs->Table -1));
-   }
+static void ShmemFutexWake(uint32_t *addr)
+{
+}
+#endif
+
+
+/**
+ * ShmemTable - Get the address of an I/O to a table
+ *
+ * @param tid: table Id (one bit only)
+ * @param elems: number of elements (4 bytes) to transfer
+ * @param offset: offset within the table, in elements
+ * @param idx: the table's bit number is returned here
+ * @param desc: the table's descriptor is returned here
+ *
+ * @return address in the shared memory; NULL if the table isn't defined or
+ * the I/O would go past its end.
+ */
+static char *ShmemTable(XmemTableId tid, int elems, int offset, int *idx,
+			XmemDrvrSegDesc **desc)
+{
+	int i;
+
+	if (!(seg_tab.Used & tid))
+		return NULL;
+	for (i = 0; i < XmemDrvrSEGMENTS; i++)
+		if (seg_tab.Descriptors[i].Id == tid)
+			break;
+	if (i == XmemDrvrSEGMENTS)
+		return NULL;
+	*desc = &seg_tab.Descriptors[i];
+	if (elems < 0 || offset < 0 ||
+		(offset + elems) * sizeof(uint32_t) > (*desc)->Size)
+		return NULL;
+	for (i = 0; i < XmemMAX_TABLES; i++)
+		if (tid == 1 << i)
+			break;
+	*idx = i;
+	return shmem_tables + (unsigned long)(*desc)->Address +
+		offset * sizeof(uint32_t);
+}
 
-   callback(cbs);
 
-   return (XmemEventMask) iob.Mask;
+/**
+ * ShmemPublish - Publish an event in the ring
+ *
+ * @param nodes: destination nodes
+ * @param cbs: the event
+ *
+ * The slot is invalidated while it's filled in, so that a reader racing
+ * with us (i.e. one that's a whole ring behind) notices it.
+ */
+static void ShmemPublish(XmemNodeId nodes, XmemCallbackStruct *cbs)
+{
+	struct shmem_event *ev;
+	uint32_t idx;
+
+	idx = __sync_fetch_and_add(&shmem->head, 1);
+	ev = &shmem->events[idx & (SHMEM_EVENTS - 1)];
+	ev->seq = 0;
+	__sync_synchronize();
+	ev->nodes = nodes;
+	ev->mask  = cbs->Mask;
+	ev->table = cbs->Table;
+	ev->node  = cbs->Node;
+	ev->data  = cbs->Data;
+	__sync_synchronize();
+	ev->seq = idx + 1;
+	__sync_fetch_and_add(&shmem->futex, 1);
+	if (shmem->waiters)
+		ShmemFutexWake(&shmem->futex);
 }
 
-/* ==================================================================== */
-/* Poll for any Xmem Events, an incomming event will call any callback  */
-/* that is registered for that event.                                   */
 
-XmemEventMask ShmemPoll() {
+/**
+ * ShmemReadEvents - Handle the events published since the last call
+ *
+ * @param : none
+ *
+ * @return Mask with the events handled; 0 if there were none
+ */
+static XmemEventMask ShmemReadEvents(void)
+{
+	struct shmem_event *ev, copy;
+	XmemCallbackStruct cbs;
+	XmemEventMask emsk = 0;
+	uint32_t seq;
+
+	for (;;) {
+		ev = &shmem->events[shmem_next & (SHMEM_EVENTS - 1)];
+		seq = *(volatile uint32_t *)&ev->seq;
+		__sync_synchronize();
+		if ((int32_t)(seq - (shmem_next + 1)) < 0)
+			break; /* not published yet */
+		copy = *ev;
+		__sync_synchronize();
+		if (seq != shmem_next + 1 ||
+			*(volatile uint32_t *)&ev->seq != seq) {
+			/* overwritten: skip to the oldest event still there */
+			shmem_next = *(volatile uint32_t *)&shmem->head -
+				SHMEM_EVENTS;
+			continue;
+		}
+		shmem_next++;
+		if (!(copy.nodes & my_nid))
+			continue;
+		cbs.Mask  = copy.mask;
+		cbs.Table = copy.table;
+		cbs.Node  = copy.node;
+		cbs.Data  = copy.data;
+		emsk |= cbs.Mask;
+		if (callmask & cbs.Mask)
+			callback(&cbs);
+	}
+	return emsk;
+}
 
-unsigned long qsize;
 
-   if (ioctl(symp,SympDrvrGET_QUEUE_SIZE,&qsize) < 0) {
-      XmemErrorCallback(XmemErrorSYSTEM,errno);
-      return 0;
-   }
-   if (qsize) return ShmemWait(0);
-   return 0;
+/**
+ * ShmemInitialize - Attach to the shared memory object
+ *
+ * @param : none
+ *
+ * The object is created when the library is initialised on
+ * XmemDeviceSHMEM; XmemDeviceANY only attaches to an existing one, so that
+ * a host without a VMIC doesn't silently end up on its own.
+ *
+ * @return Appropriate error code (XmemError)
+ */
+XmemError ShmemInitialize()
+{
+	unsigned long 	hsize, size, end;
+	struct stat 	st;
+	char 		*name, *node;
+	void 		*p;
+	int 		i, nid, fd;
+
+	if (shmem)
+		return XmemErrorSUCCESS;
+	name = getenv("XMEM_SHMEM");
+	if (name == NULL)
+		name = SHMEM_NAME;
+	node = getenv("XMEM_SHMEM_NODE");
+	nid = node ? atoi(node) : 1;
+	if (nid < 1 || nid > XmemMAX_NODES)
+		return XmemErrorNOT_INITIALIZED;
+
+	hsize = sysconf(_SC_PAGESIZE);
+	hsize = (sizeof(struct shmem_header) + hsize - 1) & ~(hsize - 1);
+	size = hsize;
+	for (i = 0; i < XmemDrvrSEGMENTS; i++) {
+		if (!(seg_tab.Used & seg_tab.Descriptors[i].Id))
+			continue;
+		end = hsize + (unsigned long)seg_tab.Descriptors[i].Address +
+			seg_tab.Descriptors[i].Size;
+		if (end > size)
+			size = end;
+	}
+
+	fd = shm_open(name, O_RDWR | (shmem_create ? O_CREAT : 0), 0666);
+	if (fd < 0)
+		return XmemErrorNOT_INITIALIZED;
+	/* a zero-filled object is a valid, empty one: just make it big enough */
+	if (fstat(fd, &st) < 0 ||
+		(st.st_size < size && ftruncate(fd, size) < 0)) {
+		XmemErrorCallback(XmemErrorSYSTEM, errno);
+		close(fd);
+		return XmemErrorNOT_INITIALIZED;
+	}
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		XmemErrorCallback(XmemErrorSYSTEM, errno);
+		return XmemErrorNOT_INITIALIZED;
+	}
+	shmem = p;
+	if (!__sync_bool_compare_and_swap(&shmem->magic, 0, SHMEM_MAGIC) &&
+		shmem->magic != SHMEM_MAGIC) {
+		munmap(p, size);
+		shmem = NULL;
+		return XmemErrorNOT_INITIALIZED;
+	}
+	shmem_tables = (char *)p + hsize;
+	symp = 1;
+	shmem_next = *(volatile uint32_t *)&shmem->head;
+	for (i = 0; i < XmemMAX_TABLES; i++)
+		shmem_seen[i] = shmem->updates[i];
+	my_nid = 1 << (nid - 1);
+	return XmemErrorSUCCESS;
 }
 
-/* ==================================================================== */
-/* Send a message to other nodes. If the node parameter is zero, then   */
-/* nothing happens, if its equal to 0xFFFFFFFF the message is sent via  */
-/* broadcast, else multicast or unicast is used.                        */
 
-XmemError ShmemSendMessage(XmemNodeId nodes, XmemMessage *mess) {
-
-int cc;
+/**
+ * ShmemGetAllNodeIds - Get all currently up and running nodes
+ *
+ * @param : none
+ *
+ * @return the nodes defined in the node table file
+ */
+XmemNodeId ShmemGetAllNodeIds()
+{
+	if (!shmem)
+		return 0;
+	return node_tab.Used | my_nid;
+}
 
-   cbs->Node  = my_nid;
 
-   switch (mess->MessageType) {
+/**
+ * ShmemRegisterCallback - Register a callback to handle Xmem Events
+ *
+ * @param cb: callback
+ * @param mask: events to subscribe to; 0 unsubscribes from all events
+ *
+ * @return Appropriate error code (XmemError)
+ */
+XmemError ShmemRegisterCallback(void (*cb)(XmemCallbackStruct *cbs),
+				XmemEventMask mask)
+{
+	if (!shmem)
+		return XmemErrorCallback(XmemErrorNOT_INITIALIZED, 0);
+	if (!(mask & XmemEventMaskMASK)) {
+		callback = NULL;
+		callmask = 0;
+		return XmemErrorSUCCESS;
+	}
+	callmask |= mask & XmemEventMaskMASK;
+	callback = cb;
+	return XmemErrorSUCCESS;
+}
 
-      case XmemMessageTypeSEND_TABLE:
-	 cbs->Table = mess->Data;
-	 cbs->Mask  = XmemEventMaskSEND_TABLE;
-      break;
 
-      case XmemMessageTypeUSER:
-	 cbs->Data  = mess->Data;
-	 cbs->Mask  = XmemEventMaskUSER;
-      break;
+/**
+ * ShmemWait - Wait for an Event with timeout
+ *
+ * @param timeout: desired timeout for the wait (in chunks of 10ms); 0 means
+ * forever
+ *
+ * All the events published since the last call are handled in one go.
+ *
+ * @return Mask with the incoming events handled (including timeout)
+ * @return 0 if there was an error
+ */
+XmemEventMask ShmemWait(int timeout)
+{
+	struct timespec 	now, end, ts, *tsp;
+	XmemCallbackStruct 	cbs;
+	XmemEventMask 		emsk;
+	uint32_t 		futex;
+
+	if (!callmask)
+		return 0;
+	if (!shmem)
+		return XmemErrorCallback(XmemErrorNOT_INITIALIZED, 0);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec  += timeout / 100;
+	end.tv_nsec += (timeout % 100) * 10000000;
+	if (end.tv_nsec >= 1000000000) {
+		end.tv_sec++;
+		end.tv_nsec -= 1000000000;
+	}
+	for (;;) {
+		/* read the futex first: an event published after this wakes us */
+		futex = *(volatile uint32_t *)&shmem->futex;
+		__sync_synchronize();
+		emsk = ShmemReadEvents();
+		if (emsk)
+			return emsk;
+		tsp = NULL;
+		if (timeout) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			ts.tv_sec  = end.tv_sec - now.tv_sec;
+			ts.tv_nsec = end.tv_nsec - now.tv_nsec;
+			if (ts.tv_nsec < 0) {
+				ts.tv_sec--;
+				ts.tv_nsec += 1000000000;
+			}
+			if (ts.tv_sec < 0)
+				break;
+			tsp = &ts;
+		}
+		__sync_fetch_and_add(&shmem->waiters, 1);
+		ShmemFutexWait(&shmem->futex, futex, tsp);
+		__sync_fetch_and_sub(&shmem->waiters, 1);
+	}
+	bzero((void *)&cbs, sizeof(XmemCallbackStruct));
+	cbs.Mask = XmemEventMaskTIMEOUT;
+	if (callmask & XmemEventMaskTIMEOUT)
+		callback(&cbs);
+	return XmemEventMaskTIMEOUT;
+}
 
-      case XmemMessageTypeTABLE_UPDATE:
-	 cbs->Table = mess->Data;
-	 cbs->Mask  = XmemEventMaskTABLE_UPDATE;
-      break;
 
-      case XmemMessageTypeINITIALIZE_ME:
-	 cbs->Data  = mess->Data;
-	 cbs->Mask = XmemEventMaskINITIALIZED;
-      break;
+/**
+ * ShmemPoll - Poll for any incoming Xmem Events
+ *
+ * @param : none
+ *
+ * @return Mask with the events handled
+ * @return 0 if there's an error or there were no events
+ */
+XmemEventMask ShmemPoll()
+{
+	if (!shmem || !callmask)
+		return 0;
+	return ShmemReadEvents();
+}
 
-      case XmemMessageTypeKILL:
-	 cbs->Mask = XmemEventMaskKILL;
-      break;
 
-      default:
-	 return XmemErrorCallback(XmemErrorNO_SUCH_MESSAGE,0);
-   }
-   iob.Mask = cbs->Mask;
-   cc = write(symp,&iob,sizeof(SympDrvrIoBuf));
-   return XmemErrorSUCCESS;
+/**
+ * ShmemSendMessage - Send a message to other nodes
+ *
+ * @param nodes: receiving nodes
+ * @param mess: message
+ *
+ * The message is seen by every process of the receiving nodes, the sender
+ * included when its node is one of them.
+ *
+ * @return Appropriate error code (XmemError)
+ */
+XmemError ShmemSendMessage(XmemNodeId nodes, XmemMessage *mess)
+{
+	XmemCallbackStruct cbs;
+	int i;
+
+	if (!shmem)
+		return XmemErrorCallback(XmemErrorNOT_INITIALIZED, 0);
+	bzero((void *)&cbs, sizeof(XmemCallbackStruct));
+	cbs.Node = my_nid;
+	switch (mess->MessageType) {
+	case XmemMessageTypeSEND_TABLE:
+		cbs.Mask  = XmemEventMaskSEND_TABLE;
+		cbs.Table = mess->Data;
+		break;
+	case XmemMessageTypeUSER:
+		cbs.Mask = XmemEventMaskUSER;
+		cbs.Data = mess->Data;
+		break;
+	case XmemMessageTypeTABLE_UPDATE:
+		cbs.Mask  = XmemEventMaskTABLE_UPDATE;
+		cbs.Table = mess->Data;
+		for (i = 0; i < XmemMAX_TABLES; i++)
+			if (mess->Data & (1 << i))
+				__sync_fetch_and_add(&shmem->updates[i], 1);
+		break;
+	case XmemMessageTypeINITIALIZE_ME:
+		cbs.Mask = XmemEventMaskINITIALIZED;
+		cbs.Data = mess->Data;
+		break;
+	case XmemMessageTypeKILL:
+		cbs.Mask = XmemEventMaskKILL;
+		cbs.Data = mess->Data;
+		break;
+	default:
+		return XmemErrorCallback(XmemErrorNO_SUCH_MESSAGE, 0);
+	}
+	if (nodes)
+		ShmemPublish(nodes, &cbs);
+	return XmemErrorSUCCESS;
 }
 
-/* ==================================================================== */
-/* Send your buffer to a reflective memory table. A table update event  */
-/* is broadcast automatically.                                          */
 
-XmemError ShmemSendTable(XmemTableId   tid,     /* Table to be written to      */
-				 void *buf,     /* Buffer containing table     */
-				 int elems, /* Nr of double words to transfer */
-				 int offset,   /* Offset of transfer          */
-				 int upflag) { /* Update message flag         */
+/**
+ * ShmemSendTable - Send a buffer to a reflective memory table
+ *
+ * @param tid: table to be written to
+ * @param buf: buffer containing the data
+ * @param elems: number of elements (4 bytes) to transfer
+ * @param offset: offset within the table
+ * @param upflag: update message flag
+ *
+ * Concurrent writers of a table are serialised by its seqlock. There is
+ * nothing to flush: if @buf is NULL, only the update is sent.
+ *
+ * @return Appropriate error code (XmemError)
+ */
+XmemError ShmemSendTable(XmemTableId tid, void *buf, int elems,
+			 int offset, int upflag)
+{
+	XmemMessage 	mess;
+	XmemDrvrSegDesc *desc;
+	uint32_t 	seq;
+	char 		*addr;
+	int 		i, idx;
+
+	if (!shmem)
+		return XmemErrorCallback(XmemErrorNOT_INITIALIZED, 0);
+	if (buf != NULL) {
+		addr = ShmemTable(tid, elems, offset, &idx, &desc);
+		if (addr == NULL)
+			return XmemErrorCallback(XmemErrorSYSTEM, EINVAL);
+		if (!(desc->Nodes & my_nid))
+			return XmemErrorCallback(XmemErrorWRITE_PROTECTED, 0);
+		for (i = 0;; i++) {
+			seq = *(volatile uint32_t *)&shmem->seq[idx];
+			if (!(seq & 1) &&
+				__sync_bool_compare_and_swap(&shmem->seq[idx],
+							     seq, seq + 1))
+				break;
+			if (ShmemBackoff(i))
+				return XmemErrorCallback(XmemErrorTIMEOUT, 0);
+		}
+		memcpy(addr, buf, elems * sizeof(uint32_t));
+		__sync_synchronize();
+		shmem->seq[idx] = seq + 2;
+	}
+	if (upflag) {
+		mess.MessageType = XmemMessageTypeTABLE_UPDATE;
+		mess.Data        = tid;
+		return ShmemSendMessage(XmemALL_NODES, &mess);
+	}
+	return XmemErrorSUCCESS;
+}
 
-XmemMessage mess;
 
-   if (upflag) {
-      mess.MessageType = XmemMessageTypeTABLE_UPDATE;
-      mess.Data        = tid;
-      return ShmemSendMessage(my_nid,&mess);
-   }
-   return XmemErrorSUCCESS;
+/**
+ * ShmemRecvTable - Update buffer from a reflective memory table
+ *
+ * @param tid: table to read from
+ * @param buf: buffer to be updated
+ * @param elems: number of elements (4 bytes) to transfer
+ * @param offset: offset within the table
+ *
+ * The copy is retried until no write to the table overlapped it.
+ *
+ * @return Appropriate Error code (XmemError)
+ */
+XmemError ShmemRecvTable(XmemTableId tid, void *buf, int elems,
+			 int offset)
+{
+	XmemDrvrSegDesc *desc;
+	uint32_t 	seq;
+	char 		*addr;
+	int 		i, idx;
+
+	if (!shmem)
+		return XmemErrorCallback(XmemErrorNOT_INITIALIZED, 0);
+	addr = ShmemTable(tid, elems, offset, &idx, &desc);
+	if (addr == NULL)
+		return XmemErrorCallback(XmemErrorSYSTEM, EINVAL);
+	for (i = 0;; i++) {
+		seq = *(volatile uint32_t *)&shmem->seq[idx];
+		if (!(seq & 1)) {
+			__sync_synchronize();
+			memcpy(buf, addr, elems * sizeof(uint32_t));
+			__sync_synchronize();
+			if (*(volatile uint32_t *)&shmem->seq[idx] == seq)
+				return XmemErrorSUCCESS;
+		}
+		if (ShmemBackoff(i))
+			return XmemErrorCallback(XmemErrorTIMEOUT, 0);
+	}
 }
 
-/* ==================================================================== */
-/* Update your buffer from a reflective memory table.                   */
-
-XmemError ShmemRecvTable(XmemTableId table, void *buf) {
 
-   return XmemErrorSUCCESS;
+/**
+ * ShmemCheckTables - Check which tables were updated
+ *
+ * @param : none
+ *
+ * @return mask with the tables for which an update was sent since the
+ * previous call
+ */
+XmemTableId ShmemCheckTables()
+{
+	XmemTableId 	tmsk = 0;
+	uint32_t 	upd;
+	int 		i;
+
+	if (!shmem)
+		return 0;
+	for (i = 0; i < XmemMAX_TABLES; i++) {
+		upd = *(volatile uint32_t *)&shmem->updates[i];
+		if (upd != shmem_seen[i]) {
+			shmem_seen[i] = upd;
+			tmsk |= 1 << i;
+		}
+	}
+	return tmsk;
 }
 
-/* ==================================================================== */
-/* Check which tables were updated.                                     */
 
-XmemTableId ShmemCheckTables() {
-XmemTableId tid;
-
-   tid = tmsk;
-   tmsk = 0;
-   return tid;
+/**
+ * ShmemSendSoftWakeup - Wake up the processes of this node
+ *
+ * @param nodeid: sender's node id
+ * @param data: data for the woken up clients
+ *
+ * @return Appropriate error code (XmemError)
+ */
+XmemError ShmemSendSoftWakeup(uint32_t nodeid, uint32_t data)
+{
+	XmemCallbackStruct cbs;
+
+	if (!shmem)
+		return XmemErrorCallback(XmemErrorNOT_INITIALIZED, 0);
+	bzero((void *)&cbs, sizeof(XmemCallbackStruct));
+	cbs.Mask  = XmemEventMaskSOFTWAKEUP;
+	cbs.Node  = nodeid ? 1 << (nodeid - 1) : 0;
+	cbs.Table = data;
+	ShmemPublish(my_nid, &cbs);
+	return XmemErrorSUCCESS;
 }
 
-XmemError ShmemSendSoftWakeup(uint32_t nodeid, uint32_t data)
+
+/**
+ * ShmemGetGeneration - Get the update generation of a table
+ *
+ * @param tid: table id, with a single bit set
+ * @param gen: the generation is put here
+ *
+ * This is the count of the updates sent for the table, from any process.
+ *
+ * @return Appropriate error code (XmemError)
+ */
+XmemError ShmemGetGeneration(XmemTableId tid, uint32_t *gen)
 {
-	return 0;
+	int i;
+
+	if (!shmem)
+		return XmemErrorNOT_INITIALIZED;
+	for (i = 0; i < XmemMAX_TABLES; i++) {
+		if (tid & (1 << i)) {
+			*gen = *(volatile uint32_t *)&shmem->updates[i];
+			return XmemErrorSUCCESS;
+		}
+	}
+	return XmemErrorNO_SUCH_TABLE;
 }
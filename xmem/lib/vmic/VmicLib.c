@@ -13,11 +13,18 @@
  */
 #include <xmemDrvr.h>
 #include <errno.h>
+#include <sys/mman.h>
 
 
 static int xmem = 0; //!< device file handler
 static void (*callback)(XmemCallbackStruct *cbs) = NULL;
 static XmemEventMask callmask = 0;
+static int vmic_timeout = -1; //!< last timeout set in the driver
+
+static XmemDrvrMmapInfo vmic_mmap;	//!< Size is 0 until it's known
+static char *vmic_sdram;		//!< SDRAM, read-only
+static int vmic_sdram_maps;		//!< tables mapped in it
+static volatile XmemDrvrGenerations *vmic_gen;
 
 /**
  * VmicWriteSegTable - Set the list of all segments into the driver
@@ -85,6 +92,7 @@ XmemError VmicInitialize()
 	if (xmem)
 		return XmemErrorSUCCESS;
 	xmem = VmicOpen();
+	vmic_timeout = -1;
 	if (!xmem)
 		goto notinit;
 
@@ -247,44 +255,24 @@ notinit:
 
 
 /**
- * VmicWait - Wait for an Event with timeout
+ * VmicHandleEvent - Call the callbacks for an event read from the driver
  *
- * @param timeout: desired timeout for the wait (in chunks of 10ms)
- *
- * When there's an incoming event, the appropriate registered callback will be
- * executed.
+ * @param rbf: event as returned by read()
  *
- * @return Mask with the incoming events handled (including timeout)
- * @return 0 if there was an error
+ * @return Mask with the events handled
  */
-XmemEventMask VmicWait(int timeout)
+static XmemEventMask VmicHandleEvent(XmemDrvrReadBuf *rbf)
 {
-	int 		i, cc;
+	int 		i;
 	XmemDrvrIntr 	imsk;
 	XmemEventMask 	emsk;
-	XmemDrvrReadBuf rbf;
 	XmemCallbackStruct cbs;
 
-	if (!callmask)
-		return 0;
-	if (!xmem)
-		return XmemErrorCallback(XmemErrorNOT_INITIALIZED, 0);
-	if (ioctl(xmem, XmemDrvrSET_TIMEOUT, &timeout) < 0) {
-		XmemErrorCallback(XmemErrorSYSTEM, errno);
-		return 0;
-	}
 	bzero((void *)&cbs, sizeof(XmemCallbackStruct));
-	cc = read(xmem, &rbf, sizeof(XmemDrvrReadBuf));
-	if (cc <= 0) {
-		cbs.Mask = XmemEventMaskTIMEOUT;
-		if (callmask & XmemEventMaskTIMEOUT)
-			callback(&cbs);
-		return XmemEventMaskTIMEOUT;
-	}
 	emsk = 0;
 	for (i = 0; i < XmemDrvrIntrSOURCES; i++) {
 		imsk = 1 << i;
-		switch (imsk & rbf.Mask) {
+		switch (imsk & rbf->Mask) {
 		case XmemDrvrIntrPARITY_ERROR:
 			cbs.Mask = XmemEventMaskIO;
 			cbs.Data = XmemIoErrorPARITY;
@@ -319,8 +307,8 @@ XmemEventMask VmicWait(int timeout)
 			break;
 		case XmemDrvrIntrPENDING_INIT:
 			cbs.Mask = XmemEventMaskINITIALIZED;
-			cbs.Node = 1 << (rbf.NodeId[XmemDrvrIntIdxPENDING_INIT] - 1);
-			cbs.Data = rbf.NdData[XmemDrvrIntIdxPENDING_INIT];
+			cbs.Node = 1 << (rbf->NodeId[XmemDrvrIntIdxPENDING_INIT] - 1);
+			cbs.Data = rbf->NdData[XmemDrvrIntIdxPENDING_INIT];
 			if (callmask & XmemEventMaskINITIALIZED)
 				callback(&cbs);
 			break;
@@ -333,32 +321,32 @@ XmemEventMask VmicWait(int timeout)
 		case XmemDrvrIntrSEGMENT_UPDATE:
 			emsk |= XmemEventMaskTABLE_UPDATE;
 			cbs.Mask  = XmemEventMaskTABLE_UPDATE;
-			cbs.Node  = 1 << (rbf.NodeId[XmemDrvrIntIdxSEGMENT_UPDATE] - 1);
-			cbs.Table = rbf.NdData[XmemDrvrIntIdxSEGMENT_UPDATE];
+			cbs.Node  = 1 << (rbf->NodeId[XmemDrvrIntIdxSEGMENT_UPDATE] - 1);
+			cbs.Table = rbf->NdData[XmemDrvrIntIdxSEGMENT_UPDATE];
 			if (callmask & XmemEventMaskTABLE_UPDATE)
 				callback(&cbs);
 			break;
 		case XmemDrvrIntrINT_2:
 			emsk |= XmemEventMaskSEND_TABLE;
 			cbs.Mask  = XmemEventMaskSEND_TABLE;
-			cbs.Node  = 1 << (rbf.NodeId[XmemDrvrIntIdxINT_2] - 1);
-			cbs.Table = rbf.NdData[XmemDrvrIntIdxINT_2];
+			cbs.Node  = 1 << (rbf->NodeId[XmemDrvrIntIdxINT_2] - 1);
+			cbs.Table = rbf->NdData[XmemDrvrIntIdxINT_2];
 			if (callmask & XmemEventMaskSEND_TABLE)
 				callback(&cbs);
 			break;
 		case XmemDrvrIntrINT_1:
 			emsk |= XmemEventMaskUSER;
 			cbs.Mask  = XmemEventMaskUSER;
-			cbs.Node  = 1 << (rbf.NodeId[XmemDrvrIntIdxINT_1] - 1);
-			cbs.Data  = rbf.NdData[XmemDrvrIntIdxINT_1];
+			cbs.Node  = 1 << (rbf->NodeId[XmemDrvrIntIdxINT_1] - 1);
+			cbs.Data  = rbf->NdData[XmemDrvrIntIdxINT_1];
 			if (callmask & XmemEventMaskUSER)
 				callback(&cbs);
 			break;
 		case XmemDrvrIntrSOFTWAKEUP:
 			emsk |= XmemEventMaskSOFTWAKEUP;
 			cbs.Mask  = XmemEventMaskSOFTWAKEUP;
-			cbs.Node  = 1 << (rbf.NodeId[XmemDrvrIntIdxSOFTWAKEUP] - 1);
-			cbs.Table = rbf.NdData[XmemDrvrIntIdxSOFTWAKEUP];
+			cbs.Node  = 1 << (rbf->NodeId[XmemDrvrIntIdxSOFTWAKEUP] - 1);
+			cbs.Table = rbf->NdData[XmemDrvrIntIdxSOFTWAKEUP];
 			if (callmask & XmemEventMaskSOFTWAKEUP)
 				callback(&cbs);
 			break;
@@ -369,6 +357,73 @@ XmemEventMask VmicWait(int timeout)
 	return emsk;
 }
 
+/*
+ * Number of events taken from the driver's queue per read(). Under a burst
+ * of updates this saves a system call for every event but the first.
+ */
+#define VMIC_READ_EVENTS 32
+
+/**
+ * VmicReadEvents - read the pending events and handle them
+ *
+ * @param : none
+ *
+ * @return Mask with the events handled, XmemEventMaskTIMEOUT if there were
+ * none. errno is set by read() in that case.
+ */
+static XmemEventMask VmicReadEvents(void)
+{
+	XmemDrvrReadBuf rbf[VMIC_READ_EVENTS];
+	XmemEventMask 	emsk;
+	int 		i, cc;
+
+	cc = read(xmem, rbf, sizeof(rbf));
+	if (cc <= 0)
+		return XmemEventMaskTIMEOUT;
+
+	emsk = 0;
+	for (i = 0; i < cc / sizeof(XmemDrvrReadBuf); i++)
+		emsk |= VmicHandleEvent(&rbf[i]);
+	return emsk;
+}
+
+/**
+ * VmicWait - Wait for an Event with timeout
+ *
+ * @param timeout: desired timeout for the wait (in chunks of 10ms)
+ *
+ * When there's an incoming event, the appropriate registered callback will be
+ * executed. If several events are queued they are all handled in one go.
+ *
+ * @return Mask with the incoming events handled (including timeout)
+ * @return 0 if there was an error
+ */
+XmemEventMask VmicWait(int timeout)
+{
+	XmemEventMask 	emsk;
+	XmemCallbackStruct cbs;
+
+	if (!callmask)
+		return 0;
+	if (!xmem)
+		return XmemErrorCallback(XmemErrorNOT_INITIALIZED, 0);
+	if (timeout != vmic_timeout) {
+		if (ioctl(xmem, XmemDrvrSET_TIMEOUT, &timeout) < 0) {
+			XmemErrorCallback(XmemErrorSYSTEM, errno);
+			return 0;
+		}
+		vmic_timeout = timeout;
+	}
+	emsk = VmicReadEvents();
+	if (emsk == XmemEventMaskTIMEOUT) {
+		bzero((void *)&cbs, sizeof(XmemCallbackStruct));
+		cbs.Mask = XmemEventMaskTIMEOUT;
+		if (callmask & XmemEventMaskTIMEOUT)
+			callback(&cbs);
+	}
+	return emsk;
+}
+
 
 /**
  * VmicPoll - Poll for any incoming Xmem Events
@@ -376,26 +431,31 @@ XmemEventMask VmicWait(int timeout)
  * @param : none
  *
  * An incoming event will call any callback that's registered for that event.
+ * Every event in the queue is handled; the driver is put in non-blocking
+ * mode for the duration of the call.
  *
- * This isn't good if there is a lot of stuff on the queue !!
- * See Jean-Claude Bau's implementation
- *
- * @return VmicWait() if there's data in the queue
+ * @return Mask with the events handled
  * @return 0 if there's an error or the queue is empty
  */
 XmemEventMask VmicPoll()
 {
-	unsigned long qsize;
+	XmemEventMask	emsk, ret;
+	long		nonblock;
 
-	if (!xmem)
+	if (!xmem || !callmask)
 		return 0;
-	if (ioctl(xmem, XmemDrvrGET_QUEUE_SIZE, &qsize) < 0) {
+	nonblock = 1;
+	if (ioctl(xmem, XmemDrvrSET_NONBLOCK, &nonblock) < 0) {
 		XmemErrorCallback(XmemErrorSYSTEM, errno);
 		return 0;
 	}
-	if (qsize)
-		return VmicWait(0);
-	return 0;
+	emsk = 0;
+	while ((ret = VmicReadEvents()) != XmemEventMaskTIMEOUT)
+		emsk |= ret;
+	nonblock = 0;
+	if (ioctl(xmem, XmemDrvrSET_NONBLOCK, &nonblock) < 0)
+		XmemErrorCallback(XmemErrorSYSTEM, errno);
+	return emsk;
 }
 
 
@@ -587,3 +647,127 @@ XmemError VmicSendSoftWakeup(uint32_t nodeid, uint32_t data)
 		return XmemErrorIO;
 	return XmemErrorSUCCESS;
 }
+
+
+/**
+ * VmicMmapInfo - Get the mmap() offsets from the driver, once
+ *
+ * @param : none
+ *
+ * @return 0 on success, -1 (and errno set) if the module can't be mapped
+ */
+static int VmicMmapInfo(void)
+{
+	if (vmic_mmap.Size)
+		return 0;
+	if (ioctl(xmem, XmemDrvrGET_MMAP_INFO, &vmic_mmap) < 0) {
+		vmic_mmap.Size = 0;
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * VmicMapTable - Map a table straight from the module's SDRAM, read-only
+ *
+ * @param tid: table to map
+ * @param addr: the (private) start of the table is put here
+ *
+ * The whole SDRAM is mapped once per process, and shared by all the mapped
+ * tables; it is unmapped when the last of them is. The driver doesn't let
+ * it be mapped for writing.
+ *
+ * @return Appropriate error code (XmemError)
+ */
+XmemError VmicMapTable(XmemTableId tid, void **addr)
+{
+	XmemDrvrSegDesc *desc = NULL;
+	unsigned long offset;
+	int i;
+	void *p;
+
+	if (!xmem)
+		return XmemErrorNOT_INITIALIZED;
+	for (i = 0; i < XmemDrvrSEGMENTS; i++) {
+		if (seg_tab.Used & (1 << i) && seg_tab.Descriptors[i].Id == tid) {
+			desc = &seg_tab.Descriptors[i];
+			break;
+		}
+	}
+	if (desc == NULL)
+		return XmemErrorNO_SUCH_TABLE;
+	if (VmicMmapInfo() < 0)
+		return XmemErrorSYSTEM;
+	offset = (unsigned long)desc->Address;
+	if (offset + desc->Size > vmic_mmap.Size) {
+		errno = EINVAL;
+		return XmemErrorSYSTEM;
+	}
+	if (vmic_sdram == NULL) {
+		p = mmap(NULL, vmic_mmap.Size, PROT_READ, MAP_SHARED, xmem,
+			 (off_t)vmic_mmap.RdOffset);
+		if (p == MAP_FAILED)
+			return XmemErrorSYSTEM;
+		vmic_sdram = p;
+	}
+	vmic_sdram_maps++;
+	*addr = vmic_sdram + offset;
+	return XmemErrorSUCCESS;
+}
+
+
+/**
+ * VmicUnmapTable - Undo VmicMapTable
+ *
+ * @param : none
+ *
+ * @return Appropriate error code (XmemError)
+ */
+XmemError VmicUnmapTable(void)
+{
+	if (!vmic_sdram_maps)
+		return XmemErrorSUCCESS;
+	if (--vmic_sdram_maps == 0) {
+		munmap(vmic_sdram, vmic_mmap.Size);
+		vmic_sdram = NULL;
+	}
+	return XmemErrorSUCCESS;
+}
+
+
+/**
+ * VmicGetGeneration - Get the update generation of a table
+ *
+ * @param tid: table id, with a single bit set
+ * @param gen: the generation is put here
+ *
+ * The driver's generations page is mapped on the first call; after that,
+ * this doesn't make any system call.
+ *
+ * @return Appropriate error code (XmemError)
+ */
+XmemError VmicGetGeneration(XmemTableId tid, uint32_t *gen)
+{
+	void *p;
+	int i;
+
+	if (!xmem)
+		return XmemErrorNOT_INITIALIZED;
+	if (vmic_gen == NULL) {
+		if (VmicMmapInfo() < 0)
+			return XmemErrorSYSTEM;
+		p = mmap(NULL, sizeof(XmemDrvrGenerations), PROT_READ,
+			 MAP_SHARED, xmem, (off_t)vmic_mmap.GenOffset);
+		if (p == MAP_FAILED)
+			return XmemErrorSYSTEM;
+		vmic_gen = p;
+	}
+	for (i = 0; i < XmemDrvrSEGMENTS; i++) {
+		if (tid & (1 << i)) {
+			*gen = vmic_gen->Gen[i];
+			return XmemErrorSUCCESS;
+		}
+	}
+	return XmemErrorNO_SUCH_TABLE;
+}
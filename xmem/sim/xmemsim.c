@@ -0,0 +1,918 @@
+/**
+ * @file xmemsim.c
+ *
+ * @brief The simulated VMIC ring (see xmemsim.h)
+ *
+ * The shared memory object holds, in this order:
+ *
+ * - a header: the ring's parameters, one lock, and the state of the 32
+ *   nodes, i.e. what their drivers keep: segment table, known nodes, and
+ *   the clients with their connections and event queues;
+ * - a page per node with its update generations, which the clients mmap()
+ *   as they would the driver's;
+ * - the SDRAM, one for all the nodes.
+ *
+ * Timing: the ring is one transmitter. Every segment write and interrupt
+ * occupies it for its size over the bandwidth, one after the other, and
+ * reaches the other nodes the latency after its transmission ends. The
+ * interrupts are queued to the clients of the other nodes with that due
+ * time, and read() doesn't return them before. A writer waits while more
+ * than XMEMSIM_TX_FIFO bytes are waiting to be transmitted, as it would on
+ * the module's transmit FIFO. Interrupts to the sending node itself are
+ * delivered straight away, as the driver's InterruptSelf() does.
+ *
+ * Simplifications: since the SDRAM is shared, the other nodes see the data
+ * written straight away, not after the latency (the update interrupts that
+ * follow them do respect it); likewise generations and CHECK_SEGMENT see an
+ * update when it is sent. There is a single module, and the raw accesses
+ * to the module's registers are not supported (ENOTTY).
+ *
+ * Copyright (c) 2010 CERN
+ * @author Emilio G. Cota <emilio.garcia.cota@cern.ch>
+ *
+ * @section license_sec License
+ * Released under the GPL v2. (and only v2, not any later version)
+ */
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+
+#include <xmemDrvr.h>
+#include "xmemsim.h"
+
+#define XMEMSIM_MAGIC	0x584d5349	/* "XMSI" */
+#define XMEMSIM_QUEUE	128		/* events per client, as the driver */
+#define XMEMSIM_TX_FIFO	(64 * 1024)	/* bytes queued before a writer waits */
+#define XMEMSIM_PACKET	8		/* bytes of an interrupt on the ring */
+#define XMEMSIM_PAGE	4096
+#define XMEMSIM_WAIT_MS	1000		/* for the creator to set the ring up */
+
+struct sim_event {
+	int64_t		due;	/* CLOCK_MONOTONIC, ns */
+	XmemDrvrReadBuf	rbf;
+};
+
+struct sim_client {
+	pid_t		pid;		/* 0 if closed */
+	unsigned long	mask;		/* connected interrupts */
+	unsigned long	updated;	/* segments, for CHECK_SEGMENT */
+	long		timeout;	/* of read(), in 10ms; 0 is forever */
+	int		nonblock;
+	int		queue_off;
+	unsigned int	in, out, elems, missed;
+	pthread_cond_t	cond;		/* signalled on every event queued */
+	struct sim_event queue[XMEMSIM_QUEUE];
+};
+
+struct sim_node {
+	unsigned long	known;		/* GET_NODES */
+	unsigned long	debug;
+	unsigned long	threshold;	/* DMA threshold, unused */
+	XmemDrvrSegTable segs;
+	XmemDrvrFlushStats flush;
+	struct sim_client clients[XmemDrvrCLIENT_CONTEXTS];
+};
+
+struct sim_ring {
+	uint32_t	magic;		/* set last by the creator */
+	unsigned long	size;		/* of the object */
+	unsigned long	gen_offset;	/* generations of node 1 */
+	unsigned long	sdram_offset;
+	unsigned long	sdram_size;
+	int64_t		latency;	/* ns */
+	double		ns_per_byte;	/* 0: infinite bandwidth */
+	int64_t		busy;		/* the ring transmits until then */
+	struct xmemsim_stats stats;
+	pthread_mutex_t	lock;		/* everything above and below */
+	struct sim_node	nodes[XmemDrvrNODES];
+};
+
+static struct sim_ring *ring;
+static int ring_fd = -1;
+static int my_node;			/* 1 to XmemDrvrNODES */
+static int sim_fds[XmemDrvrCLIENT_CONTEXTS];	/* fd + 1 of our clients */
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void ns_to_ts(int64_t ns, struct timespec *ts)
+{
+	ts->tv_sec = ns / 1000000000;
+	ts->tv_nsec = ns % 1000000000;
+}
+
+static long env_long(const char *name, long def)
+{
+	char *s = getenv(name);
+
+	return s ? strtol(s, NULL, 0) : def;
+}
+
+static const char *ring_name(void)
+{
+	char *s = getenv("XMEMSIM_RING");
+
+	return s ? s : XMEMSIM_RING;
+}
+
+static void sim_lock(void)
+{
+	if (pthread_mutex_lock(&ring->lock) == EOWNERDEAD)
+		pthread_mutex_consistent(&ring->lock);
+}
+
+static void sim_unlock(void)
+{
+	pthread_mutex_unlock(&ring->lock);
+}
+
+/* wait on @cond until @wake (0: forever); returns with the lock held */
+static void sim_wait(pthread_cond_t *cond, int64_t wake)
+{
+	struct timespec ts;
+	int err;
+
+	if (wake) {
+		ns_to_ts(wake, &ts);
+		err = pthread_cond_timedwait(cond, &ring->lock, &ts);
+	} else {
+		err = pthread_cond_wait(cond, &ring->lock);
+	}
+	if (err == EOWNERDEAD)
+		pthread_mutex_consistent(&ring->lock);
+}
+
+static XmemDrvrGenerations *sim_gens(int node)
+{
+	return (void *)((char *)ring + ring->gen_offset +
+			(node - 1) * XMEMSIM_PAGE);
+}
+
+static char *sim_sdram(void)
+{
+	return (char *)ring + ring->sdram_offset;
+}
+
+static void sim_init(struct sim_ring *r, unsigned long size,
+		     unsigned long hdr, unsigned long sdram)
+{
+	pthread_mutexattr_t ma;
+	pthread_condattr_t ca;
+	long mbps;
+	int i, j;
+
+	r->size = size;
+	r->gen_offset = hdr;
+	r->sdram_offset = hdr + XmemDrvrNODES * XMEMSIM_PAGE;
+	r->sdram_size = sdram;
+	r->latency = env_long("XMEMSIM_LATENCY_NS", XMEMSIM_LATENCY_NS);
+	mbps = env_long("XMEMSIM_MBPS", XMEMSIM_MBPS);
+	r->ns_per_byte = mbps > 0 ? 1000.0 / mbps : 0;
+
+	pthread_mutexattr_init(&ma);
+	pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&r->lock, &ma);
+	pthread_mutexattr_destroy(&ma);
+
+	pthread_condattr_init(&ca);
+	pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED);
+	pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+	for (i = 0; i < XmemDrvrNODES; i++) {
+		for (j = 0; j < XmemDrvrCLIENT_CONTEXTS; j++)
+			pthread_cond_init(&r->nodes[i].clients[j].cond, &ca);
+	}
+	pthread_condattr_destroy(&ca);
+
+	__sync_synchronize();
+	r->magic = XMEMSIM_MAGIC;
+}
+
+/* map the ring, creating it if it doesn't exist */
+static int sim_attach(void)
+{
+	unsigned long hdr, sdram, size;
+	struct sim_ring *r;
+	struct stat st;
+	int fd, i, create = 0;
+
+	if (ring)
+		return 0;
+	my_node = env_long("XMEMSIM_NODE", 1);
+	if (my_node < XmemDrvrMIN_NODE || my_node > XmemDrvrNODES) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	hdr = (sizeof(struct sim_ring) + XMEMSIM_PAGE - 1) &
+		~(XMEMSIM_PAGE - 1UL);
+	sdram = env_long("XMEMSIM_SDRAM_MB", XMEMSIM_SDRAM_MB) << 20;
+	fd = shm_open(ring_name(), O_RDWR | O_CREAT | O_EXCL, 0666);
+	if (fd >= 0) {
+		create = 1;
+		size = hdr + XmemDrvrNODES * XMEMSIM_PAGE + sdram;
+		if (ftruncate(fd, size) < 0)
+			goto out_close;
+	} else {
+		if (errno != EEXIST)
+			return -1;
+		fd = shm_open(ring_name(), O_RDWR, 0);
+		if (fd < 0)
+			return -1;
+		/* the creator sizes it before anything else */
+		for (i = 0;; i++) {
+			if (fstat(fd, &st) < 0)
+				goto out_close;
+			if (st.st_size >= sizeof(struct sim_ring))
+				break;
+			if (i == XMEMSIM_WAIT_MS) {
+				errno = ETIMEDOUT;
+				goto out_close;
+			}
+			usleep(1000);
+		}
+		size = st.st_size;
+	}
+
+	r = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (r == MAP_FAILED)
+		goto out_close;
+	if (create) {
+		sim_init(r, size, hdr, sdram);
+	} else {
+		for (i = 0; *(volatile uint32_t *)&r->magic != XMEMSIM_MAGIC;
+		     i++) {
+			if (i == XMEMSIM_WAIT_MS) {
+				munmap(r, size);
+				errno = ETIMEDOUT;
+				goto out_close;
+			}
+			usleep(1000);
+		}
+	}
+	ring = r;
+	ring_fd = fd;
+	/* the default slack, 50us, would be added to every event's latency */
+	prctl(PR_SET_TIMERSLACK, 1);
+	return 0;
+
+out_close:
+	close(fd);
+	if (create)
+		shm_unlink(ring_name());
+	return -1;
+}
+
+/* index of our client on @fd, -1 if it isn't one */
+static int sim_client_index(int fd)
+{
+	int i;
+
+	for (i = 0; i < XmemDrvrCLIENT_CONTEXTS; i++) {
+		if (sim_fds[i] == fd + 1)
+			return i;
+	}
+	return -1;
+}
+
+static struct sim_node *sim_node(int node)
+{
+	return &ring->nodes[node - 1];
+}
+
+static int sim_node_up(int node)
+{
+	struct sim_node *n = sim_node(node);
+	int i;
+
+	for (i = 0; i < XmemDrvrCLIENT_CONTEXTS; i++) {
+		if (n->clients[i].pid)
+			return 1;
+	}
+	return 0;
+}
+
+/* queue @rbf to the clients of @node connected to it, due at @due */
+static void sim_queue(int node, const XmemDrvrReadBuf *rbf, int64_t due)
+{
+	struct sim_client *c;
+	int i;
+
+	for (i = 0; i < XmemDrvrCLIENT_CONTEXTS; i++) {
+		c = &sim_node(node)->clients[i];
+		if (!c->pid || !(c->mask & rbf->Mask))
+			continue;
+		/* without queueing, only the last event is kept */
+		if (c->queue_off)
+			c->in = c->out = c->elems = 0;
+		if (c->elems >= XMEMSIM_QUEUE) {
+			c->missed++;
+			ring->stats.Missed++;
+			continue;
+		}
+		c->queue[c->in].due = due;
+		c->queue[c->in].rbf = *rbf;
+		c->in = (c->in + 1) % XMEMSIM_QUEUE;
+		c->elems++;
+		ring->stats.Events++;
+		pthread_cond_signal(&c->cond);
+	}
+}
+
+/*
+ * An interrupt from node @from arrives at @node: what the driver's ISR, or
+ * InterruptSelf() when @node is @from, does with it.
+ */
+static void sim_arrive(int node, int from, XmemDrvrNic type,
+		       unsigned long data, int64_t due)
+{
+	struct sim_node *n = sim_node(node);
+	XmemDrvrGenerations *gens;
+	XmemDrvrReadBuf rbf;
+	int i, idx = -1;
+
+	memset(&rbf, 0, sizeof(rbf));
+	rbf.Module = 1;
+	switch (type) {
+	case XmemDrvrNicREQUEST_RESET:
+		rbf.Mask = XmemDrvrIntrREQUEST_RESET;
+		break;
+	case XmemDrvrNicINT_1:
+		rbf.Mask = XmemDrvrIntrINT_1;
+		idx = XmemDrvrIntIdxINT_1;
+		break;
+	case XmemDrvrNicINT_2:
+		rbf.Mask = XmemDrvrIntrINT_2;
+		idx = XmemDrvrIntIdxINT_2;
+		break;
+	case XmemDrvrNicSEGMENT_UPDATE:
+		rbf.Mask = XmemDrvrIntrSEGMENT_UPDATE;
+		idx = XmemDrvrIntIdxSEGMENT_UPDATE;
+		gens = sim_gens(node);
+		for (i = 0; i < XmemDrvrSEGMENTS; i++) {
+			if (data & (1 << i))
+				gens->Gen[i]++;
+		}
+		for (i = 0; i < XmemDrvrCLIENT_CONTEXTS; i++)
+			n->clients[i].updated |= data;
+		break;
+	case XmemDrvrNicINITIALIZED:
+		rbf.Mask = XmemDrvrIntrPENDING_INIT;
+		idx = XmemDrvrIntIdxPENDING_INIT;
+		/* a node coming up: the others will introduce themselves */
+		if (node != from && data)
+			n->known = 1 << (node - 1);
+		break;
+	default:
+		return;
+	}
+	if (idx >= 0) {
+		rbf.NodeId[idx] = from;
+		rbf.NdData[idx] = data;
+		if (node != from)
+			n->known |= 1 << (from - 1);
+	}
+	sim_queue(node, &rbf, due);
+}
+
+/* occupy the ring for @bytes; returns when they reach the other nodes */
+static int64_t sim_transmit(unsigned long bytes)
+{
+	int64_t now = now_ns();
+	int64_t start = ring->busy > now ? ring->busy : now;
+
+	ring->busy = start + (int64_t)(bytes * ring->ns_per_byte);
+	return ring->busy + ring->latency;
+}
+
+/* wait for the transmit FIFO to have room; called without the lock */
+static void sim_fifo_wait(void)
+{
+	int64_t until = ring->busy -
+		(int64_t)(XMEMSIM_TX_FIFO * ring->ns_per_byte);
+	struct timespec ts;
+
+	if (until <= now_ns())
+		return;
+	ns_to_ts(until, &ts);
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/* SendInterrupt(); called with the lock held */
+static int sim_send(XmemDrvrNic itype, unsigned long unicast,
+		    unsigned long multicast, unsigned long data)
+{
+	XmemDrvrNic type = itype & XmemDrvrNicTYPE;
+	unsigned long targets;
+	int64_t now, due;
+	int i;
+
+	switch (itype & XmemDrvrNicCAST) {
+	case XmemDrvrNicBROADCAST:
+		targets = 0xffffffff;
+		break;
+	case XmemDrvrNicMULTICAST:
+		targets = multicast;
+		break;
+	case XmemDrvrNicUNICAST:
+		if (unicast < XmemDrvrMIN_NODE || unicast > XmemDrvrMAX_NODE) {
+			errno = EINVAL;
+			return -1;
+		}
+		/* nodes above 32 are not simulated */
+		targets = unicast <= XmemDrvrNODES ? 1 << (unicast - 1) : 0;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+	switch (type) {
+	case XmemDrvrNicREQUEST_RESET:
+	case XmemDrvrNicINT_1:
+	case XmemDrvrNicINT_2:
+	case XmemDrvrNicSEGMENT_UPDATE:
+	case XmemDrvrNicINITIALIZED:
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	data &= 0xffffffff;	/* the NTD register */
+	now = now_ns();
+	due = sim_transmit(XMEMSIM_PACKET);
+	ring->stats.Interrupts++;
+	for (i = XmemDrvrMIN_NODE; i <= XmemDrvrNODES; i++) {
+		if (!(targets & (1UL << (i - 1))) || !sim_node_up(i))
+			continue;
+		sim_arrive(i, my_node, type, data, i == my_node ? now : due);
+	}
+	return 0;
+}
+
+static XmemDrvrSegDesc *sim_segment(struct sim_node *n, unsigned long id)
+{
+	int i;
+
+	if (!id)
+		return NULL;
+	for (i = 0; i < XmemDrvrSEGMENTS; i++) {
+		if (n->segs.Used & (1 << i) && n->segs.Descriptors[i].Id == id)
+			return &n->segs.Descriptors[i];
+	}
+	return NULL;
+}
+
+/* SegmentCopy() */
+static int sim_segment_io(XmemDrvrSegIoDesc *io, int write)
+{
+	struct sim_node *n = sim_node(my_node);
+	XmemDrvrSegDesc desc, *d;
+	unsigned long addr;
+	int err = 0;
+
+	if (io->UserArray == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	sim_lock();
+	d = sim_segment(n, io->Id);
+	if (d)
+		desc = *d;
+	sim_unlock();
+	if (d == NULL) {
+		errno = ENODEV;
+		return -1;
+	}
+	addr = (unsigned long)desc.Address + io->Offset;
+	if (io->Offset + io->Size > desc.Size ||
+	    addr + io->Size > ring->sdram_size) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!write) {
+		memcpy(io->UserArray, sim_sdram() + addr, io->Size);
+		return 0;
+	}
+
+	if (!(desc.Nodes & (1 << (my_node - 1)))) {
+		errno = EACCES;
+		return -1;
+	}
+	memcpy(sim_sdram() + addr, io->UserArray, io->Size);
+	sim_lock();
+	sim_transmit(io->Size);
+	ring->stats.Bytes += io->Size;
+	if (io->UpdateFlg)
+		err = sim_send(XmemDrvrNicSEGMENT_UPDATE | XmemDrvrNicBROADCAST,
+			       0, 0, io->Id);
+	sim_unlock();
+	sim_fifo_wait();
+	return err;
+}
+
+/* FlushSegments(): the data are already everywhere, only the time counts */
+static int sim_flush(unsigned long segs)
+{
+	struct sim_node *n = sim_node(my_node);
+	unsigned long bytes = 0;
+	int64_t start, end;
+	int i;
+
+	sim_lock();
+	for (i = 0; i < XmemDrvrSEGMENTS; i++) {
+		if (!(segs & n->segs.Used & (1 << i)))
+			continue;
+		/* as the driver: nothing is flushed if a segment isn't writable */
+		if (!(n->segs.Descriptors[i].Nodes & (1 << (my_node - 1)))) {
+			sim_unlock();
+			errno = EACCES;
+			return -1;
+		}
+		bytes += n->segs.Descriptors[i].Size;
+	}
+	start = ring->busy > now_ns() ? ring->busy : now_ns();
+	end = sim_transmit(bytes) - ring->latency;
+	n->flush.Flushes++;
+	n->flush.Bytes = bytes;
+	n->flush.Time = (end - start) / 1000;
+	if (n->flush.Time > n->flush.MaxTime)
+		n->flush.MaxTime = n->flush.Time;
+	sim_unlock();
+	sim_fifo_wait();
+	return 0;
+}
+
+/* RESET: start over, and tell the others if connected to PENDING_INIT */
+static int sim_reset(void)
+{
+	struct sim_node *n = sim_node(my_node);
+	unsigned long mask = 0;
+	int i;
+
+	n->known = 1 << (my_node - 1);
+	for (i = 0; i < XmemDrvrCLIENT_CONTEXTS; i++) {
+		if (n->clients[i].pid)
+			mask |= n->clients[i].mask;
+	}
+	if (!(mask & XmemDrvrIntrPENDING_INIT))
+		return 0;
+	return sim_send(XmemDrvrNicINITIALIZED | XmemDrvrNicBROADCAST, 0, 0,
+			1 << (my_node - 1));
+}
+
+int xmemsim_open(const char *path, int flags, ...)
+{
+	struct sim_client *c;
+	mode_t mode = 0;
+	va_list ap;
+	int idx, fd;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+	if (sscanf(path, "/dev/xmem.%d", &idx) != 1)
+		return open(path, flags, mode);
+	if (idx < 1 || idx > XmemDrvrCLIENT_CONTEXTS) {
+		errno = ENODEV;
+		return -1;
+	}
+	idx--;
+	if (sim_attach() < 0)
+		return -1;
+
+	sim_lock();
+	c = &sim_node(my_node)->clients[idx];
+	/* the driver's node is busy; that of a dead process is reclaimed */
+	if (c->pid && (sim_fds[idx] || kill(c->pid, 0) == 0 ||
+		       errno != ESRCH)) {
+		sim_unlock();
+		errno = EBUSY;
+		return -1;
+	}
+	fd = dup(ring_fd);
+	if (fd < 0) {
+		sim_unlock();
+		return -1;
+	}
+	c->pid = getpid();
+	c->mask = 0;
+	c->updated = 0;
+	c->timeout = 0;
+	c->nonblock = 0;
+	c->queue_off = 0;
+	c->in = c->out = c->elems = c->missed = 0;
+	sim_unlock();
+	sim_fds[idx] = fd + 1;
+	return fd;
+}
+
+int xmemsim_close(int fd)
+{
+	struct sim_client *c;
+	int idx = sim_client_index(fd);
+
+	if (idx >= 0) {
+		sim_lock();
+		c = &sim_node(my_node)->clients[idx];
+		c->pid = 0;
+		c->mask = 0;
+		sim_unlock();
+		sim_fds[idx] = 0;
+	}
+	return close(fd);
+}
+
+ssize_t xmemsim_read(int fd, void *buf, size_t len)
+{
+	XmemDrvrReadBuf *rb = buf;
+	struct sim_client *c;
+	int64_t now, deadline, wake;
+	int idx, n, got = 0, err = 0;
+
+	idx = sim_client_index(fd);
+	if (idx < 0)
+		return read(fd, buf, len);
+	n = len / sizeof(XmemDrvrReadBuf);
+	if (n <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	c = &sim_node(my_node)->clients[idx];
+
+	sim_lock();
+	deadline = c->timeout ? now_ns() + c->timeout * 10000000LL : 0;
+	for (;;) {
+		now = now_ns();
+		while (got < n && c->elems && c->queue[c->out].due <= now) {
+			rb[got++] = c->queue[c->out].rbf;
+			c->out = (c->out + 1) % XMEMSIM_QUEUE;
+			c->elems--;
+		}
+		if (got)
+			break;
+		if (c->nonblock) {
+			err = EAGAIN;
+			break;
+		}
+		if (deadline && now >= deadline) {
+			err = ETIME;
+			break;
+		}
+		/* until the next event arrives, or the timeout */
+		wake = c->elems ? c->queue[c->out].due : 0;
+		if (deadline && (!wake || deadline < wake))
+			wake = deadline;
+		sim_wait(&c->cond, wake);
+	}
+	sim_unlock();
+	if (!got) {
+		errno = err;
+		return -1;
+	}
+	return got * sizeof(XmemDrvrReadBuf);
+}
+
+/* XmemDrvrWrite(): a software wakeup to the clients of this node */
+ssize_t xmemsim_write(int fd, const void *buf, size_t len)
+{
+	const XmemDrvrWriteBuf *wbf = buf;
+	XmemDrvrReadBuf rbf;
+
+	if (sim_client_index(fd) < 0)
+		return write(fd, buf, len);
+	if (len < sizeof(XmemDrvrWriteBuf)) {
+		errno = EINVAL;
+		return -1;
+	}
+	memset(&rbf, 0, sizeof(rbf));
+	rbf.Module = wbf->Module;
+	rbf.NdData[XmemDrvrIntIdxSOFTWAKEUP] = wbf->Data;
+	rbf.NodeId[XmemDrvrIntIdxSOFTWAKEUP] = wbf->NodeId;
+	rbf.Mask = XmemDrvrIntrSOFTWAKEUP;
+	sim_lock();
+	sim_queue(my_node, &rbf, now_ns());
+	sim_unlock();
+	return sizeof(XmemDrvrWriteBuf);
+}
+
+/*
+ * The "long" arguments are read as ints: the library passes ints for some
+ * of them. Node and segment masks are returned as 32 bits, the size of
+ * XmemNodeId and XmemTableId, which the library passes.
+ */
+static int sim_ioctl(struct sim_client *c, unsigned long cmd, void *arg)
+{
+	struct sim_node *n = sim_node(my_node);
+	XmemDrvrModuleDescriptor *mdesc;
+	XmemDrvrClientConnections *ccons;
+	XmemDrvrClientList *cls;
+	XmemDrvrConnection *conx;
+	XmemDrvrSendBuf *sbuf;
+	XmemDrvrVersion *ver;
+	XmemDrvrMmapInfo *mmi;
+	long *lap = arg;
+	int lav = arg ? *(int *)arg : 0;
+	int i;
+
+	switch (cmd) {
+	case XmemDrvrSET_SW_DEBUG:
+		n->debug = lav;
+		return 0;
+	case XmemDrvrGET_SW_DEBUG:
+		*lap = n->debug;
+		return 0;
+	case XmemDrvrGET_VERSION:
+		ver = arg;
+		ver->DriverVersion = 0;
+		ver->BoardRevision = 0;
+		ver->BoardId = 0x65;
+		return 0;
+	case XmemDrvrSET_TIMEOUT:
+		c->timeout = lav;
+		return 0;
+	case XmemDrvrGET_TIMEOUT:
+		*lap = c->timeout;
+		return 0;
+	case XmemDrvrSET_QUEUE_FLAG:
+		c->queue_off = lav == XmemDrvrQueueFlagOFF;
+		return 0;
+	case XmemDrvrGET_QUEUE_FLAG:
+		*lap = c->queue_off;
+		return 0;
+	case XmemDrvrGET_QUEUE_SIZE:
+		*lap = c->elems;
+		return 0;
+	case XmemDrvrGET_QUEUE_OVERFLOW:
+		*lap = c->missed;
+		c->missed = 0;
+		return 0;
+	case XmemDrvrGET_MODULE_DESCRIPTOR:
+		mdesc = arg;
+		memset(mdesc, 0, sizeof(*mdesc));
+		mdesc->Module = 1;
+		mdesc->NodeId = my_node;
+		mdesc->SDRam = (void *)sim_sdram();
+		return 0;
+	case XmemDrvrSET_MODULE:
+		if (lav != 1) {
+			errno = ENODEV;
+			return -1;
+		}
+		return 0;
+	case XmemDrvrGET_MODULE:
+	case XmemDrvrGET_MODULE_COUNT:
+		*lap = 1;
+		return 0;
+	case XmemDrvrSET_MODULE_BY_SLOT:
+		return 0;
+	case XmemDrvrGET_MODULE_SLOT:
+		*lap = 0;
+		return 0;
+	case XmemDrvrRESET:
+		return sim_reset();
+	case XmemDrvrSET_COMMAND:
+		return 0;
+	case XmemDrvrGET_STATUS:
+		*lap = XmemDrvrScrSIGNAL_DETECT |
+			(ring->busy <= now_ns() ? XmemDrvrScrTX_EMPTY : 0);
+		return 0;
+	case XmemDrvrGET_NODES:
+		*(uint32_t *)arg = n->known;
+		return 0;
+	case XmemDrvrGET_CLIENT_LIST:
+		cls = arg;
+		memset(cls, 0, sizeof(*cls));
+		for (i = 0; i < XmemDrvrCLIENT_CONTEXTS; i++) {
+			if (n->clients[i].pid)
+				cls->Pid[cls->Size++] = n->clients[i].pid;
+		}
+		return 0;
+	case XmemDrvrCONNECT:
+		conx = arg;
+		c->mask |= conx->Mask;
+		return 0;
+	case XmemDrvrDISCONNECT:
+		conx = arg;
+		c->mask &= ~conx->Mask;
+		return 0;
+	case XmemDrvrGET_CLIENT_CONNECTIONS:
+		ccons = arg;
+		ccons->Size = 0;
+		for (i = 0; i < XmemDrvrCLIENT_CONTEXTS; i++) {
+			if (n->clients[i].pid == ccons->Pid &&
+			    n->clients[i].mask) {
+				ccons->Connections[0].Module = 1;
+				ccons->Connections[0].Mask = n->clients[i].mask;
+				ccons->Size = 1;
+				break;
+			}
+		}
+		return 0;
+	case XmemDrvrSEND_INTERRUPT:
+		sbuf = arg;
+		if (sbuf->Module != 1) {
+			errno = ENXIO;
+			return -1;
+		}
+		return sim_send(sbuf->InterruptType, sbuf->UnicastNodeId,
+				sbuf->MulticastMask, sbuf->Data);
+	case XmemDrvrGET_XMEM_ADDRESS:
+		((XmemDrvrRamAddress *)arg)->Address = sim_sdram();
+		return 0;
+	case XmemDrvrSET_SEGMENT_TABLE:
+		n->segs = *(XmemDrvrSegTable *)arg;
+		return 0;
+	case XmemDrvrGET_SEGMENT_TABLE:
+		*(XmemDrvrSegTable *)arg = n->segs;
+		return 0;
+	case XmemDrvrCHECK_SEGMENT:
+		*(uint32_t *)arg = c->updated;
+		c->updated = 0;
+		return 0;
+	case XmemDrvrSET_DMA_THRESHOLD:
+		n->threshold = lav;
+		return 0;
+	case XmemDrvrGET_DMA_THRESHOLD:
+		*lap = n->threshold;
+		return 0;
+	case XmemDrvrSET_NONBLOCK:
+		c->nonblock = lav;
+		return 0;
+	case XmemDrvrGET_NONBLOCK:
+		*lap = c->nonblock;
+		return 0;
+	case XmemDrvrGET_FLUSH_STATS:
+		*(XmemDrvrFlushStats *)arg = n->flush;
+		return 0;
+	case XmemDrvrGET_MMAP_INFO:
+		mmi = arg;
+		mmi->Module = 1;
+		mmi->Size = ring->sdram_size;
+		mmi->RdOffset = ring->sdram_offset;
+		mmi->GenOffset = ring->gen_offset +
+			(my_node - 1) * XMEMSIM_PAGE;
+		return 0;
+	default:
+		errno = ENOTTY;
+		return -1;
+	}
+}
+
+int xmemsim_ioctl(int fd, unsigned long cmd, void *arg)
+{
+	struct sim_client *c;
+	int idx, ret;
+
+	idx = sim_client_index(fd);
+	if (idx < 0)
+		return ioctl(fd, cmd, arg);
+	c = &sim_node(my_node)->clients[idx];
+
+	/* these wait on the ring: they take the lock themselves */
+	switch (cmd) {
+	case XmemDrvrREAD_SEGMENT:
+		return sim_segment_io(arg, 0);
+	case XmemDrvrWRITE_SEGMENT:
+		return sim_segment_io(arg, 1);
+	case XmemDrvrFLUSH_SEGMENTS:
+		return sim_flush(*(uint32_t *)arg);
+	}
+
+	sim_lock();
+	ret = sim_ioctl(c, cmd, arg);
+	sim_unlock();
+	if (cmd == XmemDrvrSEND_INTERRUPT || cmd == XmemDrvrRESET)
+		sim_fifo_wait();
+	return ret;
+}
+
+int xmemsim_unlink(void)
+{
+	return shm_unlink(ring_name());
+}
+
+int xmemsim_get_stats(struct xmemsim_stats *stats)
+{
+	if (sim_attach() < 0)
+		return -1;
+	sim_lock();
+	*stats = ring->stats;
+	sim_unlock();
+	return 0;
+}
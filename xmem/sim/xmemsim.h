@@ -0,0 +1,76 @@
+/**
+ * @file xmemsim.h
+ *
+ * @brief A VMIC 5565 ring simulated in shared memory
+ *
+ * xmemsim_*() behave like the system calls on the xmem driver's nodes
+ * (/dev/xmem.<n>), for the ioctl interface that libxmem's VMIC backend
+ * uses. Every process that opens a node is a node of the ring, the node Id
+ * being $XMEMSIM_NODE (1 to 32, default 1). The ring is a POSIX shared
+ * memory object, $XMEMSIM_RING (default XMEMSIM_RING), created by the
+ * first process that opens it with:
+ *
+ * - $XMEMSIM_LATENCY_NS: from the end of a transmission to its arrival at
+ *   the other nodes (default XMEMSIM_LATENCY_NS);
+ * - $XMEMSIM_MBPS: bandwidth of the ring, in MB/s (default XMEMSIM_MBPS);
+ * - $XMEMSIM_SDRAM_MB: size of the SDRAM (default XMEMSIM_SDRAM_MB).
+ *
+ * The calls return -1 and set errno on failure; those on other files go to
+ * the system.
+ *
+ * Copyright (c) 2010 CERN
+ * @author Emilio G. Cota <emilio.garcia.cota@cern.ch>
+ *
+ * @section license_sec License
+ * Released under the GPL v2. (and only v2, not any later version)
+ */
+#ifndef _XMEMSIM_H_
+#define _XMEMSIM_H_
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#define XMEMSIM_RING		"/xmemsim"
+#define XMEMSIM_LATENCY_NS	1000
+#define XMEMSIM_MBPS		170
+#define XMEMSIM_SDRAM_MB	64
+
+int xmemsim_open(const char *path, int flags, ...);
+int xmemsim_close(int fd);
+int xmemsim_ioctl(int fd, unsigned long cmd, void *arg);
+ssize_t xmemsim_read(int fd, void *buf, size_t len);
+ssize_t xmemsim_write(int fd, const void *buf, size_t len);
+
+/* remove the ring; the nodes still attached keep it until they close */
+int xmemsim_unlink(void);
+
+/*
+ * Statistics of the ring. Missed counts the events dropped because a
+ * client's queue was full.
+ */
+struct xmemsim_stats {
+	unsigned long	Interrupts;	/* sent */
+	unsigned long	Events;		/* queued to clients */
+	unsigned long	Missed;
+	unsigned long	Bytes;		/* written to the SDRAM */
+};
+
+int xmemsim_get_stats(struct xmemsim_stats *stats);
+
+/*
+ * Programs (and libxmem) that run both against the simulator and a real
+ * driver define XMEMSIM_REDIRECT and include this after the system
+ * headers. mmap() needs no redirection: the descriptors of the simulated
+ * nodes are the shared memory object's.
+ */
+#ifdef XMEMSIM_REDIRECT
+#define open(...)	xmemsim_open(__VA_ARGS__)
+#define close(fd)	xmemsim_close(fd)
+#define ioctl(fd, c, a)	xmemsim_ioctl(fd, c, (void *)(a))
+#define read(fd, b, l)	xmemsim_read(fd, b, l)
+#define write(fd, b, l)	xmemsim_write(fd, b, l)
+#endif
+
+#endif /* _XMEMSIM_H_ */
@@ -0,0 +1,377 @@
+/**
+ * @file xmemsimBench.c
+ *
+ * @brief libxmem's VMIC backend on the simulated ring
+ *
+ * Runs a writer node and several reader nodes, as processes on this host,
+ * on a ring of their own (see xmemsim.h). The writer (node 1) owns a table;
+ * it measures:
+ *
+ * - latency: the table is sent with an update, stamped with the time it
+ *   was sent, and each reader takes the time its callback is called, after
+ *   reading the table. The next one is sent when every reader has seen it;
+ * - throughput: table writes without updates, up to the final flush;
+ * - loss: a burst of updates, as fast as they can be sent. Readers count
+ *   those their callback sees; with -c the callback takes that long, as a
+ *   slow client would. The events dropped from full queues are the ring's
+ *   Missed count.
+ *
+ * The segment and node tables are made up in a temporary directory.
+ *
+ * Copyright (c) 2010 CERN
+ * @author Emilio G. Cota <emilio.garcia.cota@cern.ch>
+ *
+ * @section license_sec License
+ * Released under the GPL v2. (and only v2, not any later version)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#include <libxmem.h>
+#include "xmemsim.h"
+
+#define TABLE		0x1
+#define MAX_READERS	8
+#define MAX_SAMPLES	100000
+
+/* shared by all the nodes */
+struct results {
+	volatile int	ready;
+	volatile int	done;
+	volatile int	phase;		/* 0: latency, 1: burst */
+	volatile int	seen[MAX_READERS];	/* last latency sample */
+	volatile int	updates[MAX_READERS];	/* during the burst */
+	int64_t		lat[MAX_READERS][MAX_SAMPLES];
+};
+
+static int readers = 2;
+static int samples = 1000;
+static int writes = 1000;
+static int burst = 1000;
+static int table_size = 4096;
+static int cb_delay;		/* us */
+
+static struct results *res;
+static uint32_t *tbuf;
+static int elems;
+static int node;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void reader_callback(XmemCallbackStruct *cbs)
+{
+	int r = node - 2;
+	int64_t stamp;
+	int seq;
+
+	if (cbs->Mask != XmemEventMaskTABLE_UPDATE)
+		return;
+	if (res->phase) {
+		res->updates[r]++;
+		if (cb_delay)
+			usleep(cb_delay);
+		return;
+	}
+	if (XmemRecvTable(TABLE, tbuf, 3, 0) != XmemErrorSUCCESS)
+		return;
+	seq = tbuf[0];
+	memcpy(&stamp, &tbuf[1], sizeof(stamp));
+	if (seq > 0 && seq <= samples && seq > res->seen[r]) {
+		res->lat[r][seq - 1] = now_ns() - stamp;
+		res->seen[r] = seq;
+	}
+}
+
+static void setenv_node(int nid)
+{
+	char str[16];
+
+	sprintf(str, "%d", nid);
+	setenv("XMEMSIM_NODE", str, 1);
+}
+
+static int init(void (*cb)(XmemCallbackStruct *), XmemEventMask mask)
+{
+	XmemError err;
+
+	setenv_node(node);
+	err = XmemInitialize(XmemDeviceVMIC);
+	if (err == XmemErrorSUCCESS && cb)
+		err = XmemRegisterCallback(cb, mask);
+	if (err != XmemErrorSUCCESS) {
+		fprintf(stderr, "node %d: %s\n", node, XmemErrorToString(err));
+		return -1;
+	}
+	return 0;
+}
+
+static void reader(void)
+{
+	if (init(reader_callback, XmemEventMaskTABLE_UPDATE) < 0)
+		exit(1);
+	__sync_fetch_and_add(&res->ready, 1);
+	while (!res->done)
+		XmemWait(1);
+	exit(0);
+}
+
+/* wait for every reader to have seen sample @seq */
+static int wait_seen(int seq)
+{
+	int64_t until = now_ns() + 1000000000;
+	int i;
+
+	for (i = 0; i < readers; i++) {
+		while (res->seen[i] < seq) {
+			if (now_ns() > until) {
+				fprintf(stderr, "node %d: no update %d\n",
+					i + 2, seq);
+				return -1;
+			}
+			sched_yield();
+		}
+	}
+	return 0;
+}
+
+static int cmp64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int latency(void)
+{
+	int64_t *all, stamp;
+	int i, r, n;
+
+	for (i = 1; i <= samples; i++) {
+		stamp = now_ns();
+		tbuf[0] = i;
+		memcpy(&tbuf[1], &stamp, sizeof(stamp));
+		if (XmemSendTable(TABLE, tbuf, elems, 0, 1) !=
+			XmemErrorSUCCESS) {
+			fprintf(stderr, "XmemSendTable failed\n");
+			return -1;
+		}
+		if (wait_seen(i) < 0)
+			return -1;
+	}
+
+	n = readers * samples;
+	all = malloc(n * sizeof(*all));
+	if (all == NULL)
+		return -1;
+	for (r = 0; r < readers; r++)
+		memcpy(&all[r * samples], res->lat[r],
+		       samples * sizeof(*all));
+	qsort(all, n, sizeof(*all), cmp64);
+	printf("latency, us: min %.1f p50 %.1f p99 %.1f p99.9 %.1f "
+	       "max %.1f\n", all[0] / 1000.0, all[n / 2] / 1000.0,
+	       all[n * 99 / 100] / 1000.0, all[n * 999 / 1000] / 1000.0,
+	       all[n - 1] / 1000.0);
+	free(all);
+	return 0;
+}
+
+static void throughput(void)
+{
+	int64_t t;
+	int i;
+
+	t = now_ns();
+	for (i = 0; i < writes; i++) {
+		tbuf[0] = i;
+		XmemSendTable(TABLE, tbuf, elems, 0, 0);
+	}
+	XmemSendTable(TABLE, NULL, 0, 0, 0);
+	t = now_ns() - t;
+	printf("%d writes of %d bytes: %.1f MB/s, %.0f writes/s\n", writes,
+	       table_size, (double)writes * table_size * 1000 / t,
+	       (double)writes * 1000000000 / t);
+}
+
+static void loss(void)
+{
+	struct xmemsim_stats before, after;
+	int64_t t;
+	int i, got = 0;
+
+	xmemsim_get_stats(&before);
+	res->phase = 1;
+	t = now_ns();
+	for (i = 0; i < burst; i++)
+		XmemSendTable(TABLE, tbuf, elems, 0, 1);
+	t = now_ns() - t;
+	/* let the readers drain their queues */
+	usleep(200000 + burst * cb_delay);
+	for (i = 0; i < readers; i++)
+		got += res->updates[i];
+	xmemsim_get_stats(&after);
+	printf("burst of %d updates in %.1f ms, callback %d us: %d of %d "
+	       "seen, %lu missed\n", burst, t / 1e6, cb_delay, got,
+	       burst * readers, after.Missed - before.Missed);
+}
+
+static int make_config(char *dir)
+{
+	FILE *fp;
+	char path[128];
+	int i;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return -1;
+	}
+	sprintf(path, "%s/Xmem.nodes", dir);
+	fp = fopen(path, "w");
+	if (fp == NULL)
+		return -1;
+	for (i = 0; i <= readers; i++)
+		fprintf(fp, "{ node%02d 0x%x }\n", i + 1, 1 << i);
+	fclose(fp);
+	sprintf(path, "%s/Xmem.segs", dir);
+	fp = fopen(path, "w");
+	if (fp == NULL)
+		return -1;
+	fprintf(fp, "{ test 0x%x 0x%x 0x0 0x1 0x0 }\n", TABLE, table_size);
+	fclose(fp);
+	return 0;
+}
+
+static void remove_config(char *dir)
+{
+	char path[128];
+
+	sprintf(path, "%s/Xmem.nodes", dir);
+	unlink(path);
+	sprintf(path, "%s/Xmem.segs", dir);
+	unlink(path);
+	rmdir(dir);
+}
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s [options]\n"
+		"  -r <n>     reader nodes, 1 to %d (default %d)\n"
+		"  -s <size>  table size in bytes (default %d)\n"
+		"  -n <n>     latency samples, up to %d (default %d)\n"
+		"  -w <n>     writes for the throughput (default %d)\n"
+		"  -b <n>     updates in the burst (default %d)\n"
+		"  -c <us>    time taken by the readers' callback in the "
+		"burst (default 0)\n"
+		"  -l <ns>    latency of the ring (default %d)\n"
+		"  -m <MB/s>  bandwidth of the ring, 0 for infinite "
+		"(default %d)\n",
+		prog, MAX_READERS, readers, table_size, MAX_SAMPLES, samples,
+		writes, burst, XMEMSIM_LATENCY_NS, XMEMSIM_MBPS);
+}
+
+int main(int argc, char *argv[])
+{
+	char dir[] = "/tmp/xmemsimBench.XXXXXX";
+	char name[64];
+	int i, status, errors = 0;
+	pid_t pids[MAX_READERS];
+
+	while ((i = getopt(argc, argv, "r:s:n:w:b:c:l:m:h")) != -1) {
+		switch (i) {
+		case 'r':
+			readers = atoi(optarg);
+			break;
+		case 's':
+			table_size = strtoul(optarg, NULL, 0) & ~3;
+			break;
+		case 'n':
+			samples = atoi(optarg);
+			break;
+		case 'w':
+			writes = atoi(optarg);
+			break;
+		case 'b':
+			burst = atoi(optarg);
+			break;
+		case 'c':
+			cb_delay = atoi(optarg);
+			break;
+		case 'l':
+			setenv("XMEMSIM_LATENCY_NS", optarg, 1);
+			break;
+		case 'm':
+			setenv("XMEMSIM_MBPS", optarg, 1);
+			break;
+		default:
+			usage(argv[0]);
+			exit(i != 'h');
+		}
+	}
+	if (readers < 1 || readers > MAX_READERS || table_size < 12 ||
+		samples < 1 || samples > MAX_SAMPLES || writes < 1 ||
+		burst < 0 || cb_delay < 0) {
+		usage(argv[0]);
+		exit(1);
+	}
+	elems = table_size / sizeof(uint32_t);
+	tbuf = calloc(1, table_size);
+	res = mmap(NULL, sizeof(*res), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (tbuf == NULL || res == MAP_FAILED || make_config(dir) < 0)
+		exit(1);
+	XmemSetPath(dir);
+
+	/* a ring of our own */
+	sprintf(name, "/xmemsimBench.%d", getpid());
+	setenv("XMEMSIM_RING", name, 1);
+
+	for (i = 0; i < readers; i++) {
+		pids[i] = fork();
+		if (pids[i] == 0) {
+			node = i + 2;
+			reader();
+		}
+	}
+	node = 1;
+	errors = init(NULL, 0) < 0;
+	for (i = 0; !errors && res->ready < readers; i++) {
+		if (i == 5000) {
+			fprintf(stderr, "the readers didn't start\n");
+			errors = 1;
+		}
+		usleep(1000);
+	}
+
+	if (!errors) {
+		printf("%d readers, table of %d bytes\n", readers,
+		       table_size);
+		errors = latency() < 0;
+	}
+	if (!errors) {
+		throughput();
+		loss();
+	}
+
+	res->done = 1;
+	for (i = 0; i < readers; i++) {
+		if (errors)
+			kill(pids[i], SIGTERM);
+		waitpid(pids[i], &status, 0);
+	}
+	xmemsim_unlink();
+	remove_config(dir);
+	return errors;
+}
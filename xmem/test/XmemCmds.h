@@ -1842,6 +1842,7 @@ int FlushSegs(int arg) {
 ArgVal   *v;
 AtomType  at;
 unsigned long smsk;
+XmemDrvrFlushStats fst;
 
    arg++;
    v = &(vals[arg]);
@@ -1859,6 +1860,13 @@ unsigned long smsk;
    }
    printf("Flushed Segments Mask: 0x%08X\n",(int) smsk);
 
+   if (ioctl(xmem,XmemDrvrGET_FLUSH_STATS,&fst) < 0) {
+      IErr("GET_FLUSH_STATS",NULL);
+      return arg;
+   }
+   printf("Flush: %lu bytes in %luus (Max: %luus Waits: Read: %luus Write: %luus) Flushes: %lu\n",
+          fst.Bytes, fst.Time, fst.MaxTime, fst.ReadWait, fst.WriteWait, fst.Flushes);
+
    return arg;
 }
 
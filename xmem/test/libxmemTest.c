@@ -0,0 +1,515 @@
+/**
+ * @file libxmemTest.c
+ *
+ * @brief Loopback test and benchmarks of libxmem's software backends
+ *
+ * Runs one writer node and several reader nodes, as processes on this
+ * host, on the SHMEM or the NETWORK device, or on VMIC when built against
+ * the ring simulator (xmem/sim). The writer (node 1) owns a table; it:
+ *
+ * - sends it a number of times with an update, each time filled with the
+ *   version number, and checks every reader ends up with the last version.
+ *   Readers read the table on every update and count the torn copies
+ *   (mixed versions), which the plain protocol doesn't prevent;
+ * - measures the round trip of a USER message to the first reader, which
+ *   sends it back;
+ * - measures the throughput of table writes (without updates), up to the
+ *   point where every reader has seen the last one;
+ * - writes the table through XmemMapTable and publishes it with
+ *   XmemSendMappedTable, a number of times. After each one, every reader
+ *   checks its own mapping of the table: the generation has to have moved
+ *   on and the contents to be the new version. On VMIC the tables are
+ *   mapped from the SDRAM, elsewhere they are XmemGetSharedMemory mirrors.
+ *
+ * The segment and node tables are made up in a temporary directory.
+ *
+ * Copyright (c) 2010 CERN
+ * @author Emilio G. Cota <emilio.garcia.cota@cern.ch>
+ *
+ * @section license_sec License
+ * Released under the GPL v2. (and only v2, not any later version)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#include <libxmem.h>
+
+#define TABLE		0x1
+#define MAX_READERS	8
+
+/* USER messages: command in the upper half, argument in the lower one */
+#define CMD_ECHO	0x10000
+#define CMD_CHECK	0x20000	/* reply: CMD_CHECK | 1 if the table's right */
+#define CMD_EXIT	0x30000
+#define CMD_MAPSTART	0x40000	/* map the table; versions start over */
+#define CMD_MAPCHECK	0x50000	/* as CMD_CHECK, on the reader's mapping */
+#define CMD_MASK	0xffff0000
+#define ARG_MASK	0x0000ffff
+
+static XmemDevice device = XmemDeviceSHMEM;
+static int readers = 2;
+static int versions = 1000;
+static int pings = 1000;
+static int writes = 10000;
+static int maps = 100;
+static int table_size = 4096;
+
+static uint32_t *tbuf;
+static int elems;
+static XmemNodeId reader_nodes;
+
+/* reader's state */
+static int node;
+static int updates, torn, last_version;
+static uint32_t *map;
+static uint32_t map_gen;
+static int map_checks;
+
+/* writer's state */
+static volatile uint32_t reply;
+static volatile XmemNodeId replied;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void send_user(XmemNodeId nodes, uint32_t data)
+{
+	XmemMessage mess;
+
+	mess.MessageType = XmemMessageTypeUSER;
+	mess.Data = data;
+	if (XmemSendMessage(nodes, &mess) != XmemErrorSUCCESS)
+		fprintf(stderr, "node %d: XmemSendMessage failed\n", node);
+}
+
+static int read_table(void)
+{
+	int i;
+
+	if (XmemRecvTable(TABLE, tbuf, elems, 0) != XmemErrorSUCCESS) {
+		fprintf(stderr, "node %d: XmemRecvTable failed\n", node);
+		return -1;
+	}
+	for (i = 1; i < elems; i++)
+		if (tbuf[i] != tbuf[0])
+			return -1;
+	return tbuf[0];
+}
+
+/* 1 if the table could be mapped */
+static int map_start(void)
+{
+	map = XmemMapTable(TABLE, 0);
+	if (map == NULL) {
+		fprintf(stderr, "node %d: XmemMapTable failed\n", node);
+		return 0;
+	}
+	last_version = 0;
+	map_checks = 0;
+	return 1;
+}
+
+/* 1 if the reader's mapping has a new generation and is at version @v */
+static int map_check(int v)
+{
+	uint32_t gen;
+	int i;
+
+	if (map == NULL)
+		return 0;
+	if (XmemGetTableGeneration(TABLE, &gen) != XmemErrorSUCCESS) {
+		fprintf(stderr, "node %d: XmemGetTableGeneration failed\n",
+			node);
+		return 0;
+	}
+	if (map_checks++ && gen == map_gen) {
+		fprintf(stderr, "node %d: generation still %u\n", node, gen);
+		return 0;
+	}
+	map_gen = gen;
+	for (i = 0; i < elems; i++)
+		if (map[i] != v)
+			return 0;
+	return 1;
+}
+
+static void reader_callback(XmemCallbackStruct *cbs)
+{
+	int v;
+
+	switch (cbs->Mask) {
+	case XmemEventMaskTABLE_UPDATE:
+		updates++;
+		v = read_table();
+		if (v < 0)
+			torn++;
+		else if (v < last_version)
+			fprintf(stderr, "node %d: version %d after %d\n",
+				node, v, last_version);
+		else
+			last_version = v;
+		break;
+	case XmemEventMaskUSER:
+		switch (cbs->Data & CMD_MASK) {
+		case CMD_ECHO:
+			send_user(cbs->Node, cbs->Data);
+			break;
+		case CMD_CHECK:
+			v = read_table();
+			send_user(cbs->Node, CMD_CHECK |
+				(v == (cbs->Data & ARG_MASK)));
+			break;
+		case CMD_MAPSTART:
+			send_user(cbs->Node, CMD_MAPSTART | map_start());
+			break;
+		case CMD_MAPCHECK:
+			send_user(cbs->Node, CMD_MAPCHECK |
+				map_check(cbs->Data & ARG_MASK));
+			break;
+		case CMD_EXIT:
+			printf("node %d: %d updates, %d torn reads\n", node,
+			       updates, torn);
+			exit(0);
+		}
+		break;
+	case XmemEventMaskIO:
+		fprintf(stderr, "node %d: I/O error 0x%x from node 0x%x\n",
+			node, cbs->Data, cbs->Node);
+		break;
+	default:
+		break;
+	}
+}
+
+static void writer_callback(XmemCallbackStruct *cbs)
+{
+	if (cbs->Mask != XmemEventMaskUSER)
+		return;
+	reply = cbs->Data;
+	replied |= cbs->Node;
+}
+
+static void setenv_node(int nid)
+{
+	char str[16];
+
+	sprintf(str, "%d", nid);
+	setenv("XMEM_SHMEM_NODE", str, 1);
+	setenv("XMEM_NET_NODE", str, 1);
+	setenv("XMEMSIM_NODE", str, 1);
+}
+
+static int init(void (*cb)(XmemCallbackStruct *), XmemEventMask mask)
+{
+	XmemError err;
+
+	err = XmemInitialize(device);
+	if (err == XmemErrorSUCCESS)
+		err = XmemRegisterCallback(cb, mask);
+	if (err != XmemErrorSUCCESS) {
+		fprintf(stderr, "node %d: %s\n", node, XmemErrorToString(err));
+		return -1;
+	}
+	return 0;
+}
+
+static void reader(int ready)
+{
+	setenv_node(node);
+	if (init(reader_callback, XmemEventMaskTABLE_UPDATE |
+			XmemEventMaskUSER | XmemEventMaskIO) < 0)
+		exit(1);
+	if (write(ready, "", 1) != 1)
+		exit(1);
+	for (;;)
+		XmemWait(100);
+}
+
+/* wait until every node in @nodes has replied */
+static int wait_replies(XmemNodeId nodes)
+{
+	int tmo = 0;
+
+	while ((replied & nodes) != nodes) {
+		if (XmemWait(100) == XmemEventMaskTIMEOUT && ++tmo == 5) {
+			fprintf(stderr, "no reply from nodes 0x%x\n",
+				nodes & ~replied);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * send @cmd | @v to the readers, one at a time: CMD_CHECK and CMD_MAPCHECK
+ * check they have version @v. Returns the failures
+ */
+static int check(uint32_t cmd, int v)
+{
+	XmemNodeId nid;
+	int i, errors = 0;
+
+	for (i = 0; i < readers; i++) {
+		nid = 1 << (i + 1);
+		replied = 0;
+		send_user(nid, cmd | v);
+		if (wait_replies(nid) < 0 || reply != (cmd | 1)) {
+			fprintf(stderr, "node %d: command 0x%x failed\n",
+				i + 2, cmd | v);
+			errors++;
+		}
+	}
+	return errors;
+}
+
+static int writer(void)
+{
+	int64_t t, rtt, min = INT64_MAX, max = 0, sum = 0;
+	uint32_t *wmap, gen0, gen;
+	int i, v, errors = 0;
+
+	/* 1. versions, with an update each */
+	t = now_ns();
+	for (v = 1; v <= versions; v++) {
+		for (i = 0; i < elems; i++)
+			tbuf[i] = v;
+		if (XmemSendTable(TABLE, tbuf, elems, 0, 1) !=
+			XmemErrorSUCCESS) {
+			fprintf(stderr, "XmemSendTable failed\n");
+			return 1;
+		}
+	}
+	t = now_ns() - t;
+	errors += check(CMD_CHECK, versions);
+	printf("%d updates of %d bytes: %.1f us each\n", versions,
+	       table_size, (double)t / versions / 1000);
+
+	/* 2. round trips */
+	for (i = 0; i < pings; i++) {
+		replied = 0;
+		t = now_ns();
+		send_user(1 << 1, CMD_ECHO | (i & ARG_MASK));
+		if (wait_replies(1 << 1) < 0) {
+			errors++;
+			break;
+		}
+		rtt = now_ns() - t;
+		if (reply != (CMD_ECHO | (i & ARG_MASK)))
+			errors++;
+		sum += rtt;
+		if (rtt < min)
+			min = rtt;
+		if (rtt > max)
+			max = rtt;
+	}
+	if (i)
+		printf("%d round trips: min %.1f avg %.1f max %.1f us\n", i,
+		       min / 1000.0, sum / 1000.0 / i, max / 1000.0);
+
+	/* 3. throughput */
+	t = now_ns();
+	for (v = 1; v <= writes; v++) {
+		for (i = 0; i < elems; i++)
+			tbuf[i] = v;
+		XmemSendTable(TABLE, tbuf, elems, 0, 0);
+	}
+	XmemSendTable(TABLE, NULL, 0, 0, 0);
+	errors += check(CMD_CHECK, writes);
+	t = now_ns() - t;
+	printf("%d writes of %d bytes: %.1f MB/s, %.0f writes/s\n", writes,
+	       table_size, (double)writes * table_size * 1000 / t,
+	       (double)writes * 1000000000 / t);
+
+	/* 4. mapped table, checked by the readers after each update */
+	wmap = XmemMapTable(TABLE, 1);
+	if (wmap == NULL ||
+		XmemGetTableGeneration(TABLE, &gen0) != XmemErrorSUCCESS) {
+		fprintf(stderr, "can't map the table\n");
+		errors++;
+		goto out;
+	}
+	if (check(CMD_MAPSTART, 0)) {
+		errors++;
+		goto out;
+	}
+	t = now_ns();
+	for (v = 1; v <= maps; v++) {
+		for (i = 0; i < elems; i++)
+			wmap[i] = v;
+		if (XmemSendMappedTable(TABLE, 1) != XmemErrorSUCCESS) {
+			fprintf(stderr, "XmemSendMappedTable failed\n");
+			errors++;
+			break;
+		}
+		errors += check(CMD_MAPCHECK, v);
+	}
+	t = now_ns() - t;
+	if (XmemGetTableGeneration(TABLE, &gen) != XmemErrorSUCCESS ||
+		gen == gen0) {
+		fprintf(stderr, "the writer's generation didn't change\n");
+		errors++;
+	}
+	printf("%d mapped updates of %d bytes, checked: %.1f us each\n",
+	       maps, table_size, (double)t / maps / 1000);
+	XmemUnmapTable(TABLE);
+
+ out:
+	send_user(reader_nodes, CMD_EXIT);
+	return errors;
+}
+
+static int make_config(char *dir)
+{
+	FILE *fp;
+	char path[128];
+	int i;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return -1;
+	}
+	sprintf(path, "%s/Xmem.nodes", dir);
+	fp = fopen(path, "w");
+	if (fp == NULL)
+		return -1;
+	for (i = 0; i <= readers; i++)
+		fprintf(fp, "{ node%02d 0x%x }\n", i + 1, 1 << i);
+	fclose(fp);
+	sprintf(path, "%s/Xmem.segs", dir);
+	fp = fopen(path, "w");
+	if (fp == NULL)
+		return -1;
+	fprintf(fp, "{ test 0x%x 0x%x 0x0 0x1 0x0 }\n", TABLE, table_size);
+	fclose(fp);
+	return 0;
+}
+
+static void remove_config(char *dir)
+{
+	char path[128];
+
+	sprintf(path, "%s/Xmem.nodes", dir);
+	unlink(path);
+	sprintf(path, "%s/Xmem.segs", dir);
+	unlink(path);
+	rmdir(dir);
+}
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s [options]\n"
+		"  -d <dev>   shmem, network or vmic (default shmem)\n"
+		"  -r <n>     reader nodes, 1 to %d (default %d)\n"
+		"  -s <size>  table size in bytes (default %d)\n"
+		"  -u <n>     updates sent (default %d)\n"
+		"  -p <n>     round trips (default %d)\n"
+		"  -w <n>     writes for the throughput (default %d)\n"
+		"  -m <n>     updates of the mapped table (default %d)\n"
+		"             at most %d updates or writes\n",
+		prog, MAX_READERS, readers, table_size, versions, pings,
+		writes, maps, ARG_MASK);
+}
+
+int main(int argc, char *argv[])
+{
+	char dir[] = "/tmp/libxmemTest.XXXXXX";
+	char name[64], c;
+	int ready[2], i, status, errors;
+	pid_t pids[MAX_READERS];
+
+	while ((i = getopt(argc, argv, "d:r:s:u:p:w:m:h")) != -1) {
+		switch (i) {
+		case 'd':
+			if (!strcmp(optarg, "network"))
+				device = XmemDeviceNETWORK;
+			else if (!strcmp(optarg, "vmic"))
+				device = XmemDeviceVMIC;
+			else if (strcmp(optarg, "shmem"))
+				device = XmemDeviceCOUNT;
+			break;
+		case 'r':
+			readers = atoi(optarg);
+			break;
+		case 's':
+			table_size = strtoul(optarg, NULL, 0) & ~3;
+			break;
+		case 'u':
+			versions = atoi(optarg);
+			break;
+		case 'p':
+			pings = atoi(optarg);
+			break;
+		case 'w':
+			writes = atoi(optarg);
+			break;
+		case 'm':
+			maps = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			exit(i != 'h');
+		}
+	}
+	if (device == XmemDeviceCOUNT || readers < 1 ||
+		readers > MAX_READERS || table_size <= 0 || versions < 1 ||
+		versions > ARG_MASK || writes < 1 || writes > ARG_MASK ||
+		maps < 1 || maps > ARG_MASK) {
+		usage(argv[0]);
+		exit(1);
+	}
+	elems = table_size / sizeof(uint32_t);
+	tbuf = malloc(table_size);
+	if (tbuf == NULL || make_config(dir) < 0)
+		exit(1);
+	XmemSetPath(dir);
+
+	/* keep concurrent runs apart */
+	sprintf(name, "/libxmemTest.%d", getpid());
+	setenv("XMEM_SHMEM", name, 1);
+	sprintf(name, "%d", 20000 + getpid() % 20000);
+	setenv("XMEM_NET_PORT", name, 1);
+	sprintf(name, "/libxmemTest.sim.%d", getpid());
+	setenv("XMEMSIM_RING", name, 1);
+
+	if (pipe(ready) < 0)
+		exit(1);
+	for (i = 0; i < readers; i++) {
+		reader_nodes |= 1 << (i + 1);
+		pids[i] = fork();
+		if (pids[i] == 0) {
+			node = i + 2;
+			reader(ready[1]);
+		}
+	}
+	node = 1;
+	setenv_node(node);
+	errors = init(writer_callback, XmemEventMaskUSER) < 0;
+	for (i = 0; i < readers && !errors; i++)
+		if (read(ready[0], &c, 1) != 1)
+			errors++;
+	if (!errors)
+		errors = writer();
+
+	for (i = 0; i < readers; i++) {
+		if (errors)
+			kill(pids[i], SIGTERM);
+		waitpid(pids[i], &status, 0);
+	}
+	shm_unlink(getenv("XMEM_SHMEM"));
+	shm_unlink(getenv("XMEMSIM_RING"));
+	remove_config(dir);
+	printf("%s\n", errors ? "FAILED" : "passed");
+	return errors != 0;
+}
@@ -0,0 +1,175 @@
+/**
+ * @file xmemAdler32Bench.c
+ *
+ * @brief Compare the table checksums of xmemAdler32.h with zlib's
+ *
+ * For table sizes from 1 KB up to 4 MB, time what libxmem does to a table
+ * in checksum mode:
+ *
+ * - sum: checksum only (SEQLOCK, and the send side of ATOMIC before);
+ * - copy+sum: copy to a bounce buffer and checksum it (ATOMIC).
+ *
+ * with zlib_adler32() (plus memcpy for the copy), and with each version of
+ * xmemAdler32.h that this CPU can run, the copy fused with the checksum.
+ * Every checksum is checked against zlib's, and every copy against its
+ * source.
+ *
+ * Copyright (c) 2010 CERN
+ * @author Emilio G. Cota <emilio.garcia.cota@cern.ch>
+ *
+ * @section license_sec License
+ * Released under the GPL v2. (and only v2, not any later version)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <xmemAdler32.h>
+
+static unsigned long min_size = 1024;
+static unsigned long max_size = 4 << 20;
+static unsigned long total = 256 << 20;	/* bytes per measurement */
+
+struct impl {
+	char		*name;
+	XmemAdler32Fn	fn;
+};
+
+static uint32_t zlib_copy(uint32_t adler, void *dst, const void *src,
+			  unsigned long len)
+{
+	if (dst) {
+		memcpy(dst, src, len);
+		src = dst;
+	}
+	return zlib_adler32(adler, src, len);
+}
+
+static struct impl impls[4];
+static int nimpls;
+
+static void add_impl(char *name, XmemAdler32Fn fn)
+{
+	impls[nimpls].name = name;
+	impls[nimpls].fn = fn;
+	nimpls++;
+}
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* MB/s of @fn on @size bytes; -1 if it gets a wrong result */
+static double measure(XmemAdler32Fn fn, unsigned char *dst,
+		      unsigned char *src, unsigned long size, uint32_t ref)
+{
+	unsigned long i, n;
+	int64_t t;
+
+	n = total / size;
+	if (n < 4)
+		n = 4;
+	if (fn(XmemADLER32_INIT, dst, src, size) != ref)
+		return -1;
+	if (dst && memcmp(dst, src, size))
+		return -1;
+	t = now_ns();
+	for (i = 0; i < n; i++)
+		fn(XmemADLER32_INIT, dst, src, size);
+	t = now_ns() - t;
+	return (double)size * n / 1e6 / ((double)t / 1e9);
+}
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s [options]\n"
+		"  -m <bytes>  smallest table (default %lu)\n"
+		"  -M <bytes>  largest table (default %lu)\n"
+		"  -t <MB>     bytes checksummed per measurement (default %lu)\n",
+		prog, min_size, max_size, total >> 20);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned char *src, *dst;
+	unsigned long size, i;
+	char name[16];
+	uint32_t ref;
+	double mbs;
+	int c, j;
+
+	while ((c = getopt(argc, argv, "m:M:t:h")) != -1) {
+		switch (c) {
+		case 'm':
+			min_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'M':
+			max_size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			total = strtoul(optarg, NULL, 0) << 20;
+			break;
+		default:
+			usage(argv[0]);
+			exit(c != 'h');
+		}
+	}
+	if (!min_size || max_size < min_size || !total) {
+		usage(argv[0]);
+		exit(1);
+	}
+
+	add_impl("zlib", zlib_copy);
+#ifdef XmemADLER32_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3"))
+		add_impl("ssse3", xmem_adler32_ssse3);
+	if (__builtin_cpu_supports("avx2"))
+		add_impl("avx2", xmem_adler32_avx2);
+#endif
+
+	src = malloc(max_size);
+	dst = malloc(max_size);
+	if (src == NULL || dst == NULL) {
+		perror("xmemAdler32Bench");
+		exit(1);
+	}
+	for (i = 0; i < max_size; i++)
+		src[i] = rand();
+
+	printf("MB/s; XmemAdler32Copy() uses %s\n",
+	       xmem_adler32_best() == xmem_adler32_scalar ? "zlib" :
+	       impls[nimpls - 1].name);
+	printf("%9s", "size");
+	for (j = 0; j < nimpls; j++)
+		printf(" %9s", impls[j].name);
+	for (j = 0; j < nimpls; j++) {
+		snprintf(name, sizeof(name), "%s+cp", impls[j].name);
+		printf(" %9s", name);
+	}
+	printf("\n");
+
+	for (size = min_size; size <= max_size; size *= 4) {
+		ref = zlib_adler32(XmemADLER32_INIT, src, size);
+		printf("%9lu", size);
+		for (c = 0; c < 2; c++) {
+			for (j = 0; j < nimpls; j++) {
+				mbs = measure(impls[j].fn, c ? dst : NULL, src,
+					      size, ref);
+				if (mbs < 0)
+					printf(" %9s", "WRONG");
+				else
+					printf(" %9.0f", mbs);
+			}
+		}
+		printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,230 @@
+/**
+ * @file xmemCopyBench.c
+ *
+ * @brief Compare xmemCopy.h's PIO copies with the per-word loops
+ *
+ * For every transfer size from 4 bytes up to the driver's DMA threshold
+ * (i.e. the transfers done by PIO), time a copy to and from the SDRAM
+ * with the old loops (one 32-bit access per word, sub-word tails dropped)
+ * and with XmemCopyToXmem()/XmemCopyFromXmem(). Each new copy is checked
+ * by reading it back.
+ *
+ * The SDRAM is reached through the PCI resource file of the VMIC's BAR3,
+ * e.g. /sys/bus/pci/devices/0000:05:0d.0/resource3. Without it the copies
+ * run on ordinary memory, which only measures the CPU side.
+ *
+ * Copyright (c) 2010 CERN
+ * @author Emilio G. Cota <emilio.garcia.cota@cern.ch>
+ *
+ * @section license_sec License
+ * Released under the GPL v2. (and only v2, not any later version)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <xmemDrvr.h>
+#include <xmemCopy.h>
+
+static char *node = "/dev/xmem.1";
+static char *resource;
+static unsigned long offset;
+static unsigned long min_size = 4;
+static unsigned long max_size;
+static unsigned long step = 1;
+static int iterations = 1000;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* the loops replaced by xmemCopy.h */
+static void word_to_xmem(void *xmem, void *buf, unsigned long size)
+{
+	uint32_t *tbuf = buf;
+	uint32_t *ioaddr = xmem;
+	int count;
+
+	count = size / sizeof(uint32_t);
+	if (count <= 0)
+		return;
+	do {
+		XmemIoWr32(*tbuf, ioaddr);
+		tbuf++;
+		ioaddr++;
+	} while (--count != 0);
+}
+
+static void word_from_xmem(void *xmem, void *buf, unsigned long size)
+{
+	uint32_t *tbuf = buf;
+	uint32_t *ioaddr = xmem;
+	int count;
+
+	count = size / sizeof(uint32_t);
+	if (count <= 0)
+		return;
+	do {
+		*tbuf++ = XmemIoRd32(ioaddr);
+		ioaddr++;
+	} while (--count != 0);
+}
+
+static unsigned long get_threshold(void)
+{
+	unsigned long thr;
+	int fd;
+
+	fd = open(node, O_RDWR);
+	if (fd < 0)
+		return 1024;
+	if (ioctl(fd, XmemDrvrGET_DMA_THRESHOLD, &thr) < 0)
+		thr = 1024;
+	close(fd);
+	return thr;
+}
+
+static void *map_sdram(unsigned long len)
+{
+	void *p;
+	int fd;
+
+	if (resource == NULL) {
+		p = malloc(len);
+		if (p == NULL)
+			perror("malloc");
+		return p;
+	}
+	fd = open(resource, O_RDWR | O_SYNC);
+	if (fd < 0) {
+		perror(resource);
+		return NULL;
+	}
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+	return p;
+}
+
+static double bench(void (*copy)(void *, void *, unsigned long),
+		    void *xmem, void *buf, unsigned long size)
+{
+	int64_t t;
+	int i;
+
+	t = now_ns();
+	for (i = 0; i < iterations; i++)
+		copy(xmem, buf, size);
+	return (double)(now_ns() - t) / iterations;
+}
+
+static void new_to_xmem(void *xmem, void *buf, unsigned long size)
+{
+	XmemCopyToXmem(xmem, buf, size);
+}
+
+static void new_from_xmem(void *xmem, void *buf, unsigned long size)
+{
+	XmemCopyFromXmem(xmem, buf, size);
+}
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s [options]\n"
+		"  -r <file>  PCI resource file of the SDRAM (BAR3)\n"
+		"  -o <off>   SDRAM offset to copy to/from (default 0)\n"
+		"  -d <node>  driver node, for the DMA threshold (%s)\n"
+		"  -s <min>   smallest size (default %lu)\n"
+		"  -m <max>   largest size (default: the DMA threshold)\n"
+		"  -t <step>  size increment (default %lu)\n"
+		"  -n <n>     iterations per size (default %d)\n",
+		prog, node, min_size, step, iterations);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned char *xmem, *src, *dst;
+	double ow, nw, or, nr;
+	unsigned long size;
+	int errors = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "r:o:d:s:m:t:n:h")) != -1) {
+		switch (c) {
+		case 'r':
+			resource = optarg;
+			break;
+		case 'o':
+			offset = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			node = optarg;
+			break;
+		case 's':
+			min_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			max_size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			step = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			exit(c != 'h');
+		}
+	}
+	if (!max_size)
+		max_size = get_threshold();
+	if (!step || !min_size || iterations <= 0) {
+		usage(argv[0]);
+		exit(1);
+	}
+
+	xmem = map_sdram(offset + max_size);
+	src = malloc(max_size);
+	dst = malloc(max_size);
+	if (xmem == NULL || src == NULL || dst == NULL)
+		exit(1);
+	xmem += offset;
+	for (size = 0; size < max_size; size++)
+		src[size] = size * 7 + 1;
+
+	printf("%s, offset 0x%lx, %d iterations; times in ns per copy\n",
+	       resource ? resource : "ordinary memory", offset, iterations);
+	printf("%8s %10s %10s %10s %10s\n", "bytes", "wr-word", "wr-new",
+	       "rd-word", "rd-new");
+
+	for (size = min_size; size <= max_size; size += step) {
+		ow = bench(word_to_xmem, xmem, src, size);
+		nw = bench(new_to_xmem, xmem, src, size);
+		or = bench(word_from_xmem, xmem, dst, size);
+		nr = bench(new_from_xmem, xmem, dst, size);
+
+		memset(dst, 0, size);
+		XmemCopyFromXmem(xmem, dst, size);
+		if (memcmp(src, dst, size)) {
+			fprintf(stderr, "%lu bytes: read back differs\n", size);
+			errors++;
+		}
+		printf("%8lu %10.1f %10.1f %10.1f %10.1f\n", size, ow, nw, or, nr);
+	}
+	return errors != 0;
+}